@@ -0,0 +1,251 @@
+/*
+ * This file is part of LEM, a Lua Event Machine.
+ * Copyright 2026 agent
+ *
+ * LEM is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * LEM is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Optional CPU time and memory accounting, enabled by setting
+ * LEM_ACCOUNTING in the environment. Every thread created by
+ * lem_newthread gets a record in its extra space, and a tag it
+ * inherits from the thread creating it. The CPU time of each
+ * resume is added to the thread and its tag. The allocator puts
+ * a header in front of every block naming the tag it was allocated
+ * for, so memory still in use can be counted per tag long after the
+ * thread which allocated it has finished.
+ */
+struct acct_thread {
+	struct lem_usage u;
+	unsigned int tag;
+};
+
+struct acct_tag {
+	struct lem_usage u;
+	char *name;
+};
+
+union acct_header {
+	struct {
+		size_t size;
+		unsigned int tag;
+	} h;
+	/* keep blocks aligned like malloc does */
+	long double align_;
+	void *align_p;
+};
+
+static __thread int acct_enabled;
+static __thread struct acct_tag *acct_tags;
+static __thread unsigned int acct_ntags;
+static __thread lua_Alloc acct_next; /* the allocator below us */
+
+#define acct_record(T) \
+	((struct acct_thread *)(LEM_EXTRA(T) & ~LEM_FLAGMASK))
+#define acct_setrecord(T, t) \
+	(LEM_EXTRA(T) = (LEM_EXTRA(T) & LEM_FLAGMASK) | (uintptr_t)(t))
+
+static uint64_t
+acct_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void *
+acct_alloc(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+	union acct_header *h = NULL;
+	unsigned int tag;
+	struct acct_thread *t = NULL;
+	size_t grow;
+
+	if (ptr != NULL) {
+		h = (union acct_header *)ptr - 1;
+		osize = h->h.size;
+		tag = h->h.tag;
+	} else {
+		if (nsize == 0)
+			return NULL;
+		if (running != NULL)
+			t = acct_record(running);
+		tag = t ? t->tag : 0;
+	}
+
+	if (nsize == 0) {
+		acct_tags[tag].u.live -= osize;
+		acct_next(ud, h, sizeof(union acct_header) + osize, 0);
+		return NULL;
+	}
+
+	if (ptr == NULL) {
+		h = acct_next(ud, NULL, osize, sizeof(union acct_header) + nsize);
+		osize = 0;
+	} else
+		h = acct_next(ud, h, sizeof(union acct_header) + osize,
+				sizeof(union acct_header) + nsize);
+	if (h == NULL)
+		return NULL;
+	h->h.size = nsize;
+	h->h.tag = tag;
+	acct_tags[tag].u.live += nsize - osize;
+
+	/* growth is charged to whoever is running */
+	if (nsize > osize) {
+		grow = nsize - osize;
+		if (ptr != NULL && running != NULL)
+			t = acct_record(running);
+		if (t != NULL)
+			t->u.allocated += grow;
+		acct_tags[t ? t->tag : tag].u.allocated += grow;
+	}
+	return h + 1;
+}
+
+/* start accounting on top of the allocator next */
+static void
+acct_init(lua_Alloc next)
+{
+	acct_tags = lem_xmalloc(sizeof(struct acct_tag));
+	memset(acct_tags, 0, sizeof(struct acct_tag));
+	acct_tags[0].name = lem_xmalloc(1);
+	acct_tags[0].name[0] = '\0';
+	acct_ntags = 1;
+	acct_next = next;
+	acct_enabled = 1;
+}
+
+static void
+acct_close(void)
+{
+	unsigned int i;
+
+	if (!acct_enabled)
+		return;
+
+	for (i = 0; i < acct_ntags; i++)
+		free(acct_tags[i].name);
+	free(acct_tags);
+	acct_tags = NULL;
+	acct_ntags = 0;
+	acct_enabled = 0;
+}
+
+static void
+acct_newthread(lua_State *T)
+{
+	struct acct_thread *t = lem_xmalloc(sizeof(struct acct_thread));
+	struct acct_thread *parent = running ? acct_record(running) : NULL;
+
+	memset(t, 0, sizeof(struct acct_thread));
+	t->tag = parent ? parent->tag : 0;
+	acct_setrecord(T, t);
+}
+
+static void
+acct_forgetthread(lua_State *T)
+{
+	free(acct_record(T));
+	acct_setrecord(T, NULL);
+}
+
+/* free the records of threads still around when the state is closed */
+static void
+acct_forgetall(void)
+{
+	if (!acct_enabled)
+		return;
+
+	lua_pushnil(L);
+	while (lua_next(L, LEM_THREADTABLE) != 0) {
+		lua_pop(L, 1);
+		if (lua_type(L, -1) == LUA_TTHREAD)
+			acct_forgetthread(lua_tothread(L, -1));
+	}
+}
+
+static void
+acct_resumed(lua_State *T, uint64_t cpu)
+{
+	struct acct_thread *t = acct_record(T);
+	struct acct_tag *tag;
+
+	/* the thread finished and was forgotten */
+	if (t == NULL)
+		return;
+
+	t->u.cpu += cpu;
+	t->u.resumes++;
+	tag = &acct_tags[t->tag];
+	tag->u.cpu += cpu;
+	tag->u.resumes++;
+}
+
+int
+lem_accounting(void)
+{
+	return acct_enabled;
+}
+
+int
+lem_settag(lua_State *T, const char *name)
+{
+	struct acct_thread *t;
+	unsigned int i;
+
+	if (!acct_enabled || (t = acct_record(T)) == NULL)
+		return -1;
+
+	for (i = 0; i < acct_ntags; i++) {
+		if (strcmp(acct_tags[i].name, name) == 0)
+			break;
+	}
+	if (i == acct_ntags) {
+		size_t len = strlen(name);
+
+		acct_tags = lem_xrealloc(acct_tags,
+				(acct_ntags + 1) * sizeof(struct acct_tag));
+		memset(&acct_tags[i], 0, sizeof(struct acct_tag));
+		acct_tags[i].name = lem_xmalloc(len + 1);
+		memcpy(acct_tags[i].name, name, len + 1);
+		acct_ntags++;
+	}
+	t->tag = i;
+	return 0;
+}
+
+const char *
+lem_gettag(lua_State *T, struct lem_usage *u)
+{
+	struct acct_thread *t;
+
+	if (!acct_enabled || (t = acct_record(T)) == NULL)
+		return NULL;
+
+	if (u)
+		*u = t->u;
+	return acct_tags[t->tag].name;
+}
+
+const char *
+lem_tagusage(unsigned int i, struct lem_usage *u)
+{
+	if (i >= acct_ntags)
+		return NULL;
+
+	*u = acct_tags[i].u;
+	return acct_tags[i].name;
+}
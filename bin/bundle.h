@@ -0,0 +1,37 @@
+/*
+ * This file is part of LEM, a Lua Event Machine.
+ * Copyright 2026 agent
+ *
+ * LEM is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * LEM is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LEM_BUNDLE_H
+#define _LEM_BUNDLE_H
+
+/* A precompiled Lua chunk linked into bin/lem-bundle.
+ * bin/bundle.c is generated by bin/bundle.lua. */
+struct lem_bundle_chunk {
+	const char *name;
+	const char *data;
+	size_t len;
+};
+
+/* Lua modules, ending with a NULL name */
+extern const struct lem_bundle_chunk lem_bundle_lua[];
+/* C modules, ending with a NULL name */
+extern const luaL_Reg lem_bundle_c[];
+/* the application, data is NULL if there is none */
+extern const struct lem_bundle_chunk lem_bundle_main;
+
+#endif
@@ -0,0 +1,121 @@
+--
+-- This file is part of LEM, a Lua Event Machine.
+-- Copyright 2026 agent
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+
+-- Generate bin/bundle.c for bin/lem-bundle.
+--
+--   bin/lem bin/bundle.lua <out.c> [-g] [--main <app.lua>]
+--                          <module.lua>... [--c <module>...]
+--
+-- Lua modules are named by their path, so lem/http/server.lua
+-- becomes lem.http.server, and are compiled to bytecode stripped
+-- of debug information unless -g is given. C modules are given
+-- by path without extension and must be linked in as well.
+
+local format = string.format
+local concat = table.concat
+
+local out = assert(arg[1], 'no output file given')
+local strip = true
+local main
+local lua, c = {}, {}
+
+do
+	local list = lua
+	local i = 2
+	while arg[i] do
+		local a = arg[i]
+		if a == '-g' then
+			strip = false
+		elseif a == '--main' then
+			i = i + 1
+			main = assert(arg[i], '--main needs a file')
+		elseif a == '--c' then
+			list = c
+		else
+			list[#list+1] = a
+		end
+		i = i + 1
+	end
+end
+
+local function modname(path)
+	return (path:gsub('%.lua$', ''):gsub('%.so$', ''):gsub('/', '.'))
+end
+
+local function bytecode(path)
+	local f, err = loadfile(path)
+	if not f then error(err, 0) end
+	return string.dump(f, strip)
+end
+
+local rope = {
+	'/* generated by bin/bundle.lua, do not edit */\n',
+	'#include <stddef.h>\n',
+	'#include <lua.h>\n',
+	'#include <lauxlib.h>\n',
+	'#include "bundle.h"\n\n',
+}
+
+local function array(id, data)
+	rope[#rope+1] = format('static const unsigned char %s[] = {', id)
+	for i = 1, #data, 16 do
+		local line = { data:byte(i, i + 15) }
+		rope[#rope+1] = '\n\t' .. concat(line, ',') .. ','
+	end
+	rope[#rope+1] = '\n};\n\n'
+end
+
+for i, path in ipairs(lua) do
+	array(format('lua_%d', i), bytecode(path))
+end
+if main then
+	array('lua_main', bytecode(main))
+end
+
+rope[#rope+1] = 'const struct lem_bundle_chunk lem_bundle_lua[] = {\n'
+for i, path in ipairs(lua) do
+	rope[#rope+1] = format('\t{ "%s", (const char *)lua_%d, sizeof(lua_%d) },\n',
+		modname(path), i, i)
+end
+rope[#rope+1] = '\t{ NULL, NULL, 0 }\n};\n\n'
+
+if main then
+	rope[#rope+1] = format(
+		'const struct lem_bundle_chunk lem_bundle_main = ' ..
+		'{ "%s", (const char *)lua_main, sizeof(lua_main) };\n\n', modname(main))
+else
+	rope[#rope+1] = 'const struct lem_bundle_chunk lem_bundle_main = ' ..
+		'{ NULL, NULL, 0 };\n\n'
+end
+
+for _, path in ipairs(c) do
+	rope[#rope+1] = format('int luaopen_%s(lua_State *L);\n',
+		modname(path):gsub('%.', '_'))
+end
+rope[#rope+1] = '\nconst luaL_Reg lem_bundle_c[] = {\n'
+for _, path in ipairs(c) do
+	local name = modname(path)
+	rope[#rope+1] = format('\t{ "%s", luaopen_%s },\n',
+		name, (name:gsub('%.', '_')))
+end
+rope[#rope+1] = '\t{ NULL, NULL }\n};\n'
+
+local f = assert(io.open(out, 'w'))
+assert(f:write(concat(rope)))
+assert(f:close())
+
+-- vim: set ts=2 sw=2 noet:
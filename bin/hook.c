@@ -0,0 +1,56 @@
+/*
+ * This file is part of LEM, a Lua Event Machine.
+ * Copyright 2026 agent
+ *
+ * LEM is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * LEM is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The profiler and the watchdog ask for a look at the running
+ * Lua thread by setting this hook on it from a signal handler.
+ * Preemption uses it as a count hook on the thread resumed,
+ * and a line hook while waiting for a place to preempt it.
+ * Threads created while the hook is set inherit it, so it may
+ * also run in threads nobody asked about.
+ */
+static void
+hook_done(lua_State *T)
+{
+	if (T == profile_pending || T == watchdog_pending)
+		return;
+	if (T == preempt_armed)
+		preempt_sethook(T);
+	else
+		lua_sethook(T, NULL, 0, 0);
+}
+
+static void
+hook_dispatch(lua_State *T, lua_Debug *ar)
+{
+	if (watchdog_pending == T)
+		watchdog_report(T);
+	if (profile_pending == T && profile_hook != NULL)
+		profile_hook(T, ar);
+	hook_done(T);
+	if (T == preempt_armed && ar != NULL)
+		preempt_check(T, ar);
+}
+
+/* T yielded or finished before the hook ran, so look at
+ * the stack it was suspended with */
+static void
+hook_yielded(lua_State *T)
+{
+	hook_dispatch(T, NULL);
+}
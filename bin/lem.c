@@ -24,6 +24,7 @@
 #include <stdio.h>
 #include <assert.h>
 #include <sys/time.h>
+#include <sys/mman.h>
 #include <time.h>
 #include <pthread.h>
 
@@ -54,20 +55,41 @@ struct lem_runqueue_slot {
 	int nargs;
 };
 
-struct lem_runqueue {
-	struct ev_idle w;
+/* a FIFO for each priority */
+struct lem_runqueue_level {
 	struct lem_runqueue_slot *queue;
 	unsigned int first;
 	unsigned int last;
 	unsigned int mask;
+	unsigned int passed; /* pops from higher levels while waiting */
 };
 
+struct lem_runqueue {
+	struct ev_idle w;
+	struct lem_runqueue_level level[LEM_PRIORITIES];
+	unsigned int count; /* threads queued on all levels */
+};
+
+/* the number of threads popped from higher levels before
+ * one waiting on a lower level gets to run */
+#define LEM_RUNQUEUE_FAIR 32
+
+/* The extra space of threads holds their priority and whether they
+ * are queued after being preempted in the low bits, and with
+ * accounting a pointer to their record in the rest. */
+#define LEM_EXTRA(T) (*(uintptr_t *)lua_getextraspace(T))
+#define LEM_PRIOMASK ((uintptr_t)3)
+#define LEM_PREEMPTED ((uintptr_t)4)
+#define LEM_FLAGMASK ((uintptr_t)7)
+
 #if EV_MULTIPLICITY
-struct ev_loop *lem_loop;
+__thread struct ev_loop *lem_loop;
 #endif
-static lua_State *L;
-static struct lem_runqueue rq;
-static int exit_status = EXIT_SUCCESS;
+static __thread lua_State *L;
+static __thread lua_State *running; /* the thread being resumed */
+static __thread struct lem_runqueue rq;
+static __thread struct lem_stats stats;
+static __thread int exit_status = EXIT_SUCCESS;
 
 static void
 oom(void)
@@ -93,6 +115,26 @@ lem_xmalloc(size_t size)
 	return p;
 }
 
+void *
+lem_xrealloc(void *p, size_t size)
+{
+	p = realloc(p, size);
+	if (p == NULL)
+		oom();
+
+	return p;
+}
+
+/* microseconds on the monotonic clock */
+static inline uint64_t
+monotime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 static int
 setsignal(int signal, void (*handler)(int), int flags)
 {
@@ -111,6 +153,9 @@ setsignal(int signal, void (*handler)(int), int flags)
 	return 0;
 }
 
+#include "slab.c"
+#include "account.c"
+
 lua_State *
 lem_newthread(void)
 {
@@ -123,6 +168,12 @@ lem_newthread(void)
 	lua_pushboolean(L, 1);
 	lua_rawset(L, LEM_THREADTABLE);
 
+	/* inherit the priority of the running thread */
+	LEM_EXTRA(T) = running ? (LEM_EXTRA(running) & LEM_PRIOMASK)
+		: LEM_PRIO_NORMAL;
+
+	if (acct_enabled)
+		acct_newthread(T);
 	return T;
 }
 
@@ -134,6 +185,9 @@ lem_forgetthread(lua_State *T)
 	lua_xmove(T, L, 1);
 	lua_pushnil(L);
 	lua_rawset(L, LEM_THREADTABLE);
+
+	if (acct_enabled)
+		acct_forgetthread(T);
 }
 
 void
@@ -143,51 +197,136 @@ lem_exit(int status)
 	ev_unloop(LEM_ EVUNLOOP_ALL);
 }
 
-void
-lem_queue(lua_State *T, int nargs)
+static void
+runqueue_push(lua_State *T, int nargs, int prio)
 {
+	struct lem_runqueue_level *q = &rq.level[prio];
 	struct lem_runqueue_slot *slot;
 
 	assert(T != NULL);
-	lem_debug("enqueueing thread with %d argument%s",
-	              nargs, nargs == 1 ? "" : "s");
+	lem_debug("enqueueing thread with %d argument%s at priority %d",
+	              nargs, nargs == 1 ? "" : "s", prio);
 
-	if (rq.first == rq.last)
+	if (rq.count == 0)
 		ev_idle_start(LEM_ &rq.w);
 
-	slot = &rq.queue[rq.last];
+	slot = &q->queue[q->last];
 	slot->T = T;
 	slot->nargs = nargs;
 
-	rq.last++;
-	rq.last &= rq.mask;
-	if (rq.first == rq.last) {
+	q->last++;
+	q->last &= q->mask;
+	if (q->first == q->last) {
 		unsigned int i;
 		unsigned int j;
 		struct lem_runqueue_slot *new_queue;
 
-		lem_debug("expanding queue to %u slots", 2*(rq.mask + 1));
-		new_queue = lem_xmalloc(2*(rq.mask + 1)
+		lem_debug("expanding queue to %u slots", 2*(q->mask + 1));
+		new_queue = lem_xmalloc(2*(q->mask + 1)
 				* sizeof(struct lem_runqueue_slot));
 
 		i = 0;
-		j = rq.first;
+		j = q->first;
 		do {
-			new_queue[i] = rq.queue[j];
+			new_queue[i] = q->queue[j];
 
 			i++;
 			j++;
-			j &= rq.mask;
-		} while (j != rq.first);
-
-		free(rq.queue);
-		rq.queue = new_queue;
-		rq.first = 0;
-		rq.last = i;
-		rq.mask = 2*rq.mask + 1;
+			j &= q->mask;
+		} while (j != q->first);
+
+		free(q->queue);
+		q->queue = new_queue;
+		q->first = 0;
+		q->last = i;
+		q->mask = 2*q->mask + 1;
 	}
+
+	rq.count++;
+	if (rq.count > stats.runqueue_max)
+		stats.runqueue_max = rq.count;
+}
+
+void
+lem_queue(lua_State *T, int nargs)
+{
+	runqueue_push(T, nargs, LEM_EXTRA(T) & LEM_PRIOMASK);
+}
+
+void
+lem_queueat(lua_State *T, int nargs, int prio)
+{
+	int own = LEM_EXTRA(T) & LEM_PRIOMASK;
+
+	runqueue_push(T, nargs, prio > own ? prio : own);
+}
+
+int
+lem_priority(lua_State *T)
+{
+	return LEM_EXTRA(T) & LEM_PRIOMASK;
 }
 
+void
+lem_setpriority(lua_State *T, int prio)
+{
+	assert(prio >= 0 && prio < LEM_PRIORITIES);
+	LEM_EXTRA(T) = (LEM_EXTRA(T) & ~LEM_PRIOMASK) | (uintptr_t)prio;
+}
+
+/* Take the next thread from the highest level with any. Each
+ * lower level waiting counts the threads popped ahead of it, and
+ * gets a turn once it has been passed LEM_RUNQUEUE_FAIR times, so
+ * no level is starved however busy the ones above it are. */
+static struct lem_runqueue_slot *
+runqueue_next(void)
+{
+	struct lem_runqueue_level *q = NULL;
+	struct lem_runqueue_level *turn = NULL;
+	struct lem_runqueue_slot *slot;
+	int i;
+
+	for (i = 0; i < LEM_PRIORITIES; i++) {
+		struct lem_runqueue_level *l = &rq.level[i];
+
+		if (l->first == l->last) {
+			l->passed = 0;
+			continue;
+		}
+		if (q == NULL)
+			q = l;
+		else if (turn == NULL && l->passed >= LEM_RUNQUEUE_FAIR)
+			turn = l;
+	}
+	if (turn != NULL)
+		q = turn;
+	q->passed = 0;
+
+	/* everyone else waiting was passed once more */
+	for (i = 0; i < LEM_PRIORITIES; i++) {
+		struct lem_runqueue_level *l = &rq.level[i];
+
+		if (l != q && l->first != l->last)
+			l->passed++;
+	}
+
+	slot = &q->queue[q->first];
+	q->first++;
+	q->first &= q->mask;
+	rq.count--;
+	return slot;
+}
+
+/* the hook shared by the profiler and the watchdog, see hook.c */
+#define HOOK_MASK (LUA_MASKCALL | LUA_MASKRET | LUA_MASKCOUNT)
+static void hook_dispatch(lua_State *T, lua_Debug *ar);
+static void hook_done(lua_State *T);
+
+#include "profile.c"
+#include "watchdog.c"
+#include "preempt.c"
+#include "hook.c"
+
 static void
 thread_error(lua_State *T)
 {
@@ -203,10 +342,12 @@ runqueue_pop(EV_P_ struct ev_idle *w, int revents)
 	struct lem_runqueue_slot *slot;
 	lua_State *T;
 	int nargs;
+	int ret;
+	uint64_t start = 0;
 
 	(void)revents;
 
-	if (rq.first == rq.last) { /* queue is empty */
+	if (rq.count == 0) { /* queue is empty */
 		lem_debug("runqueue is empty, collecting..");
 #if 0
 		if (lua_gc(L, LUA_GCSTEP, 0)) {
@@ -214,23 +355,43 @@ runqueue_pop(EV_P_ struct ev_idle *w, int revents)
 			ev_idle_stop(EV_A_ w);
 		}
 #else
+		start = monotime();
 		ev_idle_stop(EV_A_ w);
+		lem_profile_where = LEM_PROFILE_GC;
 		lua_gc(L, LUA_GCCOLLECT, 0);
+		lem_profile_where = LEM_PROFILE_LOOP;
+		lem_histogram_add(&stats.gc_pause, monotime() - start);
 #endif
 		return;
 	}
 
 	lem_debug("running thread...");
 
-	slot = &rq.queue[rq.first];
+	slot = runqueue_next();
 	T = slot->T;
 	nargs = slot->nargs;
-
-	rq.first++;
-	rq.first &= rq.mask;
+	LEM_EXTRA(T) &= ~LEM_PREEMPTED;
 
 	/* run Lua thread */
-	switch (lua_resume(T, NULL, nargs)) {
+	stats.resumes++;
+	if (acct_enabled)
+		start = acct_clock();
+	if (preempt_slice || preempt_custom)
+		preempt_arm(T);
+	running = T;
+	if (watchdog)
+		ret = watchdog_resume(T, nargs);
+	else
+		ret = lua_resume(T, NULL, nargs);
+	running = NULL;
+	if (preempt_armed)
+		preempt_disarm(T);
+	if (acct_enabled)
+		acct_resumed(T, acct_clock() - start);
+	if (profile_pending == T || watchdog_pending == T)
+		hook_yielded(T);
+
+	switch (ret) {
 	case LUA_OK: /* thread finished successfully */
 		lem_debug("thread finished successfully");
 		lem_forgetthread(T);
@@ -238,6 +399,12 @@ runqueue_pop(EV_P_ struct ev_idle *w, int revents)
 
 	case LUA_YIELD: /* thread yielded */
 		lem_debug("thread yielded");
+		if (preempted == T) {
+			/* behind work of its own priority and timers */
+			preempted = NULL;
+			LEM_EXTRA(T) |= LEM_PREEMPTED;
+			lem_queueat(T, 0, LEM_PRIO_LOW);
+		}
 		return;
 
 	case LUA_ERRERR: /* error running error handler */
@@ -261,12 +428,60 @@ runqueue_pop(EV_P_ struct ev_idle *w, int revents)
 }
 
 #include "pool.c"
+#include "marshal.c"
+#ifdef LEM_BUNDLE
+#include "preload.c"
+#endif
+
+void
+lem_stats(struct lem_stats *st)
+{
+	unsigned int threads = 0;
+
+	*st = stats;
+	st->runqueue = rq.count;
+	st->pool_jobs = pool_reaper.jobs;
+	st->pool_threads = pool_threads;
+
+	lua_pushnil(L);
+	while (lua_next(L, LEM_THREADTABLE)) {
+		lua_pop(L, 1);
+		threads++;
+	}
+	st->threads = threads;
+}
+
+pid_t
+lem_fork(void)
+{
+	pid_t pid;
+
+	pthread_mutex_lock(&pool_mutex);
+	/* jobs in flight would never be reaped in the child */
+	if (pool_jobs > 0) {
+		pthread_mutex_unlock(&pool_mutex);
+		errno = EBUSY;
+		return -1;
+	}
+
+	pid = fork();
+	if (pid == 0) {
+		/* the pool threads didn't survive the fork */
+		pool_threads = 0;
+		pthread_cond_init(&pool_cond, NULL);
+		ev_loop_fork(LEM);
+	}
+	pthread_mutex_unlock(&pool_mutex);
+
+	return pid;
+}
 
 static int
 queue_file(int argc, char *argv[], int fidx)
 {
 	lua_State *T = lem_newthread();
 	const char *filename;
+	int ret;
 	int i;
 
 	if (fidx < argc)
@@ -274,7 +489,18 @@ queue_file(int argc, char *argv[], int fidx)
 	else
 		filename = LEM_LDIR "lem/repl.lua";
 
-	switch (luaL_loadfile(T, filename)) {
+#ifdef LEM_BUNDLE
+	if (lem_bundle_main.data != NULL) {
+		/* the application is the script, so argv[1] is arg[1] */
+		fidx--;
+		ret = bundle_load(T, &lem_bundle_main);
+	} else if (fidx >= argc && bundle_find("lem.repl") != NULL)
+		ret = bundle_load(T, bundle_find("lem.repl"));
+	else
+#endif
+	ret = luaL_loadfile(T, filename);
+
+	switch (ret) {
 	case LUA_OK: /* success */
 		break;
 
@@ -306,6 +532,222 @@ runqueue_wait_init(void)
 }
 #pragma GCC diagnostic pop
 
+static void *
+state_realloc(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+	(void)ud;
+	(void)osize;
+
+	if (nsize == 0) {
+		free(ptr);
+		return NULL;
+	}
+	return realloc(ptr, nsize);
+}
+
+static int
+state_panic(lua_State *T)
+{
+	lem_log_error("lem: unprotected error in call to Lua API (%s)",
+			lua_tostring(T, -1));
+	return 0;
+}
+
+/*
+ * Create the main Lua state. The allocator is chosen by the
+ * environment: LEM_ALLOCATOR=slab or slab-huge uses the size class
+ * allocator in slab.c, optionally backed by huge pages, and with
+ * LEM_ACCOUNTING set usage is counted on top of that.
+ */
+static lua_State *
+state_new(void)
+{
+	const char *allocator = getenv("LEM_ALLOCATOR");
+	lua_Alloc f = state_realloc;
+	lua_State *S;
+
+	if (allocator != NULL && strncmp(allocator, "slab", 4) == 0) {
+		slab_init(strcmp(allocator, "slab-huge") == 0);
+		f = slab_alloc;
+	}
+	if (getenv("LEM_ACCOUNTING") != NULL) {
+		acct_init(f);
+		f = acct_alloc;
+	}
+	if (f == state_realloc)
+		S = luaL_newstate();
+	else {
+		S = lua_newstate(f, NULL);
+		if (S != NULL)
+			lua_atpanic(S, state_panic);
+	}
+	/* threads get a copy of the extra space of S */
+	if (S != NULL)
+		LEM_EXTRA(S) = LEM_PRIO_NORMAL;
+	return S;
+}
+
+/* create the Lua state and runqueue of the current loop */
+static int
+state_init(void)
+{
+	int i;
+
+	/* create main Lua state */
+	L = state_new();
+	if (L == NULL) {
+		lem_log_error("lem: error initializing Lua state");
+		return -1;
+	}
+	luaL_openlibs(L);
+#ifdef LEM_BUNDLE
+	bundle_preload(L);
+#endif
+
+	/* push thread table */
+	lua_newtable(L);
+
+	/* initialize runqueue */
+	runqueue_wait_init();
+	ev_idle_start(LEM_ &rq.w);
+	for (i = 0; i < LEM_PRIORITIES; i++) {
+		struct lem_runqueue_level *q = &rq.level[i];
+
+		q->queue = lem_xmalloc(LEM_INITIAL_QUEUESIZE
+				* sizeof(struct lem_runqueue_slot));
+		q->first = q->last = 0;
+		q->mask = LEM_INITIAL_QUEUESIZE - 1;
+		q->passed = 0;
+	}
+	rq.count = 0;
+
+	/* initialize reaping of threadpool jobs */
+	return pool_loop_init();
+}
+
+static void
+state_close(void)
+{
+	int i;
+
+	lem_profile_stop(NULL);
+	lem_watchdog_stop();
+	if (L) {
+		acct_forgetall();
+		lua_close(L);
+		L = NULL;
+	}
+	acct_close();
+	slab_close();
+	for (i = 0; i < LEM_PRIORITIES; i++) {
+		free(rq.level[i].queue);
+		rq.level[i].queue = NULL;
+	}
+}
+
+#if EV_MULTIPLICITY
+struct loopthread {
+	int (*init)(lua_State *T, void *arg);
+	void *arg;
+	char filename[];
+};
+
+static void *
+loopthread_func(void *arg)
+{
+	struct loopthread *lt = arg;
+	lua_State *T;
+	int nargs;
+
+	lem_loop = ev_loop_new(LEM_LOOPFLAGS);
+	if (lem_loop == NULL) {
+		lem_log_error("lem: error initializing event loop");
+		goto error;
+	}
+
+	if (state_init())
+		goto error;
+
+	T = lem_newthread();
+	switch (luaL_loadfile(T, lt->filename)) {
+	case LUA_OK: /* success */
+		break;
+
+	case LUA_ERRMEM:
+		oom();
+		/* fallthrough */
+
+	default:
+		lem_log_error("lem: %s", lua_tostring(T, 1));
+		goto error;
+	}
+
+	nargs = lt->init(T, lt->arg);
+	free(lt);
+	lem_queue(T, nargs);
+
+	/* start the loop of this thread */
+	ev_loop(LEM_ 0);
+	lem_debug("thread event loop exited");
+
+	/* if there is an error message left on L print it */
+	if (lua_type(L, -1) == LUA_TSTRING)
+		lem_log_error("lem: %s", lua_tostring(L, -1));
+
+	pool_loop_done();
+	state_close();
+	ev_loop_destroy(lem_loop);
+	return NULL;
+
+error:
+	lt->init(NULL, lt->arg);
+	free(lt);
+	pool_loop_done();
+	state_close();
+	if (lem_loop)
+		ev_loop_destroy(lem_loop);
+	return NULL;
+}
+#endif
+
+int
+lem_spawnloop(const char *filename,
+		int (*init)(lua_State *T, void *arg), void *arg)
+{
+#if EV_MULTIPLICITY
+	size_t len = strlen(filename) + 1;
+	struct loopthread *lt = lem_xmalloc(sizeof(struct loopthread) + len);
+	pthread_attr_t attr;
+	pthread_t thread;
+	int ret;
+
+	lt->init = init;
+	lt->arg = arg;
+	memcpy(lt->filename, filename, len);
+
+	ret = pthread_attr_init(&attr);
+	if (ret)
+		goto error;
+
+	ret = pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (ret == 0)
+		ret = pthread_create(&thread, &attr, loopthread_func, lt);
+	pthread_attr_destroy(&attr);
+	if (ret)
+		goto error;
+
+	return 0;
+error:
+	free(lt);
+	return ret;
+#else
+	(void)filename;
+	(void)init;
+	(void)arg;
+	return ENOSYS;
+#endif
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -326,31 +768,16 @@ main(int argc, char *argv[])
 	   )
 		goto error;
 
-	/* create main Lua state */
-	L = luaL_newstate();
-	if (L == NULL) {
-		lem_log_error("lem: error initializing Lua state");
-		goto error;
-	}
-	luaL_openlibs(L);
-
-	/* push thread table */
-	lua_newtable(L);
-
-	/* initialize runqueue */
-	runqueue_wait_init();
-	ev_idle_start(LEM_ &rq.w);
-	rq.queue = lem_xmalloc(LEM_INITIAL_QUEUESIZE
-			* sizeof(struct lem_runqueue_slot));
-	rq.first = rq.last = 0;
-	rq.mask = LEM_INITIAL_QUEUESIZE - 1;
-
 	/* initialize threadpool */
 	if (pool_init()) {
 		lem_log_error("lem: error initializing threadpool");
 		goto error;
 	}
 
+	/* create main Lua state and runqueue */
+	if (state_init())
+		goto error;
+
 	/* load file */
 	if (queue_file(argc, argv, 1))
 		goto error;
@@ -363,11 +790,9 @@ main(int argc, char *argv[])
 	if (lua_type(L, -1) == LUA_TSTRING)
 		lem_log_error("lem: %s", lua_tostring(L, -1));
 
-	/* shutdown Lua */
-	lua_close(L);
-
-	/* free runqueue */
-	free(rq.queue);
+	/* wait for threadpool jobs, then shutdown Lua and free runqueue */
+	pool_loop_done();
+	state_close();
 
 	/* destroy loop */
 #if EV_MULTIPLICITY
@@ -379,10 +804,8 @@ main(int argc, char *argv[])
 	return exit_status;
 
 error:
-	if (L)
-		lua_close(L);
-	if (rq.queue)
-		free(rq.queue);
+	pool_loop_done();
+	state_close();
 #if EV_MULTIPLICITY
 	ev_loop_destroy(lem_loop);
 #else
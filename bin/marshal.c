@@ -0,0 +1,277 @@
+/*
+ * This file is part of LEM, a Lua Event Machine.
+ * Copyright 2026 agent
+ *
+ * LEM is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * LEM is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Values are serialized into a flat buffer so they can be moved
+ * between Lua states. The encoding uses native byte order and
+ * is only meant to be read back by the same process.
+ */
+
+#define MARSHAL_MAXDEPTH 64
+
+enum marshal_tag {
+	MARSHAL_NIL,
+	MARSHAL_FALSE,
+	MARSHAL_TRUE,
+	MARSHAL_INTEGER,
+	MARSHAL_NUMBER,
+	MARSHAL_STRING,
+	MARSHAL_TABLE,
+	MARSHAL_END,
+};
+
+struct marshal_buf {
+	char *data;
+	size_t len;
+	size_t size;
+};
+
+static char *
+marshal_reserve(struct marshal_buf *b, size_t n)
+{
+	if (b->len + n > b->size) {
+		size_t size = 2*b->size;
+		char *data;
+
+		while (b->len + n > size)
+			size *= 2;
+
+		data = realloc(b->data, size);
+		if (data == NULL)
+			oom();
+		b->data = data;
+		b->size = size;
+	}
+
+	return b->data + b->len;
+}
+
+static void
+marshal_add(struct marshal_buf *b, const void *p, size_t n)
+{
+	memcpy(marshal_reserve(b, n), p, n);
+	b->len += n;
+}
+
+static void
+marshal_addtag(struct marshal_buf *b, unsigned char tag)
+{
+	*marshal_reserve(b, 1) = tag;
+	b->len++;
+}
+
+static const char *
+marshal_value(lua_State *T, int idx, struct marshal_buf *b, int depth)
+{
+	switch (lua_type(T, idx)) {
+	case LUA_TNIL:
+		marshal_addtag(b, MARSHAL_NIL);
+		break;
+
+	case LUA_TBOOLEAN:
+		marshal_addtag(b, lua_toboolean(T, idx) ?
+				MARSHAL_TRUE : MARSHAL_FALSE);
+		break;
+
+	case LUA_TNUMBER:
+		if (lua_isinteger(T, idx)) {
+			lua_Integer i = lua_tointeger(T, idx);
+
+			marshal_addtag(b, MARSHAL_INTEGER);
+			marshal_add(b, &i, sizeof(lua_Integer));
+		} else {
+			lua_Number n = lua_tonumber(T, idx);
+
+			marshal_addtag(b, MARSHAL_NUMBER);
+			marshal_add(b, &n, sizeof(lua_Number));
+		}
+		break;
+
+	case LUA_TSTRING: {
+			size_t len;
+			const char *str = lua_tolstring(T, idx, &len);
+
+			marshal_addtag(b, MARSHAL_STRING);
+			marshal_add(b, &len, sizeof(size_t));
+			marshal_add(b, str, len);
+		}
+		break;
+
+	case LUA_TTABLE: {
+			const char *err;
+
+			if (depth == MARSHAL_MAXDEPTH)
+				return "deeply nested table";
+			if (!lua_checkstack(T, 2))
+				return "stack overflow";
+
+			if (idx < 0)
+				idx = lua_gettop(T) + idx + 1;
+
+			marshal_addtag(b, MARSHAL_TABLE);
+			lua_pushnil(T);
+			while (lua_next(T, idx)) {
+				err = marshal_value(T, -2, b, depth + 1);
+				if (err == NULL)
+					err = marshal_value(T, -1, b, depth + 1);
+				if (err) {
+					lua_pop(T, 2);
+					return err;
+				}
+				lua_pop(T, 1);
+			}
+			marshal_addtag(b, MARSHAL_END);
+		}
+		break;
+
+	default:
+		return lua_typename(T, lua_type(T, idx));
+	}
+
+	return NULL;
+}
+
+/*
+ * Serialize the n values starting at stack index idx into
+ * a newly malloc'ed buffer. On error NULL is returned and
+ * an error message is pushed onto the stack.
+ */
+char *
+lem_marshal(lua_State *T, int idx, int n, size_t *len)
+{
+	struct marshal_buf b;
+	int i;
+
+	b.size = 64;
+	b.len = 0;
+	b.data = lem_xmalloc(b.size);
+
+	for (i = 0; i < n; i++) {
+		const char *err = marshal_value(T, idx + i, &b, 0);
+
+		if (err) {
+			free(b.data);
+			lua_pushfstring(T, "cannot marshal %s", err);
+			return NULL;
+		}
+	}
+
+	*len = b.len;
+	return b.data;
+}
+
+static const char *
+unmarshal_value(lua_State *T, const char *p, const char *end)
+{
+	if (p == end || !lua_checkstack(T, 3))
+		return NULL;
+
+	switch ((unsigned char)*p++) {
+	case MARSHAL_NIL:
+		lua_pushnil(T);
+		break;
+
+	case MARSHAL_FALSE:
+		lua_pushboolean(T, 0);
+		break;
+
+	case MARSHAL_TRUE:
+		lua_pushboolean(T, 1);
+		break;
+
+	case MARSHAL_INTEGER: {
+			lua_Integer i;
+
+			if ((size_t)(end - p) < sizeof(lua_Integer))
+				return NULL;
+			memcpy(&i, p, sizeof(lua_Integer));
+			p += sizeof(lua_Integer);
+			lua_pushinteger(T, i);
+		}
+		break;
+
+	case MARSHAL_NUMBER: {
+			lua_Number n;
+
+			if ((size_t)(end - p) < sizeof(lua_Number))
+				return NULL;
+			memcpy(&n, p, sizeof(lua_Number));
+			p += sizeof(lua_Number);
+			lua_pushnumber(T, n);
+		}
+		break;
+
+	case MARSHAL_STRING: {
+			size_t len;
+
+			if ((size_t)(end - p) < sizeof(size_t))
+				return NULL;
+			memcpy(&len, p, sizeof(size_t));
+			p += sizeof(size_t);
+			if ((size_t)(end - p) < len)
+				return NULL;
+			lua_pushlstring(T, p, len);
+			p += len;
+		}
+		break;
+
+	case MARSHAL_TABLE:
+		lua_newtable(T);
+		while (1) {
+			if (p == end)
+				return NULL;
+			if ((unsigned char)*p == MARSHAL_END)
+				break;
+			p = unmarshal_value(T, p, end);
+			if (p == NULL)
+				return NULL;
+			p = unmarshal_value(T, p, end);
+			if (p == NULL)
+				return NULL;
+			lua_rawset(T, -3);
+		}
+		p++;
+		break;
+
+	default:
+		return NULL;
+	}
+
+	return p;
+}
+
+/*
+ * Push the values serialized in buf onto the stack.
+ * Returns the number of values pushed or -1 if buf is malformed.
+ */
+int
+lem_unmarshal(lua_State *T, const char *buf, size_t len)
+{
+	const char *end = buf + len;
+	int top = lua_gettop(T);
+
+	while (buf < end) {
+		buf = unmarshal_value(T, buf, end);
+		if (buf == NULL) {
+			lua_settop(T, top);
+			return -1;
+		}
+	}
+
+	return lua_gettop(T) - top;
+}
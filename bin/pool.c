@@ -23,28 +23,43 @@ static unsigned int pool_threads;
 static time_t pool_delay;
 static pthread_mutex_t pool_mutex;
 #if _POSIX_SPIN_LOCKS >= 200112L
-static pthread_spinlock_t pool_dlock;
-#define pool_done_init()   pthread_spin_init(&pool_dlock, PTHREAD_PROCESS_PRIVATE)
-#define pool_done_lock()   pthread_spin_lock(&pool_dlock)
-#define pool_done_unlock() pthread_spin_unlock(&pool_dlock)
+#define pool_dlock_t       pthread_spinlock_t
+#define pool_done_init(r)  pthread_spin_init(&(r)->lock, PTHREAD_PROCESS_PRIVATE)
+#define pool_done_lock(r)  pthread_spin_lock(&(r)->lock)
+#define pool_done_unlock(r) pthread_spin_unlock(&(r)->lock)
 #else
-static pthread_mutex_t pool_dlock;
-#define pool_done_init()   pthread_mutex_init(&pool_dlock, NULL)
-#define pool_done_lock()   pthread_mutex_lock(&pool_dlock)
-#define pool_done_unlock() pthread_mutex_unlock(&pool_dlock)
+#define pool_dlock_t       pthread_mutex_t
+#define pool_done_init(r)  pthread_mutex_init(&(r)->lock, NULL)
+#define pool_done_lock(r)  pthread_mutex_lock(&(r)->lock)
+#define pool_done_unlock(r) pthread_mutex_unlock(&(r)->lock)
 #endif
 static pthread_cond_t pool_cond;
 static struct lem_async *pool_head;
 static struct lem_async *pool_tail;
-static struct lem_async *pool_done;
-static struct ev_async pool_watch;
+
+/* finished jobs are handed back to the loop which started them */
+struct lem_reaper {
+	struct ev_async watch;
+#if EV_MULTIPLICITY
+	struct ev_loop *loop;
+#endif
+	struct lem_async *done;
+	unsigned int jobs;
+	unsigned int sending; /* jobs not yet signalled, under lock */
+	int ready; /* jobs go to the pool threads */
+	pool_dlock_t lock;
+};
+
+static __thread struct lem_reaper pool_reaper;
 
 static void *
 pool_threadfunc(void *arg)
 {
 	struct lem_async *a;
+	struct lem_reaper *r;
 	struct timespec ts;
 	struct timeval tv;
+	uint64_t start;
 
 	(void)arg;
 
@@ -68,15 +83,27 @@ pool_threadfunc(void *arg)
 		pthread_mutex_unlock(&pool_mutex);
 
 		lem_debug("Running job %p", a);
+		start = monotime();
+		a->wait = start - a->queued;
 		a->work(a);
+		a->run = monotime() - start;
 		lem_debug("Bye %p", a);
 
-		pool_done_lock();
-		a->next = pool_done;
-		pool_done = a;
-		pool_done_unlock();
-
-		ev_async_send(LEM_ &pool_watch);
+		/* the loop may reap the job as soon as it is on the
+		 * list, but waits for r->sending before it exits */
+		r = a->reaper;
+		pool_done_lock(r);
+		a->next = r->done;
+		r->done = a;
+		pool_done_unlock(r);
+#if EV_MULTIPLICITY
+		ev_async_send(r->loop, &r->watch);
+#else
+		ev_async_send(&r->watch);
+#endif
+		pool_done_lock(r);
+		r->sending--;
+		pool_done_unlock(r);
 	}
 out:
 	pool_threads--;
@@ -84,38 +111,59 @@ out:
 	return NULL;
 }
 
-static void
-pool_cb(EV_P_ struct ev_async *w, int revents)
+/* reap the jobs handed back, returns how many there were */
+static unsigned int
+pool_reap(struct lem_reaper *r)
 {
 	struct lem_async *a;
 	struct lem_async *next;
+	unsigned int n = 0;
 
-	(void)revents;
-
-	pool_done_lock();
-	a = pool_done;
-	pool_done = NULL;
-	pool_done_unlock();
+	pool_done_lock(r);
+	a = r->done;
+	r->done = NULL;
+	pool_done_unlock(r);
 
+	lem_profile_where = LEM_PROFILE_REAP;
 	for (; a; a = next) {
-		pool_jobs--;
+		n++;
 		next = a->next;
+		lem_histogram_add(&stats.pool_wait, a->wait);
+		lem_histogram_add(&stats.pool_run, a->run);
 		if (a->reap)
 			a->reap(a);
 		else
 			free(a);
 	}
+	lem_profile_where = LEM_PROFILE_LOOP;
+
+	pthread_mutex_lock(&pool_mutex);
+	pool_jobs -= n;
+	pthread_mutex_unlock(&pool_mutex);
+
+	stats.pool_done += n;
+	r->jobs -= n;
+	return n;
+}
 
-	if (pool_jobs == 0)
+static void
+pool_cb(EV_P_ struct ev_async *w, int revents)
+{
+	struct lem_reaper *r = (struct lem_reaper *)w;
+
+	(void)revents;
+
+	pool_reap(r);
+	if (r->jobs == 0)
 		ev_async_stop(EV_A_ w);
 }
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wstrict-aliasing"
 static inline void
-pool_watch_init(void)
+pool_watch_init(struct lem_reaper *r)
 {
-	ev_async_init(&pool_watch, pool_cb);
+	ev_async_init(&r->watch, pool_cb);
 }
 #pragma GCC diagnostic pop
 
@@ -134,14 +182,9 @@ pool_init(void)
 	/*
 	pool_head = NULL;
 	pool_tail = NULL;
-	pool_done = NULL;
 	*/
 
-	pool_watch_init();
-
 	ret = pthread_mutex_init(&pool_mutex, NULL);
-	if (ret == 0)
-		ret = pool_done_init();
 	if (ret) {
 		lem_log_error("error initializing lock: %s",
 				strerror(ret));
@@ -158,6 +201,62 @@ pool_init(void)
 	return 0;
 }
 
+/* set up reaping of jobs started from the current loop */
+static int
+pool_loop_init(void)
+{
+	struct lem_reaper *r = &pool_reaper;
+	int ret;
+
+	pool_watch_init(r);
+#if EV_MULTIPLICITY
+	r->loop = lem_loop;
+#endif
+	r->done = NULL;
+	r->jobs = 0;
+	r->sending = 0;
+
+	ret = pool_done_init(r);
+	if (ret) {
+		lem_log_error("error initializing lock: %s",
+				strerror(ret));
+		return -1;
+	}
+
+	r->ready = 1;
+	return 0;
+}
+
+/*
+ * Wait for the jobs started from a loop which is exiting. Pool
+ * threads still hold on to the reaper, which is freed with a loop
+ * thread, the loop they signal and the Lua state the jobs belong
+ * to. Threads woken by reaping are never run. Jobs started after
+ * this, like those of __gc metamethods run by lua_close(), are run
+ * right away, as lua_close() also unloads the code they call.
+ */
+static void
+pool_loop_done(void)
+{
+	struct lem_reaper *r = &pool_reaper;
+	unsigned int sending;
+
+	if (!r->ready)
+		return;
+
+	while (1) {
+		pool_reap(r);
+		pool_done_lock(r);
+		sending = r->sending;
+		pool_done_unlock(r);
+		if (r->jobs == 0 && sending == 0)
+			break;
+		usleep(1000);
+	}
+	ev_async_stop(LEM_ &r->watch);
+	r->ready = 0;
+}
+
 static void
 pool_spawnthread(void)
 {
@@ -189,15 +288,32 @@ error:
 void
 lem_async_run(struct lem_async *a)
 {
+	struct lem_reaper *r = &pool_reaper;
 	int spawn = 0;
 
-	if (pool_jobs == 0)
-		ev_async_start(LEM_ &pool_watch);
-	pool_jobs++;
+	if (!r->ready) {
+		a->work(a);
+		if (a->reap)
+			a->reap(a);
+		else
+			free(a);
+		return;
+	}
+
+	if (r->jobs == 0)
+		ev_async_start(LEM_ &r->watch);
+	r->jobs++;
 
 	a->next = NULL;
+	a->reaper = r;
+	a->queued = monotime();
+
+	pool_done_lock(r);
+	r->sending++;
+	pool_done_unlock(r);
 
 	pthread_mutex_lock(&pool_mutex);
+	pool_jobs++;
 	if (pool_head == NULL) {
 		pool_head = a;
 		pool_tail = a;
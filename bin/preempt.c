@@ -0,0 +1,186 @@
+/*
+ * This file is part of LEM, a Lua Event Machine.
+ * Copyright 2026 agent
+ *
+ * LEM is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * LEM is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Optional preemption of threads running for longer than a time
+ * slice without yielding. While a thread is resumed a count hook
+ * looks at the clock every PREEMPT_COUNT instructions. Once the slice
+ * is used up the thread is yielded from the hook at the next jump
+ * back in the code of a function, and put at the back of the
+ * runqueue.
+ *
+ * Threads sharing state expect to run undisturbed between the points
+ * where they yield, so they can't be stopped just anywhere. Waiting
+ * for a loop to come around means straight code like updating a
+ * counter, or putting the thread on a list of waiters and calling
+ * utils.suspend(), is never cut in half. Line hooks tell about jumps
+ * back, as a line not after the last one seen in the same call.
+ * Should a thread still be preempted in a loop between making itself
+ * known and suspending, values passed to it by utils.resume() are
+ * held back for its next utils.suspend(), see lem/utils.c, as a
+ * thread yielded from a hook continues without them.
+ *
+ * It never happens while the thread is inside a C function calling
+ * Lua, which can't be yielded across, or in a coroutine the thread
+ * resumed itself, as that would yield to the wrong resumer.
+ */
+#define PREEMPT_COUNT 1000
+#define PREEMPT_DUEMASK (LUA_MASKLINE | LUA_MASKCALL | LUA_MASKRET)
+
+static __thread unsigned long preempt_slice;  /* microseconds, 0 is off */
+static __thread unsigned int preempt_custom;  /* slices set per thread */
+static __thread lua_State *preempt_armed;     /* the thread with the hook */
+static __thread lua_State *preempted;
+static __thread uint64_t preempt_deadline;
+static __thread int preempt_due;  /* waiting for a jump back */
+static __thread int preempt_line; /* the last line seen, or -1 */
+static const char preempt_key; /* registry key of per thread slices */
+
+static void
+preempt_arm(lua_State *T)
+{
+	unsigned long slice = preempt_slice;
+
+	if (preempt_custom) {
+		lua_rawgetp(L, LUA_REGISTRYINDEX, &preempt_key);
+		lua_checkstack(T, 1);
+		lua_pushthread(T);
+		lua_xmove(T, L, 1);
+		lua_rawget(L, -2);
+		if (lua_isinteger(L, -1))
+			slice = lua_tointeger(L, -1);
+		lua_pop(L, 2);
+	}
+	if (slice == 0)
+		return;
+
+	preempt_deadline = monotime() + slice;
+	preempt_armed = T;
+	preempt_due = 0;
+	lua_sethook(T, hook_dispatch, LUA_MASKCOUNT, PREEMPT_COUNT);
+}
+
+/* the hook the armed thread should have */
+static inline void
+preempt_sethook(lua_State *T)
+{
+	if (preempt_due)
+		lua_sethook(T, hook_dispatch, PREEMPT_DUEMASK, 0);
+	else
+		lua_sethook(T, hook_dispatch, LUA_MASKCOUNT, PREEMPT_COUNT);
+}
+
+static inline void
+preempt_disarm(lua_State *T)
+{
+	preempt_armed = NULL;
+	preempt_due = 0;
+	/* a pending sample clears the hook once it is taken */
+	if (T != profile_pending && T != watchdog_pending)
+		lua_sethook(T, NULL, 0, 0);
+}
+
+/* called from the hook of the armed thread, must be the
+ * last thing the hook does as it may yield */
+static void
+preempt_check(lua_State *T, lua_Debug *ar)
+{
+	switch (ar->event) {
+	case LUA_HOOKCOUNT:
+		if (preempt_due || monotime() < preempt_deadline)
+			return;
+		preempt_due = 1;
+		preempt_line = -1;
+		preempt_sethook(T);
+		return;
+
+	case LUA_HOOKLINE:
+		if (!preempt_due)
+			return;
+		if (preempt_line < 0 || ar->currentline > preempt_line
+				|| !lua_isyieldable(T)) {
+			preempt_line = ar->currentline;
+			return;
+		}
+		break;
+
+	default:
+		/* lines of another call don't tell about jumps */
+		preempt_line = -1;
+		return;
+	}
+
+	preempt_due = 0;
+	preempt_sethook(T);
+	preempted = T;
+	stats.preempted++;
+	lua_yield(T, 0);
+}
+
+int
+lem_preempted(lua_State *T)
+{
+	return (LEM_EXTRA(T) & LEM_PREEMPTED) != 0;
+}
+
+unsigned long
+lem_preempt(unsigned long us)
+{
+	unsigned long old = preempt_slice;
+
+	preempt_slice = us;
+	return old;
+}
+
+int
+lem_setslice(lua_State *T, long us)
+{
+	/* create the table of slices, with weak keys */
+	lua_rawgetp(L, LUA_REGISTRYINDEX, &preempt_key);
+	if (lua_isnil(L, -1)) {
+		lua_pop(L, 1);
+		lua_newtable(L);
+		lua_createtable(L, 0, 1);
+		lua_pushliteral(L, "k");
+		lua_setfield(L, -2, "__mode");
+		lua_setmetatable(L, -2);
+		lua_pushvalue(L, -1);
+		lua_rawsetp(L, LUA_REGISTRYINDEX, &preempt_key);
+	}
+
+	lua_checkstack(T, 1);
+	lua_pushthread(T);
+	lua_xmove(T, L, 1);
+	if (us < 0)
+		lua_pushnil(L);
+	else {
+		lua_pushinteger(L, us);
+		preempt_custom = 1;
+	}
+	lua_rawset(L, -3);
+	lua_pop(L, 1);
+
+	/* the running thread gets a new slice from now */
+	if (T == running) {
+		if (preempt_armed == T)
+			preempt_disarm(T);
+		if (preempt_slice || preempt_custom)
+			preempt_arm(T);
+	}
+	return 0;
+}
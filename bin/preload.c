@@ -0,0 +1,80 @@
+/*
+ * This file is part of LEM, a Lua Event Machine.
+ * Copyright 2026 agent
+ *
+ * LEM is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * LEM is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * With LEM_BUNDLE the modules compiled into the executable are
+ * put in package.preload of every new state, so require never
+ * looks at the filesystem for them. Lua modules are undumped the
+ * first time they are required.
+ */
+#include "bundle.h"
+
+static int
+bundle_load(lua_State *T, const struct lem_bundle_chunk *c)
+{
+	/* the name is only used by errors about the bytecode */
+	return luaL_loadbufferx(T, c->data, c->len, c->name, "b");
+}
+
+static int
+bundle_loader(lua_State *T)
+{
+	const struct lem_bundle_chunk *c =
+		lua_touserdata(T, lua_upvalueindex(1));
+	int nargs = lua_gettop(T);
+
+	if (bundle_load(T, c) != LUA_OK)
+		return lua_error(T);
+	lua_insert(T, 1);
+	lua_call(T, nargs, 1);
+	return 1;
+}
+
+static const struct lem_bundle_chunk *
+bundle_find(const char *name)
+{
+	const struct lem_bundle_chunk *c;
+
+	for (c = lem_bundle_lua; c->name != NULL; c++) {
+		if (strcmp(c->name, name) == 0)
+			return c;
+	}
+	return NULL;
+}
+
+static void
+bundle_preload(lua_State *S)
+{
+	const struct lem_bundle_chunk *c;
+	const luaL_Reg *r;
+
+	luaL_getsubtable(S, LUA_REGISTRYINDEX, "_PRELOAD");
+
+	for (r = lem_bundle_c; r->name != NULL; r++) {
+		lua_pushcfunction(S, r->func);
+		lua_setfield(S, -2, r->name);
+	}
+
+	for (c = lem_bundle_lua; c->name != NULL; c++) {
+		lua_pushlightuserdata(S, (void *)c);
+		lua_pushcclosure(S, bundle_loader, 1);
+		lua_setfield(S, -2, c->name);
+	}
+
+	lua_pop(S, 1);
+}
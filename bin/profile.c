@@ -0,0 +1,162 @@
+/*
+ * This file is part of LEM, a Lua Event Machine.
+ * Copyright 2026 agent
+ *
+ * LEM is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * LEM is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Sampling profiler support. A CPU time timer sends SIGPROF to the
+ * loop thread. If a Lua thread is running, the signal handler sets
+ * a hook on it which records the stack as soon as the thread is
+ * back in Lua code. Otherwise the tick is only counted against what
+ * the loop was doing, see the LEM_PROFILE_* constants.
+ */
+#ifdef SIGEV_THREAD_ID
+#include <sys/syscall.h>
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+#endif
+
+__thread int lem_profile_where;
+static __thread lua_State *profile_pending;
+static __thread lua_Hook profile_hook;
+static __thread unsigned long profile_ticks[LEM_PROFILE_MAX];
+#ifdef SIGEV_THREAD_ID
+static __thread timer_t profile_timer;
+#endif
+
+static void
+profile_signal(int sig)
+{
+	lua_State *T = running;
+
+	(void)sig;
+
+	if (profile_hook == NULL)
+		return;
+
+	if (T == NULL) {
+		profile_ticks[lem_profile_where]++;
+		return;
+	}
+
+	/* the last sample hasn't been taken yet */
+	if (profile_pending != NULL)
+		return;
+
+	profile_pending = T;
+	lua_sethook(T, hook_dispatch, HOOK_MASK, 1);
+}
+
+int
+lem_profile_start(lua_Hook hook, int hz)
+{
+	static int installed;
+	long ns = 1000000000L / hz;
+
+	if (profile_hook != NULL)
+		return EBUSY;
+
+	if (!installed) {
+		if (setsignal(SIGPROF, profile_signal, SA_RESTART))
+			return errno;
+		installed = 1;
+	}
+
+	memset(profile_ticks, 0, sizeof(profile_ticks));
+	profile_pending = NULL;
+	profile_hook = hook;
+
+#ifdef SIGEV_THREAD_ID
+	{
+		struct sigevent sev;
+		struct itimerspec its;
+
+		/* count the CPU time of this thread only, and deliver
+		 * the signal to it, so each loop can be profiled */
+		memset(&sev, 0, sizeof(sev));
+		sev.sigev_notify = SIGEV_THREAD_ID;
+		sev.sigev_signo = SIGPROF;
+		sev.sigev_notify_thread_id = syscall(SYS_gettid);
+		if (timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &profile_timer))
+			goto error;
+
+		its.it_interval.tv_sec = ns / 1000000000L;
+		its.it_interval.tv_nsec = ns % 1000000000L;
+		its.it_value = its.it_interval;
+		if (timer_settime(profile_timer, 0, &its, NULL)) {
+			timer_delete(profile_timer);
+			goto error;
+		}
+	}
+#else
+	{
+		struct itimerval itv;
+
+		itv.it_interval.tv_sec = ns / 1000000000L;
+		itv.it_interval.tv_usec = (ns % 1000000000L) / 1000;
+		itv.it_value = itv.it_interval;
+		if (setitimer(ITIMER_PROF, &itv, NULL))
+			goto error;
+	}
+#endif
+	return 0;
+error:
+	profile_hook = NULL;
+	return errno;
+}
+
+void
+lem_profile_stop(unsigned long ticks[LEM_PROFILE_MAX])
+{
+	if (profile_hook == NULL)
+		return;
+
+#ifdef SIGEV_THREAD_ID
+	timer_delete(profile_timer);
+#else
+	{
+		struct itimerval itv;
+
+		memset(&itv, 0, sizeof(itv));
+		setitimer(ITIMER_PROF, &itv, NULL);
+	}
+#endif
+	profile_hook = NULL;
+	if (profile_pending != NULL) {
+		lua_State *T = profile_pending;
+
+		profile_pending = NULL;
+		hook_done(T);
+	}
+	if (ticks)
+		memcpy(ticks, profile_ticks, sizeof(profile_ticks));
+}
+
+/*
+ * Called by the profiler hook when it runs. Returns whether T is
+ * the thread a sample was asked for, and clears the hook if
+ * nothing else is waiting for it.
+ */
+int
+lem_profile_sampled(lua_State *T)
+{
+	if (T != profile_pending)
+		return 0;
+	profile_pending = NULL;
+	hook_done(T);
+	return 1;
+}
@@ -0,0 +1,188 @@
+/*
+ * This file is part of LEM, a Lua Event Machine.
+ * Copyright 2026 agent
+ *
+ * LEM is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * LEM is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A lua_Alloc keeping small objects in size classes of 16 bytes
+ * up to 512 bytes. Each class takes pages of its own from chunks
+ * mapped with mmap(), so objects of a size are kept together and
+ * a freed object is reused by the next allocation of its class.
+ * Lua always tells us the size of the block it frees, so no header
+ * is needed. Everything is thread local, a loop only ever allocates
+ * from its own Lua state, so no locking is needed either. Larger
+ * objects go to malloc(). Memory is given back when the loop ends.
+ */
+#define SLAB_GRAIN   16
+#define SLAB_MAX     512
+#define SLAB_CLASSES (SLAB_MAX / SLAB_GRAIN)
+#define SLAB_CLASS(size) (((size) - 1) / SLAB_GRAIN)
+#define SLAB_PAGE    (16*1024)
+#define SLAB_CHUNK   (2*1024*1024)
+
+struct slab_object {
+	struct slab_object *next;
+};
+
+struct slab_class {
+	struct slab_object *free;
+	char *next;
+	char *end;
+};
+
+static __thread struct slab_class slab_classes[SLAB_CLASSES];
+static __thread char *slab_pages;     /* pages left in the last chunk */
+static __thread char *slab_pages_end;
+static __thread void **slab_chunks;
+static __thread unsigned int slab_nchunks;
+static __thread int slab_huge;
+
+static int
+slab_newchunk(void)
+{
+	void *p = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+	if (slab_huge)
+		p = mmap(NULL, SLAB_CHUNK, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+	if (p == MAP_FAILED) {
+		/* no huge pages reserved, ask for transparent ones */
+		p = mmap(NULL, SLAB_CHUNK, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			return -1;
+#ifdef MADV_HUGEPAGE
+		if (slab_huge)
+			(void)madvise(p, SLAB_CHUNK, MADV_HUGEPAGE);
+#endif
+	}
+
+	slab_chunks = lem_xrealloc(slab_chunks,
+			(slab_nchunks + 1) * sizeof(void *));
+	slab_chunks[slab_nchunks++] = p;
+	slab_pages = p;
+	slab_pages_end = slab_pages + SLAB_CHUNK;
+	return 0;
+}
+
+static void *
+slab_get(unsigned int c)
+{
+	struct slab_class *sc = &slab_classes[c];
+	struct slab_object *o = sc->free;
+	size_t size;
+	void *p;
+
+	if (o != NULL) {
+		sc->free = o->next;
+		return o;
+	}
+
+	size = (c + 1) * SLAB_GRAIN;
+	if ((size_t)(sc->end - sc->next) < size) {
+		if (slab_pages == slab_pages_end && slab_newchunk())
+			return NULL;
+		sc->next = slab_pages;
+		sc->end = slab_pages + SLAB_PAGE;
+		slab_pages += SLAB_PAGE;
+	}
+	p = sc->next;
+	sc->next += size;
+	return p;
+}
+
+static inline void
+slab_put(void *p, size_t size)
+{
+	struct slab_class *sc = &slab_classes[SLAB_CLASS(size)];
+	struct slab_object *o = p;
+
+	o->next = sc->free;
+	sc->free = o;
+}
+
+static void *
+slab_alloc(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+	void *p;
+
+	(void)ud;
+
+	if (ptr == NULL) {
+		/* osize is the type of object, not a size */
+		if (nsize == 0)
+			return NULL;
+		if (nsize > SLAB_MAX)
+			return malloc(nsize);
+		return slab_get(SLAB_CLASS(nsize));
+	}
+
+	if (osize > SLAB_MAX) {
+		if (nsize == 0) {
+			free(ptr);
+			return NULL;
+		}
+		if (nsize > SLAB_MAX)
+			return realloc(ptr, nsize);
+		p = slab_get(SLAB_CLASS(nsize));
+		if (p == NULL)
+			return NULL;
+		memcpy(p, ptr, nsize);
+		free(ptr);
+		return p;
+	}
+
+	if (nsize == 0) {
+		slab_put(ptr, osize);
+		return NULL;
+	}
+	if (nsize <= SLAB_MAX && SLAB_CLASS(nsize) == SLAB_CLASS(osize))
+		return ptr;
+
+	if (nsize > SLAB_MAX)
+		p = malloc(nsize);
+	else
+		p = slab_get(SLAB_CLASS(nsize));
+	if (p == NULL)
+		return NULL;
+	memcpy(p, ptr, osize < nsize ? osize : nsize);
+	slab_put(ptr, osize);
+	return p;
+}
+
+static void
+slab_init(int huge)
+{
+	memset(slab_classes, 0, sizeof(slab_classes));
+	slab_pages = slab_pages_end = NULL;
+	slab_huge = huge;
+}
+
+/* unmap all chunks, only after the Lua state is closed */
+static void
+slab_close(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < slab_nchunks; i++)
+		munmap(slab_chunks[i], SLAB_CHUNK);
+	free(slab_chunks);
+	slab_chunks = NULL;
+	slab_nchunks = 0;
+	slab_init(0);
+}
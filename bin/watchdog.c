@@ -0,0 +1,290 @@
+/*
+ * This file is part of LEM, a Lua Event Machine.
+ * Copyright 2026 agent
+ *
+ * LEM is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * LEM is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The watchdog is a thread checking that the loop makes progress.
+ * The loop bumps a heartbeat before each resume and around polling
+ * for events. If the loop is busy and the heartbeat hasn't moved
+ * for longer than the threshold, the stall is logged and counted.
+ * If a Lua thread is running the loop is sent WATCHDOG_SIGNAL, and
+ * the hook it sets logs the traceback of the thread.
+ */
+#define WATCHDOG_SIGNAL SIGURG
+
+struct watchdog {
+	struct ev_prepare prepare;
+	struct ev_check check;
+	pthread_t loop;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	lua_State *volatile *running;
+	volatile int *where;
+	volatile unsigned long beat;
+	volatile int busy;
+	volatile unsigned long stalls;
+	unsigned int ms;
+	int stop;
+	struct lem_histogram runs;
+	char *last;
+};
+
+static __thread struct watchdog *watchdog;
+static __thread lua_State *watchdog_pending;
+
+static const char *const watchdog_where[LEM_PROFILE_MAX] = {
+	"the event loop",
+	"garbage collection",
+	"thread pool reaps",
+	"stream reads",
+};
+
+static void
+watchdog_signal(int sig)
+{
+	lua_State *T = running;
+
+	(void)sig;
+
+	if (watchdog == NULL || T == NULL || watchdog_pending != NULL)
+		return;
+
+	watchdog_pending = T;
+	lua_sethook(T, hook_dispatch, HOOK_MASK, 1);
+}
+
+static void
+watchdog_report(lua_State *T)
+{
+	struct watchdog *w = watchdog;
+	const char *msg;
+	size_t len;
+
+	watchdog_pending = NULL;
+	if (w == NULL)
+		return;
+
+	luaL_traceback(L, T, "lem: stalled here", 0);
+	msg = lua_tolstring(L, -1, &len);
+	fprintf(stderr, "%s\n", msg);
+
+	free(w->last);
+	w->last = lem_xmalloc(len + 1);
+	memcpy(w->last, msg, len + 1);
+	lua_pop(L, 1);
+}
+
+static int
+watchdog_resume(lua_State *T, int nargs)
+{
+	struct timespec t0, t1;
+	int ret;
+
+	watchdog->beat++;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	ret = lua_resume(T, NULL, nargs);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	/* the thread may have stopped the watchdog */
+	if (watchdog == NULL)
+		return ret;
+
+	lem_histogram_add(&watchdog->runs,
+			(t1.tv_sec - t0.tv_sec) * 1000000L
+			+ (t1.tv_nsec - t0.tv_nsec) / 1000L);
+	return ret;
+}
+
+static void
+watchdog_prepare_cb(EV_P_ struct ev_prepare *w, int revents)
+{
+#if EV_MULTIPLICITY
+	(void)loop;
+#endif
+	(void)w;
+	(void)revents;
+
+	watchdog->busy = 0;
+	watchdog->beat++;
+}
+
+static void
+watchdog_check_cb(EV_P_ struct ev_check *w, int revents)
+{
+#if EV_MULTIPLICITY
+	(void)loop;
+#endif
+	(void)w;
+	(void)revents;
+
+	watchdog->busy = 1;
+	watchdog->beat++;
+}
+
+static void *
+watchdog_thread(void *arg)
+{
+	struct watchdog *w = arg;
+	unsigned long beat = w->beat;
+	long interval = w->ms * 1000000L / 4;
+	struct timespec since;
+	int reported = 0;
+
+	if (interval < 1000000L)
+		interval = 1000000L;
+
+	clock_gettime(CLOCK_MONOTONIC, &since);
+	pthread_mutex_lock(&w->lock);
+	while (!w->stop) {
+		struct timespec ts;
+		long ms;
+
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += interval;
+		ts.tv_sec += ts.tv_nsec / 1000000000L;
+		ts.tv_nsec %= 1000000000L;
+		pthread_cond_timedwait(&w->cond, &w->lock, &ts);
+		if (w->stop)
+			break;
+
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		if (!w->busy || w->beat != beat) {
+			beat = w->beat;
+			since = ts;
+			reported = 0;
+			continue;
+		}
+
+		ms = (ts.tv_sec - since.tv_sec) * 1000L
+			+ (ts.tv_nsec - since.tv_nsec) / 1000000L;
+		if (reported || ms < (long)w->ms)
+			continue;
+
+		reported = 1;
+		w->stalls++;
+		if (*w->running) {
+			fprintf(stderr, "lem: event loop stalled for %ldms "
+					"in a Lua thread\n", ms);
+			pthread_kill(w->loop, WATCHDOG_SIGNAL);
+		} else
+			fprintf(stderr, "lem: event loop stalled for %ldms "
+					"in %s\n", ms, watchdog_where[*w->where]);
+	}
+	pthread_mutex_unlock(&w->lock);
+	return NULL;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wstrict-aliasing"
+int
+lem_watchdog_start(unsigned int ms)
+{
+	static int installed;
+	struct watchdog *w;
+	int ret;
+
+	if (watchdog != NULL)
+		return EBUSY;
+
+	if (!installed) {
+		if (setsignal(WATCHDOG_SIGNAL, watchdog_signal, SA_RESTART))
+			return errno;
+		installed = 1;
+	}
+
+	w = lem_xmalloc(sizeof(struct watchdog));
+	memset(w, 0, sizeof(struct watchdog));
+	w->loop = pthread_self();
+	w->running = &running;
+	w->where = &lem_profile_where;
+	w->busy = 1;
+	w->ms = ms;
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->cond, NULL);
+
+	/* the watchers shouldn't keep the loop alive */
+	ev_prepare_init(&w->prepare, watchdog_prepare_cb);
+	ev_prepare_start(LEM_ &w->prepare);
+	ev_unref(LEM);
+	ev_check_init(&w->check, watchdog_check_cb);
+	ev_check_start(LEM_ &w->check);
+	ev_unref(LEM);
+
+	watchdog = w;
+	ret = pthread_create(&w->thread, NULL, watchdog_thread, w);
+	if (ret) {
+		watchdog = NULL;
+		ev_ref(LEM);
+		ev_prepare_stop(LEM_ &w->prepare);
+		ev_ref(LEM);
+		ev_check_stop(LEM_ &w->check);
+		pthread_cond_destroy(&w->cond);
+		pthread_mutex_destroy(&w->lock);
+		free(w);
+	}
+	return ret;
+}
+#pragma GCC diagnostic pop
+
+void
+lem_watchdog_stop(void)
+{
+	struct watchdog *w = watchdog;
+
+	if (w == NULL)
+		return;
+
+	pthread_mutex_lock(&w->lock);
+	w->stop = 1;
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+	pthread_join(w->thread, NULL);
+
+	watchdog = NULL;
+	if (watchdog_pending != NULL) {
+		lua_State *T = watchdog_pending;
+
+		watchdog_pending = NULL;
+		hook_done(T);
+	}
+
+	ev_ref(LEM);
+	ev_prepare_stop(LEM_ &w->prepare);
+	ev_ref(LEM);
+	ev_check_stop(LEM_ &w->check);
+	pthread_cond_destroy(&w->cond);
+	pthread_mutex_destroy(&w->lock);
+	free(w->last);
+	free(w);
+}
+
+void
+lem_watchdog_stats(struct lem_watchdog_stats *st)
+{
+	struct watchdog *w = watchdog;
+
+	if (w == NULL) {
+		memset(st, 0, sizeof(struct lem_watchdog_stats));
+		return;
+	}
+
+	st->threshold = w->ms;
+	st->stalls = w->stalls;
+	st->runs = w->runs;
+	st->last = w->last;
+}
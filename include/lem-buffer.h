@@ -0,0 +1,110 @@
+/*
+ * This file is part of LEM, a Lua Event Machine.
+ * Copyright 2026 agent
+ *
+ * LEM is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * LEM is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LEM_BUFFER_H
+#define _LEM_BUFFER_H
+
+#include <string.h>
+#include <lem.h>
+
+/* buffers are shared between modules,
+ * so their metatable lives in the registry */
+#define LEM_BUFFER_MT "lem.Buffer"
+
+/*
+ * A mutable byte buffer. A view has no data of its own,
+ * but refers to len bytes at offset in its base buffer.
+ * The base may grow or shrink, so always get the data
+ * through lem_buffer_data().
+ */
+struct lem_buffer {
+	char *data;
+	size_t len;
+	size_t size;
+	struct lem_buffer *base;
+	size_t offset;
+};
+
+static inline struct lem_buffer *
+lem_buffer_test(lua_State *T, int idx)
+{
+	if (lua_type(T, idx) != LUA_TUSERDATA)
+		return NULL;
+	return luaL_testudata(T, idx, LEM_BUFFER_MT);
+}
+
+static inline char *
+lem_buffer_data(struct lem_buffer *b, size_t *len)
+{
+	struct lem_buffer *base = b->base;
+
+	if (base == NULL) {
+		*len = b->len;
+		return b->data;
+	}
+
+	if (b->offset >= base->len)
+		*len = 0;
+	else if (b->len > base->len - b->offset)
+		*len = base->len - b->offset;
+	else
+		*len = b->len;
+	return base->data + b->offset;
+}
+
+/* make room for n more bytes and return a pointer to them */
+static inline char *
+lem_buffer_reserve(struct lem_buffer *b, size_t n)
+{
+	if (b->len + n > b->size) {
+		size_t size = b->size ? 2*b->size : 64;
+
+		while (b->len + n > size)
+			size *= 2;
+
+		b->data = lem_xrealloc(b->data, size);
+		b->size = size;
+	}
+
+	return b->data + b->len;
+}
+
+static inline void
+lem_buffer_append(struct lem_buffer *b, const char *p, size_t n)
+{
+	memcpy(lem_buffer_reserve(b, n), p, n);
+	b->len += n;
+}
+
+/* like lua_tolstring(), but also accepts buffers */
+static inline const char *
+lem_tolbuffer(lua_State *T, int idx, size_t *len)
+{
+	struct lem_buffer *b;
+
+	if (lua_type(T, idx) == LUA_TSTRING)
+		return lua_tolstring(T, idx, len);
+
+	b = lem_buffer_test(T, idx);
+	if (b != NULL)
+		return lem_buffer_data(b, len);
+
+	return lua_tolstring(T, idx, len);
+}
+
+#endif
@@ -20,6 +20,7 @@
 #define _LEM_PARSERS_H
 
 #include <lem.h>
+#include <lem-buffer.h>
 
 #define LEM_INPUTBUF_PSIZE (4*sizeof(size_t))
 #define LEM_INPUTBUF_SIZE 4096
@@ -27,6 +28,7 @@
 struct lem_inputbuf {
 	unsigned int start;
 	unsigned int end;
+	struct lem_buffer *dst;
 	char pstate[LEM_INPUTBUF_PSIZE];
 	char buf[LEM_INPUTBUF_SIZE];
 };
@@ -36,16 +38,85 @@ enum lem_preason {
 	LEM_PERROR,
 };
 
+/* The parser can be run again for the next result by restoring
+ * the parser state left by init. Unless the buffer is full, process
+ * must only change the state and the start and end offsets and push
+ * its return values or partial results, so a call which doesn't
+ * return a result can be undone. */
+#define LEM_PARSER_REPEAT 1
+
 struct lem_parser {
 	void (*init)(lua_State *T, struct lem_inputbuf *b);
 	int (*process)(lua_State *T, struct lem_inputbuf *b);
 	int (*destroy)(lua_State *T, struct lem_inputbuf *b, enum lem_preason reason);
+	unsigned int flags;
 };
 
 static inline void
 lem_inputbuf_init(struct lem_inputbuf *buf)
 {
 	buf->start = buf->end = 0;
+	buf->dst = NULL;
+}
+
+/*
+ * If the value at index 2 is a buffer, the parsers which support it
+ * append the data read to the buffer and return true instead of
+ * pushing strings. The buffer is removed from the stack and kept as
+ * the uservalue of the reader at index 1 until its next read, as
+ * the parsers may leave nothing on the stack referring to it.
+ */
+static inline void
+lem_inputbuf_setdst(lua_State *T, struct lem_inputbuf *buf)
+{
+	struct lem_buffer *dst = lem_buffer_test(T, 2);
+
+	buf->dst = NULL;
+	if (dst == NULL) {
+		lua_pushnil(T);
+		lua_setuservalue(T, 1);
+		return;
+	}
+
+	luaL_argcheck(T, dst->base == NULL, 2, "cannot read into a view");
+	lua_pushvalue(T, 2);
+	lua_setuservalue(T, 1);
+	lua_remove(T, 2);
+	buf->dst = dst;
+}
+
+/* add a part of the result, parts counts the strings pushed so far */
+static inline void
+lem_parser_addpart(lua_State *T, struct lem_inputbuf *buf, int *parts,
+		const char *data, size_t len)
+{
+	if (buf->dst) {
+		lem_buffer_append(buf->dst, data, len);
+		return;
+	}
+
+	lua_pushlstring(T, data, len);
+	(*parts)++;
+	if (*parts == LUA_MINSTACK-2) {
+		lua_concat(T, LUA_MINSTACK-2);
+		*parts = 1;
+	}
+}
+
+/* add the last part and push the result */
+static inline int
+lem_parser_finish(lua_State *T, struct lem_inputbuf *buf, int parts,
+		const char *data, size_t len)
+{
+	if (buf->dst) {
+		lem_buffer_append(buf->dst, data, len);
+		lua_pushboolean(T, 1);
+		return 1;
+	}
+
+	lua_pushlstring(T, data, len);
+	lua_concat(T, parts + 1);
+	return 1;
 }
 
 #endif
@@ -19,6 +19,8 @@
 #ifndef _LEM_H
 #define _LEM_H
 
+#include <sys/types.h>
+#include <stdint.h>
 #include <ev.h>
 #include <lua.h>
 #include <lauxlib.h>
@@ -51,7 +53,7 @@
 #endif
 
 #if EV_MULTIPLICITY
-extern struct ev_loop *lem_loop;
+extern __thread struct ev_loop *lem_loop;
 # define LEM lem_loop
 # define LEM_ LEM,
 #else
@@ -59,19 +61,137 @@ extern struct ev_loop *lem_loop;
 # define LEM_
 #endif
 
+struct lem_reaper;
+
 struct lem_async {
 	void (*work)(struct lem_async *a);
 	void (*reap)(struct lem_async *a);
 	struct lem_async *next;
+	struct lem_reaper *reaper;
+	uint64_t queued;   /* set by the pool, for lem.stats */
+	unsigned int wait;
+	unsigned int run;
+};
+
+/* Bucket i counts times of less than 2^i microseconds,
+ * the last bucket counts all longer times too. */
+#define LEM_HISTOGRAM_BUCKETS 24
+struct lem_histogram {
+	unsigned long count[LEM_HISTOGRAM_BUCKETS];
+	unsigned long sum; /* microseconds */
 };
 
 void *lem_xmalloc(size_t size);
+void *lem_xrealloc(void *p, size_t size);
 lua_State *lem_newthread(void);
 void lem_forgetthread(lua_State *T);
 void lem_queue(lua_State *T, int nargs);
+
+/* Threads are run by priority, higher first. A thread runs at its
+ * own priority, inherited from the thread creating it. lem_queueat()
+ * queues it at prio instead when that is lower, eg. for new
+ * connections and timers, so in-flight work goes first. */
+#define LEM_PRIO_HIGH   0
+#define LEM_PRIO_NORMAL 1
+#define LEM_PRIO_LOW    2
+#define LEM_PRIORITIES  3
+void lem_queueat(lua_State *T, int nargs, int prio);
+int lem_priority(lua_State *T);
+void lem_setpriority(lua_State *T, int prio);
 void lem_exit(int status);
+pid_t lem_fork(void);
 void lem_async_run(struct lem_async *a);
 void lem_async_config(int delay, int min, int max);
+char *lem_marshal(lua_State *T, int idx, int n, size_t *len);
+int lem_unmarshal(lua_State *T, const char *buf, size_t len);
+
+/* What the loop is doing when no Lua thread is running. Profiler
+ * ticks are counted against this, so modules doing work of their
+ * own outside Lua threads may set it and restore LEM_PROFILE_LOOP. */
+#define LEM_PROFILE_LOOP 0
+#define LEM_PROFILE_GC   1
+#define LEM_PROFILE_REAP 2
+#define LEM_PROFILE_READ 3
+#define LEM_PROFILE_MAX  4
+extern __thread int lem_profile_where;
+int lem_profile_start(lua_Hook hook, int hz);
+void lem_profile_stop(unsigned long ticks[LEM_PROFILE_MAX]);
+int lem_profile_sampled(lua_State *T);
+
+/* The watchdog reports the loop stalling for more than a threshold
+ * of milliseconds. While it runs resumes are timed into runs. */
+struct lem_watchdog_stats {
+	unsigned int threshold;
+	unsigned long stalls;
+	struct lem_histogram runs;
+	const char *last; /* traceback of the last stall in Lua */
+};
+int lem_watchdog_start(unsigned int ms);
+void lem_watchdog_stop(void);
+void lem_watchdog_stats(struct lem_watchdog_stats *st);
+
+/* Counters of the current loop, see lem.stats */
+struct lem_stats {
+	unsigned long resumes;
+	unsigned long preempted;
+	unsigned int threads;
+	unsigned int runqueue;
+	unsigned int runqueue_max;
+	unsigned int pool_jobs;    /* jobs started by this loop not reaped yet */
+	unsigned int pool_threads; /* shared by all loops */
+	unsigned long pool_done;
+	struct lem_histogram pool_wait;
+	struct lem_histogram pool_run;
+	struct lem_histogram gc_pause; /* collections when the loop is idle */
+};
+void lem_stats(struct lem_stats *st);
+
+/* Preempt threads running longer than a slice of microseconds
+ * without yielding, 0 turns it off. Returns the old slice.
+ * lem_setslice() sets the slice of one thread, 0 to never
+ * preempt it, or -1 to use the default again. */
+unsigned long lem_preempt(unsigned long us);
+int lem_setslice(lua_State *T, long us);
+/* A preempted thread waits in the runqueue to continue where it
+ * was, maybe between making itself known to others and suspending.
+ * It must not be queued again until it has run, so lem_preempted()
+ * tells if a resume from Lua has to be held back. */
+int lem_preempted(lua_State *T);
+
+/* Per thread and per tag usage when the loop was started with
+ * LEM_ACCOUNTING set in the environment. Threads inherit the tag
+ * of the thread spawning them. live is only counted for tags. */
+struct lem_usage {
+	uint64_t cpu;       /* nanoseconds of CPU time */
+	uint64_t allocated; /* bytes allocated in total */
+	uint64_t live;      /* bytes still allocated */
+	unsigned long resumes;
+};
+int lem_accounting(void);
+int lem_settag(lua_State *T, const char *name);
+const char *lem_gettag(lua_State *T, struct lem_usage *u);
+const char *lem_tagusage(unsigned int i, struct lem_usage *u);
+
+/* Run filename on a new event loop in a new OS thread.
+ * init is called from the new thread to push arguments for the
+ * script and returns how many. Once lem_spawnloop() has returned 0
+ * init is always called, with T == NULL if the script couldn't be
+ * started, so arg can be cleaned up. */
+int lem_spawnloop(const char *filename,
+		int (*init)(lua_State *T, void *arg), void *arg);
+
+static inline void
+lem_histogram_add(struct lem_histogram *h, unsigned long us)
+{
+	unsigned int i = 0;
+
+	h->sum += us;
+	while (us > 0 && i < LEM_HISTOGRAM_BUCKETS - 1) {
+		us >>= 1;
+		i++;
+	}
+	h->count[i]++;
+}
 
 static inline void
 lem_async_do(struct lem_async *a,
@@ -0,0 +1,511 @@
+/*
+ * This file is part of LEM, a Lua Event Machine.
+ * Copyright 2026 agent
+ *
+ * LEM is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * LEM is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <lem-buffer.h>
+
+static struct lem_buffer *
+buffer_check(lua_State *T, int idx)
+{
+	return luaL_checkudata(T, idx, LEM_BUFFER_MT);
+}
+
+static struct lem_buffer *
+buffer_checkbase(lua_State *T, int idx)
+{
+	struct lem_buffer *b = buffer_check(T, idx);
+
+	if (b->base != NULL)
+		luaL_argerror(T, idx, "cannot resize a view");
+	return b;
+}
+
+static struct lem_buffer *
+buffer_push(lua_State *T)
+{
+	/* create userdata and set the metatable */
+	struct lem_buffer *b = lua_newuserdata(T, sizeof(struct lem_buffer));
+	luaL_setmetatable(T, LEM_BUFFER_MT);
+
+	/* initialize userdata */
+	b->data = NULL;
+	b->len = 0;
+	b->size = 0;
+	b->base = NULL;
+	b->offset = 0;
+
+	return b;
+}
+
+/* translate Lua style string positions i and j into
+ * an offset and length, clamped to the buffer like string.sub() */
+static size_t
+buffer_range(lua_State *T, int idx, size_t len, size_t *offset)
+{
+	lua_Integer i = luaL_optinteger(T, idx, 1);
+	lua_Integer j = luaL_optinteger(T, idx + 1, -1);
+
+	if (i < 0)
+		i = (lua_Integer)len + i + 1;
+	if (i < 1)
+		i = 1;
+	if (j < 0)
+		j = (lua_Integer)len + j + 1;
+	if (j > (lua_Integer)len)
+		j = len;
+
+	*offset = i - 1;
+	if (i > j)
+		return 0;
+	return j - i + 1;
+}
+
+/* check that size bytes at position idx are inside the buffer */
+static char *
+buffer_checkpos(lua_State *T, struct lem_buffer *b, int idx, size_t size)
+{
+	lua_Integer pos = luaL_checkinteger(T, idx);
+	size_t len;
+	char *data = lem_buffer_data(b, &len);
+
+	if (pos < 1 || size > len || (size_t)pos - 1 > len - size)
+		luaL_argerror(T, idx, "out of range");
+	return data + pos - 1;
+}
+
+static int
+buffer_checksize(lua_State *T, int idx)
+{
+	lua_Integer size = luaL_checkinteger(T, idx);
+
+	luaL_argcheck(T, size >= 1 && size <= 8, idx, "size must be 1 to 8");
+	return size;
+}
+
+static int
+buffer_gc(lua_State *T)
+{
+	struct lem_buffer *b = lua_touserdata(T, 1);
+
+	if (b->base == NULL)
+		free(b->data);
+	b->data = NULL;
+	return 0;
+}
+
+static int
+buffer_len(lua_State *T)
+{
+	size_t len;
+
+	(void)lem_buffer_data(buffer_check(T, 1), &len);
+	lua_pushinteger(T, len);
+	return 1;
+}
+
+/*
+ * buffer:tostring([i [, j]]) method
+ */
+static int
+buffer_tostring(lua_State *T)
+{
+	struct lem_buffer *b = buffer_check(T, 1);
+	size_t len;
+	const char *data = lem_buffer_data(b, &len);
+	size_t offset;
+
+	len = buffer_range(T, 2, len, &offset);
+	lua_pushlstring(T, data + offset, len);
+	return 1;
+}
+
+/*
+ * buffer:view([i [, j]]) method
+ *
+ * The view shares memory with the buffer, so changes
+ * through one of them are seen by the other.
+ */
+static int
+buffer_view(lua_State *T)
+{
+	struct lem_buffer *b = buffer_check(T, 1);
+	struct lem_buffer *v;
+	size_t len;
+	size_t offset;
+
+	(void)lem_buffer_data(b, &len);
+	len = buffer_range(T, 2, len, &offset);
+
+	v = buffer_push(T);
+	v->len = len;
+	if (b->base == NULL) {
+		v->base = b;
+		v->offset = offset;
+		lua_pushvalue(T, 1);
+	} else {
+		v->base = b->base;
+		v->offset = b->offset + offset;
+		lua_getuservalue(T, 1);
+	}
+	/* keep the base alive as long as the view */
+	lua_setuservalue(T, -2);
+	return 1;
+}
+
+/*
+ * buffer:append(...) method
+ */
+static int
+buffer_append(lua_State *T)
+{
+	struct lem_buffer *b = buffer_checkbase(T, 1);
+	int top = lua_gettop(T);
+	int i;
+
+	for (i = 2; i <= top; i++) {
+		size_t len;
+		const char *str = lem_tolbuffer(T, i, &len);
+
+		if (str == NULL)
+			return luaL_argerror(T, i, "expected string or buffer");
+		if (len == 0)
+			continue;
+
+		/* appending a buffer to itself or one of its views
+		 * must not read from the old data after growing it */
+		if (str >= b->data && str < b->data + b->size) {
+			size_t offset = str - b->data;
+
+			(void)lem_buffer_reserve(b, len);
+			str = b->data + offset;
+		}
+		lem_buffer_append(b, str, len);
+	}
+
+	lua_settop(T, 1);
+	return 1;
+}
+
+/*
+ * buffer:set(pos, str) method
+ */
+static int
+buffer_set(lua_State *T)
+{
+	struct lem_buffer *b = buffer_check(T, 1);
+	size_t len;
+	const char *str = lem_tolbuffer(T, 3, &len);
+	char *p;
+
+	if (str == NULL)
+		return luaL_argerror(T, 3, "expected string or buffer");
+
+	p = buffer_checkpos(T, b, 2, len);
+	memmove(p, str, len);
+	lua_settop(T, 1);
+	return 1;
+}
+
+/*
+ * buffer:find(str [, init]) method
+ *
+ * Plain search like string.find(s, str, init, true).
+ */
+static int
+buffer_find(lua_State *T)
+{
+	struct lem_buffer *b = buffer_check(T, 1);
+	size_t nlen;
+	const char *needle = lem_tolbuffer(T, 2, &nlen);
+	lua_Integer init = luaL_optinteger(T, 3, 1);
+	size_t len;
+	const char *data = lem_buffer_data(b, &len);
+	const char *p;
+
+	if (needle == NULL)
+		return luaL_argerror(T, 2, "expected string or buffer");
+
+	if (init < 0)
+		init = (lua_Integer)len + init + 1;
+	if (init < 1)
+		init = 1;
+	if ((size_t)init - 1 > len || nlen > len - (init - 1)) {
+		lua_pushnil(T);
+		return 1;
+	}
+
+	if (nlen == 0) {
+		lua_pushinteger(T, init);
+		lua_pushinteger(T, init - 1);
+		return 2;
+	}
+
+	p = memmem(data + init - 1, len - (init - 1), needle, nlen);
+	if (p == NULL) {
+		lua_pushnil(T);
+		return 1;
+	}
+
+	lua_pushinteger(T, p - data + 1);
+	lua_pushinteger(T, p - data + nlen);
+	return 2;
+}
+
+/*
+ * buffer:consume(n) method
+ *
+ * Remove the first n bytes of the buffer.
+ */
+static int
+buffer_consume(lua_State *T)
+{
+	struct lem_buffer *b = buffer_checkbase(T, 1);
+	lua_Integer n = luaL_checkinteger(T, 2);
+
+	luaL_argcheck(T, n >= 0, 2, "out of range");
+	if ((size_t)n >= b->len)
+		b->len = 0;
+	else {
+		memmove(b->data, b->data + n, b->len - n);
+		b->len -= n;
+	}
+
+	lua_settop(T, 1);
+	return 1;
+}
+
+static int
+buffer_clear(lua_State *T)
+{
+	struct lem_buffer *b = buffer_checkbase(T, 1);
+
+	b->len = 0;
+	lua_settop(T, 1);
+	return 1;
+}
+
+/*
+ * integer encoding and decoding
+ */
+static lua_Unsigned
+buffer_decode(const unsigned char *p, int size, int little)
+{
+	lua_Unsigned r = 0;
+	int i;
+
+	if (little) {
+		for (i = size - 1; i >= 0; i--)
+			r = (r << 8) | p[i];
+	} else {
+		for (i = 0; i < size; i++)
+			r = (r << 8) | p[i];
+	}
+	return r;
+}
+
+static void
+buffer_encode(unsigned char *p, int size, lua_Unsigned v, int little)
+{
+	int i;
+
+	if (little) {
+		for (i = 0; i < size; i++, v >>= 8)
+			p[i] = v & 0xFF;
+	} else {
+		for (i = size - 1; i >= 0; i--, v >>= 8)
+			p[i] = v & 0xFF;
+	}
+}
+
+/*
+ * buffer:getu(pos, size [, little]) method
+ */
+static int
+buffer_getu(lua_State *T)
+{
+	struct lem_buffer *b = buffer_check(T, 1);
+	int size = buffer_checksize(T, 3);
+	const char *p = buffer_checkpos(T, b, 2, size);
+
+	lua_pushinteger(T, buffer_decode((const unsigned char *)p,
+				size, lua_toboolean(T, 4)));
+	return 1;
+}
+
+/*
+ * buffer:geti(pos, size [, little]) method
+ */
+static int
+buffer_geti(lua_State *T)
+{
+	struct lem_buffer *b = buffer_check(T, 1);
+	int size = buffer_checksize(T, 3);
+	const char *p = buffer_checkpos(T, b, 2, size);
+	lua_Unsigned v = buffer_decode((const unsigned char *)p,
+			size, lua_toboolean(T, 4));
+
+	/* sign extend */
+	if (size < 8) {
+		lua_Unsigned sign = (lua_Unsigned)1 << (8*size - 1);
+
+		v = (v ^ sign) - sign;
+	}
+	lua_pushinteger(T, (lua_Integer)v);
+	return 1;
+}
+
+/*
+ * buffer:setint(pos, size, value [, little]) method
+ */
+static int
+buffer_setint(lua_State *T)
+{
+	struct lem_buffer *b = buffer_check(T, 1);
+	int size = buffer_checksize(T, 3);
+	lua_Integer v = luaL_checkinteger(T, 4);
+	char *p = buffer_checkpos(T, b, 2, size);
+
+	buffer_encode((unsigned char *)p, size, v, lua_toboolean(T, 5));
+	lua_settop(T, 1);
+	return 1;
+}
+
+/*
+ * buffer:putint(size, value [, little]) method
+ *
+ * Append an integer.
+ */
+static int
+buffer_putint(lua_State *T)
+{
+	struct lem_buffer *b = buffer_checkbase(T, 1);
+	int size = buffer_checksize(T, 2);
+	lua_Integer v = luaL_checkinteger(T, 3);
+
+	buffer_encode((unsigned char *)lem_buffer_reserve(b, size),
+			size, v, lua_toboolean(T, 4));
+	b->len += size;
+	lua_settop(T, 1);
+	return 1;
+}
+
+/*
+ * buffer.new([size | str])
+ */
+static int
+buffer_new(lua_State *T)
+{
+	struct lem_buffer *b;
+
+	switch (lua_type(T, 1)) {
+	case LUA_TNONE:
+	case LUA_TNIL:
+		buffer_push(T);
+		break;
+
+	case LUA_TNUMBER: {
+			lua_Integer size = luaL_checkinteger(T, 1);
+
+			luaL_argcheck(T, size >= 0, 1, "out of range");
+			b = buffer_push(T);
+			if (size > 0) {
+				b->data = lem_xmalloc(size);
+				b->size = size;
+			}
+		}
+		break;
+
+	default: {
+			size_t len;
+			const char *str = lem_tolbuffer(T, 1, &len);
+
+			if (str == NULL)
+				return luaL_argerror(T, 1, "expected size, string or buffer");
+			b = buffer_push(T);
+			if (len > 0)
+				lem_buffer_append(b, str, len);
+		}
+	}
+
+	return 1;
+}
+
+int
+luaopen_lem_buffer(lua_State *L)
+{
+	/* create module table */
+	lua_newtable(L);
+
+	/* create Buffer metatable */
+	luaL_newmetatable(L, LEM_BUFFER_MT);
+	/* mt.__index = mt */
+	lua_pushvalue(L, -1);
+	lua_setfield(L, -2, "__index");
+	/* mt.__gc = <buffer_gc> */
+	lua_pushcfunction(L, buffer_gc);
+	lua_setfield(L, -2, "__gc");
+	/* mt.__len = <buffer_len> */
+	lua_pushcfunction(L, buffer_len);
+	lua_setfield(L, -2, "__len");
+	/* mt.__tostring = <buffer_tostring> */
+	lua_pushcfunction(L, buffer_tostring);
+	lua_setfield(L, -2, "__tostring");
+	/* mt.tostring = <buffer_tostring> */
+	lua_pushcfunction(L, buffer_tostring);
+	lua_setfield(L, -2, "tostring");
+	/* mt.view = <buffer_view> */
+	lua_pushcfunction(L, buffer_view);
+	lua_setfield(L, -2, "view");
+	/* mt.append = <buffer_append> */
+	lua_pushcfunction(L, buffer_append);
+	lua_setfield(L, -2, "append");
+	/* mt.set = <buffer_set> */
+	lua_pushcfunction(L, buffer_set);
+	lua_setfield(L, -2, "set");
+	/* mt.find = <buffer_find> */
+	lua_pushcfunction(L, buffer_find);
+	lua_setfield(L, -2, "find");
+	/* mt.consume = <buffer_consume> */
+	lua_pushcfunction(L, buffer_consume);
+	lua_setfield(L, -2, "consume");
+	/* mt.clear = <buffer_clear> */
+	lua_pushcfunction(L, buffer_clear);
+	lua_setfield(L, -2, "clear");
+	/* mt.getu = <buffer_getu> */
+	lua_pushcfunction(L, buffer_getu);
+	lua_setfield(L, -2, "getu");
+	/* mt.geti = <buffer_geti> */
+	lua_pushcfunction(L, buffer_geti);
+	lua_setfield(L, -2, "geti");
+	/* mt.setint = <buffer_setint> */
+	lua_pushcfunction(L, buffer_setint);
+	lua_setfield(L, -2, "setint");
+	/* mt.putint = <buffer_putint> */
+	lua_pushcfunction(L, buffer_putint);
+	lua_setfield(L, -2, "putint");
+	/* insert table */
+	lua_setfield(L, -2, "Buffer");
+
+	/* set new function */
+	lua_pushcfunction(L, buffer_new);
+	lua_setfield(L, -2, "new");
+
+	return 1;
+}
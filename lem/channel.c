@@ -0,0 +1,533 @@
+/*
+ * This file is part of LEM, a Lua Event Machine.
+ * Copyright 2026 agent
+ *
+ * LEM is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * LEM is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <lem.h>
+
+/*
+ * The values of a channel, and the coroutines waiting to get
+ * or put values, are kept in rings stored in three tables
+ * in the uservalue of the channel.
+ */
+#define CHANNEL_VALUES  1
+#define CHANNEL_GETTERS 2
+#define CHANNEL_PUTTERS 3
+
+#define RING_INITIAL_SIZE 8
+
+struct ring {
+	unsigned int first;
+	unsigned int count;
+	unsigned int size;
+};
+
+struct channel {
+	struct ring v;
+	struct ring g;
+	struct ring p;
+	unsigned int cap;
+	int closed;
+};
+
+/*
+ * A waiter is a userdata recording a waiting coroutine.
+ * A putter keeps the value to be put as its uservalue.
+ * A coroutine selecting on several channels has the same waiter
+ * in all of them and it is marked done when the first one wakes it,
+ * so it will be skipped by the others.
+ */
+struct waiter {
+	lua_State *T;
+	int select;
+	int done;
+};
+
+static void
+ring_init(struct ring *r, unsigned int size)
+{
+	r->first = 0;
+	r->count = 0;
+	r->size = size;
+}
+
+/* pop the value on top of the stack and add it to the end of the ring */
+static void
+ring_push(lua_State *T, struct ring *r, int t)
+{
+	if (r->count == r->size) {
+		unsigned int i;
+
+		/* move the part which wrapped around past the old end */
+		for (i = 0; i < r->first; i++) {
+			lua_rawgeti(T, t, i + 1);
+			lua_rawseti(T, t, r->size + i + 1);
+			lua_pushnil(T);
+			lua_rawseti(T, t, i + 1);
+		}
+		r->size *= 2;
+	}
+
+	lua_rawseti(T, t, (r->first + r->count) % r->size + 1);
+	r->count++;
+}
+
+/* remove the first value of the ring and push it onto the stack */
+static void
+ring_shift(lua_State *T, struct ring *r, int t)
+{
+	lua_rawgeti(T, t, r->first + 1);
+	lua_pushnil(T);
+	lua_rawseti(T, t, r->first + 1);
+	r->first = (r->first + 1) % r->size;
+	r->count--;
+}
+
+/*
+ * Find the first waiter which isn't done, remove it from the ring
+ * and leave it on the stack. Returns NULL if there are none.
+ */
+static struct waiter *
+waiter_shift(lua_State *T, struct ring *r, int t)
+{
+	while (r->count > 0) {
+		struct waiter *w;
+
+		ring_shift(T, r, t);
+		w = lua_touserdata(T, -1);
+		if (!w->done) {
+			w->done = 1;
+			return w;
+		}
+		lua_pop(T, 1);
+	}
+	return NULL;
+}
+
+static struct waiter *
+waiter_new(lua_State *T, int select)
+{
+	struct waiter *w = lua_newuserdata(T, sizeof(struct waiter));
+
+	w->T = T;
+	w->select = select;
+	w->done = 0;
+	return w;
+}
+
+/* push the uservalue of the channel at index 1 and its rings */
+static int
+channel_rings(lua_State *T)
+{
+	int top = lua_gettop(T);
+
+	lua_getuservalue(T, 1);
+	lua_rawgeti(T, top + 1, CHANNEL_VALUES);
+	lua_rawgeti(T, top + 1, CHANNEL_GETTERS);
+	lua_rawgeti(T, top + 1, CHANNEL_PUTTERS);
+	return top + 2;
+}
+
+/*
+ * Wake a getter with the value on top of the stack.
+ * The channel is at index ch and the value is popped.
+ */
+static void
+channel_deliver(lua_State *T, struct waiter *w, int ch)
+{
+	lua_State *S = w->T;
+
+	if (w->select) {
+		lua_pushvalue(T, ch);
+		lua_xmove(T, S, 1);
+		lua_xmove(T, S, 1);
+		lem_queue(S, 2);
+	} else {
+		lua_xmove(T, S, 1);
+		lem_queue(S, 1);
+	}
+}
+
+static void
+channel_wakeclosed(lua_State *T, struct waiter *w, int ch)
+{
+	lua_State *S = w->T;
+	int n = 2;
+
+	if (w->select) {
+		lua_pushvalue(T, ch);
+		lua_xmove(T, S, 1);
+		n++;
+	}
+	lua_pushnil(S);
+	lua_pushliteral(S, "closed");
+	lem_queue(S, n);
+}
+
+static int
+channel_closederr(lua_State *T)
+{
+	lua_pushnil(T);
+	lua_pushliteral(T, "closed");
+	return 2;
+}
+
+/*
+ * Move the first value of the channel onto the stack, and let
+ * the first waiting putter, if any, fill up its place.
+ * The rings start at index v.
+ */
+static void
+channel__get(lua_State *T, struct channel *c, int v)
+{
+	struct waiter *w;
+
+	ring_shift(T, &c->v, v);
+
+	w = waiter_shift(T, &c->p, v + 2);
+	if (w == NULL)
+		return;
+
+	lua_getuservalue(T, -1);
+	ring_push(T, &c->v, v);
+	lua_pop(T, 1);
+
+	lua_pushboolean(w->T, 1);
+	lem_queue(w->T, 1);
+}
+
+/*
+ * channel:put() and channel:tryput() methods
+ */
+static int
+channel__put(lua_State *T, int block)
+{
+	struct channel *c;
+	struct waiter *w;
+	int v;
+
+	luaL_checktype(T, 1, LUA_TUSERDATA);
+	luaL_checkany(T, 2);
+	c = lua_touserdata(T, 1);
+	if (c->closed)
+		return channel_closederr(T);
+
+	lua_settop(T, 2);
+	v = channel_rings(T);
+
+	/* hand the value directly to a waiting getter */
+	w = waiter_shift(T, &c->g, v + 1);
+	if (w != NULL) {
+		lua_pushvalue(T, 2);
+		channel_deliver(T, w, 1);
+		lua_pushboolean(T, 1);
+		return 1;
+	}
+
+	if (c->cap == 0 || c->v.count < c->cap) {
+		lua_pushvalue(T, 2);
+		ring_push(T, &c->v, v);
+		lua_pushboolean(T, 1);
+		return 1;
+	}
+
+	if (!block) {
+		lua_pushnil(T);
+		lua_pushliteral(T, "full");
+		return 2;
+	}
+
+	waiter_new(T, 0);
+	lua_pushvalue(T, 2);
+	lua_setuservalue(T, -2);
+	ring_push(T, &c->p, v + 2);
+
+	lua_settop(T, 1);
+	return lua_yield(T, 1);
+}
+
+static int
+channel_put(lua_State *T)
+{
+	return channel__put(T, 1);
+}
+
+static int
+channel_tryput(lua_State *T)
+{
+	return channel__put(T, 0);
+}
+
+/*
+ * channel:get() and channel:tryget() methods
+ */
+static int
+channel__get_method(lua_State *T, int block)
+{
+	struct channel *c;
+	int v;
+
+	luaL_checktype(T, 1, LUA_TUSERDATA);
+	c = lua_touserdata(T, 1);
+
+	lua_settop(T, 1);
+	v = channel_rings(T);
+
+	if (c->v.count > 0) {
+		channel__get(T, c, v);
+		return 1;
+	}
+
+	if (c->closed)
+		return channel_closederr(T);
+
+	if (!block) {
+		lua_pushnil(T);
+		lua_pushliteral(T, "empty");
+		return 2;
+	}
+
+	waiter_new(T, 0);
+	ring_push(T, &c->g, v + 1);
+
+	lua_settop(T, 1);
+	return lua_yield(T, 1);
+}
+
+static int
+channel_get(lua_State *T)
+{
+	return channel__get_method(T, 1);
+}
+
+static int
+channel_tryget(lua_State *T)
+{
+	return channel__get_method(T, 0);
+}
+
+/*
+ * channel:close() method
+ *
+ * Values already in the channel can still be read,
+ * but everybody waiting is woken with nil, 'closed'.
+ */
+static int
+channel_close(lua_State *T)
+{
+	struct channel *c;
+	struct waiter *w;
+	int v;
+
+	luaL_checktype(T, 1, LUA_TUSERDATA);
+	c = lua_touserdata(T, 1);
+	if (c->closed) {
+		lua_pushnil(T);
+		lua_pushliteral(T, "already closed");
+		return 2;
+	}
+	c->closed = 1;
+
+	lua_settop(T, 1);
+	v = channel_rings(T);
+
+	while ((w = waiter_shift(T, &c->g, v + 1)) != NULL) {
+		channel_wakeclosed(T, w, 1);
+		lua_pop(T, 1);
+	}
+	while ((w = waiter_shift(T, &c->p, v + 2)) != NULL) {
+		channel_wakeclosed(T, w, 1);
+		lua_pop(T, 1);
+	}
+
+	lua_pushboolean(T, 1);
+	return 1;
+}
+
+static int
+channel_closed(lua_State *T)
+{
+	struct channel *c;
+
+	luaL_checktype(T, 1, LUA_TUSERDATA);
+	c = lua_touserdata(T, 1);
+	lua_pushboolean(T, c->closed);
+	return 1;
+}
+
+static int
+channel_count(lua_State *T)
+{
+	struct channel *c;
+
+	luaL_checktype(T, 1, LUA_TUSERDATA);
+	c = lua_touserdata(T, 1);
+	lua_pushinteger(T, c->v.count);
+	return 1;
+}
+
+/*
+ * channel.select(ch1, ch2, ...)
+ *
+ * Wait for the first of the channels to have a value
+ * and return that channel and the value.
+ */
+static int
+channel_select(lua_State *T)
+{
+	int n = lua_gettop(T);
+	int i;
+
+	luaL_argcheck(T, n > 0, 1, "expected at least one channel");
+	for (i = 1; i <= n; i++)
+		luaL_checktype(T, i, LUA_TUSERDATA);
+
+	for (i = 1; i <= n; i++) {
+		struct channel *c = lua_touserdata(T, i);
+
+		if (c->v.count > 0) {
+			lua_pushvalue(T, i);
+			lua_replace(T, 1);
+			lua_settop(T, 1);
+			lua_getuservalue(T, 1);
+			lua_rawgeti(T, 2, CHANNEL_VALUES);
+			lua_rawgeti(T, 2, CHANNEL_GETTERS);
+			lua_rawgeti(T, 2, CHANNEL_PUTTERS);
+			channel__get(T, c, 3);
+			lua_replace(T, 2);
+			lua_settop(T, 2);
+			return 2;
+		}
+		if (c->closed) {
+			lua_pushvalue(T, i);
+			lua_pushnil(T);
+			lua_pushliteral(T, "closed");
+			return 3;
+		}
+	}
+
+	waiter_new(T, 1);
+	for (i = 1; i <= n; i++) {
+		struct channel *c = lua_touserdata(T, i);
+
+		lua_getuservalue(T, i);
+		lua_rawgeti(T, -1, CHANNEL_GETTERS);
+
+		/* forget waiters which were woken by another channel */
+		while (c->g.count > 0) {
+			struct waiter *o;
+
+			lua_rawgeti(T, -1, c->g.first + 1);
+			o = lua_touserdata(T, -1);
+			lua_pop(T, 1);
+			if (!o->done)
+				break;
+			ring_shift(T, &c->g, lua_gettop(T));
+			lua_pop(T, 1);
+		}
+
+		lua_pushvalue(T, n + 1);
+		ring_push(T, &c->g, lua_gettop(T) - 1);
+		lua_pop(T, 2);
+	}
+
+	lua_settop(T, n);
+	return lua_yield(T, n);
+}
+
+/*
+ * channel.new([capacity])
+ */
+static int
+channel_new(lua_State *T)
+{
+	lua_Integer cap = luaL_optinteger(T, 1, 0);
+	struct channel *c;
+
+	luaL_argcheck(T, cap >= 0, 1, "negative capacity");
+
+	/* create userdata and set the metatable */
+	c = lua_newuserdata(T, sizeof(struct channel));
+	lua_pushvalue(T, lua_upvalueindex(1));
+	lua_setmetatable(T, -2);
+
+	/* initialize userdata */
+	ring_init(&c->v, cap > 0 && cap < 1024 ? cap : RING_INITIAL_SIZE);
+	ring_init(&c->g, RING_INITIAL_SIZE);
+	ring_init(&c->p, RING_INITIAL_SIZE);
+	c->cap = cap;
+	c->closed = 0;
+
+	/* create tables for the rings */
+	lua_createtable(T, 3, 0);
+	lua_createtable(T, c->v.size, 0);
+	lua_rawseti(T, -2, CHANNEL_VALUES);
+	lua_newtable(T);
+	lua_rawseti(T, -2, CHANNEL_GETTERS);
+	lua_newtable(T);
+	lua_rawseti(T, -2, CHANNEL_PUTTERS);
+	lua_setuservalue(T, -2);
+
+	return 1;
+}
+
+int
+luaopen_lem_channel(lua_State *L)
+{
+	/* create module table */
+	lua_newtable(L);
+
+	/* create Channel metatable */
+	lua_newtable(L);
+	/* mt.__index = mt */
+	lua_pushvalue(L, -1);
+	lua_setfield(L, -2, "__index");
+	/* mt.put = <channel_put> */
+	lua_pushcfunction(L, channel_put);
+	lua_setfield(L, -2, "put");
+	/* mt.tryput = <channel_tryput> */
+	lua_pushcfunction(L, channel_tryput);
+	lua_setfield(L, -2, "tryput");
+	/* mt.get = <channel_get> */
+	lua_pushcfunction(L, channel_get);
+	lua_setfield(L, -2, "get");
+	/* mt.tryget = <channel_tryget> */
+	lua_pushcfunction(L, channel_tryget);
+	lua_setfield(L, -2, "tryget");
+	/* mt.close = <channel_close> */
+	lua_pushcfunction(L, channel_close);
+	lua_setfield(L, -2, "close");
+	/* mt.closed = <channel_closed> */
+	lua_pushcfunction(L, channel_closed);
+	lua_setfield(L, -2, "closed");
+	/* mt.count = <channel_count> */
+	lua_pushcfunction(L, channel_count);
+	lua_setfield(L, -2, "count");
+
+	/* set new function */
+	lua_pushvalue(L, -1); /* upvalue 1 = Channel */
+	lua_pushcclosure(L, channel_new, 1);
+	lua_setfield(L, -3, "new");
+
+	/* insert table */
+	lua_setfield(L, -2, "Channel");
+
+	/* set select function */
+	lua_pushcfunction(L, channel_select);
+	lua_setfield(L, -2, "select");
+
+	return 1;
+}
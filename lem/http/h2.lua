@@ -0,0 +1,654 @@
+--
+-- This file is part of LEM, a Lua Event Machine.
+-- Copyright 2026 agent
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+--
+
+-- Cleartext HTTP/2 for lem.http.server. Each request runs the
+-- server handler in its own thread, while the thread which accepted
+-- the connection reads frames and hands them to the streams.
+
+local setmetatable = setmetatable
+local tostring = tostring
+local tonumber = tonumber
+local pairs = pairs
+local type = type
+local min = math.min
+local pack, unpack = string.pack, string.unpack
+local concat = table.concat
+local tunpack = table.unpack
+
+local h2       = require 'lem.http.h2.core'
+local parsers  = require 'lem.parsers'
+local utils    = require 'lem.utils'
+local response = require 'lem.http.response'
+local server   = require 'lem.http.server'
+local static   = require 'lem.http.static'
+
+parsers.lookup['H2Frame'] = h2.H2Frame
+h2.H2Frame = nil
+
+local spawn, thisthread, suspend, resume
+	= utils.spawn, utils.thisthread, utils.suspend, utils.resume
+local urldecode = server.urldecode
+local newresponse = response.new
+
+-- frame types
+local DATA, HEADERS, PRIORITY, RST_STREAM, SETTINGS, PUSH_PROMISE,
+	PING, GOAWAY, WINDOW_UPDATE, CONTINUATION = 0, 1, 2, 3, 4, 5, 6, 7, 8, 9
+
+-- flags
+local END_STREAM, ACK, END_HEADERS, PADDED, PRIO = 0x1, 0x1, 0x4, 0x8, 0x20
+
+-- error codes
+local NO_ERROR, PROTOCOL_ERROR, FLOW_CONTROL_ERROR, STREAM_CLOSED,
+	FRAME_SIZE_ERROR, REFUSED_STREAM, COMPRESSION_ERROR
+	= 0x0, 0x1, 0x3, 0x5, 0x6, 0x7, 0x9
+
+h2.preface = 'PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n'
+
+-- SETTINGS_MAX_CONCURRENT_STREAMS sent to clients
+h2.max_streams = 100
+
+-- the request data buffered per connection before the handlers
+-- read it, each stream may hold the initial window of it
+h2.window = 1048576
+
+local FRAME_SIZE = 16384
+local WINDOW_SIZE = 65535
+local MAX_WINDOW = 0x7FFFFFFF
+
+-- payload lengths of the frames which have a fixed size
+local fixedsize = {
+	[PRIORITY] = 5,
+	[RST_STREAM] = 4,
+	[PING] = 8,
+	[WINDOW_UPDATE] = 4,
+}
+
+-- headers which only mean something for HTTP/1.x
+local connection_specific = {
+	['connection'] = true,
+	['keep-alive'] = true,
+	['proxy-connection'] = true,
+	['transfer-encoding'] = true,
+	['upgrade'] = true,
+}
+
+local Request = setmetatable({}, { __index = server.Request })
+Request.__index = Request
+h2.Request = Request
+
+local Conn = {}
+Conn.__index = Conn
+
+local function frame(type, flags, id, payload)
+	return pack('>I3BBI4', #payload, type, flags, id), payload
+end
+
+function Conn:write(type, flags, id, payload)
+	return self.client:write(frame(type, flags, id, payload))
+end
+
+-- a connection error, tell the client and stop reading
+function Conn:goaway(code)
+	self:write(GOAWAY, 0, 0, pack('>I4I4', self.lastid, code))
+	self.client:close()
+	return nil, 'protocol error'
+end
+
+-- strip the padding of a DATA or HEADERS frame, nil when
+-- the pad length doesn't fit in the payload
+local function unpad(payload)
+	local len = #payload
+	if len == 0 then return nil end
+	local pad = payload:byte(1)
+	if pad >= len then return nil end
+	return payload:sub(2, len - pad)
+end
+
+-- wake the thread waiting for the body or for window space
+local function wake(conn, stream)
+	local t = stream.waiter
+	if t then
+		stream.waiter = nil
+		resume(t)
+	end
+end
+
+local function wait(stream)
+	stream.waiter = thisthread()
+	suspend()
+end
+
+-- give the flow control credit for n bytes back to the client,
+-- for the stream too unless it won't send more
+local function credit(conn, stream, n)
+	if n == 0 then return true end
+	conn.inwindow = conn.inwindow + n
+	local update = pack('>I4', n)
+	if not stream or stream.done or stream.closed or stream.oversized then
+		return conn:write(WINDOW_UPDATE, 0, 0, update)
+	end
+	stream.inwindow = stream.inwindow + n
+	local ch, cp = frame(WINDOW_UPDATE, 0, 0, update)
+	local sh, sp = frame(WINDOW_UPDATE, 0, stream.id, update)
+	return conn.client:write(ch, cp, sh, sp)
+end
+
+-- drop what the stream holds, the handler may still answer
+-- with 413 before the rest of the body is refused
+local function oversize(conn, stream)
+	local n = stream.held
+	stream.oversized = true
+	stream.data = nil
+	stream.held = 0
+	wake(conn, stream)
+	return credit(conn, nil, n)
+end
+
+local function closestream(conn, stream)
+	if conn.streams[stream.id] == stream then
+		conn.streams[stream.id] = nil
+		conn.nstreams = conn.nstreams - 1
+	end
+	stream.closed = true
+	if stream.held > 0 then
+		local n = stream.held
+		stream.held = 0
+		credit(conn, nil, n)
+	end
+end
+
+-- a stream error, fail the handler and tell the client
+function Conn:reset(stream, code)
+	closestream(self, stream)
+	wake(self, stream)
+	return self:write(RST_STREAM, 0, stream.id, pack('>I4', code))
+end
+
+-- DATA frames wait in the stream until the body is read,
+-- from then on the window is given back as they arrive
+function Request:body(maxsize)
+	local stream = self.stream
+	local conn = stream.conn
+	local len = tonumber(self.headers['content-length'])
+	if maxsize and (stream.size > maxsize or (len and len > maxsize)) then
+		oversize(conn, stream)
+	end
+	stream.maxsize = maxsize
+
+	if not stream.reading then
+		local n = stream.held
+		stream.reading = true
+		stream.held = 0
+		credit(conn, stream, n)
+	end
+
+	while true do
+		if stream.oversized then return nil, 'oversized' end
+		if stream.done then break end
+		if stream.closed then return nil, 'closed' end
+		wait(stream)
+	end
+	return concat(stream.data)
+end
+
+-- send DATA frames as the flow control windows allow
+local function senddata(conn, stream, body)
+	local len, i = #body, 1
+	repeat
+		if stream.closed then return nil, 'closed' end
+
+		local n = min(len - i + 1, conn.maxframe, stream.window, conn.window)
+		if n <= 0 and len > 0 then
+			conn.blocked[stream] = true
+			wait(stream)
+			conn.blocked[stream] = nil
+		else
+			local flags = 0
+			if i + n > len then flags = END_STREAM end
+			stream.window = stream.window - n
+			conn.window = conn.window - n
+			local ok, err = conn:write(DATA, flags, stream.id, body:sub(i, i + n - 1))
+			if not ok then return nil, err end
+			i = i + n
+		end
+	until i > len
+
+	return true
+end
+
+local function respond(conn, stream, req, res)
+	local file, entry
+	res, file, entry = conn.server:prepare(req, res)
+
+	local status = res.status
+	if type(status) == 'string' then
+		status = status:match('^%d+')
+	end
+
+	local list = { ':status', tostring(status) }
+	for k, v in pairs(res.headers) do
+		local name = k:lower()
+		if not connection_specific[name] then
+			list[#list+1] = name
+			list[#list+1] = tostring(v)
+		end
+	end
+
+	local body
+	if req.method ~= 'HEAD' then
+		if entry then
+			local len = tonumber(res.headers['Content-Length'])
+			body = len > 0 and static.read(entry, res.offset or 0, len) or ''
+		elseif file then
+			body = file:read('*a') or ''
+		else
+			body = concat(res)
+		end
+	end
+	if entry then static.release(entry) end
+	if body == '' then body = nil end
+
+	-- encode and queue the header block without yielding in
+	-- between, so the encoder and decoder tables stay in sync
+	local block = conn.encoder:encode(list)
+	local frames, max = {}, conn.maxframe
+	local i, id = 1, stream.id
+	local ftype, flags = HEADERS, body and 0 or END_STREAM
+	repeat
+		local chunk = block:sub(i, i + max - 1)
+		i = i + max
+		if i > #block then flags = flags | END_HEADERS end
+		frames[#frames+1], frames[#frames+2] = frame(ftype, flags, id, chunk)
+		ftype, flags = CONTINUATION, 0
+	until i > #block
+
+	local ok, err = conn.client:write(tunpack(frames))
+	if ok and body then
+		ok, err = senddata(conn, stream, body)
+	end
+	if not ok then conn.server.debug('write', err) end
+end
+
+local function handle(conn, stream, req)
+	local res = newresponse(req)
+	conn.server.handler(req, res)
+	if not stream.closed then
+		respond(conn, stream, req, res)
+		-- the response is complete, so stop the client
+		-- sending a body nobody will read
+		if not stream.done and not stream.closed then
+			conn:write(RST_STREAM, 0, stream.id, pack('>I4', NO_ERROR))
+		end
+	end
+	closestream(conn, stream)
+end
+
+local function newrequest(stream, list)
+	local headers = {}
+	local req = setmetatable({
+		headers = headers,
+		version = '2.0',
+		stream = stream,
+	}, Request)
+
+	for i = 1, #list, 2 do
+		local name, value = list[i], list[i+1]
+		if name == ':method' then
+			req.method = value
+		elseif name == ':path' then
+			req.uri = value
+		elseif name == ':authority' then
+			req.authority = value
+		elseif name == ':scheme' then
+			req.scheme = value
+		else
+			local old = headers[name]
+			if old then
+				value = old .. (name == 'cookie' and '; ' or ', ') .. value
+			end
+			headers[name] = value
+		end
+	end
+
+	if not req.method or not req.uri then return nil end
+	if not headers['host'] then headers['host'] = req.authority end
+	req.path = urldecode(req.uri:match('^([^?]*)'))
+	return req
+end
+
+function Conn:newstream(id)
+	local stream = {
+		conn = self,
+		id = id,
+		window = self.initwindow,
+		inwindow = WINDOW_SIZE,
+		data = {},
+		size = 0,
+		held = 0,
+		done = false,
+		closed = false,
+	}
+	self.streams[id] = stream
+	self.nstreams = self.nstreams + 1
+	return stream
+end
+
+function Conn:headers(id, flags, block)
+	local list = self.decoder:decode(block)
+	if not list then return self:goaway(COMPRESSION_ERROR) end
+
+	local stream = self.streams[id]
+	if stream then
+		-- trailers, which we ignore
+		if flags & END_STREAM == 0 then return self:goaway(PROTOCOL_ERROR) end
+		stream.done = true
+		wake(self, stream)
+		return true
+	end
+
+	if id % 2 == 0 or id <= self.lastid then
+		return self:goaway(PROTOCOL_ERROR)
+	end
+	self.lastid = id
+
+	if self.nstreams >= h2.max_streams then
+		return self:write(RST_STREAM, 0, id, pack('>I4', REFUSED_STREAM))
+	end
+
+	stream = self:newstream(id)
+	local req = newrequest(stream, list)
+	if not req then
+		closestream(self, stream)
+		return self:write(RST_STREAM, 0, id, pack('>I4', PROTOCOL_ERROR))
+	end
+
+	stream.done = flags & END_STREAM ~= 0
+	spawn(handle, self, stream, req)
+	return true
+end
+
+function Conn:settings(payload)
+	if #payload % 6 ~= 0 then return self:goaway(FRAME_SIZE_ERROR) end
+
+	for i = 1, #payload, 6 do
+		local k, v = unpack('>I2I4', payload, i)
+		if k == 0x1 then
+			self.encoder:setmax(v)
+		elseif k == 0x4 then
+			if v > MAX_WINDOW then return self:goaway(FLOW_CONTROL_ERROR) end
+			local delta = v - self.initwindow
+			self.initwindow = v
+			for _, stream in pairs(self.streams) do
+				stream.window = stream.window + delta
+				if stream.window > MAX_WINDOW then
+					return self:goaway(FLOW_CONTROL_ERROR)
+				end
+				if delta > 0 then wake(self, stream) end
+			end
+		elseif k == 0x5 then
+			if v < FRAME_SIZE or v > 0xFFFFFF then
+				return self:goaway(PROTOCOL_ERROR)
+			end
+			self.maxframe = v
+		end
+	end
+	return true
+end
+
+-- count a DATA frame against the windows we gave the client
+-- and keep it for the handler, unless nobody wants it or the
+-- body grew past what the handler said it would take
+function Conn:data(id, flags, payload)
+	local len = #payload
+	if id == 0 then return self:goaway(PROTOCOL_ERROR) end
+	if flags & PADDED ~= 0 then
+		payload = unpad(payload)
+		if not payload then return self:goaway(PROTOCOL_ERROR) end
+	end
+	if len > self.inwindow then return self:goaway(FLOW_CONTROL_ERROR) end
+	self.inwindow = self.inwindow - len
+
+	local stream = self.streams[id]
+	if not stream or stream.done or stream.oversized then
+		return credit(self, nil, len)
+	end
+	if len > stream.inwindow then
+		credit(self, nil, len)
+		return self:reset(stream, FLOW_CONTROL_ERROR)
+	end
+	stream.inwindow = stream.inwindow - len
+
+	stream.size = stream.size + #payload
+	if stream.maxsize and stream.size > stream.maxsize then
+		oversize(self, stream)
+		return credit(self, nil, len)
+	end
+
+	stream.data[#stream.data+1] = payload
+	if flags & END_STREAM ~= 0 then
+		stream.done = true
+		wake(self, stream)
+	end
+	if stream.reading then
+		return credit(self, stream, len)
+	end
+	stream.held = stream.held + len
+	return true
+end
+
+-- read frames until the connection is closed
+function Conn:run()
+	local client, streams = self.client, self.streams
+	local ok, err = true, nil
+
+	while ok do
+		local ftype, flags, id, payload = client:read('H2Frame', FRAME_SIZE)
+		if not ftype then
+			if flags == 'frame too large' then
+				self:goaway(FRAME_SIZE_ERROR)
+			end
+			err = flags
+			break
+		end
+
+		local size = fixedsize[ftype]
+		if self.continuation and (ftype ~= CONTINUATION or id ~= self.continuation) then
+			ok, err = self:goaway(PROTOCOL_ERROR)
+		elseif size and #payload ~= size then
+			ok, err = self:goaway(FRAME_SIZE_ERROR)
+		elseif ftype == DATA then
+			ok, err = self:data(id, flags, payload)
+		elseif ftype == HEADERS then
+			if flags & PADDED ~= 0 then
+				payload = unpad(payload)
+			end
+			if flags & PRIO ~= 0 and payload then
+				payload = #payload >= 5 and payload:sub(6) or nil
+			end
+			if not payload then
+				ok, err = self:goaway(PROTOCOL_ERROR)
+			elseif flags & END_HEADERS == 0 then
+				self.continuation, self.cflags, self.block = id, flags, { payload }
+			else
+				ok, err = self:headers(id, flags, payload)
+			end
+		elseif ftype == CONTINUATION then
+			if not self.continuation then
+				ok, err = self:goaway(PROTOCOL_ERROR)
+			else
+				local block = self.block
+				block[#block+1] = payload
+				if flags & END_HEADERS ~= 0 then
+					self.continuation, self.block = nil, nil
+					ok, err = self:headers(id, self.cflags, concat(block))
+				end
+			end
+		elseif ftype == SETTINGS then
+			if flags & ACK == 0 then
+				ok, err = self:settings(payload)
+				if ok then
+					ok, err = self:write(SETTINGS, ACK, 0, '')
+				end
+			end
+		elseif ftype == PING then
+			if flags & ACK == 0 then
+				ok, err = self:write(PING, ACK, 0, payload)
+			end
+		elseif ftype == WINDOW_UPDATE then
+			local inc = unpack('>I4', payload) & MAX_WINDOW
+			local stream = streams[id]
+			if id == 0 then
+				if inc == 0 then
+					ok, err = self:goaway(PROTOCOL_ERROR)
+				elseif self.window + inc > MAX_WINDOW then
+					ok, err = self:goaway(FLOW_CONTROL_ERROR)
+				else
+					self.window = self.window + inc
+					for stream in pairs(self.blocked) do
+						wake(self, stream)
+					end
+				end
+			elseif stream then
+				if inc == 0 then
+					ok, err = self:reset(stream, PROTOCOL_ERROR)
+				elseif stream.window + inc > MAX_WINDOW then
+					ok, err = self:reset(stream, FLOW_CONTROL_ERROR)
+				else
+					stream.window = stream.window + inc
+					wake(self, stream)
+				end
+			end
+		elseif ftype == RST_STREAM then
+			local stream = streams[id]
+			if id == 0 then
+				ok, err = self:goaway(PROTOCOL_ERROR)
+			elseif stream then
+				closestream(self, stream)
+				wake(self, stream)
+			end
+		elseif ftype == PUSH_PROMISE then
+			ok, err = self:goaway(PROTOCOL_ERROR)
+		end
+		-- PRIORITY, GOAWAY and unknown frames are ignored
+	end
+
+	-- fail the streams still waiting
+	for _, stream in pairs(streams) do
+		stream.closed = true
+		wake(self, stream)
+	end
+	client:close()
+	self.server.debug('h2', err)
+end
+
+local function newconn(srv, client)
+	-- frames are small and often answered, so don't wait
+	-- for acknowledgements before sending them
+	client:nodelay()
+	return setmetatable({
+		server = srv,
+		client = client,
+		decoder = h2.newdecoder(),
+		encoder = h2.newencoder(),
+		streams = {},
+		nstreams = 0,
+		blocked = {},
+		lastid = 0,
+		window = WINDOW_SIZE,
+		initwindow = WINDOW_SIZE,
+		inwindow = WINDOW_SIZE,
+		maxframe = FRAME_SIZE,
+	}, Conn)
+end
+
+local function start(conn)
+	local sh, sp = frame(SETTINGS, 0, 0, pack('>I2I4', 0x3, h2.max_streams))
+	if h2.window <= WINDOW_SIZE then
+		return conn.client:write(sh, sp)
+	end
+	local wh, wp = frame(WINDOW_UPDATE, 0, 0, pack('>I4', h2.window - WINDOW_SIZE))
+	conn.inwindow = h2.window
+	return conn.client:write(sh, sp, wh, wp)
+end
+
+-- serve a connection after the client preface was read
+function h2.serve(srv, client)
+	local conn = newconn(srv, client)
+	if start(conn) then conn:run() end
+	client:close()
+end
+
+local function base64url(s)
+	local alphabet = 'ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_'
+	local t, bits, n = {}, 0, 0
+	for c in s:gmatch('[^=]') do
+		local v = alphabet:find(c, 1, true)
+		if not v then return nil end
+		bits = bits << 6 | (v - 1)
+		n = n + 6
+		if n >= 8 then
+			n = n - 8
+			t[#t+1] = string.char(bits >> n & 0xFF)
+		end
+	end
+	return concat(t)
+end
+
+-- upgrade an HTTP/1.1 request with "Upgrade: h2c",
+-- the request becomes stream 1
+function h2.upgrade(srv, req)
+	local client = req.client
+	local settings = base64url(req.headers['http2-settings'])
+	if not settings then return false end
+
+	local body, err = req:body()
+	if not body then return false end
+
+	local ok = client:write('HTTP/1.1 101 Switching Protocols\r\n'
+		.. 'Connection: Upgrade\r\nUpgrade: h2c\r\n\r\n')
+	if not ok then client:close() return true end
+
+	local conn = newconn(srv, client)
+	-- the 101 response acknowledges the settings
+	if not conn:settings(settings) or not start(conn) then
+		client:close()
+		return true
+	end
+
+	local stream = conn:newstream(1)
+	conn.lastid = 1
+	stream.data[1] = body
+	stream.size = #body
+	stream.done = true
+
+	setmetatable(req, Request)
+	req.version = '2.0'
+	req.stream = stream
+	req.client = nil
+	spawn(handle, conn, stream, req)
+
+	if client:read(#h2.preface) == h2.preface then
+		conn:run()
+	end
+	client:close()
+	return true
+end
+
+return h2
+
+-- vim: ts=2 sw=2 noet:
@@ -0,0 +1,186 @@
+/*
+ * This file is part of LEM, a Lua Event Machine.
+ * Copyright 2026 agent
+ *
+ * LEM is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * LEM is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <lem-parsers.h>
+
+#include "hpack.c"
+
+/*
+ * Read one HTTP/2 frame and return type, flags, stream id and
+ * payload. The optional argument is the largest payload allowed,
+ * which defaults to the initial SETTINGS_MAX_FRAME_SIZE.
+ */
+#define H2_DEFAULT_FRAME_SIZE 16384
+
+struct parse_h2_state {
+	size_t target;
+	uint32_t id;
+	int parts;
+	unsigned char header;
+	unsigned char type;
+	unsigned char flags;
+};
+LEM_BUILD_ASSERT(sizeof(struct parse_h2_state) < LEM_INPUTBUF_PSIZE);
+
+static void
+parse_h2_init(lua_State *T, struct lem_inputbuf *b)
+{
+	struct parse_h2_state *s = (struct parse_h2_state *)&b->pstate;
+	lua_Integer max = luaL_optinteger(T, 3, H2_DEFAULT_FRAME_SIZE);
+
+	luaL_argcheck(T, max > 0 && max < 0x1000000, 3, "out of range");
+	s->header = 1;
+	s->parts = 0;
+	lua_settop(T, 2);
+	lua_pushinteger(T, max);
+}
+
+static int
+parse_h2_process(lua_State *T, struct lem_inputbuf *b)
+{
+	struct parse_h2_state *s = (struct parse_h2_state *)&b->pstate;
+	size_t size;
+
+	if (s->header) {
+		const unsigned char *p = (unsigned char *)b->buf + b->start;
+		size_t len;
+
+		size = b->end - b->start;
+		if (size < 9) {
+			if (b->end == LEM_INPUTBUF_SIZE && b->start > 0) {
+				memmove(b->buf, p, size);
+				b->end = size;
+				b->start = 0;
+			}
+			return 0;
+		}
+
+		len = (size_t)p[0] << 16 | (size_t)p[1] << 8 | p[2];
+		if (len > (size_t)lua_tointeger(T, 3)) {
+			b->start = b->end = 0;
+			lua_settop(T, 0);
+			lua_pushnil(T);
+			lua_pushliteral(T, "frame too large");
+			return 2;
+		}
+
+		s->type = p[3];
+		s->flags = p[4];
+		s->id = ((uint32_t)p[5] << 24 | (uint32_t)p[6] << 16 |
+				(uint32_t)p[7] << 8 | p[8]) & 0x7FFFFFFF;
+		s->target = len;
+		s->header = 0;
+		b->start += 9;
+	}
+
+	size = b->end - b->start;
+	if (size < s->target) {
+		if (b->end < LEM_INPUTBUF_SIZE)
+			return 0;
+
+		lua_pushlstring(T, b->buf + b->start, size);
+		s->parts++;
+		if (s->parts == LUA_MINSTACK-2) {
+			lua_concat(T, LUA_MINSTACK-2);
+			s->parts = 1;
+		}
+		s->target -= size;
+		b->start = b->end = 0;
+		return 0;
+	}
+
+	lua_pushinteger(T, s->type);
+	lua_pushinteger(T, s->flags);
+	lua_pushinteger(T, s->id);
+	lua_rotate(T, -3 - s->parts, 3);
+	lua_pushlstring(T, b->buf + b->start, s->target);
+	lua_concat(T, s->parts + 1);
+	b->start += s->target;
+	if (b->start == b->end)
+		b->start = b->end = 0;
+	return 4;
+}
+
+static const struct lem_parser h2_parser = {
+	.init    = parse_h2_init,
+	.process = parse_h2_process,
+};
+
+static int
+h2_newdecoder(lua_State *T)
+{
+	hpack_new(T);
+	return 1;
+}
+
+static int
+h2_newencoder(lua_State *T)
+{
+	hpack_new(T);
+	return 1;
+}
+
+int
+luaopen_lem_http_h2_core(lua_State *L)
+{
+	/* create module table */
+	lua_newtable(L);
+
+	/* push the frame parser */
+	lua_pushlightuserdata(L, (void *)&h2_parser);
+	lua_setfield(L, -2, "H2Frame");
+
+	/* create Decoder metatable */
+	lua_newtable(L);
+	lua_pushvalue(L, -1);
+	lua_setfield(L, -2, "__index");
+	/* mt.__gc = <hpack_gc> */
+	lua_pushcfunction(L, hpack_gc);
+	lua_setfield(L, -2, "__gc");
+	/* mt.setmax = <hpack_setmax> */
+	lua_pushcfunction(L, hpack_setmax);
+	lua_setfield(L, -2, "setmax");
+	/* mt.decode = <hpack_decode> */
+	lua_pushcfunction(L, hpack_decode);
+	lua_setfield(L, -2, "decode");
+	/* set newdecoder function */
+	lua_pushcclosure(L, h2_newdecoder, 1);
+	lua_setfield(L, -2, "newdecoder");
+
+	/* create Encoder metatable */
+	lua_newtable(L);
+	lua_pushvalue(L, -1);
+	lua_setfield(L, -2, "__index");
+	/* mt.__gc = <hpack_gc> */
+	lua_pushcfunction(L, hpack_gc);
+	lua_setfield(L, -2, "__gc");
+	/* mt.setmax = <hpack_setmax> */
+	lua_pushcfunction(L, hpack_setmax);
+	lua_setfield(L, -2, "setmax");
+	/* mt.encode = <hpack_encode> */
+	lua_pushcfunction(L, hpack_encode);
+	lua_setfield(L, -2, "encode");
+	/* set newencoder function */
+	lua_pushcclosure(L, h2_newencoder, 1);
+	lua_setfield(L, -2, "newencoder");
+
+	return 1;
+}
@@ -0,0 +1,715 @@
+/*
+ * This file is part of LEM, a Lua Event Machine.
+ * Copyright 2026 agent
+ *
+ * LEM is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * LEM is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * HPACK header compression (RFC 7541)
+ */
+
+#define HPACK_DEFAULT_SIZE 4096
+
+struct hpack_entry {
+	const char *name;
+	const char *value;
+	unsigned short nlen;
+	unsigned short vlen;
+};
+
+/*
+ * The Huffman code is canonical, so codes of the same length are
+ * consecutive. Symbols are sorted by code, and for each length
+ * we have the first code, the number of codes and the index of
+ * the first symbol with that length.
+ */
+static const uint32_t hpack_huff_code[257] = {
+	0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5,
+	0xfffffe6, 0xfffffe7, 0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9,
+	0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec, 0xfffffed, 0xfffffee,
+	0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+	0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9,
+	0xffffffa, 0xffffffb, 0x14, 0x3f8, 0x3f9, 0xffa,
+	0x1ff9, 0x15, 0xf8, 0x7fa, 0x3fa, 0x3fb,
+	0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+	0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b,
+	0x1c, 0x1d, 0x1e, 0x1f, 0x5c, 0xfb,
+	0x7ffc, 0x20, 0xffb, 0x3fc, 0x1ffa, 0x21,
+	0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+	0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+	0x69, 0x6a, 0x6b, 0x6c, 0x6d, 0x6e,
+	0x6f, 0x70, 0x71, 0x72, 0xfc, 0x73,
+	0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+	0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5,
+	0x25, 0x26, 0x27, 0x6, 0x74, 0x75,
+	0x28, 0x29, 0x2a, 0x7, 0x2b, 0x76,
+	0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+	0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd,
+	0x1ffd, 0xffffffc, 0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8,
+	0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9, 0x3fffd6, 0x7fffda,
+	0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+	0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1,
+	0x7fffe2, 0x7fffe3, 0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5,
+	0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef, 0x3fffda, 0x1fffdd,
+	0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+	0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf,
+	0x7fffeb, 0x7fffec, 0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2,
+	0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef, 0xfffea, 0x3fffe2,
+	0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+	0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2,
+	0x3fffe8, 0x1ffffec, 0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde,
+	0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed, 0x7fff2, 0x1fffe3,
+	0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+	0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3,
+	0x7ffffe4, 0x7ffffe5, 0xfffec, 0xfffff3, 0xfffed, 0x1fffe6,
+	0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3, 0x3fffea, 0x3fffeb,
+	0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+	0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8,
+	0x7ffffe9, 0x7ffffea, 0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed,
+	0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee, 0x3fffffff,
+};
+static const unsigned char hpack_huff_len[257] = {
+	13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+	28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+	6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+	5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+	13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+	7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+	15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+	6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+	20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+	24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+	22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+	21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+	26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+	19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+	20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+	26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+	30,
+};
+static const unsigned short hpack_huff_sym[257] = {
+	48, 49, 50, 97, 99, 101, 105, 111, 115, 116, 32, 37, 45, 46, 47, 51,
+	52, 53, 54, 55, 56, 57, 61, 65, 95, 98, 100, 102, 103, 104, 108, 109,
+	110, 112, 114, 117, 58, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76,
+	77, 78, 79, 80, 81, 82, 83, 84, 85, 86, 87, 89, 106, 107, 113, 118,
+	119, 120, 121, 122, 38, 42, 44, 59, 88, 90, 33, 34, 40, 41, 63, 39,
+	43, 124, 35, 62, 0, 36, 64, 91, 93, 126, 94, 125, 60, 96, 123, 92,
+	195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161, 167, 172, 176, 177,
+	179, 209, 216, 217, 227, 229, 230, 129, 132, 133, 134, 136, 146, 154, 156, 160,
+	163, 164, 169, 170, 173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232,
+	233, 1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150, 151, 152, 155, 157,
+	158, 165, 166, 168, 174, 175, 180, 182, 183, 188, 191, 197, 231, 239, 9, 142,
+	144, 145, 148, 159, 171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193,
+	200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243, 255, 203, 204, 211,
+	212, 214, 221, 222, 223, 241, 244, 245, 246, 247, 248, 250, 251, 252, 253, 254,
+	2, 3, 4, 5, 6, 7, 8, 11, 12, 14, 15, 16, 17, 18, 19, 20,
+	21, 23, 24, 25, 26, 27, 28, 29, 30, 31, 127, 220, 249, 10, 13, 22,
+	256,
+};
+static const uint32_t hpack_huff_first[31] = {
+	0x0, 0x0, 0x0, 0x0, 0x0, 0x0,
+	0x14, 0x5c, 0xf8, 0x0, 0x3f8, 0x7fa,
+	0xffa, 0x1ff8, 0x3ffc, 0x7ffc, 0x0, 0x0,
+	0x0, 0x7fff0, 0xfffe6, 0x1fffdc, 0x3fffd2, 0x7fffd8,
+	0xffffea, 0x1ffffec, 0x3ffffe0, 0x7ffffde, 0xfffffe2, 0x0,
+	0x3ffffffc,
+};
+static const unsigned short hpack_huff_count[31] = {
+	0, 0, 0, 0, 0, 10, 26, 32, 6, 0, 5, 3, 2, 6, 2, 3,
+	0, 0, 0, 3, 8, 13, 26, 29, 12, 4, 15, 19, 29, 0, 4,
+};
+static const unsigned short hpack_huff_offset[31] = {
+	0, 0, 0, 0, 0, 0, 10, 36, 68, 0, 74, 79, 82, 84, 90, 92,
+	0, 0, 0, 95, 98, 106, 119, 145, 174, 186, 190, 205, 224, 0, 253,
+};
+
+#define HPACK_STATIC_SIZE 61
+static const struct hpack_entry hpack_static[HPACK_STATIC_SIZE] = {
+	{ ":authority", "", 10, 0 },
+	{ ":method", "GET", 7, 3 },
+	{ ":method", "POST", 7, 4 },
+	{ ":path", "/", 5, 1 },
+	{ ":path", "/index.html", 5, 11 },
+	{ ":scheme", "http", 7, 4 },
+	{ ":scheme", "https", 7, 5 },
+	{ ":status", "200", 7, 3 },
+	{ ":status", "204", 7, 3 },
+	{ ":status", "206", 7, 3 },
+	{ ":status", "304", 7, 3 },
+	{ ":status", "400", 7, 3 },
+	{ ":status", "404", 7, 3 },
+	{ ":status", "500", 7, 3 },
+	{ "accept-charset", "", 14, 0 },
+	{ "accept-encoding", "gzip, deflate", 15, 13 },
+	{ "accept-language", "", 15, 0 },
+	{ "accept-ranges", "", 13, 0 },
+	{ "accept", "", 6, 0 },
+	{ "access-control-allow-origin", "", 27, 0 },
+	{ "age", "", 3, 0 },
+	{ "allow", "", 5, 0 },
+	{ "authorization", "", 13, 0 },
+	{ "cache-control", "", 13, 0 },
+	{ "content-disposition", "", 19, 0 },
+	{ "content-encoding", "", 16, 0 },
+	{ "content-language", "", 16, 0 },
+	{ "content-length", "", 14, 0 },
+	{ "content-location", "", 16, 0 },
+	{ "content-range", "", 13, 0 },
+	{ "content-type", "", 12, 0 },
+	{ "cookie", "", 6, 0 },
+	{ "date", "", 4, 0 },
+	{ "etag", "", 4, 0 },
+	{ "expect", "", 6, 0 },
+	{ "expires", "", 7, 0 },
+	{ "from", "", 4, 0 },
+	{ "host", "", 4, 0 },
+	{ "if-match", "", 8, 0 },
+	{ "if-modified-since", "", 17, 0 },
+	{ "if-none-match", "", 13, 0 },
+	{ "if-range", "", 8, 0 },
+	{ "if-unmodified-since", "", 19, 0 },
+	{ "last-modified", "", 13, 0 },
+	{ "link", "", 4, 0 },
+	{ "location", "", 8, 0 },
+	{ "max-forwards", "", 12, 0 },
+	{ "proxy-authenticate", "", 18, 0 },
+	{ "proxy-authorization", "", 19, 0 },
+	{ "range", "", 5, 0 },
+	{ "referer", "", 7, 0 },
+	{ "refresh", "", 7, 0 },
+	{ "retry-after", "", 11, 0 },
+	{ "server", "", 6, 0 },
+	{ "set-cookie", "", 10, 0 },
+	{ "strict-transport-security", "", 25, 0 },
+	{ "transfer-encoding", "", 17, 0 },
+	{ "user-agent", "", 10, 0 },
+	{ "vary", "", 4, 0 },
+	{ "via", "", 3, 0 },
+	{ "www-authenticate", "", 16, 0 },
+};
+
+/*
+ * The dynamic table is a ring of entries,
+ * entry 0 is the newest
+ */
+struct hpack_dentry {
+	char *data;     /* name followed by value */
+	size_t nlen;
+	size_t vlen;
+};
+
+struct hpack_table {
+	struct hpack_dentry *ents;
+	unsigned int cap;
+	unsigned int first;
+	unsigned int n;
+	size_t size;    /* as defined by the RFC */
+	size_t max;     /* the current maximum size */
+	size_t limit;   /* the maximum size allowed by settings */
+	int update;     /* encoder: signal a size update */
+};
+
+#define HPACK_ENTRY_OVERHEAD 32
+
+static struct hpack_dentry *
+hpack_get(struct hpack_table *t, unsigned int i)
+{
+	return &t->ents[(t->first + t->n - 1 - i) % t->cap];
+}
+
+static void
+hpack_evict(struct hpack_table *t, size_t max)
+{
+	while (t->n > 0 && t->size > max) {
+		struct hpack_dentry *e = &t->ents[t->first];
+
+		t->size -= e->nlen + e->vlen + HPACK_ENTRY_OVERHEAD;
+		free(e->data);
+		t->first = (t->first + 1) % t->cap;
+		t->n--;
+	}
+}
+
+static void
+hpack_add(struct hpack_table *t, const char *name, size_t nlen,
+		const char *value, size_t vlen)
+{
+	size_t size = nlen + vlen + HPACK_ENTRY_OVERHEAD;
+	struct hpack_dentry *e;
+
+	if (size > t->max) {
+		hpack_evict(t, 0);
+		return;
+	}
+	hpack_evict(t, t->max - size);
+
+	if (t->n == t->cap) {
+		unsigned int cap = t->cap ? 2*t->cap : 16;
+		struct hpack_dentry *ents = lem_xmalloc(cap * sizeof(struct hpack_dentry));
+		unsigned int i;
+
+		for (i = 0; i < t->n; i++)
+			ents[i] = t->ents[(t->first + i) % t->cap];
+		free(t->ents);
+		t->ents = ents;
+		t->cap = cap;
+		t->first = 0;
+	}
+
+	e = &t->ents[(t->first + t->n) % t->cap];
+	e->data = lem_xmalloc(nlen + vlen);
+	memcpy(e->data, name, nlen);
+	memcpy(e->data + nlen, value, vlen);
+	e->nlen = nlen;
+	e->vlen = vlen;
+	t->n++;
+	t->size += size;
+}
+
+static struct hpack_table *
+hpack_new(lua_State *T)
+{
+	struct hpack_table *t = lua_newuserdata(T, sizeof(struct hpack_table));
+
+	lua_pushvalue(T, lua_upvalueindex(1));
+	lua_setmetatable(T, -2);
+
+	t->ents = NULL;
+	t->cap = t->first = t->n = 0;
+	t->size = 0;
+	t->max = t->limit = HPACK_DEFAULT_SIZE;
+	t->update = 0;
+	return t;
+}
+
+static int
+hpack_gc(lua_State *T)
+{
+	struct hpack_table *t = lua_touserdata(T, 1);
+
+	hpack_evict(t, 0);
+	free(t->ents);
+	t->ents = NULL;
+	t->cap = 0;
+	return 0;
+}
+
+/*
+ * table:setmax(size) sets the maximum table size. For a decoder
+ * this is the size we announce in our settings, for an encoder
+ * it is the size announced by the peer.
+ */
+static int
+hpack_setmax(lua_State *T)
+{
+	struct hpack_table *t;
+	lua_Integer max;
+
+	luaL_checktype(T, 1, LUA_TUSERDATA);
+	t = lua_touserdata(T, 1);
+	max = luaL_checkinteger(T, 2);
+	luaL_argcheck(T, max >= 0, 2, "out of range");
+
+	t->limit = max;
+	/* an encoder never uses more than the default size,
+	 * but must tell the decoder about a new maximum */
+	if (max > HPACK_DEFAULT_SIZE)
+		max = HPACK_DEFAULT_SIZE;
+	if ((size_t)max != t->max)
+		t->update = 1;
+	return 0;
+}
+
+/*
+ * Decoding
+ */
+struct hpack_input {
+	const unsigned char *p;
+	const unsigned char *end;
+};
+
+static int
+hpack_integer(struct hpack_input *in, int prefix, size_t *r)
+{
+	unsigned int mask = (1 << prefix) - 1;
+	size_t v;
+	int shift = 0;
+
+	if (in->p == in->end)
+		return -1;
+	v = *in->p++ & mask;
+	if (v < mask) {
+		*r = v;
+		return 0;
+	}
+
+	while (1) {
+		unsigned int c;
+
+		if (in->p == in->end || shift > 28)
+			return -1;
+		c = *in->p++;
+		v += (size_t)(c & 0x7F) << shift;
+		shift += 7;
+		if ((c & 0x80) == 0)
+			break;
+	}
+
+	*r = v;
+	return 0;
+}
+
+static int
+hpack_huffman_decode(luaL_Buffer *B, const unsigned char *p, size_t len)
+{
+	const unsigned char *end = p + len;
+	uint32_t code = 0;
+	unsigned int bits = 0;
+
+	for (; p < end; p++) {
+		int i;
+
+		for (i = 7; i >= 0; i--) {
+			unsigned int n;
+
+			code = (code << 1) | ((*p >> i) & 1);
+			bits++;
+			if (bits < 5)
+				continue;
+			if (bits > 30)
+				return -1;
+
+			n = code - hpack_huff_first[bits];
+			if (n >= hpack_huff_count[bits])
+				continue;
+
+			n = hpack_huff_sym[hpack_huff_offset[bits] + n];
+			if (n == 256)
+				return -1;
+			luaL_addchar(B, n);
+			code = 0;
+			bits = 0;
+		}
+	}
+
+	/* padding is a prefix of EOS, so all ones and shorter than a byte */
+	if (bits > 7 || code != (1U << bits) - 1)
+		return -1;
+	return 0;
+}
+
+static int
+hpack_pushstring(lua_State *T, struct hpack_input *in)
+{
+	int huffman;
+	size_t len;
+
+	if (in->p == in->end)
+		return -1;
+	huffman = *in->p & 0x80;
+	if (hpack_integer(in, 7, &len) || len > (size_t)(in->end - in->p))
+		return -1;
+
+	if (huffman) {
+		luaL_Buffer B;
+
+		luaL_buffinit(T, &B);
+		if (hpack_huffman_decode(&B, in->p, len))
+			return -1;
+		luaL_pushresult(&B);
+	} else
+		lua_pushlstring(T, (const char *)in->p, len);
+
+	in->p += len;
+	return 0;
+}
+
+/* push the name, and the value if value is set, of entry i */
+static int
+hpack_pushindex(lua_State *T, struct hpack_table *t, size_t i, int value)
+{
+	if (i == 0)
+		return -1;
+
+	if (i <= HPACK_STATIC_SIZE) {
+		const struct hpack_entry *e = &hpack_static[i - 1];
+
+		lua_pushlstring(T, e->name, e->nlen);
+		if (value)
+			lua_pushlstring(T, e->value, e->vlen);
+		return 0;
+	}
+
+	i -= HPACK_STATIC_SIZE + 1;
+	if (i >= t->n)
+		return -1;
+	{
+		struct hpack_dentry *e = hpack_get(t, i);
+
+		lua_pushlstring(T, e->data, e->nlen);
+		if (value)
+			lua_pushlstring(T, e->data + e->nlen, e->vlen);
+	}
+	return 0;
+}
+
+/*
+ * decoder:decode(block) returns the header list as
+ * { name1, value1, name2, value2, ... }
+ * or nil and an error message
+ */
+static int
+hpack_decode(lua_State *T)
+{
+	struct hpack_table *t;
+	struct hpack_input in;
+	size_t len;
+	lua_Integer n = 0;
+	int fields = 0;
+
+	luaL_checktype(T, 1, LUA_TUSERDATA);
+	t = lua_touserdata(T, 1);
+	in.p = (const unsigned char *)luaL_checklstring(T, 2, &len);
+	in.end = in.p + len;
+
+	lua_settop(T, 2);
+	lua_createtable(T, 16, 0);
+
+	while (in.p < in.end) {
+		unsigned char c = *in.p;
+		size_t i;
+
+		if (c & 0x80) {
+			/* indexed header field */
+			if (hpack_integer(&in, 7, &i) ||
+					hpack_pushindex(T, t, i, 1))
+				goto error;
+		} else if ((c & 0xE0) == 0x20) {
+			/* dynamic table size update */
+			if (fields > 0 || hpack_integer(&in, 5, &i) ||
+					i > t->limit)
+				goto error;
+			t->max = i;
+			hpack_evict(t, i);
+			continue;
+		} else {
+			int indexing = c & 0x40;
+
+			/* literal header field */
+			if (hpack_integer(&in, indexing ? 6 : 4, &i))
+				goto error;
+			if (i == 0) {
+				if (hpack_pushstring(T, &in))
+					goto error;
+			} else if (hpack_pushindex(T, t, i, 0))
+				goto error;
+			if (hpack_pushstring(T, &in))
+				goto error;
+
+			if (indexing) {
+				size_t nlen, vlen;
+				const char *name = lua_tolstring(T, -2, &nlen);
+				const char *value = lua_tolstring(T, -1, &vlen);
+
+				hpack_add(t, name, nlen, value, vlen);
+			}
+		}
+
+		lua_rawseti(T, 3, n + 2);
+		lua_rawseti(T, 3, n + 1);
+		n += 2;
+		fields++;
+	}
+
+	return 1;
+
+error:
+	lua_pushnil(T);
+	lua_pushliteral(T, "compression error");
+	return 2;
+}
+
+/*
+ * Encoding
+ */
+static void
+hpack_putchar(struct lem_buffer *b, unsigned char c)
+{
+	*lem_buffer_reserve(b, 1) = c;
+	b->len++;
+}
+
+static void
+hpack_putinteger(struct lem_buffer *b, unsigned char first, int prefix, size_t v)
+{
+	unsigned int mask = (1 << prefix) - 1;
+
+	if (v < mask) {
+		hpack_putchar(b, first | v);
+		return;
+	}
+
+	hpack_putchar(b, first | mask);
+	v -= mask;
+	while (v >= 0x80) {
+		hpack_putchar(b, 0x80 | (v & 0x7F));
+		v >>= 7;
+	}
+	hpack_putchar(b, v);
+}
+
+static void
+hpack_putstring(struct lem_buffer *b, const char *str, size_t len)
+{
+	const unsigned char *p = (const unsigned char *)str;
+	uint64_t acc = 0;
+	unsigned int n = 0;
+	size_t bits = 0;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		bits += hpack_huff_len[p[i]];
+
+	/* only use Huffman coding when it is shorter */
+	if ((bits + 7) / 8 >= len) {
+		hpack_putinteger(b, 0x00, 7, len);
+		lem_buffer_append(b, str, len);
+		return;
+	}
+
+	hpack_putinteger(b, 0x80, 7, (bits + 7) / 8);
+	for (i = 0; i < len; i++) {
+		acc = (acc << hpack_huff_len[p[i]]) | hpack_huff_code[p[i]];
+		n += hpack_huff_len[p[i]];
+		while (n >= 8) {
+			n -= 8;
+			hpack_putchar(b, acc >> n);
+		}
+	}
+	/* pad with the most significant bits of EOS */
+	if (n > 0)
+		hpack_putchar(b, (acc << (8 - n)) | (0xFF >> n));
+}
+
+/*
+ * Find the best index for name and value,
+ * returns the index and whether the value matched too.
+ */
+static size_t
+hpack_find(struct hpack_table *t, const char *name, size_t nlen,
+		const char *value, size_t vlen, int *exact)
+{
+	size_t found = 0;
+	unsigned int i;
+
+	*exact = 0;
+	for (i = 0; i < HPACK_STATIC_SIZE; i++) {
+		const struct hpack_entry *e = &hpack_static[i];
+
+		if (e->nlen != nlen || memcmp(e->name, name, nlen) != 0)
+			continue;
+		if (e->vlen == vlen && memcmp(e->value, value, vlen) == 0) {
+			*exact = 1;
+			return i + 1;
+		}
+		if (found == 0)
+			found = i + 1;
+	}
+
+	for (i = 0; i < t->n; i++) {
+		struct hpack_dentry *e = hpack_get(t, i);
+
+		if (e->nlen != nlen || memcmp(e->data, name, nlen) != 0)
+			continue;
+		if (e->vlen == vlen && memcmp(e->data + nlen, value, vlen) == 0) {
+			*exact = 1;
+			return HPACK_STATIC_SIZE + 1 + i;
+		}
+		if (found == 0)
+			found = HPACK_STATIC_SIZE + 1 + i;
+	}
+
+	return found;
+}
+
+/*
+ * encoder:encode(list) encodes the header list
+ * { name1, value1, name2, value2, ... } into a header block
+ */
+static int
+hpack_encode(lua_State *T)
+{
+	struct hpack_table *t;
+	struct lem_buffer b;
+	lua_Integer n, i;
+
+	luaL_checktype(T, 1, LUA_TUSERDATA);
+	t = lua_touserdata(T, 1);
+	luaL_checktype(T, 2, LUA_TTABLE);
+	n = lua_rawlen(T, 2);
+
+	/* check the list first, so we don't leak the buffer */
+	for (i = 1; i <= n; i++) {
+		int type = lua_rawgeti(T, 2, i);
+
+		if (type != LUA_TSTRING && type != LUA_TNUMBER)
+			return luaL_argerror(T, 2, "expected a list of strings");
+		lua_pop(T, 1);
+	}
+
+	b.data = NULL;
+	b.len = b.size = 0;
+	b.base = NULL;
+	b.offset = 0;
+
+	if (t->update) {
+		size_t max = t->limit < HPACK_DEFAULT_SIZE ?
+			t->limit : HPACK_DEFAULT_SIZE;
+
+		t->max = max;
+		hpack_evict(t, max);
+		hpack_putinteger(&b, 0x20, 5, max);
+		t->update = 0;
+	}
+
+	for (i = 1; i < n; i += 2) {
+		size_t nlen, vlen;
+		const char *name, *value;
+		size_t index;
+		int exact;
+
+		lua_rawgeti(T, 2, i);
+		lua_rawgeti(T, 2, i + 1);
+		name = lua_tolstring(T, -2, &nlen);
+		value = lua_tolstring(T, -1, &vlen);
+
+		index = hpack_find(t, name, nlen, value, vlen, &exact);
+		if (exact)
+			hpack_putinteger(&b, 0x80, 7, index);
+		else {
+			/* literal with incremental indexing */
+			hpack_putinteger(&b, 0x40, 6, index);
+			if (index == 0)
+				hpack_putstring(&b, name, nlen);
+			hpack_putstring(&b, value, vlen);
+			hpack_add(t, name, nlen, value, vlen);
+		}
+		lua_pop(T, 2);
+	}
+
+	lua_pushlstring(T, b.len ? b.data : "", b.len);
+	free(b.data);
+	return 1;
+}
@@ -30,6 +30,7 @@ local remove = table.remove
 local io       = require 'lem.io'
                  require 'lem.http'
 local response = require 'lem.http.response'
+local static   = require 'lem.http.static'
 
 local M = {}
 
@@ -88,6 +89,66 @@ end
 local urldecode = M.urldecode
 local newresponse = response.new
 
+-- Fill in the status and the default headers. Returns the response,
+-- which is replaced if the file can't be opened, the file to send if
+-- any, and the static cache entry it came from which must be released.
+local function prepare(self, req, res)
+	local headers = res.headers
+	local file, entry = res.file, nil
+	if type(file) == 'string' then
+		local err
+		entry, err = static.open(file)
+		if entry then
+			file = entry.file
+			if not res.status and not static.headers(req, res, entry) then
+				static.release(entry)
+				file, entry = nil, nil
+			end
+		else
+			self.debug('open', err)
+			file = nil
+			res = newresponse(req)
+			headers = res.headers
+			response.not_found(req, res)
+		end
+	end
+
+	if not res.status then
+		if #res == 0 and file == nil then
+			res.status = 204
+		else
+			res.status = 200
+		end
+	end
+
+	if headers['Content-Length'] == nil
+			and res.status ~= 204 and res.status ~= 304 then
+		local len
+		if entry then
+			len = entry.size
+		elseif file then
+			len = file:size()
+		else
+			len = 0
+			for i = 1, #res do
+				len = len + #res[i]
+			end
+		end
+
+		headers['Content-Length'] = len
+	end
+
+	if headers['Date'] == nil then
+		headers['Date'] = date('!%a, %d %b %Y %H:%M:%S GMT')
+	end
+
+	if headers['Server'] == nil then
+		headers['Server'] = 'Hathaway/0.1 LEM/0.3'
+	end
+
+	return res, file, entry
+end
+
 local function handleHTTP(self, client)
 	repeat
 		local req, err = client:read('HTTPRequest')
@@ -98,6 +159,19 @@ local function handleHTTP(self, client)
 		req.client = client
 		req.path = urldecode(uri:match('^([^?]*)'))
 
+		-- HTTP/2 with prior knowledge sends a preface which
+		-- looks like a request, upgrades come as HTTP/1.1
+		if method == 'PRI' and uri == '*' and version == '2.0' then
+			if client:read(6) == 'SM\r\n\r\n' then
+				return require('lem.http.h2').serve(self, client)
+			end
+			break
+		end
+		if version == '1.1' and req.headers['upgrade'] == 'h2c'
+				and req.headers['http2-settings'] then
+			if require('lem.http.h2').upgrade(self, req) then return end
+		end
+
 		local res = newresponse(req)
 
 		if version ~= '1.0' and version ~= '1.1' then
@@ -109,54 +183,17 @@ local function handleHTTP(self, client)
 				response.expectation_failed(req, res)
 			else
 				self.handler(req, res)
+				-- the connection was taken over, eg. by a websocket
+				if res.upgraded then return end
 			end
 		end
 
+		local file, entry
+		res, file, entry = self:prepare(req, res)
 		local headers = res.headers
-		local file, close = res.file, false
-		if type(file) == 'string' then
-			file, err = io.open(file)
-			if file then
-				close = true
-			else
-				self.debug('open', err)
-				res = newresponse(req)
-				headers = res.headers
-				response.not_found(req, res)
-			end
-		end
-
-		if not res.status then
-			if #res == 0 and file == nil then
-				res.status = 204
-			else
-				res.status = 200
-			end
-		end
-
-		if headers['Content-Length'] == nil and res.status ~= 204 then
-			local len
-			if file then
-				len = file:size()
-			else
-				len = 0
-				for i = 1, #res do
-					len = len + #res[i]
-				end
-			end
-
-			headers['Content-Length'] = len
-		end
-
-		if headers['Date'] == nil then
-			headers['Date'] = date('!%a, %d %b %Y %H:%M:%S GMT')
-		end
 
-		if headers['Server'] == nil then
-			headers['Server'] = 'Hathaway/0.1 LEM/0.3'
-		end
-
-		if req.headers['connection'] == 'close' and headers['Connection'] == nil then
+		if (self.draining or req.headers['connection'] == 'close')
+				and headers['Connection'] == nil then
 			headers['Connection'] = 'close'
 		end
 
@@ -175,20 +212,18 @@ local function handleHTTP(self, client)
 		client:cork()
 
 		local ok, err = client:write(concat(rope))
-		if not ok then self.debug('write', err) break end
-
-		if method ~= 'HEAD' then
+		if ok and method ~= 'HEAD' then
 			if file then
-				ok, err = client:sendfile(file, headers['Content-Length'])
-				if close then file:close() end
+				ok, err = client:sendfile(file, headers['Content-Length'], res.offset)
 			else
 				local body = concat(res)
 				if #body > 0 then
 					ok, err = client:write(body)
 				end
 			end
-			if not ok then self.debug('write', err) break end
 		end
+		if entry then static.release(entry) end
+		if not ok then self.debug('write', err) break end
 
 		client:uncork()
 
@@ -201,6 +236,8 @@ local Server = {}
 Server.__index = Server
 M.Server = Server
 
+Server.prepare = prepare
+
 function Server:run()
 	return self.socket:autospawn(function(...) return handleHTTP(self, ...) end)
 end
@@ -209,6 +246,16 @@ function Server:close()
 	return self.socket:close()
 end
 
+-- Stop accepting connections. Connections in flight
+-- are closed after the response to their current request.
+function Server:drain()
+	self.draining = true
+	return self.socket:close()
+end
+
+-- servers by their listening socket, for lem.reload
+M.servers = setmetatable({}, { __mode = 'k' })
+
 local type, setmetatable = type, setmetatable
 
 function M.new(host, port, handler)
@@ -223,11 +270,13 @@ function M.new(host, port, handler)
 		handler = port
 	end
 
-	return setmetatable({
+	local self = setmetatable({
 		socket = socket,
 		handler = handler,
 		debug = M.debug
 	}, Server)
+	M.servers[socket] = self
+	return self
 end
 
 return M
@@ -0,0 +1,341 @@
+--
+-- This file is part of LEM, a Lua Event Machine.
+-- Copyright 2026 agent
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+--
+
+local tonumber = tonumber
+local date = os.date
+local format = string.format
+
+local utils = require 'lem.utils'
+local io    = require 'lem.io'
+local lfs   = require 'lem.lfs'
+
+local now = utils.now
+local suspend, resume, thisthread = utils.suspend, utils.resume, utils.thisthread
+
+local M = {}
+
+-- seconds a cached entry is trusted before it is stat'ed again
+M.ttl = 1
+
+-- the number of open files kept around
+M.size = 256
+
+M.default_type = 'application/octet-stream'
+
+M.types = {
+	html = 'text/html; charset=UTF-8',
+	htm  = 'text/html; charset=UTF-8',
+	txt  = 'text/plain; charset=UTF-8',
+	css  = 'text/css; charset=UTF-8',
+	js   = 'application/javascript; charset=UTF-8',
+	json = 'application/json',
+	xml  = 'application/xml',
+	svg  = 'image/svg+xml',
+	png  = 'image/png',
+	jpg  = 'image/jpeg',
+	jpeg = 'image/jpeg',
+	gif  = 'image/gif',
+	ico  = 'image/x-icon',
+	webp = 'image/webp',
+	woff = 'font/woff',
+	woff2 = 'font/woff2',
+	pdf  = 'application/pdf',
+	wasm = 'application/wasm',
+	mp4  = 'video/mp4',
+	gz   = 'application/gzip',
+}
+
+function M.mimetype(path)
+	local ext = path:match('%.([^./]+)$')
+	return ext and M.types[ext:lower()] or M.default_type
+end
+
+--
+-- The cache maps paths to entries holding an open file and
+-- everything the response headers need. Entries are kept on a
+-- list in least recently used order. Every request using an
+-- entry holds a reference, so a file evicted or replaced while
+-- it is being sent is only closed when the last user is done.
+--
+local cache = {}
+local count = 0
+local head = {}
+head.prev, head.next = head, head
+
+local function unlink(e)
+	e.prev.next = e.next
+	e.next.prev = e.prev
+end
+
+local function pushfront(e)
+	e.prev, e.next = head, head.next
+	head.next.prev = e
+	head.next = e
+end
+
+local function retire(e)
+	cache[e.path] = nil
+	count = count - 1
+	unlink(e)
+	e.stale = true
+	if e.users == 0 then e.file:close() end
+end
+
+local function insert(e)
+	pushfront(e)
+	cache[e.path] = e
+	count = count + 1
+	while count > M.size do
+		retire(head.prev)
+	end
+end
+
+local function sameattr(e, attr)
+	return e.ino == attr.ino and e.dev == attr.dev
+		and e.size == attr.size and e.mtime == attr.modification
+end
+
+local function load(path)
+	local attr, err = lfs.attributes(path)
+	if not attr then return nil, err end
+	if attr.mode ~= 'file' then return nil, 'not a regular file' end
+
+	local file
+	file, err = io.open(path)
+	if not file then return nil, err end
+
+	local mtime = attr.modification
+	return {
+		path = path,
+		file = file,
+		users = 0,
+		checked = now(),
+		ino = attr.ino,
+		dev = attr.dev,
+		size = attr.size,
+		mtime = mtime,
+		etag = format('"%x-%x-%x"', attr.ino, attr.size, mtime),
+		lastmod = date('!%a, %d %b %Y %H:%M:%S GMT', mtime),
+		ctype = M.mimetype(path),
+	}
+end
+
+-- threads waiting for a path being loaded by another thread
+local loading = {}
+
+-- Returns the cache entry for path or nil and an error. On a hit
+-- nothing is done beyond an occasional stat to see if the file
+-- has changed. The entry must be given back with static.release().
+function M.open(path)
+	local e = cache[path]
+	if e and not e.checking and now() - e.checked >= M.ttl then
+		e.checking = true
+		local attr = lfs.attributes(path)
+		e.checking = false
+		if attr and sameattr(e, attr) then
+			e.checked = now()
+		elseif cache[path] == e then
+			retire(e)
+		end
+		e = cache[path]
+	end
+
+	if not e then
+		local waiting = loading[path]
+		if waiting then
+			waiting[#waiting+1] = thisthread()
+			suspend()
+			return M.open(path)
+		end
+
+		waiting = {}
+		loading[path] = waiting
+		local err
+		e, err = load(path)
+		loading[path] = nil
+		for i = 1, #waiting do
+			resume(waiting[i])
+		end
+		if not e then return nil, err end
+		insert(e)
+	elseif head.next ~= e then
+		unlink(e)
+		pushfront(e)
+	end
+
+	e.users = e.users + 1
+	return e
+end
+
+function M.release(e)
+	e.users = e.users - 1
+	if e.stale and e.users == 0 then e.file:close() end
+end
+
+-- close all cached files not in use
+function M.flush()
+	while head.prev ~= head do
+		retire(head.prev)
+	end
+end
+
+-- read len bytes from offset of the entry, for when sendfile
+-- can't be used. The cached file is shared, so it is not seeked.
+function M.read(e, offset, len)
+	local file, err = io.open(e.path)
+	if not file then return nil, err end
+	if offset > 0 then
+		local ok
+		ok, err = file:seek('set', offset)
+		if not ok then file:close() return nil, err end
+	end
+	local data
+	data, err = file:read(len)
+	file:close()
+	if not data then return nil, err end
+	return data
+end
+
+local httptime
+do
+	local months = {
+		Jan = 1, Feb = 2, Mar = 3, Apr = 4, May = 5, Jun = 6,
+		Jul = 7, Aug = 8, Sep = 9, Oct = 10, Nov = 11, Dec = 12,
+	}
+
+	-- seconds since the epoch of an IMF-fixdate
+	function httptime(s)
+		local d, mon, y, h, m, sec =
+			s:match('^%a+, (%d%d) (%a%a%a) (%d%d%d%d) (%d%d):(%d%d):(%d%d) GMT$')
+		mon = months[mon]
+		if not mon then return nil end
+		y = tonumber(y)
+		if mon <= 2 then y = y - 1 end
+		local era = y // 400
+		local yoe = y - era * 400
+		local doy = (153 * (mon + (mon > 2 and -3 or 9)) + 2) // 5 + tonumber(d) - 1
+		local doe = yoe * 365 + yoe // 4 - yoe // 100 + doy
+		local days = era * 146097 + doe - 719468
+		return ((days * 24 + tonumber(h)) * 60 + tonumber(m)) * 60 + tonumber(sec)
+	end
+	M.httptime = httptime
+end
+
+local function etagmatch(list, etag)
+	if list == '*' then return true end
+	for tag in list:gmatch('[^,%s]+') do
+		if tag == etag or tag == 'W/' .. etag then return true end
+	end
+	return false
+end
+
+-- Set the validators of entry e on res, and answer conditional and
+-- range requests. Returns true if (a range of) the file should be
+-- sent, or false if the status set on res has no body.
+function M.headers(req, res, e)
+	local rh, headers = req.headers, res.headers
+	local size = e.size
+
+	headers['Last-Modified'] = e.lastmod
+	headers['ETag'] = e.etag
+	headers['Accept-Ranges'] = 'bytes'
+	if headers['Content-Type'] == nil then
+		headers['Content-Type'] = e.ctype
+	end
+
+	local method = req.method
+	if method ~= 'GET' and method ~= 'HEAD' then return true end
+
+	local inm = rh['if-none-match']
+	if inm then
+		if etagmatch(inm, e.etag) then
+			res.status = 304
+			return false
+		end
+	elseif rh['if-modified-since'] then
+		local t = httptime(rh['if-modified-since'])
+		if t and e.mtime <= t then
+			res.status = 304
+			return false
+		end
+	end
+
+	local range = rh['range']
+	if not range then return true end
+	local ifrange = rh['if-range']
+	if ifrange and ifrange ~= e.etag and ifrange ~= e.lastmod then
+		return true
+	end
+
+	-- only a single range is served, anything else gets the whole file
+	local first, last = range:match('^bytes=%s*(%d*)%-(%d*)%s*$')
+	if not first or (first == '' and last == '') then return true end
+	if first == '' then
+		first = size - tonumber(last)
+		if first < 0 then first = 0 end
+		last = size - 1
+	else
+		first = tonumber(first)
+		last = last == '' and size - 1 or tonumber(last)
+		if last >= size then last = size - 1 end
+	end
+	if first > last then
+		res.status = 416
+		headers['Content-Range'] = format('bytes */%d', size)
+		return false
+	end
+
+	res.status = 206
+	res.offset = first
+	headers['Content-Range'] = format('bytes %d-%d/%d', first, last, size)
+	headers['Content-Length'] = last - first + 1
+	return true
+end
+
+-- Returns a handler serving files below the directory root.
+-- The request path is used with prefix removed from it.
+function M.handler(root, prefix)
+	prefix = prefix or ''
+	return function(req, res)
+		local path = req.path
+		if path:sub(1, #prefix) ~= prefix then
+			res.status = 404
+			return
+		end
+		path = path:sub(#prefix + 1)
+		if path:find('%z') then
+			res.status = 400
+			return
+		end
+		for seg in path:gmatch('[^/]+') do
+			if seg == '..' then
+				res.status = 403
+				return
+			end
+		end
+		if path == '' or path:sub(-1) == '/' then
+			path = path .. 'index.html'
+		end
+		if path:sub(1, 1) ~= '/' then path = '/' .. path end
+		res.file = root .. path
+	end
+end
+
+return M
+
+-- vim: ts=2 sw=2 noet:
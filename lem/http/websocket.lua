@@ -0,0 +1,265 @@
+--
+-- This file is part of LEM, a Lua Event Machine.
+-- Copyright 2026 agent
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+--
+
+local setmetatable = setmetatable
+local type = type
+local pairs = pairs
+local format = string.format
+local char, byte = string.char, string.byte
+local concat = table.concat
+local utf8len = utf8.len
+
+local websocket = require 'lem.http.websocket.core'
+local parsers   = require 'lem.parsers'
+local utils     = require 'lem.utils'
+
+parsers.lookup['WSFrame'] = websocket.WSFrame
+websocket.WSFrame = nil
+
+local header = websocket.header
+local spawn = utils.spawn
+
+local CONT, TEXT, BINARY, CLOSE, PING, PONG = 0, 1, 2, 8, 9, 10
+
+-- the largest message received
+websocket.maxsize = 16*1024*1024
+
+local WebSocket = {}
+WebSocket.__index = WebSocket
+websocket.WebSocket = WebSocket
+
+-- header and payload go out with one writev()
+local function send(self, opcode, payload)
+	return self.client:write(header(opcode, #payload), payload)
+end
+
+function WebSocket:send(msg, binary)
+	if self.closing then return nil, 'closed' end
+	return send(self, binary and BINARY or TEXT, msg)
+end
+
+function WebSocket:ping(data)
+	if self.closing then return nil, 'closed' end
+	return send(self, PING, data or '')
+end
+
+local function closeframe(code, reason)
+	if code == nil then return '' end
+	return char(code >> 8, code & 0xFF) .. (reason or '')
+end
+
+-- send a close frame, the connection is closed
+-- when the peer answers or the next read fails
+function WebSocket:close(code, reason)
+	if self.closing then return nil, 'closed' end
+	self.closing = true
+	local ok, err = send(self, CLOSE, closeframe(code or 1000, reason))
+	if not ok or not self.reading then
+		self.client:close()
+	end
+	return ok, err
+end
+
+local function fail(self, code, err)
+	if not self.closing then
+		self.closing = true
+		send(self, CLOSE, closeframe(code))
+	end
+	self.client:close()
+	return nil, err
+end
+
+-- frame parser errors and the close codes they are answered with
+local close_codes = {
+	['reserved bits set']     = 1002,
+	['frame not masked']      = 1002,
+	['unexpected mask']       = 1002,
+	['invalid control frame'] = 1002,
+	['frame too large']       = 1009,
+}
+
+-- receive the next message, returns the message
+-- and 'text' or 'binary', or nil and an error
+function WebSocket:receive()
+	local client, maxsize = self.client, self.maxsize
+	local opcode, parts, size
+
+	self.reading = true
+	while true do
+		local op, payload, fin = client:read('WSFrame', maxsize, true)
+		if not op then
+			self.reading = false
+			local code = close_codes[payload]
+			if code then return fail(self, code, payload) end
+			self.closing = true
+			client:close()
+			return nil, payload
+		end
+
+		if op == PING then
+			if not self.closing then send(self, PONG, payload) end
+		elseif op == PONG then
+			if self.onpong then self.onpong(payload) end
+		elseif op == CLOSE then
+			self.reading = false
+			if #payload == 1 then
+				return fail(self, 1002, 'protocol error')
+			end
+			if not self.closing then
+				self.closing = true
+				send(self, CLOSE, payload:sub(1, 2))
+			end
+			client:close()
+			if #payload >= 2 then
+				local hi, lo = byte(payload, 1, 2)
+				self.code, self.reason = hi << 8 | lo, payload:sub(3)
+			end
+			return nil, 'closed'
+		elseif op == TEXT or op == BINARY then
+			if parts then
+				self.reading = false
+				return fail(self, 1002, 'protocol error')
+			end
+			if fin then
+				parts = payload
+				opcode = op
+				break
+			end
+			opcode, parts, size = op, { payload }, #payload
+		elseif op == CONT and parts then
+			size = size + #payload
+			if size > maxsize then
+				self.reading = false
+				return fail(self, 1009, 'message too large')
+			end
+			parts[#parts+1] = payload
+			if fin then
+				parts = concat(parts)
+				break
+			end
+		else
+			self.reading = false
+			return fail(self, 1002, 'protocol error')
+		end
+	end
+	self.reading = false
+
+	if opcode == TEXT then
+		if not utf8len(parts) then
+			return fail(self, 1007, 'invalid utf-8')
+		end
+		return parts, 'text'
+	end
+	return parts, 'binary'
+end
+
+-- iterate over the messages received
+function WebSocket:messages()
+	return self.receive, self
+end
+
+local function contains(list, token)
+	if not list then return false end
+	for t in list:gmatch('[^,%s]+') do
+		if t:lower() == token then return true end
+	end
+	return false
+end
+
+-- Answer an upgrade request. On success the connection is taken
+-- over and handleHTTP leaves it alone after the handler returns.
+-- protocols is an optional list of supported subprotocols.
+function websocket.upgrade(req, res, protocols)
+	local headers = req.headers
+	local key = headers['sec-websocket-key']
+
+	if req.method ~= 'GET' or req.version ~= '1.1'
+			or not contains(headers['upgrade'], 'websocket')
+			or not contains(headers['connection'], 'upgrade')
+			or not key or #key ~= 24 then
+		res.status = 400
+		return nil, 'bad request'
+	end
+
+	if headers['sec-websocket-version'] ~= '13' then
+		res.status = 426
+		res.headers['Sec-WebSocket-Version'] = '13'
+		return nil, 'unsupported version'
+	end
+
+	local protocol
+	if protocols and headers['sec-websocket-protocol'] then
+		for p in headers['sec-websocket-protocol']:gmatch('[^,%s]+') do
+			for i = 1, #protocols do
+				if protocols[i] == p then protocol = p break end
+			end
+			if protocol then break end
+		end
+	end
+
+	local rope = {
+		'HTTP/1.1 101 Switching Protocols\r\n',
+		'Upgrade: websocket\r\n',
+		'Connection: Upgrade\r\n',
+		format('Sec-WebSocket-Accept: %s\r\n', websocket.accept(key)),
+	}
+	if protocol then
+		rope[#rope+1] = format('Sec-WebSocket-Protocol: %s\r\n', protocol)
+	end
+	rope[#rope+1] = '\r\n'
+
+	local client = req.client
+	local ok, err = client:write(concat(rope))
+	if not ok then return nil, err end
+	res.upgraded = true
+
+	return setmetatable({
+		client = client,
+		protocol = protocol,
+		maxsize = websocket.maxsize,
+		closing = false,
+		reading = false,
+	}, WebSocket)
+end
+
+local function broadcast_one(ws, frame)
+	if not ws.client:write(frame) then
+		ws.closing = true
+		ws.client:close()
+	end
+end
+
+-- Send msg to all websockets in list (an array or a set). The frame
+-- is encoded once and written to each connection from its own thread,
+-- so one slow client doesn't hold up the others.
+function websocket.broadcast(list, msg, binary)
+	local frame = header(binary and BINARY or TEXT, #msg) .. msg
+	local n = 0
+	for k, v in pairs(list) do
+		local ws = type(k) == 'table' and k or v
+		if not ws.closing then
+			spawn(broadcast_one, ws, frame)
+			n = n + 1
+		end
+	end
+	return n
+end
+
+return websocket
+
+-- vim: ts=2 sw=2 noet:
@@ -0,0 +1,397 @@
+/*
+ * This file is part of LEM, a Lua Event Machine.
+ * Copyright 2026 agent
+ *
+ * LEM is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * LEM is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <lem-parsers.h>
+
+/*
+ * SHA-1, only used for the opening handshake
+ */
+#define ROL32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+struct sha1 {
+	uint32_t h[5];
+	uint64_t len;
+	unsigned char block[64];
+};
+
+static void
+sha1_block(struct sha1 *c, const unsigned char *p)
+{
+	uint32_t w[80];
+	uint32_t a, b, d, e, f, k, t;
+	uint32_t cc;
+	int i;
+
+	for (i = 0; i < 16; i++)
+		w[i] = (uint32_t)p[4*i] << 24 | (uint32_t)p[4*i+1] << 16 |
+			(uint32_t)p[4*i+2] << 8 | (uint32_t)p[4*i+3];
+	for (; i < 80; i++)
+		w[i] = ROL32(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+
+	a = c->h[0]; b = c->h[1]; cc = c->h[2]; d = c->h[3]; e = c->h[4];
+	for (i = 0; i < 80; i++) {
+		if (i < 20) {
+			f = (b & cc) | (~b & d);
+			k = 0x5A827999;
+		} else if (i < 40) {
+			f = b ^ cc ^ d;
+			k = 0x6ED9EBA1;
+		} else if (i < 60) {
+			f = (b & cc) | (b & d) | (cc & d);
+			k = 0x8F1BBCDC;
+		} else {
+			f = b ^ cc ^ d;
+			k = 0xCA62C1D6;
+		}
+		t = ROL32(a, 5) + f + e + k + w[i];
+		e = d;
+		d = cc;
+		cc = ROL32(b, 30);
+		b = a;
+		a = t;
+	}
+	c->h[0] += a; c->h[1] += b; c->h[2] += cc; c->h[3] += d; c->h[4] += e;
+}
+
+static void
+sha1_init(struct sha1 *c)
+{
+	c->h[0] = 0x67452301;
+	c->h[1] = 0xEFCDAB89;
+	c->h[2] = 0x98BADCFE;
+	c->h[3] = 0x10325476;
+	c->h[4] = 0xC3D2E1F0;
+	c->len = 0;
+}
+
+static void
+sha1_update(struct sha1 *c, const unsigned char *p, size_t len)
+{
+	size_t used = c->len & 63;
+
+	c->len += len;
+	while (len > 0) {
+		size_t n = 64 - used;
+
+		if (n > len)
+			n = len;
+		memcpy(c->block + used, p, n);
+		used += n;
+		p += n;
+		len -= n;
+		if (used == 64) {
+			sha1_block(c, c->block);
+			used = 0;
+		}
+	}
+}
+
+static void
+sha1_final(struct sha1 *c, unsigned char digest[20])
+{
+	uint64_t bits = c->len << 3;
+	unsigned char pad[8];
+	int i;
+
+	sha1_update(c, (const unsigned char *)"\x80", 1);
+	while ((c->len & 63) != 56)
+		sha1_update(c, (const unsigned char *)"", 1);
+	for (i = 0; i < 8; i++)
+		pad[i] = bits >> (56 - 8*i);
+	sha1_update(c, pad, 8);
+
+	for (i = 0; i < 20; i++)
+		digest[i] = c->h[i/4] >> (24 - 8*(i%4));
+}
+
+static const char ws_guid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+static const char base64[] =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/*
+ * websocket.accept(key) computes Sec-WebSocket-Accept for key
+ */
+static int
+ws_accept(lua_State *T)
+{
+	size_t len;
+	const char *key = luaL_checklstring(T, 1, &len);
+	struct sha1 c;
+	unsigned char d[21];
+	char out[28];
+	int i;
+
+	sha1_init(&c);
+	sha1_update(&c, (const unsigned char *)key, len);
+	sha1_update(&c, (const unsigned char *)ws_guid, sizeof(ws_guid) - 1);
+	sha1_final(&c, d);
+	d[20] = 0;
+
+	for (i = 0; i < 7; i++) {
+		uint32_t v = (uint32_t)d[3*i] << 16 | (uint32_t)d[3*i+1] << 8 | d[3*i+2];
+
+		out[4*i]   = base64[(v >> 18) & 63];
+		out[4*i+1] = base64[(v >> 12) & 63];
+		out[4*i+2] = base64[(v >> 6) & 63];
+		out[4*i+3] = base64[v & 63];
+	}
+	out[27] = '=';
+
+	lua_pushlstring(T, out, 28);
+	return 1;
+}
+
+/*
+ * websocket.header(opcode, len[, fin]) encodes an unmasked frame header
+ */
+static int
+ws_header(lua_State *T)
+{
+	lua_Integer opcode = luaL_checkinteger(T, 1);
+	lua_Integer len = luaL_checkinteger(T, 2);
+	unsigned char h[10];
+	size_t n;
+
+	luaL_argcheck(T, opcode >= 0 && opcode < 16, 1, "invalid opcode");
+	luaL_argcheck(T, len >= 0, 2, "out of range");
+
+	h[0] = opcode;
+	if (lua_isnoneornil(T, 3) || lua_toboolean(T, 3))
+		h[0] |= 0x80;
+
+	if (len < 126) {
+		h[1] = len;
+		n = 2;
+	} else if (len < 0x10000) {
+		h[1] = 126;
+		h[2] = len >> 8;
+		h[3] = len;
+		n = 4;
+	} else {
+		int i;
+
+		h[1] = 127;
+		for (i = 0; i < 8; i++)
+			h[2+i] = (lua_Unsigned)len >> (56 - 8*i);
+		n = 10;
+	}
+
+	lua_pushlstring(T, (char *)h, n);
+	return 1;
+}
+
+/*
+ * Unmask len bytes at p, which are at offset off of the payload.
+ * The mask is repeated into a 64bit word, so most of the payload
+ * is done a word at a time.
+ */
+static void
+ws_unmask(unsigned char *p, size_t len, const unsigned char mask[4], size_t off)
+{
+	unsigned char m[8];
+	uint64_t w;
+	size_t i;
+
+	for (i = 0; i < 8; i++)
+		m[i] = mask[(off + i) & 3];
+	memcpy(&w, m, 8);
+
+	for (i = 0; i + 8 <= len; i += 8) {
+		uint64_t v;
+
+		memcpy(&v, p + i, 8);
+		v ^= w;
+		memcpy(p + i, &v, 8);
+	}
+	for (; i < len; i++)
+		p[i] ^= m[i & 7];
+}
+
+/*
+ * Read one frame and return opcode, payload and fin.
+ * Optional arguments are the maximum payload size and
+ * whether frames must be masked (true) or not (false).
+ */
+struct parse_ws_state {
+	uint64_t target;
+	int parts;
+	unsigned char mask[4];
+	unsigned char off;
+	unsigned char header;
+	unsigned char opcode;
+	unsigned char fin;
+	unsigned char masked;
+};
+LEM_BUILD_ASSERT(sizeof(struct parse_ws_state) < LEM_INPUTBUF_PSIZE);
+
+static void
+parse_ws_init(lua_State *T, struct lem_inputbuf *b)
+{
+	struct parse_ws_state *s = (struct parse_ws_state *)&b->pstate;
+	lua_Integer max = luaL_optinteger(T, 3, 0);
+
+	luaL_argcheck(T, max >= 0, 3, "out of range");
+	s->masked = lua_isnoneornil(T, 4) ? 2 : lua_toboolean(T, 4);
+	s->header = 1;
+	s->parts = 0;
+	lua_settop(T, 3);
+}
+
+static int
+parse_ws_error(lua_State *T, struct lem_inputbuf *b, const char *msg)
+{
+	b->start = b->end = 0;
+	lua_settop(T, 0);
+	lua_pushnil(T);
+	lua_pushstring(T, msg);
+	return 2;
+}
+
+static int
+parse_ws_process(lua_State *T, struct lem_inputbuf *b)
+{
+	struct parse_ws_state *s = (struct parse_ws_state *)&b->pstate;
+	unsigned char *p;
+	size_t size;
+
+	if (s->header) {
+		size_t need = 2;
+		uint64_t len = 0;
+		int masked = 0;
+
+		p = (unsigned char *)b->buf + b->start;
+		size = b->end - b->start;
+		if (size >= 2) {
+			masked = p[1] >> 7;
+			len = p[1] & 0x7F;
+			if (len == 126)
+				need += 2;
+			else if (len == 127)
+				need += 8;
+			if (masked)
+				need += 4;
+		}
+		if (size < need) {
+			if (b->end == LEM_INPUTBUF_SIZE && b->start > 0) {
+				memmove(b->buf, p, size);
+				b->end = size;
+				b->start = 0;
+			}
+			return 0;
+		}
+
+		if (p[0] & 0x70)
+			return parse_ws_error(T, b, "reserved bits set");
+		if (s->masked != 2 && masked != s->masked)
+			return parse_ws_error(T, b, masked ?
+					"unexpected mask" : "frame not masked");
+		s->opcode = p[0] & 0x0F;
+		s->fin = p[0] >> 7;
+
+		if (len == 126)
+			len = (uint64_t)p[2] << 8 | p[3];
+		else if (len == 127) {
+			int i;
+
+			len = 0;
+			for (i = 2; i < 10; i++)
+				len = (len << 8) | p[i];
+			if (len >> 63)
+				return parse_ws_error(T, b, "frame too large");
+		}
+		if (s->opcode & 0x08) {
+			if (len > 125 || !s->fin)
+				return parse_ws_error(T, b, "invalid control frame");
+		} else {
+			lua_Integer max = lua_tointeger(T, 3);
+
+			if (max > 0 && len > (lua_Unsigned)max)
+				return parse_ws_error(T, b, "frame too large");
+		}
+
+		if (masked)
+			memcpy(s->mask, p + need - 4, 4);
+		else
+			memset(s->mask, 0, 4);
+		b->start += need;
+		s->target = len;
+		s->off = 0;
+		s->header = 0;
+	}
+
+	p = (unsigned char *)b->buf + b->start;
+	size = b->end - b->start;
+	if (size < s->target) {
+		if (b->end < LEM_INPUTBUF_SIZE)
+			return 0;
+
+		/* the buffer is full, so save what we have */
+		ws_unmask(p, size, s->mask, s->off);
+		lua_pushlstring(T, (char *)p, size);
+		s->parts++;
+		if (s->parts == LUA_MINSTACK-2) {
+			lua_concat(T, LUA_MINSTACK-2);
+			s->parts = 1;
+		}
+		s->target -= size;
+		s->off = (s->off + size) & 3;
+		b->start = b->end = 0;
+		return 0;
+	}
+
+	size = s->target;
+	ws_unmask(p, size, s->mask, s->off);
+	lua_pushlstring(T, (char *)p, size);
+	lua_concat(T, s->parts + 1);
+	b->start += size;
+	if (b->start == b->end)
+		b->start = b->end = 0;
+
+	lua_pushinteger(T, s->opcode);
+	lua_insert(T, -2);
+	lua_pushboolean(T, s->fin);
+	return 3;
+}
+
+static const struct lem_parser ws_parser = {
+	.init    = parse_ws_init,
+	.process = parse_ws_process,
+};
+
+int
+luaopen_lem_http_websocket_core(lua_State *L)
+{
+	/* create module table */
+	lua_newtable(L);
+
+	/* push the frame parser */
+	lua_pushlightuserdata(L, (void *)&ws_parser);
+	lua_setfield(L, -2, "WSFrame");
+
+	/* set accept function */
+	lua_pushcfunction(L, ws_accept);
+	lua_setfield(L, -2, "accept");
+
+	/* set header function */
+	lua_pushcfunction(L, ws_header);
+	lua_setfield(L, -2, "header");
+
+	return 1;
+}
@@ -27,6 +27,7 @@ do
 	local parsers = require 'lem.parsers'
 
 	io.Stream.read = parsers.newreader(io.Stream.readp)
+	io.Stream.readmany = parsers.newmanyreader(io.Stream.readmanyp)
 	io.File.read   = parsers.newreader(io.File.readp)
 end
 
@@ -117,6 +118,27 @@ do
 		return rok, rerr
 	end
 
+	-- the limits apply to each listening socket on its own
+	function MultiServer:setlimits(max, rate, batch)
+		for i = 1, #self do
+			self[i]:setlimits(max, rate, batch)
+		end
+		return true
+	end
+
+	function MultiServer:stats()
+		local r = self[1]:stats()
+		for i = 2, #self do
+			local s = self[i]:stats()
+			r.accepted = r.accepted + s.accepted
+			r.rejected = r.rejected + s.rejected
+			r.limited = r.limited + s.limited
+			r.active = r.active + s.active
+			r.paused = r.paused or s.paused
+		end
+		return r
+	end
+
 
 	local function autospawn(self, i, handler)
 		local ok, err = self[i]:autospawn(handler)
@@ -145,20 +167,20 @@ do
 	local setmetatable = setmetatable
 	local listen4, listen6 = io.tcp.listen4, io.tcp.listen6
 
-	function io.tcp.listen(host, port)
+	function io.tcp.listen(host, port, backlog, reuseport)
 		if host:match(':') then
-			return listen6(host, port)
+			return listen6(host, port, backlog, reuseport)
 		end
 
-		local s6, err = listen6(host, port)
+		local s6, err = listen6(host, port, backlog, reuseport)
 		if s6 then
-			local s4 = listen4(host, port)
+			local s4 = listen4(host, port, backlog, reuseport)
 			if s4 then
 				return setmetatable({ s6, s4 }, MultiServer)
 			end
 			return s6
 		else
-			return listen4(host, port)
+			return listen4(host, port, backlog, reuseport)
 		end
 	end
 end
@@ -21,12 +21,15 @@
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <stddef.h>
+#include <limits.h>
 #include <assert.h>
 
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
 #include <netinet/tcp.h>
 #include <netdb.h>
@@ -48,6 +51,36 @@ extern char **environ;
 
 #include <lem-parsers.h>
 
+/* syscalls and bytes of each kind of i/o, for lem.stats */
+#define IO_STREAM 0
+#define IO_FILE   1
+#define IO_UDP    2
+#define IO_KINDS  3
+struct io_counters {
+	unsigned long reads;
+	unsigned long writes;
+	unsigned long rbytes;
+	unsigned long wbytes;
+};
+static __thread struct io_counters io_counters[IO_KINDS];
+static __thread unsigned long io_accepts;
+
+static inline void
+io_count_read(int kind, ssize_t bytes)
+{
+	io_counters[kind].reads++;
+	if (bytes > 0)
+		io_counters[kind].rbytes += bytes;
+}
+
+static inline void
+io_count_write(int kind, ssize_t bytes)
+{
+	io_counters[kind].writes++;
+	if (bytes > 0)
+		io_counters[kind].wbytes += bytes;
+}
+
 static int
 io_closed(lua_State *T)
 {
@@ -104,11 +137,94 @@ error:
 	return luaL_argerror(T, idx, "invalid permissions");
 }
 
+static int
+io_socket_listening(int fd)
+{
+	int val;
+	socklen_t len = sizeof(int);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &val, &len) == 0 && val)
+		return 1;
+
+	return 0;
+}
+
+/*
+ * Find out what fd should be wrapped in. Returns 0 for a file,
+ * 1 for a stream and 2 for a listening socket, which are made
+ * non-blocking, or -errno.
+ */
+static int
+io_fdkind(int fd)
+{
+	struct stat st;
+	int ret;
+
+	if (fstat(fd, &st))
+		return -errno;
+
+	lem_debug("st.st_mode & S_IFMT = %o", st.st_mode & S_IFMT);
+	switch (st.st_mode & S_IFMT) {
+	case S_IFREG:
+	case S_IFBLK:
+		return 0;
+
+	case S_IFSOCK:
+		if (io_socket_listening(fd)) {
+			ret = 2;
+			break;
+		}
+		/* fallthrough */
+	case S_IFCHR:
+	case S_IFIFO:
+		ret = 1;
+		break;
+
+	default:
+		return -EINVAL;
+	}
+
+	if (fcntl(fd, F_SETFL, O_NONBLOCK) == -1)
+		return -errno;
+	return ret;
+}
+
 #include "file.c"
 #include "stream.c"
 #include "server.c"
 #include "tcp.c"
 #include "unix.c"
+#include "udp.c"
+
+/*
+ * io.stats() returns the reads, writes and bytes of streams,
+ * files and udp sockets, and the number of accepted connections
+ */
+static int
+io_stats(lua_State *T)
+{
+	static const char *const names[IO_KINDS] = { "stream", "file", "udp" };
+	int i;
+
+	lua_createtable(T, 0, IO_KINDS + 1);
+	for (i = 0; i < IO_KINDS; i++) {
+		struct io_counters *c = &io_counters[i];
+
+		lua_createtable(T, 0, 4);
+		lua_pushinteger(T, c->reads);
+		lua_setfield(T, -2, "reads");
+		lua_pushinteger(T, c->writes);
+		lua_setfield(T, -2, "writes");
+		lua_pushinteger(T, c->rbytes);
+		lua_setfield(T, -2, "rbytes");
+		lua_pushinteger(T, c->wbytes);
+		lua_setfield(T, -2, "wbytes");
+		lua_setfield(T, -2, names[i]);
+	}
+	lua_pushinteger(T, io_accepts);
+	lua_setfield(T, -2, "accepts");
+	return 1;
+}
 
 /*
  * io.open()
@@ -271,55 +387,12 @@ struct fromfd {
 	int ret;
 };
 
-static int
-io_socket_listening(int fd)
-{
-	int val;
-	socklen_t len = sizeof(int);
-
-	if (getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &val, &len) == 0 && val)
-		return 1;
-
-	return 0;
-}
-
 static void
 io_fromfd_work(struct lem_async *a)
 {
 	struct fromfd *ff = (struct fromfd *)a;
-	struct stat st;
-
-	if (fstat(ff->fd, &st)) {
-		ff->ret = -errno;
-		return;
-	}
-
-	lem_debug("st.st_mode & S_IFMT = %o", st.st_mode & S_IFMT);
-	switch (st.st_mode & S_IFMT) {
-	case S_IFREG:
-	case S_IFBLK:
-		ff->ret = 0;
-		break;
 
-	case S_IFSOCK:
-		if (io_socket_listening(ff->fd)) {
-			ff->ret = 2;
-			goto nonblock;
-		}
-		/* fallthrough */
-	case S_IFCHR:
-	case S_IFIFO:
-		ff->ret = 1;
-		goto nonblock;
-
-	default:
-		ff->ret = -EINVAL;
-		break;
-	}
-	return;
-nonblock:
-	if (fcntl(ff->fd, F_SETFL, O_NONBLOCK) == -1)
-		ff->ret = -errno;
+	ff->ret = io_fdkind(ff->fd);
 }
 
 static void
@@ -620,6 +693,9 @@ luaopen_lem_io_core(lua_State *L)
 	/* mt.readp = <stream_readp> */
 	lua_pushcfunction(L, stream_readp);
 	lua_setfield(L, -2, "readp");
+	/* mt.readmanyp = <stream_readmanyp> */
+	lua_pushcfunction(L, stream_readmanyp);
+	lua_setfield(L, -2, "readmanyp");
 	/* mt.write = <stream_write> */
 	lua_pushcfunction(L, stream_write);
 	lua_setfield(L, -2, "write");
@@ -631,12 +707,18 @@ luaopen_lem_io_core(lua_State *L)
 	lua_pushcfunction(L, stream_uncork);
 	lua_setfield(L, -2, "uncork");
 #endif
+	/* mt.nodelay = <stream_nodelay> */
+	lua_pushcfunction(L, stream_nodelay);
+	lua_setfield(L, -2, "nodelay");
 	/* mt.getpeer = <stream_getpeer> */
 	lua_pushcfunction(L, stream_getpeer);
 	lua_setfield(L, -2, "getpeer");
 	/* mt.sendfile = <stream_sendfile> */
 	lua_pushcfunction(L, stream_sendfile);
 	lua_setfield(L, -2, "sendfile");
+	/* mt.splice = <stream_splice> */
+	lua_pushcfunction(L, stream_splice);
+	lua_setfield(L, -2, "splice");
 	/* insert io.stdin stream */
 	push_stdstream(L, STDIN_FILENO);
 	lua_setfield(L, -3, "stdin");
@@ -663,6 +745,9 @@ luaopen_lem_io_core(lua_State *L)
 	/* mt.busy = <server_busy> */
 	lua_pushcfunction(L, server_busy);
 	lua_setfield(L, -2, "busy");
+	/* mt.fileno = <server_fileno> */
+	lua_pushcfunction(L, server_fileno);
+	lua_setfield(L, -2, "fileno");
 	/* mt.close = <server_close> */
 	lua_pushcfunction(L, server_close);
 	lua_setfield(L, -2, "close");
@@ -677,9 +762,69 @@ luaopen_lem_io_core(lua_State *L)
 	lua_getfield(L, -2, "Stream"); /* upvalue 1 = Stream */
 	lua_pushcclosure(L, server_autospawn, 1);
 	lua_setfield(L, -2, "autospawn");
+	/* mt.setlimits = <server_setlimits> */
+	lua_pushcfunction(L, server_setlimits);
+	lua_setfield(L, -2, "setlimits");
+	/* mt.stats = <server_stats> */
+	lua_pushcfunction(L, server_stats);
+	lua_setfield(L, -2, "stats");
 	/* insert table */
 	lua_setfield(L, -2, "Server");
 
+	/* the fd passing methods of Stream need all the metatables */
+	lua_getfield(L, -1, "Stream");
+	/* mt.sendfd = <unix_sendfd> */
+	lua_getfield(L, -2, "File");   /* upvalue 1 = File   */
+	lua_getfield(L, -3, "Stream"); /* upvalue 2 = Stream */
+	lua_getfield(L, -4, "Server"); /* upvalue 3 = Server */
+	lua_pushcclosure(L, unix_sendfd, 3);
+	lua_setfield(L, -2, "sendfd");
+	/* mt.recvfd = <unix_recvfd> */
+	lua_getfield(L, -2, "File");   /* upvalue 1 = File   */
+	lua_getfield(L, -3, "Stream"); /* upvalue 2 = Stream */
+	lua_getfield(L, -4, "Server"); /* upvalue 3 = Server */
+	lua_pushcclosure(L, unix_recvfd, 3);
+	lua_setfield(L, -2, "recvfd");
+	lua_pop(L, 1);
+
+	/* create UDP metatable */
+	lua_newtable(L);
+	/* mt.__index = mt */
+	lua_pushvalue(L, -1);
+	lua_setfield(L, -2, "__index");
+	/* mt.__gc = <udp_gc> */
+	lua_pushcfunction(L, udp_gc);
+	lua_setfield(L, -2, "__gc");
+	/* mt.closed = <udp_closed> */
+	lua_pushcfunction(L, udp_closed);
+	lua_setfield(L, -2, "closed");
+	/* mt.close = <udp_close> */
+	lua_pushcfunction(L, udp_close);
+	lua_setfield(L, -2, "close");
+	/* mt.recvfrom = <udp_recvfrom> */
+	lua_pushcfunction(L, udp_recvfrom);
+	lua_setfield(L, -2, "recvfrom");
+	/* mt.recvmany = <udp_recvmany> */
+	lua_pushcfunction(L, udp_recvmany);
+	lua_setfield(L, -2, "recvmany");
+	/* mt.sendto = <udp_sendto> */
+	lua_pushcfunction(L, udp_sendto);
+	lua_setfield(L, -2, "sendto");
+	/* mt.send = <udp_sendto> */
+	lua_pushcfunction(L, udp_sendto);
+	lua_setfield(L, -2, "send");
+	/* mt.sendmany = <udp_sendmany> */
+	lua_pushcfunction(L, udp_sendmany);
+	lua_setfield(L, -2, "sendmany");
+	/* mt.buffers = <udp_buffers> */
+	lua_pushcfunction(L, udp_buffers);
+	lua_setfield(L, -2, "buffers");
+	/* mt.getsockname = <udp_getsockname> */
+	lua_pushcfunction(L, udp_getsockname);
+	lua_setfield(L, -2, "getsockname");
+	/* insert table */
+	lua_setfield(L, -2, "UDP");
+
 	/* insert open function */
 	lua_getfield(L, -1, "File");   /* upvalue 1 = File   */
 	lua_getfield(L, -2, "Stream"); /* upvalue 2 = Stream */
@@ -699,6 +844,9 @@ luaopen_lem_io_core(lua_State *L)
 	lua_getfield(L, -1, "Stream"); /* upvalue 1 = Stream */
 	lua_pushcclosure(L, io_streamfile, 1);
 	lua_setfield(L, -2, "streamfile");
+	/* insert stats function */
+	lua_pushcfunction(L, io_stats);
+	lua_setfield(L, -2, "stats");
 
 	/* create tcp table */
 	lua_createtable(L, 0, 0);
@@ -730,5 +878,18 @@ luaopen_lem_io_core(lua_State *L)
 	/* insert the unix table */
 	lua_setfield(L, -2, "unix");
 
+	/* create udp table */
+	lua_createtable(L, 0, 0);
+	/* insert the bind function */
+	lua_getfield(L, -2, "UDP"); /* upvalue 1 = UDP */
+	lua_pushcclosure(L, udp_bind, 1);
+	lua_setfield(L, -2, "bind");
+	/* insert the connect function */
+	lua_getfield(L, -2, "UDP"); /* upvalue 1 = UDP */
+	lua_pushcclosure(L, udp_connect, 1);
+	lua_setfield(L, -2, "connect");
+	/* insert the udp table */
+	lua_setfield(L, -2, "udp");
+
 	return 1;
 }
@@ -21,6 +21,7 @@ struct file {
 	lua_State *T;
 	int fd;
 	int ret;
+	ssize_t bytes; /* of the last read or write, for lem.stats */
 	union {
 		struct {
 			struct lem_parser *p;
@@ -168,6 +169,7 @@ file_readp_work(struct lem_async *a)
 			LEM_INPUTBUF_SIZE - f->buf.end);
 
 	lem_debug("read %ld bytes from %d", bytes, f->fd);
+	f->bytes = bytes;
 	if (bytes > 0) {
 		f->ret = 0;
 		f->buf.end += bytes;
@@ -187,6 +189,7 @@ file_readp_reap(struct lem_async *a)
 	lua_State *T = f->T;
 	int ret;
 
+	io_count_read(IO_FILE, f->bytes);
 	if (f->ret) {
 		enum lem_preason res = f->ret < 0 ? LEM_PCLOSED : LEM_PERROR;
 
@@ -225,16 +228,17 @@ file_readp(lua_State *T)
 	int ret;
 
 	luaL_checktype(T, 1, LUA_TUSERDATA);
-	ret = lua_type(T, 2);
-	if (ret != LUA_TUSERDATA && ret != LUA_TLIGHTUSERDATA)
-		return luaL_argerror(T, 2, "expected userdata");
-
 	f = lua_touserdata(T, 1);
 	if (f->fd < 0)
 		return io_closed(T);
 	if (f->T != NULL)
 		return io_busy(T);
 
+	lem_inputbuf_setdst(T, &f->buf);
+	ret = lua_type(T, 2);
+	if (ret != LUA_TUSERDATA && ret != LUA_TLIGHTUSERDATA)
+		return luaL_argerror(T, 2, "expected userdata");
+
 	p = lua_touserdata(T, 2);
 	if (p->init)
 		p->init(T, &f->buf);
@@ -258,6 +262,7 @@ file_write_work(struct lem_async *a)
 	struct file *f = (struct file *)a;
 	ssize_t bytes = write(f->fd, f->write.str, f->write.len);
 
+	f->bytes = bytes;
 	if (bytes < 0)
 		f->ret = errno;
 	else
@@ -271,6 +276,7 @@ file_write_reap(struct lem_async *a)
 	lua_State *T = f->T;
 	int top;
 
+	io_count_write(IO_FILE, f->bytes);
 	if (f->ret) {
 		f->T = NULL;
 		lem_queue(T, io_strerror(T, f->ret));
@@ -16,9 +16,16 @@
 -- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
 --
 
+-- Serialize concurrent writes to a file or stream.
+--
+-- Streams queue concurrent writers themselves and write everything
+-- pending with one writev() call, so for them the wrapper just passes
+-- writes on. Files are still serialized here.
+
 local utils = require 'lem.utils'
+local io    = require 'lem.io'
 
-local setmetatable = setmetatable
+local setmetatable, getmetatable = setmetatable, getmetatable
 local thisthread, suspend, resume
 	= utils.thisthread, utils.suspend, utils.resume
 
@@ -34,6 +41,13 @@ function Stream:close(...)
 end
 
 function Stream:write(...)
+	return self.stream:write(...)
+end
+
+local Serialized = setmetatable({}, { __index = Stream })
+Serialized.__index = Serialized
+
+function Serialized:write(...)
 	local nxt = self.next
 	if nxt == 0 then
 		nxt = 1
@@ -63,7 +77,10 @@ end
 
 local function wrap(stream, ...)
 	if not stream then return stream, ... end
-	return setmetatable({ stream = stream, next = 0 }, Stream)
+	if getmetatable(stream) == io.Stream then
+		return setmetatable({ stream = stream }, Stream)
+	end
+	return setmetatable({ stream = stream, next = 0 }, Serialized)
 end
 
 return {
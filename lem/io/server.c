@@ -16,67 +16,185 @@
  * License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-static struct ev_io *
+#define SERVER_BATCH 16
+
+/* how long to back off when out of file descriptors */
+#define SERVER_FDWAIT 0.1
+
+/*
+ * The io watcher must be the first member, so the server
+ * can still be used wherever a struct ev_io is expected.
+ *
+ * While autospawning the watcher is stopped whenever max connections
+ * are active or the accept rate is exceeded. The timer is used to
+ * start it again once enough time has passed.
+ */
+struct server {
+	struct ev_io w;
+	struct ev_timer t;
+	unsigned int batch;
+	unsigned int max;      /* 0 means no limit */
+	unsigned int rate;     /* connections per second, 0 means no limit */
+	unsigned int active;
+	unsigned int paused;
+	double tokens;
+	ev_tstamp stamp;
+	lua_Integer accepted;
+	lua_Integer rejected;  /* accept errors */
+	lua_Integer limited;   /* times the limits held connections back */
+};
+
+static void server_resume_cb(EV_P_ struct ev_timer *t, int revents);
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wstrict-aliasing"
+static inline void
+server_watch_init(struct server *s, int fd)
+{
+	ev_io_init(&s->w, NULL, fd, EV_READ);
+	ev_init(&s->t, server_resume_cb);
+}
+#pragma GCC diagnostic pop
+
+static struct server *
 server_new(lua_State *T, int fd, int mt)
 {
 	/* create userdata and set the metatable */
-	struct ev_io *w = lua_newuserdata(T, sizeof(struct ev_io));
+	struct server *s = lua_newuserdata(T, sizeof(struct server));
 	lua_pushvalue(T, mt);
 	lua_setmetatable(T, -2);
 
 	/* initialize userdata */
-	ev_io_init(w, NULL, fd, EV_READ);
-	w->data = NULL;
+	server_watch_init(s, fd);
+	s->w.data = NULL;
+	s->batch = SERVER_BATCH;
+	s->max = 0;
+	s->rate = 0;
+	s->active = 0;
+	s->paused = 0;
+	s->tokens = 0;
+	s->stamp = 0;
+	s->accepted = 0;
+	s->rejected = 0;
+	s->limited = 0;
+
+	return s;
+}
+
+/* stop listening, either because autospawn is ending
+ * or because the admission limits were hit */
+static void
+server_pause(struct server *s, ev_tstamp delay)
+{
+	struct ev_timer *t = &s->t;
 
-	return w;
+	ev_io_stop(LEM_ &s->w);
+	s->paused = 1;
+	if (delay > 0) {
+		ev_timer_set(t, delay, 0);
+		ev_timer_start(LEM_ t);
+	}
+}
+
+static void
+server_unpause(struct server *s)
+{
+	ev_timer_stop(LEM_ &s->t);
+	s->paused = 0;
+}
+
+static void
+server_resume(struct server *s)
+{
+	struct ev_timer *t = &s->t;
+
+	if (!s->paused || ev_is_active(t) ||
+			s->w.data == NULL || s->w.fd < 0)
+		return;
+	if (s->max > 0 && s->active >= s->max)
+		return;
+
+	lem_debug("resuming autospawn");
+	s->paused = 0;
+	ev_io_start(LEM_ &s->w);
+}
+
+static void
+server_resume_cb(EV_P_ struct ev_timer *t, int revents)
+{
+	struct server *s = (struct server *)
+		(((char *)t) - offsetof(struct server, t));
+
+	(void)revents;
+#if EV_MULTIPLICITY
+	(void)loop;
+#endif
+	server_resume(s);
 }
 
 static int
 server_closed(lua_State *T)
 {
-	struct ev_io *w;
+	struct server *s;
 
 	luaL_checktype(T, 1, LUA_TUSERDATA);
-	w = lua_touserdata(T, 1);
-	lua_pushboolean(T, w->fd < 0);
+	s = lua_touserdata(T, 1);
+	lua_pushboolean(T, s->w.fd < 0);
+	return 1;
+}
+
+static int
+server_fileno(lua_State *T)
+{
+	struct server *s;
+
+	luaL_checktype(T, 1, LUA_TUSERDATA);
+	s = lua_touserdata(T, 1);
+	if (s->w.fd < 0)
+		return io_closed(T);
+
+	lua_pushinteger(T, s->w.fd);
 	return 1;
 }
 
 static int
 server_busy(lua_State *T)
 {
-	struct ev_io *w;
+	struct server *s;
 
 	luaL_checktype(T, 1, LUA_TUSERDATA);
-	w = lua_touserdata(T, 1);
-	lua_pushboolean(T, w->data != NULL);
+	s = lua_touserdata(T, 1);
+	lua_pushboolean(T, s->w.data != NULL);
 	return 1;
 }
 
 static int
 server_close(lua_State *T)
 {
-	struct ev_io *w;
+	struct server *s;
 	int ret;
 
 	luaL_checktype(T, 1, LUA_TUSERDATA);
-	w = lua_touserdata(T, 1);
-	if (w->fd < 0)
+	s = lua_touserdata(T, 1);
+	if (s->w.fd < 0)
 		return io_closed(T);
 
-	if (w->data != NULL) {
+	if (s->w.data != NULL) {
+		lua_State *S = s->w.data;
+
 		lem_debug("interrupting listen");
-		ev_io_stop(LEM_ w);
-		lua_pushnil(w->data);
-		lua_pushliteral(w->data, "interrupted");
-		lem_queue(w->data, 2);
-		w->data = NULL;
+		ev_io_stop(LEM_ &s->w);
+		server_unpause(s);
+		s->w.data = NULL;
+		lua_pushnil(S);
+		lua_pushliteral(S, "interrupted");
+		lem_queue(S, 2);
 	}
 
 	lem_debug("closing server..");
 
-	ret = close(w->fd);
-	w->fd = -1;
+	ret = close(s->w.fd);
+	s->w.fd = -1;
 	if (ret)
 		return io_strerror(T, errno);
 
@@ -87,50 +205,130 @@ server_close(lua_State *T)
 static int
 server_interrupt(lua_State *T)
 {
-	struct ev_io *w;
+	struct server *s;
+	lua_State *S;
 
 	luaL_checktype(T, 1, LUA_TUSERDATA);
-	w = lua_touserdata(T, 1);
-	if (w->data == NULL) {
+	s = lua_touserdata(T, 1);
+	S = s->w.data;
+	if (S == NULL) {
 		lua_pushnil(T);
 		lua_pushliteral(T, "not busy");
 		return 2;
 	}
 
 	lem_debug("interrupting listening");
-	ev_io_stop(LEM_ w);
-	lua_pushnil(w->data);
-	lua_pushliteral(w->data, "interrupted");
-	lem_queue(w->data, 2);
-	w->data = NULL;
+	ev_io_stop(LEM_ &s->w);
+	server_unpause(s);
+	s->w.data = NULL;
+	lua_pushnil(S);
+	lua_pushliteral(S, "interrupted");
+	lem_queue(S, 2);
+
+	lua_pushboolean(T, 1);
+	return 1;
+}
+
+/*
+ * server:setlimits([max [, rate [, batch]]])
+ *
+ * Limit autospawn to max concurrent connections and
+ * rate new connections per second. Leaving out or passing
+ * 0 for a limit removes it. The batch size is the number
+ * of connections accepted per wakeup.
+ */
+static int
+server_setlimits(lua_State *T)
+{
+	struct server *s;
+	lua_Integer max;
+	lua_Integer rate;
+	lua_Integer batch;
+
+	luaL_checktype(T, 1, LUA_TUSERDATA);
+	max = luaL_optinteger(T, 2, 0);
+	rate = luaL_optinteger(T, 3, 0);
+	batch = luaL_optinteger(T, 4, SERVER_BATCH);
+	luaL_argcheck(T, max >= 0 && max <= UINT_MAX, 2, "out of range");
+	luaL_argcheck(T, rate >= 0 && rate <= UINT_MAX, 3, "out of range");
+	luaL_argcheck(T, batch > 0 && batch <= UINT_MAX, 4, "out of range");
+
+	s = lua_touserdata(T, 1);
+	s->max = max;
+	s->rate = rate;
+	s->batch = batch;
+	s->tokens = rate;
+	s->stamp = ev_now(LEM);
+
+	/* the new limits might allow more connections */
+	if (s->paused) {
+		ev_timer_stop(LEM_ &s->t);
+		server_resume(s);
+	}
 
 	lua_pushboolean(T, 1);
 	return 1;
 }
 
+/*
+ * server:stats()
+ *
+ * Returns a table with the number of connections accepted,
+ * rejected because of errors and currently handled by autospawn,
+ * and how many times the limits held new connections back.
+ */
 static int
-server__accept(lua_State *T, struct ev_io *w, int mt)
+server_stats(lua_State *T)
+{
+	struct server *s;
+
+	luaL_checktype(T, 1, LUA_TUSERDATA);
+	s = lua_touserdata(T, 1);
+
+	lua_createtable(T, 0, 5);
+	lua_pushinteger(T, s->accepted);
+	lua_setfield(T, -2, "accepted");
+	lua_pushinteger(T, s->rejected);
+	lua_setfield(T, -2, "rejected");
+	lua_pushinteger(T, s->limited);
+	lua_setfield(T, -2, "limited");
+	lua_pushinteger(T, s->active);
+	lua_setfield(T, -2, "active");
+	lua_pushboolean(T, s->paused);
+	lua_setfield(T, -2, "paused");
+	return 1;
+}
+
+static int
+server__accept(lua_State *T, struct server *s, int mt)
 {
 #ifdef SOCK_CLOEXEC
-	int sock = accept4(w->fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+	int sock = accept4(s->w.fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
 #else
-	int sock = accept(w->fd, NULL, NULL);
+	int sock = accept(s->w.fd, NULL, NULL);
 #endif
+	int err;
 
 	if (sock < 0) {
 		switch (errno) {
-		case EAGAIN: case EINTR: case ECONNABORTED:
+		case EAGAIN: case EINTR:
+			return 0;
+		case ECONNABORTED:
 		case ENETDOWN: case EPROTO: case ENOPROTOOPT:
 		case EHOSTDOWN:
 #ifdef ENONET
 		case ENONET:
 #endif
 		case EHOSTUNREACH: case EOPNOTSUPP: case ENETUNREACH:
+			s->rejected++;
 			return 0;
 		}
+		err = errno;
 		lua_pushnil(T);
 		lua_pushfstring(T, "error accepting connection: %s",
-		                strerror(errno));
+		                strerror(err));
+		/* let the caller see what went wrong */
+		errno = err;
 		return 2;
 	}
 #ifndef SOCK_CLOEXEC
@@ -144,6 +342,8 @@ server__accept(lua_State *T, struct ev_io *w, int mt)
 		return 2;
 	}
 #endif
+	s->accepted++;
+	io_accepts++;
 	stream_new(T, sock, mt);
 	return 1;
 }
@@ -151,11 +351,13 @@ server__accept(lua_State *T, struct ev_io *w, int mt)
 static void
 server_accept_cb(EV_P_ struct ev_io *w, int revents)
 {
+	struct server *s = (struct server *)w;
+	lua_State *T = w->data;
 	int ret;
 
 	(void)revents;
 
-	ret = server__accept(w->data, w, 2);
+	ret = server__accept(T, s, 2);
 	if (ret == 0)
 		return;
 
@@ -165,90 +367,147 @@ server_accept_cb(EV_P_ struct ev_io *w, int revents)
 		close(w->fd);
 		w->fd = -1;
 	}
-	lem_queue(w->data, ret);
+	lem_queue(T, ret);
 }
 
 static int
 server_accept(lua_State *T)
 {
-	struct ev_io *w;
+	struct server *s;
 
 	luaL_checktype(T, 1, LUA_TUSERDATA);
-	w = lua_touserdata(T, 1);
-	if (w->fd < 0)
+	s = lua_touserdata(T, 1);
+	if (s->w.fd < 0)
 		return io_closed(T);
-	if (w->data != NULL)
+	if (s->w.data != NULL)
 		return io_busy(T);
 
-	switch (server__accept(T, w, lua_upvalueindex(1))) {
+	switch (server__accept(T, s, lua_upvalueindex(1))) {
 	case 1:
 		return 1;
 	case 2:
-		close(w->fd);
-		w->fd= -1;
+		close(s->w.fd);
+		s->w.fd = -1;
 		return 2;
 	}
 
-	w->cb = server_accept_cb;
-	w->data = T;
-	ev_io_start(LEM_ w);
+	s->w.cb = server_accept_cb;
+	s->w.data = T;
+	ev_io_start(LEM_ &s->w);
 	lua_settop(T, 1);
 	lua_pushvalue(T, lua_upvalueindex(1));
 	return lua_yield(T, 2);
 }
 
+/*
+ * Each spawned thread runs the handler through this function,
+ * so the server knows when the connection is done. The server
+ * object is kept at index 1 which also keeps it alive.
+ */
+static int
+server_handler_k(lua_State *S, int status, lua_KContext ctx)
+{
+	struct server *s = lua_touserdata(S, 1);
+
+	(void)status;
+	(void)ctx;
+
+	s->active--;
+	server_resume(s);
+	return 0;
+}
+
+static int
+server_handler(lua_State *S)
+{
+	/* errors in the handler are fatal anyway,
+	 * so there is no need to catch them here */
+	lua_callk(S, 1, 0, 0, server_handler_k);
+	return server_handler_k(S, LUA_OK, 0);
+}
+
+/* returns 0 when a connection may be accepted now */
+static int
+server_admit(struct server *s)
+{
+	if (s->max > 0 && s->active >= s->max) {
+		lem_debug("connection limit reached");
+		s->limited++;
+		server_pause(s, 0);
+		return -1;
+	}
+
+	if (s->rate > 0) {
+		ev_tstamp now = ev_now(LEM);
+
+		/* refill the bucket, allowing bursts of up to a second */
+		s->tokens += (now - s->stamp) * s->rate;
+		if (s->tokens > s->rate)
+			s->tokens = s->rate;
+		s->stamp = now;
+
+		if (s->tokens < 1) {
+			lem_debug("accept rate exceeded");
+			s->limited++;
+			server_pause(s, (1 - s->tokens) / s->rate);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
 static void
 server_autospawn_cb(EV_P_ struct ev_io *w, int revents)
 {
+	struct server *s = (struct server *)w;
 	lua_State *T = w->data;
-	int sock;
-	lua_State *S;
+	unsigned int i;
+	int ret;
 
 	(void)revents;
 
-	/* dequeue the incoming connection */
-#ifdef SOCK_CLOEXEC
-	sock = accept4(w->fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
-#else
-	sock = accept(w->fd, NULL, NULL);
-#endif
-	if (sock < 0) {
-		switch (errno) {
-		case EAGAIN: case EINTR: case ECONNABORTED:
-		case ENETDOWN: case EPROTO: case ENOPROTOOPT:
-		case EHOSTDOWN:
-#ifdef ENONET
-		case ENONET:
-#endif
-		case EHOSTUNREACH: case EOPNOTSUPP: case ENETUNREACH:
+	for (i = 0; i < s->batch; i++) {
+		lua_State *S;
+
+		if (server_admit(s))
+			return;
+
+		/* dequeue the incoming connection */
+		ret = server__accept(T, s, 3);
+		if (ret == 0)
 			return;
+		if (ret == 2) {
+			switch (errno) {
+			case EMFILE: case ENFILE:
+			case ENOBUFS: case ENOMEM:
+				/* leave the connections in the
+				 * backlog and try again later */
+				lem_debug("out of resources, pausing");
+				lua_pop(T, 2);
+				server_pause(s, SERVER_FDWAIT);
+				return;
+			}
+			goto error;
 		}
-		lua_pushnil(T);
-		lua_pushfstring(T, "error accepting connection: %s",
-		                strerror(errno));
-		goto error;
-	}
-#ifndef SOCK_CLOEXEC
-	/* set FD_CLOEXEC and make the socket non-blocking */
-	if (fcntl(sock, F_SETFD, FD_CLOEXEC) == -1 ||
-			fcntl(sock, F_SETFL, O_NONBLOCK) == -1) {
-		close(sock);
-		lua_pushnil(T);
-		lua_pushfstring(T, "error setting socket flags: %s",
-		                strerror(errno));
-		goto error;
-	}
-#endif
-	S = lem_newthread();
 
-	/* copy handler function */
-	lua_pushvalue(T, 2);
-	/* create stream */
-	stream_new(T, sock, 3);
-	/* move function and stream to new thread */
-	lua_xmove(T, S, 2);
+		s->tokens -= 1;
+		s->active++;
+
+		S = lem_newthread();
 
-	lem_queue(S, 1);
+		/* push handler trampoline */
+		lua_pushcfunction(S, server_handler);
+		/* copy server object and handler function */
+		lua_pushvalue(T, 1);
+		lua_pushvalue(T, 2);
+		/* move them along with the stream to the new thread */
+		lua_rotate(T, -3, 2);
+		lua_xmove(T, S, 3);
+
+		/* let requests in flight go before new connections */
+		lem_queueat(S, 3, LEM_PRIO_LOW);
+	}
 	return;
 
 error:
@@ -262,20 +521,23 @@ error:
 static int
 server_autospawn(lua_State *T)
 {
-	struct ev_io *w;
+	struct server *s;
 
 	luaL_checktype(T, 1, LUA_TUSERDATA);
 	luaL_checktype(T, 2, LUA_TFUNCTION);
 
-	w = lua_touserdata(T, 1);
-	if (w->fd < 0)
+	s = lua_touserdata(T, 1);
+	if (s->w.fd < 0)
 		return io_closed(T);
-	if (w->data != NULL)
+	if (s->w.data != NULL)
 		return io_busy(T);
 
-	w->cb = server_autospawn_cb;
-	w->data = T;
-	ev_io_start(LEM_ w);
+	s->w.cb = server_autospawn_cb;
+	s->w.data = T;
+	s->paused = 1;
+	s->tokens = s->rate;
+	s->stamp = ev_now(LEM);
+	server_resume(s);
 
 	lem_debug("yielding");
 
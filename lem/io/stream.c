@@ -16,17 +16,36 @@
  * License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+/*
+ * A writer waiting for its strings to be written.
+ * The record is a userdata on the stack of the writing coroutine,
+ * next to the strings it refers to. Buffers may be moved while
+ * waiting, so only the offset into the current one is kept.
+ */
+struct stream_writer {
+	struct stream_writer *next;
+	lua_State *T;
+	int idx;
+	int top;
+	size_t pos;
+};
+
 struct stream {
 	struct ev_io r;
 	struct ev_io w;
 	unsigned int open;
-	int idx;
-	const char *out;
-	size_t out_len;
+	struct stream_writer *wfirst;
+	struct stream_writer *wlast;
 	struct lem_parser *p;
+	int many;
 	struct lem_inputbuf buf;
 };
 
+#define STREAM_IOVMAX 64
+
+static void stream_splice_cb(EV_P_ struct ev_io *w, int revents);
+static void stream_splice_abort(lua_State *T);
+
 #define STREAM_FROM_WATCH(w, member)\
 	(struct stream *)(((char *)w) - offsetof(struct stream, member))
 
@@ -53,11 +72,37 @@ stream_new(lua_State *T, int fd, int mt)
 	s->open = 1;
 	s->r.data = NULL;
 	s->w.data = NULL;
+	s->wfirst = NULL;
+	s->wlast = NULL;
+	s->many = 0;
 	lem_inputbuf_init(&s->buf);
 
 	return s;
 }
 
+static int
+stream_writeerr(lua_State *T, int err)
+{
+	if (err == 0 || err == ECONNRESET || err == EPIPE)
+		return io_closed(T);
+
+	return io_strerror(T, err);
+}
+
+/* wake all queued writers but self with an error */
+static void
+stream_wakewriters(struct stream *s, struct stream_writer *self, int err)
+{
+	struct stream_writer *w = s->wfirst;
+
+	s->wfirst = s->wlast = NULL;
+	for (; w; w = w->next) {
+		if (w == self)
+			continue;
+		lem_queue(w->T, stream_writeerr(w->T, err));
+	}
+}
+
 static int
 stream_gc(lua_State *T)
 {
@@ -65,7 +110,9 @@ stream_gc(lua_State *T)
 
 	if (s->open & 1)
 		close(s->r.fd);
-	if (s->open & 2)
+	/* stdio is shared with the loops of other threads,
+	 * so only the main loop puts it back in blocking mode */
+	if ((s->open & 2) && ev_is_default_loop(LEM))
 		fcntl(s->w.fd, F_SETFL, 0);
 
 	return 0;
@@ -91,12 +138,20 @@ stream_close(lua_State *T)
 	s = lua_touserdata(T, 1);
 	if (!s->open)
 		return io_closed(T);
+	if (s->r.data != NULL && s->r.cb == stream_splice_cb)
+		stream_splice_abort(s->r.data);
+	if (s->w.data != NULL && s->w.cb == stream_splice_cb)
+		stream_splice_abort(s->w.data);
 	if (s->r.data != NULL) {
 		ev_io_stop(LEM_ &s->r);
 		lem_queue(s->r.data, io_closed(s->r.data));
 		s->r.data = NULL;
 	}
-	if (s->w.data != NULL) {
+	if (s->wfirst != NULL) {
+		ev_io_stop(LEM_ &s->w);
+		stream_wakewriters(s, NULL, 0);
+		s->w.data = NULL;
+	} else if (s->w.data != NULL) {
 		ev_io_stop(LEM_ &s->w);
 		lem_queue(s->w.data, io_closed(s->w.data));
 		s->w.data = NULL;
@@ -111,8 +166,89 @@ stream_close(lua_State *T)
 }
 
 /*
- * stream:readp() method
+ * stream:readp() and stream:readmanyp() methods
+ *
+ * When reading many, s->many is the stack index of a
+ * struct stream_many, right above the table of results.
  */
+struct stream_many {
+	lua_Integer max;
+	char pstate[LEM_INPUTBUF_PSIZE];
+};
+
+static int
+stream__process(lua_State *T, struct stream *s)
+{
+	struct stream_many *m;
+	int results = s->many - 1;
+	lua_Integer n;
+	int ret;
+
+	if (s->many == 0)
+		return s->p->process(T, &s->buf);
+
+	m = lua_touserdata(T, s->many);
+	n = lua_rawlen(T, results);
+	while (n < m->max) {
+		struct lem_inputbuf *b = &s->buf;
+		unsigned int start;
+		unsigned int end;
+		int top = lua_gettop(T);
+
+		/* once we have results an incomplete one is parsed
+		 * again on the next call, so the parser must not see
+		 * a full buffer and move data out of it */
+		if (n > 0 && b->end == LEM_INPUTBUF_SIZE && b->start > 0) {
+			memmove(b->buf, b->buf + b->start, b->end - b->start);
+			b->end -= b->start;
+			b->start = 0;
+		}
+		start = b->start;
+		end = b->end;
+
+		ret = s->p->process(T, b);
+		if (ret != 1) {
+			if (n == 0)
+				return ret;
+			/* return what we have, errors are
+			 * returned by the next call */
+			lua_settop(T, top);
+			b->start = start;
+			b->end = end;
+			memcpy(b->pstate, m->pstate, LEM_INPUTBUF_PSIZE);
+			break;
+		}
+
+		lua_rawseti(T, results, ++n);
+		/* start over on the next result */
+		memcpy(b->pstate, m->pstate, LEM_INPUTBUF_PSIZE);
+
+		/* results which don't consume input, like read(0),
+		 * would be returned forever */
+		if (b->start == start && b->end == end)
+			break;
+	}
+
+	lua_pushvalue(T, results);
+	return 1;
+}
+
+static int
+stream__destroy(lua_State *T, struct stream *s, enum lem_preason res)
+{
+	if (s->many == 0) {
+		if (s->p->destroy)
+			return s->p->destroy(T, &s->buf, res);
+		return 0;
+	}
+
+	/* the results read before the stream closed */
+	if (lua_rawlen(T, s->many - 1) == 0)
+		return 0;
+	lua_pushvalue(T, s->many - 1);
+	return 1;
+}
+
 static int
 stream__readp(lua_State *T, struct stream *s)
 {
@@ -124,15 +260,17 @@ stream__readp(lua_State *T, struct stream *s)
 	while ((bytes = read(s->r.fd, s->buf.buf + s->buf.end,
 					LEM_INPUTBUF_SIZE - s->buf.end)) > 0) {
 		lem_debug("read %ld bytes from %d", bytes, s->r.fd);
+		io_count_read(IO_STREAM, bytes);
 
 		s->buf.end += bytes;
 
-		ret = s->p->process(T, &s->buf);
+		ret = stream__process(T, s);
 		if (ret > 0)
 			return ret;
 	}
 	err = errno;
 	lem_debug("read %ld bytes from %d", bytes, s->r.fd);
+	io_count_read(IO_STREAM, bytes);
 
 	if (bytes < 0 && (err == EAGAIN || err == EINTR))
 		return 0;
@@ -145,7 +283,8 @@ stream__readp(lua_State *T, struct stream *s)
 	s->open = 0;
 	close(s->r.fd);
 
-	if (s->p->destroy && (ret = s->p->destroy(T, &s->buf, res)) > 0)
+	ret = stream__destroy(T, s, res);
+	if (ret > 0)
 		return ret;
 
 	lua_settop(T, 0);
@@ -165,13 +304,13 @@ stream_readp_cb(EV_P_ struct ev_io *w, int revents)
 	(void)revents;
 
 	if (!s->open) {
-		ret = 0;
-		if (s->p->destroy)
-			ret = s->p->destroy(T, &s->buf, LEM_PCLOSED);
+		ret = stream__destroy(T, s, LEM_PCLOSED);
 		if (ret <= 0)
 			ret = io_closed(T);
 	} else {
+		lem_profile_where = LEM_PROFILE_READ;
 		ret = stream__readp(T, s);
+		lem_profile_where = LEM_PROFILE_LOOP;
 		if (ret == 0)
 			return;
 	}
@@ -189,25 +328,86 @@ stream_readp(lua_State *T)
 	int ret;
 
 	luaL_checktype(T, 1, LUA_TUSERDATA);
+	s = lua_touserdata(T, 1);
+	if (!s->open)
+		return io_closed(T);
+	if (s->r.data != NULL)
+		return io_busy(T);
+
+	lem_inputbuf_setdst(T, &s->buf);
 	ret = lua_type(T, 2);
 	if (ret != LUA_TUSERDATA && ret != LUA_TLIGHTUSERDATA)
 		return luaL_argerror(T, 2, "expected userdata");
 
+	p = lua_touserdata(T, 2);
+	if (p->init)
+		p->init(T, &s->buf);
+
+	ret = p->process(T, &s->buf);
+	if (ret > 0)
+		return ret;
+
+	s->p = p;
+	s->many = 0;
+	ret = stream__readp(T, s);
+	if (ret > 0)
+		return ret;
+
+	s->r.data = T;
+	s->r.cb = stream_readp_cb;
+	ev_io_start(LEM_ &s->r);
+	return lua_yield(T, lua_gettop(T));
+}
+
+/*
+ * stream:readmanyp(max, parser, ...) method
+ *
+ * Returns a table of up to max results, waiting only
+ * until at least one result is available.
+ */
+static int
+stream_readmanyp(lua_State *T)
+{
+	struct stream *s;
+	struct lem_parser *p;
+	struct stream_many *m;
+	lua_Integer max;
+	int ret;
+
+	luaL_checktype(T, 1, LUA_TUSERDATA);
+	max = luaL_checkinteger(T, 2);
+	luaL_argcheck(T, max > 0, 2, "must be positive");
 	s = lua_touserdata(T, 1);
 	if (!s->open)
 		return io_closed(T);
 	if (s->r.data != NULL)
 		return io_busy(T);
 
+	lua_remove(T, 2);
+	ret = lua_type(T, 2);
+	if (ret != LUA_TUSERDATA && ret != LUA_TLIGHTUSERDATA)
+		return luaL_argerror(T, 2, "expected userdata");
+
 	p = lua_touserdata(T, 2);
+	if (!(p->flags & LEM_PARSER_REPEAT))
+		return luaL_argerror(T, 2, "parser cannot read many");
+
+	s->buf.dst = NULL;
 	if (p->init)
 		p->init(T, &s->buf);
 
-	ret = p->process(T, &s->buf);
+	/* save the state to start over from after each result */
+	lua_newtable(T);
+	m = lua_newuserdata(T, sizeof(struct stream_many));
+	m->max = max;
+	memcpy(m->pstate, s->buf.pstate, LEM_INPUTBUF_PSIZE);
+
+	s->p = p;
+	s->many = lua_gettop(T);
+	ret = stream__process(T, s);
 	if (ret > 0)
 		return ret;
 
-	s->p = p;
 	ret = stream__readp(T, s);
 	if (ret > 0)
 		return ret;
@@ -220,103 +420,198 @@ stream_readp(lua_State *T)
 
 /*
  * stream:write() method
+ *
+ * Writers arriving while others are waiting for the socket to become
+ * writable are queued behind them, and everything queued is written
+ * with a single writev() once it is. Each writer is woken when all
+ * its strings have been written.
  */
+/* get what is left of the current string of the writer */
+static const char *
+stream_writer_out(struct stream_writer *w, size_t *len)
+{
+	const char *out = lem_tolbuffer(w->T, w->idx, len);
+
+	if (w->pos >= *len) {
+		*len = 0;
+		return out;
+	}
+	*len -= w->pos;
+	return out + w->pos;
+}
+
+/* move to the next non-empty string of the writer */
 static int
-stream__write(lua_State *T, struct stream *s)
+stream_writer_next(struct stream_writer *w)
 {
-	ssize_t bytes;
-	int err;
+	size_t len;
+
+	while (1) {
+		(void)stream_writer_out(w, &len);
+		if (len > 0)
+			return 1;
+		if (w->idx == w->top)
+			return 0;
+		w->idx++;
+		w->pos = 0;
+	}
+}
 
-	while ((bytes = write(s->w.fd, s->out, s->out_len)) > 0) {
-		lem_debug("wrote %ld bytes to fd %d", bytes, s->w.fd);
-		s->out += bytes;
-		s->out_len -= bytes;
-		while (s->out_len == 0) {
-			if (s->idx == lua_gettop(T)) {
-				lua_pushboolean(T, 1);
-				return 1;
+/*
+ * Write as much of the queued strings as possible.
+ * Finished writers, except self, are woken.
+ * Returns 1 when the queue is empty, 0 if the socket would block
+ * and -1 on error in which case all writers but self are woken
+ * with the error, and the error is stored in *err.
+ */
+static int
+stream__flush(struct stream *s, struct stream_writer *self, int *err)
+{
+	struct iovec iov[STREAM_IOVMAX];
+	ssize_t bytes = 0;
+
+	while (1) {
+		struct stream_writer *w;
+		int n = 0;
+
+		/* advance the writers past what was written,
+		 * this also skips buffers emptied while waiting */
+		while ((w = s->wfirst) != NULL) {
+			size_t len;
+
+			(void)stream_writer_out(w, &len);
+			if ((size_t)bytes < len) {
+				w->pos += bytes;
+				break;
+			}
+			bytes -= len;
+			w->pos += len;
+			if (stream_writer_next(w))
+				continue;
+
+			s->wfirst = w->next;
+			if (s->wfirst == NULL)
+				s->wlast = NULL;
+			if (w != self) {
+				lua_pushboolean(w->T, 1);
+				lem_queue(w->T, 1);
 			}
-			s->out = lua_tolstring(T, ++s->idx, &s->out_len);
 		}
-	}
-	err = errno;
-	lem_debug("wrote %ld bytes to fd %d", bytes, s->w.fd);
+		if (s->wfirst == NULL)
+			return 1;
 
-	if (bytes < 0 && (err == EAGAIN || err == EINTR))
-		return 0;
+		/* gather the strings of as many writers as possible */
+		for (w = s->wfirst; w && n < STREAM_IOVMAX; w = w->next) {
+			int i;
 
-	s->open = 0;
-	close(s->w.fd);
+			iov[n].iov_base = (void *)stream_writer_out(w, &iov[n].iov_len);
+			n++;
+			for (i = w->idx + 1; i <= w->top && n < STREAM_IOVMAX; i++) {
+				size_t len;
 
-	if (bytes == 0 || err == ECONNRESET || err == EPIPE)
-		return io_closed(T);
+				iov[n].iov_base = (void *)lem_tolbuffer(w->T, i, &len);
+				iov[n].iov_len = len;
+				n++;
+			}
+		}
 
-	return io_strerror(T, err);
+		bytes = writev(s->w.fd, iov, n);
+		io_count_write(IO_STREAM, bytes);
+		if (bytes <= 0) {
+			*err = errno;
+			lem_debug("wrote %ld bytes to fd %d", bytes, s->w.fd);
+			if (bytes < 0 && (*err == EAGAIN || *err == EINTR))
+				return 0;
+
+			if (bytes == 0)
+				*err = 0;
+			s->open = 0;
+			close(s->w.fd);
+			stream_wakewriters(s, self, *err);
+			return -1;
+		}
+		lem_debug("wrote %ld bytes to fd %d", bytes, s->w.fd);
+	}
 }
 
 static void
 stream_write_cb(EV_P_ struct ev_io *w, int revents)
 {
 	struct stream *s = STREAM_FROM_WATCH(w, w);
-	lua_State *T = s->w.data;
-	int ret;
+	int err;
 
 	(void)revents;
 
-	if (!s->open)
-		ret = io_closed(T);
-	else {
-		ret = stream__write(T, s);
-		if (ret == 0)
-			return;
-	}
+	if (stream__flush(s, NULL, &err) == 0)
+		return;
 
 	ev_io_stop(EV_A_ &s->w);
 	s->w.data = NULL;
-	lem_queue(T, ret);
 }
 
 static int
 stream_write(lua_State *T)
 {
 	struct stream *s;
-	const char *out;
-	size_t out_len;
-	int idx;
-	int i;
+	struct stream_writer self;
+	struct stream_writer *w;
 	int top;
-	int ret;
+	int i;
+	int err;
 
 	luaL_checktype(T, 1, LUA_TUSERDATA);
 	top = lua_gettop(T);
-	idx = 1;
-	do {
-		out = luaL_checklstring(T, ++idx, &out_len);
-	} while (out_len == 0 && idx < top);
-	for (i = idx+1; i <= top; i++)
-		(void)luaL_checkstring(T, i);
+	luaL_checkany(T, 2);
+	for (i = 2; i <= top; i++) {
+		size_t len;
+
+		if (lem_tolbuffer(T, i, &len) == NULL)
+			return luaL_argerror(T, i, "expected string or buffer");
+	}
 
 	s = lua_touserdata(T, 1);
 	if (!s->open)
 		return io_closed(T);
-	if (s->w.data != NULL)
+	if (s->w.data != NULL && s->wfirst == NULL)
 		return io_busy(T);
-	if (out_len == 0) {
+
+	self.next = NULL;
+	self.T = T;
+	self.idx = 2;
+	self.top = top;
+	self.pos = 0;
+	if (!stream_writer_next(&self)) {
 		lua_pushboolean(T, 1);
 		return 1;
 	}
 
-	s->out = out;
-	s->out_len = out_len;
-	s->idx = idx;
-	ret = stream__write(T, s);
-	if (ret > 0)
-		return ret;
+	if (s->wfirst == NULL) {
+		/* nobody is waiting, so try writing right away */
+		s->wfirst = s->wlast = &self;
+		switch (stream__flush(s, &self, &err)) {
+		case 1:
+			lua_pushboolean(T, 1);
+			return 1;
+		case -1:
+			return stream_writeerr(T, err);
+		}
 
-	s->w.data = T;
-	s->w.cb = stream_write_cb;
-	ev_io_start(LEM_ &s->w);
-	return lua_yield(T, top);
+		/* we're still first in the queue */
+		w = lua_newuserdata(T, sizeof(struct stream_writer));
+		*w = self;
+		s->wfirst = s->wlast = w;
+
+		s->w.data = s;
+		s->w.cb = stream_write_cb;
+		ev_io_start(LEM_ &s->w);
+	} else {
+		w = lua_newuserdata(T, sizeof(struct stream_writer));
+		*w = self;
+		s->wlast->next = w;
+		s->wlast = w;
+	}
+
+	return lua_yield(T, lua_gettop(T));
 }
 
 #ifdef TCP_CORK
@@ -352,6 +647,29 @@ stream_uncork(lua_State *T)
 }
 #endif
 
+/*
+ * stream:nodelay([on]) sets TCP_NODELAY, so small writes
+ * aren't held back waiting for acknowledgements
+ */
+static int
+stream_nodelay(lua_State *T)
+{
+	struct stream *s;
+	int state;
+
+	luaL_checktype(T, 1, LUA_TUSERDATA);
+	s = lua_touserdata(T, 1);
+	state = lua_isnoneornil(T, 2) || lua_toboolean(T, 2);
+	if (!s->open)
+		return io_closed(T);
+
+	if (setsockopt(s->w.fd, IPPROTO_TCP, TCP_NODELAY, &state, sizeof(int)))
+		return io_strerror(T, errno);
+
+	lua_pushboolean(T, 1);
+	return 1;
+}
+
 static int
 stream_getpeer(lua_State *T)
 {
@@ -503,6 +821,7 @@ stream_sendfile_reap(struct lem_async *a)
 	struct stream *s = sf->s;
 	int ret;
 
+	io_count_write(IO_STREAM, sf->ret == 0 ? sf->size : 0);
 	if (sf->ret == 0) {
 		lua_pushinteger(T, sf->size);
 		ret = 1;
@@ -559,3 +878,242 @@ stream_sendfile(lua_State *T)
 	lua_settop(T, 2);
 	return lua_yield(T, 2);
 }
+
+/*
+ * stream:splice() method
+ *
+ * Move data from one stream to another without passing it through
+ * Lua. On Linux the data is moved by splice() through a pipe,
+ * otherwise the input buffer of the source stream is used.
+ * The state lives in a userdata at index 3 of the stack of the
+ * coroutine, which is set as data of the watchers of both streams.
+ */
+#ifdef SPLICE_F_NONBLOCK
+#define STREAM_SPLICE_CHUNK (1 << 16)
+#endif
+
+struct stream_splice {
+	struct stream *src;
+	struct stream *dst;
+	struct ev_io *wait;
+	int pipe[2];
+	size_t pending;
+	lua_Integer max;
+	lua_Integer moved;
+};
+
+static void
+stream_splice_finish(struct stream_splice *sp)
+{
+	ev_io_stop(LEM_ &sp->src->r);
+	ev_io_stop(LEM_ &sp->dst->w);
+	sp->src->r.data = NULL;
+	sp->dst->w.data = NULL;
+
+	if (sp->pipe[0] >= 0) {
+		close(sp->pipe[0]);
+		close(sp->pipe[1]);
+		sp->pipe[0] = sp->pipe[1] = -1;
+	}
+}
+
+static int
+stream_splice_error(lua_State *T, struct stream_splice *sp, int err)
+{
+	if (err == ECONNRESET || err == EPIPE)
+		io_closed(T);
+	else
+		io_strerror(T, err);
+	lua_pushinteger(T, sp->moved);
+	return 3;
+}
+
+/* returns the number of values to return, or 0 to wait on sp->wait */
+static int
+stream__splice(lua_State *T, struct stream_splice *sp)
+{
+	struct lem_inputbuf *buf = &sp->src->buf;
+	ssize_t bytes;
+
+	while (1) {
+		/* write out what is in the input buffer first */
+		if (buf->end > buf->start) {
+			size_t len = buf->end - buf->start;
+
+			if (sp->max >= 0 && (lua_Integer)len > sp->max)
+				len = sp->max;
+			if (len == 0)
+				break;
+
+			bytes = write(sp->dst->w.fd, buf->buf + buf->start, len);
+			io_count_write(IO_STREAM, bytes);
+			if (bytes < 0)
+				goto write_error;
+
+			buf->start += bytes;
+			if (buf->start == buf->end)
+				buf->start = buf->end = 0;
+			sp->moved += bytes;
+			if (sp->max >= 0)
+				sp->max -= bytes;
+			continue;
+		}
+
+#ifdef SPLICE_F_NONBLOCK
+		/* then what is in the pipe */
+		if (sp->pending > 0) {
+			bytes = splice(sp->pipe[0], NULL, sp->dst->w.fd, NULL,
+					sp->pending,
+					SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			io_count_write(IO_STREAM, bytes);
+			if (bytes < 0)
+				goto write_error;
+
+			sp->pending -= bytes;
+			sp->moved += bytes;
+			continue;
+		}
+#endif
+
+		if (sp->max == 0)
+			break;
+
+#ifdef SPLICE_F_NONBLOCK
+		if (sp->pipe[0] >= 0) {
+			size_t len = STREAM_SPLICE_CHUNK;
+
+			if (sp->max >= 0 && (lua_Integer)len > sp->max)
+				len = sp->max;
+
+			bytes = splice(sp->src->r.fd, NULL, sp->pipe[1], NULL,
+					len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			io_count_read(IO_STREAM, bytes);
+			if (bytes < 0 && (errno == EINVAL || errno == ENOSYS)) {
+				/* not spliceable, use the input buffer */
+				close(sp->pipe[0]);
+				close(sp->pipe[1]);
+				sp->pipe[0] = sp->pipe[1] = -1;
+				continue;
+			}
+			if (bytes <= 0)
+				goto read_error;
+
+			sp->pending = bytes;
+			if (sp->max >= 0)
+				sp->max -= bytes;
+			continue;
+		}
+#endif
+
+		bytes = read(sp->src->r.fd, buf->buf, LEM_INPUTBUF_SIZE);
+		io_count_read(IO_STREAM, bytes);
+		if (bytes <= 0)
+			goto read_error;
+		buf->start = 0;
+		buf->end = bytes;
+	}
+
+	lua_pushinteger(T, sp->moved);
+	return 1;
+
+read_error:
+	if (bytes == 0) {
+		/* end of file */
+		lua_pushinteger(T, sp->moved);
+		return 1;
+	}
+	if (errno == EAGAIN || errno == EINTR) {
+		sp->wait = &sp->src->r;
+		return 0;
+	}
+	return stream_splice_error(T, sp, errno);
+
+write_error:
+	if (errno == EAGAIN || errno == EINTR) {
+		sp->wait = &sp->dst->w;
+		return 0;
+	}
+	return stream_splice_error(T, sp, errno);
+}
+
+static void
+stream_splice_cb(EV_P_ struct ev_io *w, int revents)
+{
+	lua_State *T = w->data;
+	struct stream_splice *sp = lua_touserdata(T, 3);
+	int ret;
+
+	(void)revents;
+
+	ev_io_stop(EV_A_ w);
+	ret = stream__splice(T, sp);
+	if (ret == 0) {
+		ev_io_start(EV_A_ sp->wait);
+		return;
+	}
+
+	stream_splice_finish(sp);
+	lem_queue(T, ret);
+}
+
+/* one of the streams was closed while splicing */
+static void
+stream_splice_abort(lua_State *T)
+{
+	struct stream_splice *sp = lua_touserdata(T, 3);
+
+	stream_splice_finish(sp);
+	io_closed(T);
+	lua_pushinteger(T, sp->moved);
+	lem_queue(T, 3);
+}
+
+static int
+stream_splice(lua_State *T)
+{
+	struct stream *src;
+	struct stream *dst;
+	struct stream_splice *sp;
+	lua_Integer max;
+	int ret;
+
+	luaL_checktype(T, 1, LUA_TUSERDATA);
+	luaL_checktype(T, 2, LUA_TUSERDATA);
+	max = luaL_optinteger(T, 3, -1);
+	luaL_argcheck(T, max >= -1, 3, "invalid size");
+
+	src = lua_touserdata(T, 1);
+	dst = lua_touserdata(T, 2);
+	if (!src->open || !dst->open)
+		return io_closed(T);
+	if (src->r.data != NULL || dst->w.data != NULL)
+		return io_busy(T);
+
+	lua_settop(T, 2);
+	sp = lua_newuserdata(T, sizeof(struct stream_splice));
+	sp->src = src;
+	sp->dst = dst;
+	sp->pending = 0;
+	sp->max = max;
+	sp->moved = 0;
+	sp->pipe[0] = sp->pipe[1] = -1;
+#ifdef SPLICE_F_NONBLOCK
+	if (pipe2(sp->pipe, O_NONBLOCK | O_CLOEXEC))
+		sp->pipe[0] = sp->pipe[1] = -1;
+#endif
+
+	/* mark both streams busy */
+	src->r.data = T;
+	src->r.cb = stream_splice_cb;
+	dst->w.data = T;
+	dst->w.cb = stream_splice_cb;
+
+	ret = stream__splice(T, sp);
+	if (ret > 0) {
+		stream_splice_finish(sp);
+		return ret;
+	}
+
+	ev_io_start(LEM_ sp->wait);
+	return lua_yield(T, 3);
+}
@@ -27,6 +27,7 @@ struct tcp_getaddr {
 	const char *service;
 	int sock;
 	int err;
+	int reuseport;
 };
 
 static const int tcp_famnumber[] = { AF_UNSPEC, AF_INET, AF_INET6 };
@@ -213,6 +214,20 @@ tcp_listen_work(struct lem_async *a)
 	/* set SO_REUSEADDR option if possible */
 	ret = 1;
 	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &ret, sizeof(int));
+	/* let several processes bind the same address */
+	if (g->reuseport) {
+#ifdef SO_REUSEPORT
+		if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &ret, sizeof(int))) {
+			g->sock = -2;
+			g->err = errno;
+			goto error;
+		}
+#else
+		g->sock = -2;
+		g->err = ENOPROTOOPT;
+		goto error;
+#endif
+	}
 #ifdef IPV6_V6ONLY
 	if (g->sock == AF_INET6)
 		setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, &ret, sizeof(int));
@@ -294,6 +309,7 @@ tcp_listen(lua_State *T, int family)
 	const char *node = luaL_checkstring(T, 1);
 	const char *service = luaL_checkstring(T, 2);
 	int backlog = (int)luaL_optnumber(T, 3, MAXPENDING);
+	int reuseport = lua_toboolean(T, 4);
 	struct tcp_getaddr *g;
 
 	if (node[0] == '*' && node[1] == '\0')
@@ -305,6 +321,7 @@ tcp_listen(lua_State *T, int family)
 	g->service = service;
 	g->sock = family;
 	g->err = backlog;
+	g->reuseport = reuseport;
 	lem_async_do(&g->a, tcp_listen_work, tcp_listen_reap);
 
 	lua_settop(T, 2);
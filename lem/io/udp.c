@@ -0,0 +1,864 @@
+/*
+ * This file is part of LEM, a Lua Event Machine.
+ * Copyright 2026 agent
+ *
+ * LEM is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * LEM is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* the most datagrams moved by a single call to recvmany() or sendmany() */
+#define UDP_MAXBATCH   64
+/* default buffer size for each received datagram */
+#define UDP_DGRAMSIZE  2048
+
+/* recvmmsg() and sendmmsg() appeared in the same glibc as MSG_WAITFORONE */
+#if defined(__linux__) && defined(MSG_WAITFORONE)
+#define HAVE_MMSG 1
+#endif
+
+union udp_addr {
+	struct sockaddr all;
+	struct sockaddr_in in;
+	struct sockaddr_in6 in6;
+	struct sockaddr_storage storage;
+};
+
+struct udp {
+	struct ev_io r;
+	struct ev_io w;
+	int (*rop)(lua_State *T, struct udp *u);
+	int (*wop)(lua_State *T, struct udp *u);
+	int family;
+	unsigned int rn;
+	size_t rsize;
+	unsigned int wdone;
+	char *buf;
+	size_t buf_size;
+};
+
+#define UDP_FROM_WATCH(w, member)\
+	(struct udp *)(((char *)w) - offsetof(struct udp, member))
+
+static void udp_read_cb(EV_P_ struct ev_io *w, int revents);
+static void udp_write_cb(EV_P_ struct ev_io *w, int revents);
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wstrict-aliasing"
+static inline void
+udp_watch_init(struct udp *u, int fd)
+{
+	ev_io_init(&u->r, udp_read_cb, fd, EV_READ);
+	ev_io_init(&u->w, udp_write_cb, fd, EV_WRITE);
+}
+#pragma GCC diagnostic pop
+
+static struct udp *
+udp_new(lua_State *T, int fd, int family, int mt)
+{
+	/* create userdata and set the metatable */
+	struct udp *u = lua_newuserdata(T, sizeof(struct udp));
+	lua_pushvalue(T, mt);
+	lua_setmetatable(T, -2);
+
+	/* initialize userdata */
+	udp_watch_init(u, fd);
+	u->r.data = NULL;
+	u->w.data = NULL;
+	u->family = family;
+	u->buf = NULL;
+	u->buf_size = 0;
+
+	return u;
+}
+
+static char *
+udp_buffer(struct udp *u, size_t size)
+{
+	if (u->buf_size < size) {
+		free(u->buf);
+		u->buf = lem_xmalloc(size);
+		u->buf_size = size;
+	}
+	return u->buf;
+}
+
+static int
+udp_pushaddr(lua_State *T, union udp_addr *addr)
+{
+	char buf[INET6_ADDRSTRLEN];
+
+	switch (addr->all.sa_family) {
+	case AF_INET:
+		if (inet_ntop(AF_INET, &addr->in.sin_addr,
+					buf, sizeof(buf)) == NULL)
+			break;
+		lua_pushstring(T, buf);
+		lua_pushinteger(T, ntohs(addr->in.sin_port));
+		return 2;
+
+	case AF_INET6:
+		if (inet_ntop(AF_INET6, &addr->in6.sin6_addr,
+					buf, sizeof(buf)) == NULL)
+			break;
+		lua_pushstring(T, buf);
+		lua_pushinteger(T, ntohs(addr->in6.sin6_port));
+		return 2;
+	}
+
+	lua_pushnil(T);
+	lua_pushnil(T);
+	return 2;
+}
+
+/*
+ * Convert a numeric address and port to a sockaddr for the socket.
+ * IPv4 addresses are mapped when the socket is IPv6.
+ */
+static socklen_t
+udp_getaddr(struct udp *u, const char *node, lua_Integer port,
+		union udp_addr *addr)
+{
+	memset(addr, 0, sizeof(union udp_addr));
+
+	if (port < 0 || port > 65535)
+		return 0;
+
+	if (u->family == AF_INET) {
+		addr->in.sin_family = AF_INET;
+		addr->in.sin_port = htons(port);
+		if (inet_pton(AF_INET, node, &addr->in.sin_addr) != 1)
+			return 0;
+		return sizeof(struct sockaddr_in);
+	}
+
+	addr->in6.sin6_family = AF_INET6;
+	addr->in6.sin6_port = htons(port);
+	if (inet_pton(AF_INET6, node, &addr->in6.sin6_addr) != 1) {
+		struct in_addr in;
+
+		if (inet_pton(AF_INET, node, &in) != 1)
+			return 0;
+		addr->in6.sin6_addr.s6_addr[10] = 0xff;
+		addr->in6.sin6_addr.s6_addr[11] = 0xff;
+		memcpy(&addr->in6.sin6_addr.s6_addr[12], &in, 4);
+	}
+	return sizeof(struct sockaddr_in6);
+}
+
+static int
+udp_closed(lua_State *T)
+{
+	struct udp *u;
+
+	luaL_checktype(T, 1, LUA_TUSERDATA);
+	u = lua_touserdata(T, 1);
+	lua_pushboolean(T, u->r.fd < 0);
+	return 1;
+}
+
+static int
+udp_gc(lua_State *T)
+{
+	struct udp *u = lua_touserdata(T, 1);
+
+	if (u->r.fd >= 0)
+		close(u->r.fd);
+	free(u->buf);
+	u->buf = NULL;
+	return 0;
+}
+
+static int
+udp_close(lua_State *T)
+{
+	struct udp *u;
+	int ret;
+
+	luaL_checktype(T, 1, LUA_TUSERDATA);
+	u = lua_touserdata(T, 1);
+	if (u->r.fd < 0)
+		return io_closed(T);
+
+	if (u->r.data != NULL) {
+		ev_io_stop(LEM_ &u->r);
+		lem_queue(u->r.data, io_closed(u->r.data));
+		u->r.data = NULL;
+	}
+	if (u->w.data != NULL) {
+		ev_io_stop(LEM_ &u->w);
+		lem_queue(u->w.data, io_closed(u->w.data));
+		u->w.data = NULL;
+	}
+
+	ret = close(u->r.fd);
+	u->r.fd = u->w.fd = -1;
+	free(u->buf);
+	u->buf = NULL;
+	u->buf_size = 0;
+	if (ret)
+		return io_strerror(T, errno);
+
+	lua_pushboolean(T, 1);
+	return 1;
+}
+
+static void
+udp_read_cb(EV_P_ struct ev_io *w, int revents)
+{
+	struct udp *u = UDP_FROM_WATCH(w, r);
+	lua_State *T = w->data;
+	int ret;
+
+	(void)revents;
+
+	ret = u->rop(T, u);
+	if (ret < 0)
+		return;
+
+	ev_io_stop(EV_A_ w);
+	w->data = NULL;
+	lem_queue(T, ret);
+}
+
+static void
+udp_write_cb(EV_P_ struct ev_io *w, int revents)
+{
+	struct udp *u = UDP_FROM_WATCH(w, w);
+	lua_State *T = w->data;
+	int ret;
+
+	(void)revents;
+
+	ret = u->wop(T, u);
+	if (ret < 0)
+		return;
+
+	ev_io_stop(EV_A_ w);
+	w->data = NULL;
+	lem_queue(T, ret);
+}
+
+/* run op now, or yield until the socket is ready for it */
+static int
+udp_op(lua_State *T, struct udp *u, struct ev_io *w,
+		int (*op)(lua_State *T, struct udp *u))
+{
+	int ret = op(T, u);
+
+	if (ret >= 0)
+		return ret;
+
+	w->data = T;
+	ev_io_start(LEM_ w);
+	return lua_yield(T, lua_gettop(T));
+}
+
+static int
+udp_again(lua_State *T, int err)
+{
+	if (err == EAGAIN || err == EWOULDBLOCK || err == EINTR)
+		return -1;
+
+	return io_strerror(T, err);
+}
+
+/*
+ * socket:recvfrom([maxlen]) method
+ */
+static int
+udp__recvfrom(lua_State *T, struct udp *u)
+{
+	union udp_addr addr;
+	socklen_t len = sizeof(addr);
+	ssize_t bytes;
+
+	bytes = recvfrom(u->r.fd, u->buf, u->rsize, 0, &addr.all, &len);
+	io_count_read(IO_UDP, bytes);
+	if (bytes < 0)
+		return udp_again(T, errno);
+
+	lua_pushlstring(T, u->buf, bytes);
+	if (len == 0)
+		return 1;
+	return 1 + udp_pushaddr(T, &addr);
+}
+
+static int
+udp_recvfrom(lua_State *T)
+{
+	struct udp *u;
+	lua_Integer size;
+
+	luaL_checktype(T, 1, LUA_TUSERDATA);
+	size = luaL_optinteger(T, 2, 65536);
+	luaL_argcheck(T, size > 0 && size <= 65536, 2, "invalid size");
+
+	u = lua_touserdata(T, 1);
+	if (u->r.fd < 0)
+		return io_closed(T);
+	if (u->r.data != NULL)
+		return io_busy(T);
+
+	udp_buffer(u, size);
+	u->rsize = size;
+	u->rop = udp__recvfrom;
+	lua_settop(T, 1);
+	return udp_op(T, u, &u->r, udp__recvfrom);
+}
+
+/*
+ * socket:recvmany([n [, size]]) method
+ *
+ * Returns a list of datagrams, a list of the addresses
+ * they came from and a list of the ports.
+ */
+static void
+udp_pushmany(lua_State *T, int n)
+{
+	lua_createtable(T, n, 0);
+	lua_createtable(T, n, 0);
+	lua_createtable(T, n, 0);
+}
+
+static void
+udp_setmany(lua_State *T, int i, const char *data, size_t len,
+		union udp_addr *addr, socklen_t addrlen)
+{
+	lua_pushlstring(T, data, len);
+	lua_rawseti(T, -4, i);
+	if (addrlen == 0)
+		return;
+	udp_pushaddr(T, addr);
+	lua_rawseti(T, -3, i);
+	lua_rawseti(T, -3, i);
+}
+
+#ifdef HAVE_MMSG
+static int
+udp__recvmany(lua_State *T, struct udp *u)
+{
+	struct mmsghdr msgs[UDP_MAXBATCH];
+	struct iovec iov[UDP_MAXBATCH];
+	union udp_addr addrs[UDP_MAXBATCH];
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < u->rn; i++) {
+		iov[i].iov_base = u->buf + i * u->rsize;
+		iov[i].iov_len = u->rsize;
+		msgs[i].msg_hdr.msg_name = &addrs[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(union udp_addr);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_control = NULL;
+		msgs[i].msg_hdr.msg_controllen = 0;
+		msgs[i].msg_hdr.msg_flags = 0;
+	}
+
+	ret = recvmmsg(u->r.fd, msgs, u->rn, 0, NULL);
+	io_count_read(IO_UDP, 0);
+	if (ret < 0)
+		return udp_again(T, errno);
+
+	udp_pushmany(T, ret);
+	for (i = 0; i < (unsigned int)ret; i++) {
+		io_counters[IO_UDP].rbytes += msgs[i].msg_len;
+		udp_setmany(T, i + 1, iov[i].iov_base, msgs[i].msg_len,
+				&addrs[i], msgs[i].msg_hdr.msg_namelen);
+	}
+	return 3;
+}
+#else
+static int
+udp__recvmany(lua_State *T, struct udp *u)
+{
+	union udp_addr addr;
+	socklen_t len;
+	ssize_t bytes;
+	unsigned int i;
+
+	for (i = 0; i < u->rn; i++) {
+		len = sizeof(addr);
+		bytes = recvfrom(u->r.fd, u->buf, u->rsize, 0, &addr.all, &len);
+		io_count_read(IO_UDP, bytes);
+		if (bytes < 0)
+			break;
+
+		if (i == 0)
+			udp_pushmany(T, 0);
+		udp_setmany(T, i + 1, u->buf, bytes, &addr, len);
+	}
+
+	if (i > 0)
+		return 3;
+
+	return udp_again(T, errno);
+}
+#endif
+
+static int
+udp_recvmany(lua_State *T)
+{
+	struct udp *u;
+	lua_Integer n;
+	lua_Integer size;
+
+	luaL_checktype(T, 1, LUA_TUSERDATA);
+	n = luaL_optinteger(T, 2, UDP_MAXBATCH);
+	luaL_argcheck(T, n > 0 && n <= UDP_MAXBATCH, 2, "invalid count");
+	size = luaL_optinteger(T, 3, UDP_DGRAMSIZE);
+	luaL_argcheck(T, size > 0 && size <= 65536, 3, "invalid size");
+
+	u = lua_touserdata(T, 1);
+	if (u->r.fd < 0)
+		return io_closed(T);
+	if (u->r.data != NULL)
+		return io_busy(T);
+
+	udp_buffer(u, n * size);
+	u->rn = n;
+	u->rsize = size;
+	u->rop = udp__recvmany;
+	lua_settop(T, 1);
+	return udp_op(T, u, &u->r, udp__recvmany);
+}
+
+/*
+ * socket:sendto(data [, addr, port]) method
+ */
+static int
+udp__sendto(lua_State *T, struct udp *u)
+{
+	union udp_addr addr;
+	socklen_t addrlen = 0;
+	const char *data;
+	size_t len;
+	ssize_t bytes;
+
+	data = lua_tolstring(T, 2, &len);
+	if (!lua_isnoneornil(T, 3)) {
+		addrlen = udp_getaddr(u, lua_tostring(T, 3),
+				lua_tointeger(T, 4), &addr);
+		if (addrlen == 0) {
+			lua_pushnil(T);
+			lua_pushliteral(T, "invalid address");
+			return 2;
+		}
+	}
+
+	bytes = sendto(u->w.fd, data, len, 0,
+			addrlen ? &addr.all : NULL, addrlen);
+	io_count_write(IO_UDP, bytes);
+	if (bytes < 0)
+		return udp_again(T, errno);
+
+	lua_pushboolean(T, 1);
+	return 1;
+}
+
+static int
+udp_sendto(lua_State *T)
+{
+	struct udp *u;
+
+	luaL_checktype(T, 1, LUA_TUSERDATA);
+	luaL_checkstring(T, 2);
+	if (!lua_isnoneornil(T, 3)) {
+		luaL_checkstring(T, 3);
+		luaL_checkinteger(T, 4);
+	}
+
+	u = lua_touserdata(T, 1);
+	if (u->w.fd < 0)
+		return io_closed(T);
+	if (u->w.data != NULL)
+		return io_busy(T);
+
+	lua_settop(T, 4);
+	u->wop = udp__sendto;
+	return udp_op(T, u, &u->w, udp__sendto);
+}
+
+/*
+ * socket:sendmany(datagrams [, addrs, ports]) method
+ *
+ * The lists are laid out like the ones returned by recvmany(),
+ * without addresses the socket must be connected.
+ */
+static int
+udp__sendmany(lua_State *T, struct udp *u)
+{
+	unsigned int total = lua_rawlen(T, 2);
+	int addressed = !lua_isnil(T, 3);
+
+	while (u->wdone < total) {
+#ifdef HAVE_MMSG
+		struct mmsghdr msgs[UDP_MAXBATCH];
+		struct iovec iov[UDP_MAXBATCH];
+		union udp_addr addrs[UDP_MAXBATCH];
+		unsigned int n = total - u->wdone;
+		unsigned int i;
+		int ret;
+
+		if (n > UDP_MAXBATCH)
+			n = UDP_MAXBATCH;
+
+		for (i = 0; i < n; i++) {
+			unsigned int j = u->wdone + i + 1;
+			socklen_t addrlen = 0;
+			size_t len;
+
+			lua_rawgeti(T, 2, j);
+			iov[i].iov_base = (void *)lua_tolstring(T, -1, &len);
+			iov[i].iov_len = len;
+			lua_pop(T, 1); /* still referenced by the list */
+			if (iov[i].iov_base == NULL)
+				goto invalid;
+
+			if (addressed) {
+				lua_rawgeti(T, 3, j);
+				lua_rawgeti(T, 4, j);
+				addrlen = udp_getaddr(u, lua_tostring(T, -2),
+						lua_tointeger(T, -1), &addrs[i]);
+				lua_pop(T, 2);
+				if (addrlen == 0)
+					goto invalid;
+			}
+
+			msgs[i].msg_hdr.msg_name = addrlen ? &addrs[i] : NULL;
+			msgs[i].msg_hdr.msg_namelen = addrlen;
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_control = NULL;
+			msgs[i].msg_hdr.msg_controllen = 0;
+			msgs[i].msg_hdr.msg_flags = 0;
+		}
+
+		ret = sendmmsg(u->w.fd, msgs, n, 0);
+		io_count_write(IO_UDP, 0);
+		if (ret < 0)
+			return udp_again(T, errno);
+		for (i = 0; i < (unsigned int)ret; i++)
+			io_counters[IO_UDP].wbytes += msgs[i].msg_len;
+		u->wdone += ret;
+#else
+		unsigned int j = u->wdone + 1;
+		union udp_addr addr;
+		socklen_t addrlen = 0;
+		const char *data;
+		size_t len;
+		ssize_t bytes;
+
+		lua_rawgeti(T, 2, j);
+		data = lua_tolstring(T, -1, &len);
+		lua_pop(T, 1);
+		if (data == NULL)
+			goto invalid;
+
+		if (addressed) {
+			lua_rawgeti(T, 3, j);
+			lua_rawgeti(T, 4, j);
+			addrlen = udp_getaddr(u, lua_tostring(T, -2),
+					lua_tointeger(T, -1), &addr);
+			lua_pop(T, 2);
+			if (addrlen == 0)
+				goto invalid;
+		}
+
+		bytes = sendto(u->w.fd, data, len, 0,
+				addrlen ? &addr.all : NULL, addrlen);
+		io_count_write(IO_UDP, bytes);
+		if (bytes < 0)
+			return udp_again(T, errno);
+		u->wdone++;
+#endif
+	}
+
+	lua_pushinteger(T, total);
+	return 1;
+
+invalid:
+	lua_pushnil(T);
+	lua_pushfstring(T, "invalid datagram or address #%d", u->wdone + 1);
+	return 2;
+}
+
+static int
+udp_sendmany(lua_State *T)
+{
+	struct udp *u;
+
+	luaL_checktype(T, 1, LUA_TUSERDATA);
+	luaL_checktype(T, 2, LUA_TTABLE);
+	if (!lua_isnoneornil(T, 3)) {
+		luaL_checktype(T, 3, LUA_TTABLE);
+		luaL_checktype(T, 4, LUA_TTABLE);
+	}
+
+	u = lua_touserdata(T, 1);
+	if (u->w.fd < 0)
+		return io_closed(T);
+	if (u->w.data != NULL)
+		return io_busy(T);
+
+	lua_settop(T, 4);
+	u->wdone = 0;
+	u->wop = udp__sendmany;
+	return udp_op(T, u, &u->w, udp__sendmany);
+}
+
+/*
+ * socket:buffers([rcvbuf [, sndbuf]]) method
+ *
+ * Set the kernel buffer sizes and return the resulting ones.
+ */
+static int
+udp_buffers(lua_State *T)
+{
+	struct udp *u;
+	int rcv = (int)luaL_optinteger(T, 2, 0);
+	int snd = (int)luaL_optinteger(T, 3, 0);
+	socklen_t len;
+
+	luaL_checktype(T, 1, LUA_TUSERDATA);
+	u = lua_touserdata(T, 1);
+	if (u->r.fd < 0)
+		return io_closed(T);
+
+	if (rcv > 0 && setsockopt(u->r.fd, SOL_SOCKET, SO_RCVBUF,
+				&rcv, sizeof(int)))
+		return io_strerror(T, errno);
+	if (snd > 0 && setsockopt(u->r.fd, SOL_SOCKET, SO_SNDBUF,
+				&snd, sizeof(int)))
+		return io_strerror(T, errno);
+
+	len = sizeof(int);
+	if (getsockopt(u->r.fd, SOL_SOCKET, SO_RCVBUF, &rcv, &len))
+		return io_strerror(T, errno);
+	len = sizeof(int);
+	if (getsockopt(u->r.fd, SOL_SOCKET, SO_SNDBUF, &snd, &len))
+		return io_strerror(T, errno);
+
+	lua_pushinteger(T, rcv);
+	lua_pushinteger(T, snd);
+	return 2;
+}
+
+static int
+udp_getsockname(lua_State *T)
+{
+	struct udp *u;
+	union udp_addr addr;
+	socklen_t len = sizeof(addr);
+
+	luaL_checktype(T, 1, LUA_TUSERDATA);
+	u = lua_touserdata(T, 1);
+	if (u->r.fd < 0)
+		return io_closed(T);
+
+	if (getsockname(u->r.fd, &addr.all, &len))
+		return io_strerror(T, errno);
+
+	return udp_pushaddr(T, &addr);
+}
+
+/*
+ * io.udp.bind() and io.udp.connect()
+ */
+struct udp_getaddr {
+	struct lem_async a;
+	lua_State *T;
+	const char *node;
+	const char *service;
+	int sock;
+	int err;
+	int family;
+	int connect;
+	int reuseport;
+};
+
+static const int udp_famnumber[] = { AF_UNSPEC, AF_INET, AF_INET6 };
+static const char *const udp_famnames[] = { "any", "ipv4", "ipv6", NULL };
+
+static void
+udp_open_work(struct lem_async *a)
+{
+	struct udp_getaddr *g = (struct udp_getaddr *)a;
+	struct addrinfo hints = {
+		.ai_flags     = g->connect ? 0 : AI_PASSIVE,
+		.ai_family    = g->family,
+		.ai_socktype  = SOCK_DGRAM,
+		.ai_protocol  = IPPROTO_UDP,
+		.ai_addrlen   = 0,
+		.ai_addr      = NULL,
+		.ai_canonname = NULL,
+		.ai_next      = NULL
+	};
+	struct addrinfo *addr = NULL;
+	int sock = -1;
+	int ret;
+
+	/* lookup name */
+	ret = getaddrinfo(g->node, g->service, &hints, &addr);
+	if (ret) {
+		g->sock = -1;
+		g->err = ret;
+		return;
+	}
+
+	/* create the UDP socket */
+	sock = socket(addr->ai_family,
+#ifdef SOCK_CLOEXEC
+			SOCK_CLOEXEC |
+#endif
+			addr->ai_socktype, addr->ai_protocol);
+	lem_debug("addr->ai_family = %d, sock = %d", addr->ai_family, sock);
+	if (sock < 0) {
+		g->sock = -2;
+		g->err = errno;
+		goto out;
+	}
+#ifndef SOCK_CLOEXEC
+	if (fcntl(sock, F_SETFD, FD_CLOEXEC) == -1) {
+		g->sock = -2;
+		g->err = errno;
+		goto error;
+	}
+#endif
+	g->family = addr->ai_family;
+
+	if (g->connect) {
+		if (connect(sock, addr->ai_addr, addr->ai_addrlen)) {
+			g->sock = -3;
+			g->err = errno;
+			goto error;
+		}
+	} else {
+		ret = 1;
+		setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &ret, sizeof(int));
+		/* let several sockets bind the same address */
+		if (g->reuseport) {
+#ifdef SO_REUSEPORT
+			if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT,
+						&ret, sizeof(int))) {
+				g->sock = -2;
+				g->err = errno;
+				goto error;
+			}
+#else
+			g->sock = -2;
+			g->err = ENOPROTOOPT;
+			goto error;
+#endif
+		}
+
+		if (bind(sock, addr->ai_addr, addr->ai_addrlen)) {
+			g->sock = -4;
+			g->err = errno;
+			goto error;
+		}
+	}
+
+	/* make the socket non-blocking */
+	if (fcntl(sock, F_SETFL, O_NONBLOCK) == -1) {
+		g->sock = -2;
+		g->err = errno;
+		goto error;
+	}
+
+	g->sock = sock;
+	goto out;
+
+error:
+	close(sock);
+out:
+	freeaddrinfo(addr);
+}
+
+static void
+udp_open_reap(struct lem_async *a)
+{
+	struct udp_getaddr *g = (struct udp_getaddr *)a;
+	lua_State *T = g->T;
+	int sock = g->sock;
+
+	if (g->node == NULL)
+		g->node = "*";
+
+	if (sock >= 0) {
+		udp_new(T, sock, g->family, 3);
+		free(g);
+		lem_queue(T, 1);
+		return;
+	}
+
+	lua_pushnil(T);
+	switch (-sock) {
+	case 1:
+		lua_pushfstring(T, "error looking up '%s:%s': %s",
+				g->node, g->service, gai_strerror(g->err));
+		break;
+	case 2:
+		lua_pushfstring(T, "error creating socket: %s",
+				strerror(g->err));
+		break;
+	case 3:
+		lua_pushfstring(T, "error connecting to '%s:%s': %s",
+				g->node, g->service, strerror(g->err));
+		break;
+	case 4:
+		lua_pushfstring(T, "error binding to '%s:%s': %s",
+				g->node, g->service, strerror(g->err));
+		break;
+	}
+	free(g);
+	lem_queue(T, 2);
+}
+
+static int
+udp_open(lua_State *T, int connect)
+{
+	const char *node = luaL_checkstring(T, 1);
+	const char *service = luaL_checkstring(T, 2);
+	int family = luaL_checkoption(T, 3, "any", udp_famnames);
+	int reuseport = lua_toboolean(T, 4);
+	struct udp_getaddr *g;
+
+	if (!connect && node[0] == '*' && node[1] == '\0')
+		node = NULL;
+
+	g = lem_xmalloc(sizeof(struct udp_getaddr));
+	g->T = T;
+	g->node = node;
+	g->service = service;
+	g->family = udp_famnumber[family];
+	g->connect = connect;
+	g->reuseport = reuseport;
+	lem_async_do(&g->a, udp_open_work, udp_open_reap);
+
+	lua_settop(T, 2);
+	lua_pushvalue(T, lua_upvalueindex(1));
+	return lua_yield(T, 3);
+}
+
+static int
+udp_bind(lua_State *T)
+{
+	return udp_open(T, 0);
+}
+
+static int
+udp_connect(lua_State *T)
+{
+	return udp_open(T, 1);
+}
@@ -245,3 +245,364 @@ unix_listen(lua_State *T)
 	lua_pushvalue(T, lua_upvalueindex(1));
 	return lua_yield(T, 2);
 }
+
+/*
+ * stream:sendfd(fd[, data]) and stream:recvfd() pass files,
+ * streams and servers to another process over a unix socket.
+ *
+ * The fd goes along with the first byte of data as SCM_RIGHTS
+ * ancillary data. A stream socket can't carry ancillary data
+ * on its own, so data defaults to a single zero byte. Where
+ * the kernel supports it the receiver also gets the pid, uid
+ * and gid of the sender, as checked by the kernel.
+ *
+ * Bytes read with stream:read() lose any fds sent with them,
+ * so don't mix the two on the same stream.
+ */
+#define UNIX_RECVFD_DATA 4096
+
+struct unix_sendfd {
+	size_t pos;
+	int fd;
+};
+
+/* returns 1 when done, 0 when the socket is full or -errno */
+static int
+unix__sendfd(struct stream *s, struct unix_sendfd *u,
+		const char *data, size_t len)
+{
+	while (u->pos < len) {
+		union {
+			struct cmsghdr hdr;
+			char buf[CMSG_SPACE(sizeof(int))
+#ifdef SCM_CREDENTIALS
+				+ CMSG_SPACE(sizeof(struct ucred))
+#endif
+				];
+		} control;
+		struct msghdr msg;
+		struct iovec iov;
+		ssize_t bytes;
+
+		iov.iov_base = (char *)data + u->pos;
+		iov.iov_len = len - u->pos;
+		memset(&msg, 0, sizeof(struct msghdr));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		if (u->fd >= 0) {
+			struct cmsghdr *cmsg;
+
+			memset(&control, 0, sizeof(control));
+			msg.msg_control = control.buf;
+			msg.msg_controllen = sizeof(control.buf);
+			cmsg = CMSG_FIRSTHDR(&msg);
+			cmsg->cmsg_level = SOL_SOCKET;
+			cmsg->cmsg_type = SCM_RIGHTS;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+			memcpy(CMSG_DATA(cmsg), &u->fd, sizeof(int));
+#ifdef SCM_CREDENTIALS
+			/* without this the kernel only records who we
+			 * are if the receiver already asked for it */
+			{
+				struct ucred cred;
+
+				cred.pid = getpid();
+				cred.uid = geteuid();
+				cred.gid = getegid();
+				cmsg = CMSG_NXTHDR(&msg, cmsg);
+				cmsg->cmsg_level = SOL_SOCKET;
+				cmsg->cmsg_type = SCM_CREDENTIALS;
+				cmsg->cmsg_len = CMSG_LEN(sizeof(struct ucred));
+				memcpy(CMSG_DATA(cmsg), &cred, sizeof(struct ucred));
+			}
+#endif
+		}
+
+		bytes = sendmsg(s->w.fd, &msg, MSG_NOSIGNAL);
+		if (bytes < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				return 0;
+			return -errno;
+		}
+		lem_debug("sent %ld bytes and fd %d", bytes, u->fd);
+		io_count_write(IO_STREAM, bytes);
+
+		/* the fd went with the first byte */
+		u->fd = -1;
+		u->pos += bytes;
+	}
+	return 1;
+}
+
+static void
+unix_sendfd_cb(EV_P_ struct ev_io *w, int revents)
+{
+	struct stream *s = STREAM_FROM_WATCH(w, w);
+	lua_State *T = s->w.data;
+	struct unix_sendfd *u = lua_touserdata(T, 4);
+	const char *data;
+	size_t len;
+	int ret;
+
+	(void)revents;
+
+	data = lua_tolstring(T, 3, &len);
+	ret = unix__sendfd(s, u, data, len);
+	if (ret == 0)
+		return;
+
+	ev_io_stop(EV_A_ &s->w);
+	s->w.data = NULL;
+	if (ret < 0) {
+		lem_queue(T, stream_writeerr(T, -ret));
+		return;
+	}
+	lua_pushboolean(T, 1);
+	lem_queue(T, 1);
+}
+
+/* the fd of an integer or an open file, stream or server */
+static int
+unix_checkfd(lua_State *T, int idx)
+{
+	int fd = -1;
+
+	if (lua_type(T, idx) == LUA_TNUMBER) {
+		fd = luaL_checkinteger(T, idx);
+		if (fd < 0)
+			return luaL_argerror(T, idx, "invalid fd");
+		return fd;
+	}
+
+	if (lua_type(T, idx) != LUA_TUSERDATA || !lua_getmetatable(T, idx))
+		return luaL_argerror(T, idx, "expected fd, file, stream or server");
+
+	if (lua_rawequal(T, -1, lua_upvalueindex(1)))
+		fd = ((struct file *)lua_touserdata(T, idx))->fd;
+	else if (lua_rawequal(T, -1, lua_upvalueindex(2))) {
+		struct stream *s = lua_touserdata(T, idx);
+
+		if (s->open)
+			fd = s->r.fd;
+	} else if (lua_rawequal(T, -1, lua_upvalueindex(3)))
+		fd = ((struct server *)lua_touserdata(T, idx))->w.fd;
+	else
+		return luaL_argerror(T, idx, "expected fd, file, stream or server");
+	lua_pop(T, 1);
+
+	return fd;
+}
+
+static int
+unix_sendfd(lua_State *T)
+{
+	struct stream *s;
+	struct unix_sendfd *u;
+	const char *data;
+	size_t len;
+	int fd;
+	int ret;
+
+	luaL_checktype(T, 1, LUA_TUSERDATA);
+	fd = unix_checkfd(T, 2);
+	if (lua_isnoneornil(T, 3)) {
+		lua_settop(T, 2);
+		lua_pushlstring(T, "", 1);
+	} else {
+		luaL_checkstring(T, 3);
+		lua_settop(T, 3);
+	}
+	data = lua_tolstring(T, 3, &len);
+	luaL_argcheck(T, len > 0, 3, "empty data");
+
+	s = lua_touserdata(T, 1);
+	if (!s->open)
+		return io_closed(T);
+	if (s->w.data != NULL)
+		return io_busy(T);
+	if (fd < 0)
+		return luaL_argerror(T, 2, "closed");
+
+	u = lua_newuserdata(T, sizeof(struct unix_sendfd));
+	u->pos = 0;
+	u->fd = fd;
+	ret = unix__sendfd(s, u, data, len);
+	if (ret < 0)
+		return stream_writeerr(T, -ret);
+	if (ret > 0) {
+		lua_pushboolean(T, 1);
+		return 1;
+	}
+
+	s->w.data = T;
+	s->w.cb = unix_sendfd_cb;
+	ev_io_start(LEM_ &s->w);
+	return lua_yield(T, lua_gettop(T));
+}
+
+/*
+ * Returns the number of values pushed or 0 if there
+ * was nothing to read. The stack holds the stream and
+ * the File, Stream and Server metatables.
+ */
+static int
+unix__recvfd(lua_State *T, struct stream *s)
+{
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(int) * 8)
+#ifdef SCM_CREDENTIALS
+			+ CMSG_SPACE(sizeof(struct ucred))
+#endif
+			];
+	} control;
+	char data[UNIX_RECVFD_DATA];
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	ssize_t bytes;
+	int fd = -1;
+	int ret;
+#ifdef SCM_CREDENTIALS
+	struct ucred cred;
+	int havecred = 0;
+#endif
+
+	iov.iov_base = data;
+	iov.iov_len = sizeof(data);
+	memset(&msg, 0, sizeof(struct msghdr));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	bytes = recvmsg(s->r.fd, &msg,
+#ifdef MSG_CMSG_CLOEXEC
+			MSG_CMSG_CLOEXEC
+#else
+			0
+#endif
+			);
+	if (bytes < 0 && (errno == EAGAIN || errno == EINTR))
+		return 0;
+	io_count_read(IO_STREAM, bytes);
+	if (bytes <= 0) {
+		int err = errno;
+
+		s->open = 0;
+		close(s->r.fd);
+		lua_settop(T, 0);
+		if (bytes == 0 || err == ECONNRESET || err == EPIPE)
+			return io_closed(T);
+		return io_strerror(T, err);
+	}
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET)
+			continue;
+		if (cmsg->cmsg_type == SCM_RIGHTS) {
+			int *fds = (int *)CMSG_DATA(cmsg);
+			int n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			int i;
+
+			/* we only asked for one, close the rest */
+			for (i = 0; i < n; i++) {
+				int f;
+
+				memcpy(&f, fds + i, sizeof(int));
+				if (fd < 0)
+					fd = f;
+				else
+					close(f);
+			}
+		}
+#ifdef SCM_CREDENTIALS
+		else if (cmsg->cmsg_type == SCM_CREDENTIALS) {
+			memcpy(&cred, CMSG_DATA(cmsg), sizeof(struct ucred));
+			/* pid 0 when nobody asked for them in time */
+			havecred = cred.pid != 0;
+		}
+#endif
+	}
+	lem_debug("received %ld bytes and fd %d", bytes, fd);
+
+	if (fd < 0)
+		lua_pushboolean(T, 0);
+	else {
+		ret = io_fdkind(fd);
+		switch (ret) {
+		case 0: file_new(T, fd, 2); break;
+		case 1: stream_new(T, fd, 3); break;
+		case 2: server_new(T, fd, 4); break;
+		default:
+			close(fd);
+			lua_settop(T, 0);
+			return io_strerror(T, -ret);
+		}
+	}
+	lua_pushlstring(T, data, bytes);
+#ifdef SCM_CREDENTIALS
+	if (havecred) {
+		lua_pushinteger(T, cred.pid);
+		lua_pushinteger(T, cred.uid);
+		lua_pushinteger(T, cred.gid);
+		return 5;
+	}
+#endif
+	return 2;
+}
+
+static void
+unix_recvfd_cb(EV_P_ struct ev_io *w, int revents)
+{
+	struct stream *s = STREAM_FROM_WATCH(w, r);
+	lua_State *T = s->r.data;
+	int ret;
+
+	(void)revents;
+
+	ret = unix__recvfd(T, s);
+	if (ret == 0)
+		return;
+
+	ev_io_stop(EV_A_ &s->r);
+	s->r.data = NULL;
+	lem_queue(T, ret);
+}
+
+/*
+ * Returns the file, stream or server received, the data sent
+ * with it and the pid, uid and gid of the sender if known.
+ * Data which came without an fd is returned after false.
+ */
+static int
+unix_recvfd(lua_State *T)
+{
+	struct stream *s;
+	int ret;
+
+	luaL_checktype(T, 1, LUA_TUSERDATA);
+	s = lua_touserdata(T, 1);
+	if (!s->open)
+		return io_closed(T);
+	if (s->r.data != NULL)
+		return io_busy(T);
+
+#ifdef SO_PASSCRED
+	ret = 1;
+	setsockopt(s->r.fd, SOL_SOCKET, SO_PASSCRED, &ret, sizeof(int));
+#endif
+
+	lua_settop(T, 1);
+	lua_pushvalue(T, lua_upvalueindex(1));
+	lua_pushvalue(T, lua_upvalueindex(2));
+	lua_pushvalue(T, lua_upvalueindex(3));
+	ret = unix__recvfd(T, s);
+	if (ret > 0)
+		return ret;
+
+	s->r.data = T;
+	s->r.cb = unix_recvfd_cb;
+	ev_io_start(LEM_ &s->r);
+	return lua_yield(T, lua_gettop(T));
+}
@@ -21,20 +21,47 @@ local parsers = require 'lem.parsers.core'
 local type   = type
 local error  = error
 
+local maxinteger = math.maxinteger
+
 local lookup = parsers.lookup
 local available = lookup.available
 lookup.available = nil
 local target = lookup.target
 lookup.target = nil
 
+-- read into a buffer instead of returning a string
+local function readinto(readp, self, buf, fmt, ...)
+	local parser
+	if fmt == nil then
+		parser = available
+	elseif type(fmt) == 'number' then
+		return readinto(readp, self, buf, target, fmt)
+	elseif type(fmt) == 'userdata' then
+		parser = fmt
+	else
+		parser = lookup[fmt]
+		if parser == nil then
+			error('invalid format', 3)
+		end
+	end
+
+	local ok, err = readp(self, buf, parser, ...)
+	if not ok then return nil, err end
+	return buf
+end
+
 function parsers.newreader(readp)
 	return function(self, fmt, ...)
 		if fmt == nil then
 			return readp(self, available)
 		end
-		if type(fmt) == 'number' then
+		local t = type(fmt)
+		if t == 'number' then
 			return readp(self, target, fmt)
 		end
+		if t == 'userdata' then
+			return readinto(readp, self, fmt, ...)
+		end
 		local parser = lookup[fmt]
 		if parser == nil then
 			error('invalid format', 2)
@@ -43,6 +70,21 @@ function parsers.newreader(readp)
 	end
 end
 
+-- read up to max results at once, fmt is like for read()
+function parsers.newmanyreader(readmanyp)
+	return function(self, fmt, max, ...)
+		max = max or maxinteger
+		if type(fmt) == 'number' then
+			return readmanyp(self, max, target, fmt)
+		end
+		local parser = lookup[fmt]
+		if parser == nil then
+			error('invalid format', 2)
+		end
+		return readmanyp(self, max, parser, ...)
+	end
+end
+
 return parsers
 
 -- vim: ts=2 sw=2 noet:
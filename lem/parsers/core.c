@@ -16,6 +16,7 @@
  * License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <string.h>
 #include <lem-parsers.h>
 
 #define LEM_PSTATE_CHECK(x) LEM_BUILD_ASSERT(sizeof(x) < LEM_INPUTBUF_PSIZE)
@@ -31,7 +32,7 @@ parse_available_process(lua_State *T, struct lem_inputbuf *b)
 	if (size == 0)
 		return 0;
 
-	lua_pushlstring(T, b->buf + b->start, size);
+	lem_parser_finish(T, b, 0, b->buf + b->start, size);
 	b->start = b->end = 0;
 	return 1;
 }
@@ -59,16 +60,15 @@ parse_target_init(lua_State *T, struct lem_inputbuf *b)
 	lua_settop(T, 2);
 }
 
+/* also used by the framing parsers once they know the length */
 static int
-parse_target_process(lua_State *T, struct lem_inputbuf *b)
+parse__target(lua_State *T, struct lem_inputbuf *b, size_t *target, int *parts)
 {
-	struct parse_target_state *s = (struct parse_target_state *)&b->pstate;
 	size_t size = b->end - b->start;
 
-	if (size >= s->target) {
-		lua_pushlstring(T, b->buf + b->start, s->target);
-		lua_concat(T, s->parts + 1);
-		b->start += s->target;
+	if (size >= *target) {
+		lem_parser_finish(T, b, *parts, b->buf + b->start, *target);
+		b->start += *target;
 		if (b->start == b->end)
 			b->start = b->end = 0;
 
@@ -76,22 +76,26 @@ parse_target_process(lua_State *T, struct lem_inputbuf *b)
 	}
 
 	if (b->end == LEM_INPUTBUF_SIZE) {
-		lua_pushlstring(T, b->buf + b->start, size);
-		s->parts++;
-		if (s->parts == LUA_MINSTACK-2) {
-			lua_concat(T, LUA_MINSTACK-2);
-			s->parts = 1;
-		}
+		lem_parser_addpart(T, b, parts, b->buf + b->start, size);
 		b->start = b->end = 0;
-		s->target -= size;
+		*target -= size;
 	}
 
 	return 0;
 }
 
+static int
+parse_target_process(lua_State *T, struct lem_inputbuf *b)
+{
+	struct parse_target_state *s = (struct parse_target_state *)&b->pstate;
+
+	return parse__target(T, b, &s->target, &s->parts);
+}
+
 static const struct lem_parser parser_target = {
 	.init    = parse_target_init,
 	.process = parse_target_process,
+	.flags   = LEM_PARSER_REPEAT,
 };
 
 /*
@@ -117,13 +121,8 @@ parse_all_process(lua_State *T, struct lem_inputbuf *b)
 	struct parse_all_state *s = (struct parse_all_state *)&b->pstate;
 
 	if (b->end == LEM_INPUTBUF_SIZE) {
-		lua_pushlstring(T, b->buf + b->start,
+		lem_parser_addpart(T, b, &s->parts, b->buf + b->start,
 				LEM_INPUTBUF_SIZE - b->start);
-		s->parts++;
-		if (s->parts == LUA_MINSTACK-2) {
-			lua_concat(T, LUA_MINSTACK-2);
-			s->parts = 1;
-		}
 		b->start = b->end = 0;
 	}
 
@@ -140,13 +139,8 @@ parse_all_destroy(lua_State *T, struct lem_inputbuf *b, enum lem_preason reason)
 		return 0;
 
 	size = b->end - b->start;
-	if (size > 0) {
-		lua_pushlstring(T, b->buf + b->start, size);
-		s->parts++;
-	}
+	lem_parser_finish(T, b, s->parts, b->buf + b->start, size);
 	b->start = b->end = 0;
-
-	lua_concat(T, s->parts);
 	return 1;
 }
 
@@ -184,8 +178,8 @@ parse_line_process(lua_State *T, struct lem_inputbuf *b)
 
 	for (i = b->start; i < b->end; i++) {
 		if (b->buf[i] == s->stopbyte) {
-			lua_pushlstring(T, b->buf + b->start, i - b->start);
-			lua_concat(T, s->parts + 1);
+			lem_parser_finish(T, b, s->parts,
+					b->buf + b->start, i - b->start);
 			i++;
 			if (i == b->end)
 				b->start = b->end = 0;
@@ -196,13 +190,8 @@ parse_line_process(lua_State *T, struct lem_inputbuf *b)
 	}
 
 	if (b->end == LEM_INPUTBUF_SIZE) {
-		lua_pushlstring(T, b->buf + b->start,
+		lem_parser_addpart(T, b, &s->parts, b->buf + b->start,
 				LEM_INPUTBUF_SIZE - b->start);
-		s->parts++;
-		if (s->parts == LUA_MINSTACK-2) {
-			lua_concat(T, LUA_MINSTACK-2);
-			s->parts = 1;
-		}
 		b->start = b->end = 0;
 	}
 
@@ -212,6 +201,382 @@ parse_line_process(lua_State *T, struct lem_inputbuf *b)
 static const struct lem_parser parser_line = {
 	.init    = parse_line_init,
 	.process = parse_line_process,
+	.flags   = LEM_PARSER_REPEAT,
+};
+
+/*
+ * frames are refused when longer than the optional max argument
+ */
+static size_t
+parse_optmax(lua_State *T, int idx)
+{
+	lua_Integer max = luaL_optinteger(T, idx, 0);
+
+	luaL_argcheck(T, max >= 0, idx, "out of range");
+	if (max == 0 || (lua_Unsigned)max > (size_t)-1)
+		return (size_t)-1;
+	return max;
+}
+
+static int
+parse_error(lua_State *T, struct lem_inputbuf *b, const char *msg)
+{
+	/* the input is out of sync now, so drop it */
+	b->start = b->end = 0;
+	lua_pushnil(T);
+	lua_pushstring(T, msg);
+	return 2;
+}
+
+/* move what is left to the front, so a header
+ * split at the end of the buffer can be completed */
+static void
+parse_compact(struct lem_inputbuf *b)
+{
+	if (b->end == LEM_INPUTBUF_SIZE && b->start > 0) {
+		memmove(b->buf, b->buf + b->start, b->end - b->start);
+		b->end -= b->start;
+		b->start = 0;
+	}
+}
+
+/*
+ * read a frame with a fixed size length prefix
+ */
+struct parse_prefix_state {
+	size_t target;
+	size_t max;
+	int parts;
+	unsigned char size;
+	unsigned char little;
+	unsigned char header;
+};
+LEM_PSTATE_CHECK(struct parse_prefix_state);
+
+static void
+parse_prefix_init(lua_State *T, struct lem_inputbuf *b)
+{
+	static const char *const orders[] = { "be", "le", NULL };
+	struct parse_prefix_state *s = (struct parse_prefix_state *)&b->pstate;
+	lua_Integer size = luaL_checkinteger(T, 3);
+
+	luaL_argcheck(T, size == 1 || size == 2 || size == 4 || size == 8,
+			3, "size must be 1, 2, 4 or 8");
+	s->size = size;
+	s->little = luaL_checkoption(T, 4, "be", orders);
+	s->max = parse_optmax(T, 5);
+	s->header = 1;
+	s->parts = 0;
+	lua_settop(T, 2);
+}
+
+static int
+parse_prefix_process(lua_State *T, struct lem_inputbuf *b)
+{
+	struct parse_prefix_state *s = (struct parse_prefix_state *)&b->pstate;
+
+	if (s->header) {
+		const unsigned char *p = (unsigned char *)b->buf + b->start;
+		lua_Unsigned len = 0;
+		int i;
+
+		if (b->end - b->start < s->size) {
+			parse_compact(b);
+			return 0;
+		}
+
+		if (s->little) {
+			for (i = s->size - 1; i >= 0; i--)
+				len = (len << 8) | p[i];
+		} else {
+			for (i = 0; i < s->size; i++)
+				len = (len << 8) | p[i];
+		}
+		if (len > s->max)
+			return parse_error(T, b, "frame too large");
+
+		b->start += s->size;
+		s->target = len;
+		s->header = 0;
+	}
+
+	return parse__target(T, b, &s->target, &s->parts);
+}
+
+static const struct lem_parser parser_prefix = {
+	.init    = parse_prefix_init,
+	.process = parse_prefix_process,
+	.flags   = LEM_PARSER_REPEAT,
+};
+
+/*
+ * read a frame with a varint (LEB128) length prefix
+ */
+struct parse_varint_state {
+	size_t target;
+	size_t max;
+	int parts;
+	unsigned char shift;
+	unsigned char header;
+};
+LEM_PSTATE_CHECK(struct parse_varint_state);
+
+static void
+parse_varint_init(lua_State *T, struct lem_inputbuf *b)
+{
+	struct parse_varint_state *s = (struct parse_varint_state *)&b->pstate;
+
+	s->max = parse_optmax(T, 3);
+	s->target = 0;
+	s->shift = 0;
+	s->header = 1;
+	s->parts = 0;
+	lua_settop(T, 2);
+}
+
+static int
+parse_varint_process(lua_State *T, struct lem_inputbuf *b)
+{
+	struct parse_varint_state *s = (struct parse_varint_state *)&b->pstate;
+
+	while (s->header) {
+		unsigned char c;
+
+		if (b->start == b->end) {
+			b->start = b->end = 0;
+			return 0;
+		}
+
+		c = b->buf[b->start++];
+		if (s->shift >= 8*sizeof(size_t) ||
+				((size_t)(c & 0x7F) << s->shift) >> s->shift != (size_t)(c & 0x7F))
+			return parse_error(T, b, "invalid varint");
+		s->target |= (size_t)(c & 0x7F) << s->shift;
+		s->shift += 7;
+
+		if ((c & 0x80) == 0) {
+			if (s->target > s->max)
+				return parse_error(T, b, "frame too large");
+			s->header = 0;
+		}
+	}
+
+	return parse__target(T, b, &s->target, &s->parts);
+}
+
+static const struct lem_parser parser_varint = {
+	.init    = parse_varint_init,
+	.process = parse_varint_process,
+	.flags   = LEM_PARSER_REPEAT,
+};
+
+/*
+ * read a netstring, eg. "5:hello,"
+ */
+enum parse_netstring_phase {
+	NETSTRING_LENGTH,
+	NETSTRING_DATA,
+	NETSTRING_COMMA,
+};
+
+struct parse_netstring_state {
+	size_t target;
+	size_t max;
+	int parts;
+	unsigned char phase;
+	unsigned char digits;
+};
+LEM_PSTATE_CHECK(struct parse_netstring_state);
+
+static void
+parse_netstring_init(lua_State *T, struct lem_inputbuf *b)
+{
+	struct parse_netstring_state *s = (struct parse_netstring_state *)&b->pstate;
+
+	s->max = parse_optmax(T, 3);
+	s->target = 0;
+	s->phase = NETSTRING_LENGTH;
+	s->digits = 0;
+	s->parts = 0;
+	lua_settop(T, 2);
+}
+
+static int
+parse_netstring_process(lua_State *T, struct lem_inputbuf *b)
+{
+	struct parse_netstring_state *s = (struct parse_netstring_state *)&b->pstate;
+	size_t size;
+
+	while (s->phase == NETSTRING_LENGTH) {
+		char c;
+
+		if (b->start == b->end) {
+			b->start = b->end = 0;
+			return 0;
+		}
+
+		c = b->buf[b->start++];
+		if (c == ':' && s->digits > 0) {
+			s->phase = NETSTRING_DATA;
+			break;
+		}
+		if (c < '0' || c > '9' || (s->digits > 0 && s->target == 0))
+			return parse_error(T, b, "invalid netstring");
+		if (s->target > s->max / 10 ||
+				(size_t)(c - '0') > s->max - 10*s->target)
+			return parse_error(T, b, "frame too large");
+		s->target = 10*s->target + (c - '0');
+		s->digits++;
+	}
+
+	size = b->end - b->start;
+	if (s->phase == NETSTRING_DATA) {
+		if (size <= s->target) {
+			/* the comma isn't here yet */
+			if (size == s->target || b->end == LEM_INPUTBUF_SIZE) {
+				lem_parser_addpart(T, b, &s->parts,
+						b->buf + b->start, size);
+				b->start = b->end = 0;
+				s->target -= size;
+				if (s->target == 0)
+					s->phase = NETSTRING_COMMA;
+			}
+			return 0;
+		}
+
+		if (b->buf[b->start + s->target] != ',')
+			return parse_error(T, b, "invalid netstring");
+		lem_parser_finish(T, b, s->parts, b->buf + b->start, s->target);
+		b->start += s->target + 1;
+		if (b->start == b->end)
+			b->start = b->end = 0;
+		return 1;
+	}
+
+	/* NETSTRING_COMMA */
+	if (size == 0)
+		return 0;
+	if (b->buf[b->start] != ',')
+		return parse_error(T, b, "invalid netstring");
+	lem_parser_finish(T, b, s->parts, b->buf + b->start, 0);
+	b->start++;
+	if (b->start == b->end)
+		b->start = b->end = 0;
+	return 1;
+}
+
+static const struct lem_parser parser_netstring = {
+	.init    = parse_netstring_init,
+	.process = parse_netstring_process,
+	.flags   = LEM_PARSER_REPEAT,
+};
+
+/*
+ * read until a delimiter string
+ *
+ * Single bytes are found with memchr(), longer delimiters
+ * with Boyer-Moore-Horspool. The skip table is kept in a
+ * userdata at stack index 3 while reading.
+ */
+#define PARSE_DELIM_MAX 255
+
+struct parse_delim_table {
+	size_t len;
+	unsigned char skip[256];
+	char delim[];
+};
+
+struct parse_delim_state {
+	size_t next;
+	int parts;
+};
+LEM_PSTATE_CHECK(struct parse_delim_state);
+
+static void
+parse_delim_init(lua_State *T, struct lem_inputbuf *b)
+{
+	struct parse_delim_state *s = (struct parse_delim_state *)&b->pstate;
+	size_t len;
+	const char *delim = luaL_checklstring(T, 3, &len);
+	struct parse_delim_table *t;
+	size_t i;
+
+	luaL_argcheck(T, len > 0 && len <= PARSE_DELIM_MAX, 3,
+			"delimiter must be 1 to 255 bytes");
+
+	t = lua_newuserdata(T, sizeof(struct parse_delim_table) + len);
+	t->len = len;
+	memcpy(t->delim, delim, len);
+	memset(t->skip, len, sizeof(t->skip));
+	for (i = 0; i < len - 1; i++)
+		t->skip[(unsigned char)delim[i]] = len - 1 - i;
+	lua_replace(T, 3);
+
+	s->next = 0;
+	s->parts = 0;
+	lua_settop(T, 3);
+}
+
+static int
+parse_delim_process(lua_State *T, struct lem_inputbuf *b)
+{
+	struct parse_delim_state *s = (struct parse_delim_state *)&b->pstate;
+	struct parse_delim_table *t = lua_touserdata(T, 3);
+	size_t len = t->len;
+	size_t i = b->start + s->next;
+	const char *match = NULL;
+
+	if (len == 1) {
+		match = memchr(b->buf + i, t->delim[0], b->end - i);
+		i = b->end;
+	} else {
+		unsigned char last = t->delim[len - 1];
+
+		while (i + len <= b->end) {
+			unsigned char c = b->buf[i + len - 1];
+
+			if (c == last && memcmp(b->buf + i, t->delim, len - 1) == 0) {
+				match = b->buf + i;
+				break;
+			}
+			i += t->skip[c];
+		}
+	}
+
+	if (match != NULL) {
+		lem_parser_finish(T, b, s->parts, b->buf + b->start,
+				match - (b->buf + b->start));
+		b->start = match - b->buf + len;
+		if (b->start == b->end)
+			b->start = b->end = 0;
+		return 1;
+	}
+
+	/* the next search starts where this one stopped */
+	s->next = i - b->start;
+
+	if (b->end == LEM_INPUTBUF_SIZE) {
+		/* keep what might be the start of the delimiter */
+		size_t keep = len - 1;
+		size_t size = b->end - b->start;
+
+		if (keep > size)
+			keep = size;
+		lem_parser_addpart(T, b, &s->parts, b->buf + b->start,
+				size - keep);
+		memmove(b->buf, b->buf + b->end - keep, keep);
+		b->start = 0;
+		b->end = keep;
+		s->next = 0;
+	}
+
+	return 0;
+}
+
+static const struct lem_parser parser_delim = {
+	.init    = parse_delim_init,
+	.process = parse_delim_process,
+	.flags   = LEM_PARSER_REPEAT,
 };
 
 int
@@ -221,7 +586,7 @@ luaopen_lem_parsers_core(lua_State *L)
 	lua_newtable(L);
 
 	/* create lookup table */
-	lua_createtable(L, 0, 4);
+	lua_createtable(L, 0, 8);
 	/* push parser_line */
 	lua_pushlightuserdata(L, (void *)&parser_available);
 	lua_setfield(L, -2, "available");
@@ -234,6 +599,18 @@ luaopen_lem_parsers_core(lua_State *L)
 	/* push parser_line */
 	lua_pushlightuserdata(L, (void *)&parser_line);
 	lua_setfield(L, -2, "*l");
+	/* push parser_prefix */
+	lua_pushlightuserdata(L, (void *)&parser_prefix);
+	lua_setfield(L, -2, "*p");
+	/* push parser_varint */
+	lua_pushlightuserdata(L, (void *)&parser_varint);
+	lua_setfield(L, -2, "*v");
+	/* push parser_netstring */
+	lua_pushlightuserdata(L, (void *)&parser_netstring);
+	lua_setfield(L, -2, "*n");
+	/* push parser_delim */
+	lua_pushlightuserdata(L, (void *)&parser_delim);
+	lua_setfield(L, -2, "*d");
 	/* insert lookup table */
 	lua_setfield(L, -2, "lookup");
 
@@ -0,0 +1,178 @@
+--
+-- This file is part of LEM, a Lua Event Machine.
+-- Copyright 2026 agent
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+--
+
+-- Run a function in a number of forked worker processes.
+--
+-- Workers either share a listening socket created before calling
+-- run(), or each bind their own with io.tcp.listen(host, port, nil, true)
+-- to get SO_REUSEPORT load balancing from the kernel.
+--
+-- The master respawns workers that die and forwards signals to them.
+-- On SIGTERM, SIGINT or SIGQUIT it stops respawning and returns
+-- once every worker has exited.
+--
+-- A worker exits when func returns. The master's threads stop in
+-- the worker and run() never returns there, so func has the process
+-- to itself.
+
+local utils  = require 'lem.utils'
+local signal = require 'lem.signal'
+
+local pairs, select = pairs, select
+local unpack = table.unpack or unpack
+local fork, exit, suspend = utils.fork, utils.exit, utils.suspend
+
+local M = {}
+
+-- signals which make the master shut down
+local stopsignals = { 'SIGTERM', 'SIGINT', 'SIGQUIT' }
+-- signals which are just passed on to the workers
+local passsignals = { 'SIGHUP', 'SIGUSR1' }
+
+-- don't respawn workers dying faster than this more than once a second
+local MINLIFE = 1
+
+function M.run(n, func, ...)
+	local args, nargs = { ... }, select('#', ...)
+	local workers, count = {}, 0
+	local stopping, worker = false, false
+	-- the signal watchers don't keep the loop alive, so the master
+	-- waits on a timer while it has workers to look after
+	local sleeper = utils.newsleeper()
+	-- respawns waiting out MINLIFE
+	local delayed = {}
+	local handlers = {}
+
+	local function unregister()
+		for sig, handler in pairs(handlers) do
+			signal.unregister(sig, handler)
+		end
+	end
+
+	local function spawn(id)
+		local pid, err = fork()
+		if not pid then return nil, err end
+
+		if pid == 0 then
+			-- the worker shouldn't act as a master, so let the
+			-- master threads copied from the parent finish
+			unregister()
+			worker, workers, count = true, {}, 0
+			sleeper:wakeup()
+			for s in pairs(delayed) do
+				s:wakeup()
+			end
+			func(id, unpack(args, 1, nargs))
+			exit(0)
+		end
+
+		workers[pid] = { id = id, started = utils.now() }
+		count = count + 1
+		return pid
+	end
+
+	local function forward(signum)
+		for pid, _ in pairs(workers) do
+			signal.kill(pid, signum)
+		end
+	end
+
+	local function respawn(w)
+		if utils.now() - w.started < MINLIFE then
+			local s = utils.newsleeper()
+			delayed[s] = true
+			s:sleep(MINLIFE)
+			delayed[s] = nil
+		end
+		if stopping or worker then return end
+		local ok, err = spawn(w.id)
+		if not ok then
+			M.debug('respawn', err)
+		end
+	end
+
+	handlers.SIGCHLD = function(_, ev)
+		if ev.type ~= 'exited' and ev.type ~= 'signaled' then return end
+		local w = workers[ev.rpid]
+		if not w then return end
+
+		workers[ev.rpid] = nil
+		count = count - 1
+		if not stopping then
+			return respawn(w)
+		end
+		if count == 0 then
+			sleeper:wakeup()
+		end
+	end
+
+	for i = 1, #stopsignals do
+		handlers[stopsignals[i]] = function(signum)
+			stopping = true
+			forward(signum)
+			-- cancel pending respawns
+			for s in pairs(delayed) do
+				s:wakeup()
+			end
+			if count == 0 then
+				sleeper:wakeup()
+			end
+		end
+	end
+
+	for i = 1, #passsignals do
+		handlers[passsignals[i]] = forward
+	end
+
+	for sig, handler in pairs(handlers) do
+		local ok, err = signal.register(sig, handler)
+		if not ok then
+			unregister()
+			return nil, err
+		end
+	end
+
+	for id = 1, n do
+		local ok, err = spawn(id)
+		if not ok then
+			stopping = true
+			forward(signal.lookup('SIGTERM'))
+			if count == 0 then
+				unregister()
+				return nil, err
+			end
+			break
+		end
+	end
+
+	while not stopping or count > 0 do
+		sleeper:sleep(60)
+		if worker then
+			-- forked from a signal handler, nothing will resume us
+			return suspend()
+		end
+	end
+	unregister()
+	return true
+end
+
+function M.debug() end
+
+return M
+
+-- vim: ts=2 sw=2 noet:
@@ -0,0 +1,73 @@
+--
+-- This file is part of LEM, a Lua Event Machine.
+-- Copyright 2026 agent
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+--
+
+-- A sampling profiler for the Lua threads of the current loop.
+-- Ticks taken outside Lua threads are counted as [loop], [gc],
+-- [reap] (thread pool results) and [read] (reading and parsing
+-- stream input).
+
+local pairs = pairs
+local format = string.format
+local concat, sort = table.concat, table.sort
+
+local profiler = require 'lem.profiler.core'
+local io       = require 'lem.io'
+
+local stop = profiler.stop
+
+-- the stacks as text in the folded format used by flamegraph.pl,
+-- one stack per line, most samples first
+function profiler.folded(stacks)
+	local list = {}
+	for stack in pairs(stacks) do
+		list[#list+1] = stack
+	end
+	sort(list, function(a, b)
+		local na, nb = stacks[a], stacks[b]
+		if na ~= nb then return na > nb end
+		return a < b
+	end)
+	for i = 1, #list do
+		local stack = list[i]
+		list[i] = format('%s %d\n', stack, stacks[stack])
+	end
+	return concat(list)
+end
+
+-- Stop profiling and return the sampled stacks. If path is
+-- given they are also written there in the folded format.
+function profiler.stop(path)
+	local stacks, err = stop()
+	if not stacks then return nil, err end
+
+	if path then
+		local file
+		file, err = io.open(path, 'w')
+		if not file then return nil, err end
+		local ok
+		ok, err = file:write(profiler.folded(stacks))
+		file:close()
+		if not ok then return nil, err end
+	end
+
+	return stacks
+end
+
+return profiler
+
+-- vim: ts=2 sw=2 noet:
@@ -0,0 +1,181 @@
+/*
+ * This file is part of LEM, a Lua Event Machine.
+ * Copyright 2026 agent
+ *
+ * LEM is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * LEM is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <lem.h>
+#include <string.h>
+
+#define PROFILER_MAXDEPTH 128
+
+/* the table of stacks sampled so far, in the registry */
+static int profiler_key;
+
+static const char *const profiler_where[LEM_PROFILE_MAX] = {
+	"[loop]", "[gc]", "[reap]", "[read]",
+};
+
+/* Lua functions are named by where they are defined, since the
+ * name depends on the caller and would split up the same function */
+static void
+profiler_frame(lua_State *T, luaL_Buffer *buf, lua_Debug *ar)
+{
+	if (*ar->what == 'C') {
+		luaL_addstring(buf, ar->name ? ar->name : "?");
+		luaL_addstring(buf, " [C]");
+		return;
+	}
+	luaL_addstring(buf, ar->short_src);
+	if (*ar->what != 'm') {
+		lua_pushfstring(T, ":%d", ar->linedefined);
+		luaL_addvalue(buf);
+	}
+}
+
+/*
+ * Record the stack of T as "root;...;leaf". A sample asked for
+ * by the signal handler is taken at the first event. On a call
+ * the new function hasn't run yet, so it is left out. On a
+ * return the function at the top has been running, which is how
+ * C functions are attributed. ar is NULL when the thread yielded
+ * before any event.
+ */
+static void
+profiler_hook(lua_State *T, lua_Debug *ar)
+{
+	lua_Debug frame;
+	luaL_Buffer buf;
+	int first = 0;
+	int level;
+
+	if (!lem_profile_sampled(T))
+		return;
+
+	if (ar != NULL && (ar->event == LUA_HOOKCALL ||
+				ar->event == LUA_HOOKTAILCALL))
+		first = 1;
+
+	for (level = first; level < PROFILER_MAXDEPTH; level++) {
+		if (!lua_getstack(T, level, &frame))
+			break;
+	}
+	if (level == first)
+		return;
+
+	lua_rawgetp(T, LUA_REGISTRYINDEX, &profiler_key);
+	if (!lua_istable(T, -1)) {
+		lua_pop(T, 1);
+		return;
+	}
+
+	luaL_buffinit(T, &buf);
+	while (--level >= first) {
+		lua_getstack(T, level, &frame);
+		lua_getinfo(T, "Sn", &frame);
+		profiler_frame(T, &buf, &frame);
+		if (level > first)
+			luaL_addchar(&buf, ';');
+	}
+	luaL_pushresult(&buf);
+
+	lua_pushvalue(T, -1);
+	lua_rawget(T, -3);
+	lua_pushinteger(T, lua_tointeger(T, -1) + 1);
+	lua_replace(T, -2);
+	lua_rawset(T, -3);
+	lua_pop(T, 1);
+}
+
+/*
+ * profiler.start([hz]) starts sampling this loop at hz
+ * times a second of CPU time, 100 by default
+ */
+static int
+profiler_start(lua_State *T)
+{
+	lua_Integer hz = luaL_optinteger(T, 1, 100);
+	int ret;
+
+	luaL_argcheck(T, hz > 0 && hz <= 10000, 1, "out of range");
+
+	lua_rawgetp(T, LUA_REGISTRYINDEX, &profiler_key);
+	if (lua_istable(T, -1)) {
+		lua_pushnil(T);
+		lua_pushliteral(T, "busy");
+		return 2;
+	}
+
+	lua_newtable(T);
+	lua_rawsetp(T, LUA_REGISTRYINDEX, &profiler_key);
+
+	ret = lem_profile_start(profiler_hook, hz);
+	if (ret) {
+		lua_pushnil(T);
+		lua_rawsetp(T, LUA_REGISTRYINDEX, &profiler_key);
+		lua_pushnil(T);
+		lua_pushstring(T, strerror(ret));
+		return 2;
+	}
+
+	lua_pushboolean(T, 1);
+	return 1;
+}
+
+/*
+ * profiler.stop() stops sampling and returns a table mapping
+ * folded stacks to the number of samples
+ */
+static int
+profiler_stop(lua_State *T)
+{
+	unsigned long ticks[LEM_PROFILE_MAX];
+	int i;
+
+	lua_rawgetp(T, LUA_REGISTRYINDEX, &profiler_key);
+	if (!lua_istable(T, -1)) {
+		lua_pushnil(T);
+		lua_pushliteral(T, "not running");
+		return 2;
+	}
+	lua_pushnil(T);
+	lua_rawsetp(T, LUA_REGISTRYINDEX, &profiler_key);
+
+	lem_profile_stop(ticks);
+	for (i = 0; i < LEM_PROFILE_MAX; i++) {
+		if (ticks[i] == 0)
+			continue;
+		lua_pushinteger(T, ticks[i]);
+		lua_setfield(T, -2, profiler_where[i]);
+	}
+	return 1;
+}
+
+int
+luaopen_lem_profiler_core(lua_State *L)
+{
+	/* create module table */
+	lua_newtable(L);
+
+	/* set start function */
+	lua_pushcfunction(L, profiler_start);
+	lua_setfield(L, -2, "start");
+
+	/* set stop function */
+	lua_pushcfunction(L, profiler_stop);
+	lua_setfield(L, -2, "stop");
+
+	return 1;
+}
@@ -0,0 +1,166 @@
+--
+-- This file is part of LEM, a Lua Event Machine.
+-- Copyright 2026 agent
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+--
+
+local redis   = require 'lem.redis.core'
+local parsers = require 'lem.parsers'
+local utils   = require 'lem.utils'
+local io      = require 'lem.io'
+
+local setmetatable = setmetatable
+local tostring, select = tostring, select
+local concat = table.concat
+local thisthread, suspend, resume
+	= utils.thisthread, utils.suspend, utils.resume
+
+parsers.lookup['RESP'] = redis.RESP
+redis.RESP = nil
+
+local null = redis.null
+
+-- encode a command as an array of bulk strings
+local function encode(...)
+	local n = select('#', ...)
+	local t = { '*', tostring(n), '\r\n' }
+	for i = 1, n do
+		local arg = tostring((select(i, ...)))
+		t[#t+1] = '$'
+		t[#t+1] = tostring(#arg)
+		t[#t+1] = '\r\n'
+		t[#t+1] = arg
+		t[#t+1] = '\r\n'
+	end
+	return concat(t)
+end
+redis.encode = encode
+
+-- resumes a waiting thread to make it read the replies
+local READ = {}
+
+local Client = {}
+Client.__index = function(self, name)
+	local method = Client[name]
+	if method then return method end
+
+	method = function(self, ...)
+		return self:call(name:upper(), ...)
+	end
+	Client[name] = method
+	return method
+end
+redis.Client = Client
+
+-- Replies come back in the order the commands were written,
+-- so threads waiting for a reply are kept in a fifo. The thread
+-- at the head reads replies and hands them to the waiting threads
+-- until it gets its own. Then it wakes the next thread to read.
+local function read(self, me)
+	local stream, waiting = self.stream, self.waiting
+
+	while true do
+		local head = waiting.head
+		local waiter = waiting[head]
+		local reply, err = stream:read('RESP')
+
+		if reply == nil then
+			-- the connection is broken, fail everybody
+			err = err or 'closed'
+			self.err = err
+			stream:close()
+			for i = head, waiting.tail do
+				local t = waiting[i]
+				waiting[i] = nil
+				if t ~= me then resume(t, nil, err) end
+			end
+			waiting.head, waiting.tail = 1, 0
+			return nil, err
+		end
+
+		waiting[head] = nil
+		waiting.head = head + 1
+		if waiter == me then
+			local nxt = waiting[head + 1]
+			if nxt then
+				resume(nxt, READ)
+			else
+				waiting.head, waiting.tail = 1, 0
+			end
+			return reply, err
+		end
+		resume(waiter, reply, err)
+	end
+end
+
+function Client:call(...)
+	if self.err then return nil, self.err end
+
+	local me = thisthread()
+	local waiting = self.waiting
+	local tail = waiting.tail + 1
+	waiting.tail = tail
+	waiting[tail] = me
+
+	-- if the write fails the stream is closed, so the
+	-- reader fails with the rest of us below
+	if not self.stream:write(encode(...)) then
+		self.stream:close()
+	end
+
+	local reply, err
+	if tail == waiting.head then
+		reply, err = read(self, me)
+	else
+		reply, err = suspend()
+		if reply == READ then
+			reply, err = read(self, me)
+		end
+	end
+
+	if err ~= nil then
+		return nil, err
+	end
+	if reply == null then
+		return nil
+	end
+	return reply
+end
+
+function Client:closed()
+	return self.stream:closed()
+end
+
+function Client:close()
+	return self.stream:close()
+end
+
+function redis.wrap(stream)
+	return setmetatable({
+		stream = stream,
+		waiting = { head = 1, tail = 0 },
+		err = false,
+	}, Client)
+end
+
+function redis.connect(host, port)
+	local stream, err = io.tcp.connect(host or '127.0.0.1', port or 6379)
+	if not stream then return nil, err end
+	return redis.wrap(stream)
+end
+
+return redis
+
+-- vim: ts=2 sw=2 noet:
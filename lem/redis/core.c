@@ -0,0 +1,403 @@
+/*
+ * This file is part of LEM, a Lua Event Machine.
+ * Copyright 2026 agent
+ *
+ * LEM is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * LEM is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <lem-parsers.h>
+
+/*
+ * RESP2 and RESP3 reply parser
+ *
+ * Replies are decoded into Lua values as follows:
+ *   simple and bulk strings, verbatim strings and big numbers: strings
+ *   integers: integers, doubles: numbers, booleans: booleans
+ *   arrays, sets and pushes: arrays, maps: tables
+ *   nulls: the null lightuserdata
+ *   errors: false and the message at the top level and
+ *           { err = message } inside aggregates
+ * Attributes are skipped.
+ *
+ * Aggregates being filled are kept on the stack above
+ * a struct resp_stack userdata at index 3.
+ */
+#define RESP_MAXDEPTH 64
+
+enum resp_phase {
+	RESP_LINE,
+	RESP_BULK,
+	RESP_CRLF,
+};
+
+struct resp_level {
+	lua_Integer left; /* elements, or pairs for maps */
+	lua_Integer n;
+	unsigned char type;
+	unsigned char haskey;
+};
+
+struct resp_stack {
+	int depth;
+	struct resp_level level[RESP_MAXDEPTH];
+};
+
+struct parse_resp_state {
+	size_t target;
+	size_t len;
+	int parts;
+	unsigned char phase;
+	unsigned char type;
+};
+LEM_BUILD_ASSERT(sizeof(struct parse_resp_state) < LEM_INPUTBUF_PSIZE);
+
+static void
+parse_resp_init(lua_State *T, struct lem_inputbuf *b)
+{
+	struct parse_resp_state *s = (struct parse_resp_state *)&b->pstate;
+	struct resp_stack *st;
+
+	lua_settop(T, 2);
+	st = lua_newuserdata(T, sizeof(struct resp_stack));
+	st->depth = 0;
+	s->phase = RESP_LINE;
+}
+
+static int
+parse_resp_error(lua_State *T, struct lem_inputbuf *b, const char *msg)
+{
+	b->start = b->end = 0;
+	lua_settop(T, 0);
+	lua_pushnil(T);
+	lua_pushstring(T, msg);
+	return 2;
+}
+
+static int
+resp_integer(const char *p, size_t len, lua_Integer *r)
+{
+	lua_Unsigned v = 0;
+	int neg = 0;
+	size_t i = 0;
+
+	if (len > 0 && (p[0] == '-' || p[0] == '+')) {
+		neg = p[0] == '-';
+		i++;
+	}
+	if (i == len || len - i > 19)
+		return 0;
+	for (; i < len; i++) {
+		if (p[i] < '0' || p[i] > '9')
+			return 0;
+		v = 10*v + (p[i] - '0');
+	}
+
+	*r = neg ? -(lua_Integer)v : (lua_Integer)v;
+	return 1;
+}
+
+static int
+resp_double(lua_State *T, const char *p, size_t len)
+{
+	char buf[64];
+	char *end;
+	double d;
+
+	if (len == 0 || len >= sizeof(buf))
+		return 0;
+	memcpy(buf, p, len);
+	buf[len] = '\0';
+
+	if (strcmp(buf, "inf") == 0)
+		d = HUGE_VAL;
+	else if (strcmp(buf, "-inf") == 0)
+		d = -HUGE_VAL;
+	else {
+		d = strtod(buf, &end);
+		if (*end != '\0')
+			return 0;
+	}
+
+	lua_pushnumber(T, d);
+	return 1;
+}
+
+/* wrap an error message below the top level */
+static void
+resp_pusherror(lua_State *T, struct resp_stack *st)
+{
+	if (st->depth == 0)
+		return;
+
+	lua_createtable(T, 0, 1);
+	lua_insert(T, -2);
+	lua_setfield(T, -2, "err");
+}
+
+/*
+ * Add the value on top of the stack to the aggregate
+ * being filled. Returns 1 when the reply is complete.
+ */
+static int
+resp_add(lua_State *T, struct resp_stack *st)
+{
+	while (st->depth > 0) {
+		struct resp_level *l = &st->level[st->depth - 1];
+
+		if (l->type == '%' || l->type == '|') {
+			if (!l->haskey) {
+				l->haskey = 1;
+				return 0;
+			}
+			l->haskey = 0;
+			if (l->type == '%')
+				lua_rawset(T, -3);
+			else
+				lua_pop(T, 2);
+		} else
+			lua_rawseti(T, -2, ++l->n);
+
+		if (--l->left > 0)
+			return 0;
+
+		/* the aggregate is complete */
+		st->depth--;
+		if (l->type == '|') {
+			/* attributes come before the actual value */
+			lua_pop(T, 1);
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static int
+parse_resp_process(lua_State *T, struct lem_inputbuf *b)
+{
+	struct parse_resp_state *s = (struct parse_resp_state *)&b->pstate;
+	struct resp_stack *st = lua_touserdata(T, 3);
+
+	while (1) {
+		int error = 0;
+
+		switch (s->phase) {
+		case RESP_LINE: {
+				const char *line = b->buf + b->start;
+				size_t size = b->end - b->start;
+				const char *nl = memchr(line, '\n', size);
+				const char *p;
+				size_t len;
+				lua_Integer n;
+
+				if (nl == NULL) {
+					if (b->end < LEM_INPUTBUF_SIZE)
+						return 0;
+					if (b->start == 0)
+						return parse_resp_error(T, b, "line too long");
+					memmove(b->buf, line, size);
+					b->start = 0;
+					b->end = size;
+					return 0;
+				}
+				if (nl - line < 2 || nl[-1] != '\r')
+					return parse_resp_error(T, b, "protocol error");
+
+				p = line + 1;
+				len = nl - line - 2;
+				b->start += nl - line + 1;
+
+				if (!lua_checkstack(T, 4))
+					return parse_resp_error(T, b, "out of stack space");
+
+				switch (line[0]) {
+				case '-':
+					if (st->depth == 0)
+						lua_pushboolean(T, 0);
+					lua_pushlstring(T, p, len);
+					resp_pusherror(T, st);
+					error = 1;
+					break;
+
+				case '+':
+				case '(':
+					lua_pushlstring(T, p, len);
+					break;
+
+				case ':':
+					if (!resp_integer(p, len, &n))
+						return parse_resp_error(T, b, "protocol error");
+					lua_pushinteger(T, n);
+					break;
+
+				case ',':
+					if (!resp_double(T, p, len))
+						return parse_resp_error(T, b, "protocol error");
+					break;
+
+				case '#':
+					if (len != 1 || (p[0] != 't' && p[0] != 'f'))
+						return parse_resp_error(T, b, "protocol error");
+					lua_pushboolean(T, p[0] == 't');
+					break;
+
+				case '_':
+					lua_pushlightuserdata(T, NULL);
+					break;
+
+				case '$':
+				case '!':
+				case '=':
+					if (!resp_integer(p, len, &n) || n < -1)
+						return parse_resp_error(T, b, "protocol error");
+					if (n == -1) {
+						lua_pushlightuserdata(T, NULL);
+						break;
+					}
+					s->phase = RESP_BULK;
+					s->type = line[0];
+					s->target = s->len = n;
+					s->parts = 0;
+					continue;
+
+				case '*':
+				case '~':
+				case '>':
+				case '%':
+				case '|':
+					if (!resp_integer(p, len, &n) || n < -1)
+						return parse_resp_error(T, b, "protocol error");
+					if (n == -1) {
+						lua_pushlightuserdata(T, NULL);
+						break;
+					}
+					if (line[0] == '%')
+						lua_createtable(T, 0, n < 1024 ? n : 1024);
+					else
+						lua_createtable(T, n < 1024 ? n : 1024, 0);
+					if (n == 0) {
+						if (line[0] == '|') {
+							lua_pop(T, 1);
+							continue;
+						}
+						break;
+					}
+					if (st->depth == RESP_MAXDEPTH)
+						return parse_resp_error(T, b, "nesting too deep");
+					st->level[st->depth].left = n;
+					st->level[st->depth].n = 0;
+					st->level[st->depth].type = line[0];
+					st->level[st->depth].haskey = 0;
+					st->depth++;
+					continue;
+
+				default:
+					return parse_resp_error(T, b, "protocol error");
+				}
+
+				if (b->start == b->end)
+					b->start = b->end = 0;
+			}
+			break;
+
+		case RESP_BULK: {
+				size_t size = b->end - b->start;
+
+				if (size < s->target) {
+					if (b->end == LEM_INPUTBUF_SIZE) {
+						lua_pushlstring(T, b->buf + b->start, size);
+						s->parts++;
+						if (s->parts == LUA_MINSTACK-2) {
+							lua_concat(T, LUA_MINSTACK-2);
+							s->parts = 1;
+						}
+						b->start = b->end = 0;
+						s->target -= size;
+					}
+					return 0;
+				}
+
+				lua_pushlstring(T, b->buf + b->start, s->target);
+				lua_concat(T, s->parts + 1);
+				b->start += s->target;
+				s->phase = RESP_CRLF;
+			}
+			/* fallthrough */
+
+		case RESP_CRLF:
+			if (b->end - b->start < 2) {
+				if (b->end == LEM_INPUTBUF_SIZE) {
+					memmove(b->buf, b->buf + b->start, b->end - b->start);
+					b->end -= b->start;
+					b->start = 0;
+				}
+				return 0;
+			}
+			if (b->buf[b->start] != '\r' || b->buf[b->start + 1] != '\n')
+				return parse_resp_error(T, b, "protocol error");
+			b->start += 2;
+			if (b->start == b->end)
+				b->start = b->end = 0;
+			s->phase = RESP_LINE;
+
+			if (s->type == '=' && s->len >= 4) {
+				/* strip the format, eg. "txt:" */
+				size_t len;
+				const char *str = lua_tolstring(T, -1, &len);
+
+				lua_pushlstring(T, str + 4, len - 4);
+				lua_remove(T, -2);
+			} else if (s->type == '!') {
+				if (st->depth == 0) {
+					lua_pushboolean(T, 0);
+					lua_insert(T, -2);
+				}
+				resp_pusherror(T, st);
+				error = 1;
+			}
+			break;
+		}
+
+		/* errors at the top level return false and the message */
+		if (error && st->depth == 0)
+			return 2;
+		if (resp_add(T, st))
+			return 1;
+	}
+}
+
+static const struct lem_parser resp_parser = {
+	.init    = parse_resp_init,
+	.process = parse_resp_process,
+};
+
+int
+luaopen_lem_redis_core(lua_State *L)
+{
+	/* create module table */
+	lua_newtable(L);
+
+	/* push the reply parser */
+	lua_pushlightuserdata(L, (void *)&resp_parser);
+	lua_setfield(L, -2, "RESP");
+
+	/* set null value */
+	lua_pushlightuserdata(L, NULL);
+	lua_setfield(L, -2, "null");
+
+	return 1;
+}
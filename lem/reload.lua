@@ -0,0 +1,317 @@
+--
+-- This file is part of LEM, a Lua Event Machine.
+-- Copyright 2026 agent
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+--
+
+-- Zero-downtime restarts.
+--
+-- Listening sockets opened with reload.tcp(), reload.unix() or
+-- reload.listen() are handed over to a new process on SIGUSR2 or
+-- reload.restart(). The new process is the same program started
+-- with the same arguments, and it picks up the sockets instead of
+-- opening them again. Once it calls reload.enable() it is ready,
+-- and the old process stops accepting, gives connections in flight
+-- reload.timeout seconds to finish and exits. If the new process
+-- dies before it is ready the old one carries on as before.
+--
+-- Sockets are passed like systemd does for socket activation,
+-- with LISTEN_FDS, LISTEN_PID and LISTEN_FDNAMES, so the same code
+-- picks up sockets from a systemd .socket unit. They're matched by
+-- name, which for reload.tcp(host, port) is 'host_port'. Set
+-- FileDescriptorName= in the unit to match, eg. *_8080 for
+-- reload.tcp('*', 8080), or sockets without a name are used in the
+-- order they're asked for. When a listener has a socket for each
+-- address family, like reload.tcp('*', 8080) usually has, they're
+-- named *_8080#1, *_8080#2 and so on.
+
+local tonumber = tonumber
+local ipairs = ipairs
+local getmetatable, setmetatable = getmetatable, setmetatable
+local format = string.format
+local concat = table.concat
+local remove = table.remove
+local select = select
+local getenv = os.getenv
+
+local utils  = require 'lem.utils'
+local io     = require 'lem.io'
+local signal = require 'lem.signal'
+
+local M = {}
+
+-- seconds connections in flight get to finish when restarting
+M.timeout = 30
+
+-- seconds the new process gets to call reload.enable()
+M.startup = 30
+
+-- the program started, the running one by default
+M.program = '/proc/self/exe'
+
+function M.debug() end
+
+-- called when a restart on SIGUSR2 fails, replace
+-- it to report the error somewhere else
+function M.onerror(err)
+	io.stderr:write(format('lem.reload: restart failed: %s\n', err))
+end
+
+-- sockets we got, by name and those without one
+local named, unnamed
+-- the parent to tell when we're ready
+local parent
+-- the sockets handed over, in order
+local listeners = {}
+-- objects to drain, all listeners by default
+local drainable
+
+local function inherit()
+	named, unnamed = {}, {}
+	local n = tonumber(getenv('LISTEN_FDS') or '')
+	local pid = tonumber(getenv('LISTEN_PID') or '')
+	local fdnames = getenv('LISTEN_FDNAMES') or ''
+	local ppid = tonumber(getenv('LEM_RELOAD_PARENT') or '')
+
+	-- like sd_listen_fds(), so they aren't passed on to
+	-- processes we start
+	for _, name in ipairs{ 'LISTEN_FDS', 'LISTEN_PID',
+			'LISTEN_FDNAMES', 'LEM_RELOAD_PARENT' } do
+		utils.setenv(name)
+	end
+
+	if not n or pid ~= utils.getpid() then return end
+	parent = ppid
+
+	local names = {}
+	for name in fdnames:gmatch('[^:]+') do
+		names[#names+1] = name
+	end
+	for i = 1, n do
+		local sock, err = io.fromfd(2 + i)
+		if sock then
+			local name = names[i]
+			if name and name ~= 'unknown' then
+				named[name] = sock
+			else
+				unnamed[#unnamed+1] = sock
+			end
+		else
+			M.debug('fromfd', 2 + i, err)
+		end
+	end
+end
+
+-- Returns the socket passed to us as name, or the one returned by
+-- create() if there is none, and hands it over on restarts.
+-- Colons in the name are replaced by underscores.
+function M.listen(name, create, ...)
+	if not named then inherit() end
+	name = name:gsub(':', '_')
+
+	local sock = named[name]
+	if sock then
+		named[name] = nil
+	elseif named[name .. '#1'] then
+		sock = setmetatable({}, io.MultiServer)
+		local part = name .. '#1'
+		while named[part] do
+			sock[#sock+1], named[part] = named[part], nil
+			part = format('%s#%d', name, #sock + 1)
+		end
+	elseif #unnamed > 0 then
+		sock = remove(unnamed, 1)
+	else
+		local err
+		sock, err = create(...)
+		if not sock then return nil, err end
+	end
+
+	listeners[#listeners+1] = { name = name, socket = sock }
+	return sock
+end
+
+function M.tcp(host, port, ...)
+	return M.listen(format('%s_%s', host, port), io.tcp.listen, host, port, ...)
+end
+
+function M.unix(path, ...)
+	return M.listen(path, io.unix.listen, path, ...)
+end
+
+local function active()
+	local n = 0
+	for _, l in ipairs(listeners) do
+		n = n + l.socket:stats().active
+	end
+	return n
+end
+
+local draining = false
+
+-- stop accepting, so new connections go to the new process
+local function stop()
+	draining = true
+	local http = package.loaded['lem.http.server']
+	for _, obj in ipairs(drainable or listeners) do
+		local sock = obj.socket or obj
+		local srv = http and http.servers[sock]
+		if obj.drain then
+			obj:drain()
+		elseif srv then
+			srv:drain()
+		else
+			sock:close()
+		end
+	end
+end
+
+-- exit once connections in flight are done
+local function drain()
+	local sleeper = utils.newsleeper()
+	local deadline = utils.now() + M.timeout
+	while active() > 0 and utils.now() < deadline do
+		sleeper:sleep(0.05)
+	end
+	M.debug('drained', active())
+	utils.exit(0)
+end
+
+local function argv()
+	local first = 0
+	while arg[first - 1] do first = first - 1 end
+	local t = {}
+	for i = first, #arg do
+		t[#t+1] = arg[i]
+	end
+	return t
+end
+
+local restarting, ready
+
+local function onchild(_, ev)
+	if not restarting or ev.rpid ~= restarting.pid then return end
+	if ev.type ~= 'exited' and ev.type ~= 'signaled' then return end
+	ready = false
+	restarting.sleeper:wakeup()
+end
+
+-- Start a new process taking over our sockets. Returns true
+-- once it is up and we're draining, or nil and an error.
+function M.restart()
+	if restarting or draining then return nil, 'busy' end
+
+	local fds, names = {}, {}
+	for _, l in ipairs(listeners) do
+		local sock = l.socket
+		if getmetatable(sock) == io.MultiServer then
+			for i = 1, #sock do
+				local fd, err = sock[i]:fileno()
+				if not fd then return nil, err end
+				fds[#fds+1], names[#names+1] = fd, format('%s#%d', l.name, i)
+			end
+		else
+			local fd, err = sock:fileno()
+			if not fd then return nil, err end
+			fds[#fds+1], names[#names+1] = fd, l.name
+		end
+	end
+
+	local env = {
+		LISTEN_FDS = #fds,
+		LISTEN_FDNAMES = concat(names, ':'),
+		LEM_RELOAD_PARENT = utils.getpid(),
+	}
+	local args = argv()
+
+	restarting = { sleeper = utils.newsleeper() }
+	ready = nil
+	signal.register('SIGCHLD', onchild)
+
+	-- forking waits until no thread pool jobs are in flight,
+	-- as they would never finish in the child
+	local pid, err
+	local deadline = utils.now() + M.startup
+	local sleeper = utils.newsleeper()
+	while true do
+		pid, err = utils.fork()
+		if pid or err ~= 'busy' or utils.now() >= deadline then break end
+		sleeper:sleep(0.01)
+	end
+	if pid == 0 then
+		env.LISTEN_PID = utils.getpid()
+		local _, err = utils.exec(M.program, args, env, fds)
+		M.debug('exec', err)
+		os.exit(1)
+	end
+	if pid then
+		restarting.pid = pid
+		restarting.sleeper:sleep(M.startup)
+		if not ready then
+			signal.kill(pid, 'SIGTERM')
+			err = ready == false and 'new process died' or 'timeout'
+		end
+	end
+
+	signal.unregister('SIGCHLD', onchild)
+	restarting = nil
+	if not ready then
+		M.debug('restart', err)
+		return nil, err
+	end
+
+	stop()
+	utils.spawn(drain)
+	return true
+end
+
+local function onusr2()
+	if restarting then
+		-- the new process is ready, unless we're still forking
+		if restarting.pid then
+			ready = true
+			restarting.sleeper:wakeup()
+		end
+	else
+		local ok, err = M.restart()
+		if not ok then M.onerror(err) end
+	end
+end
+
+-- Restart on SIGUSR2, and if we were started by reload.restart()
+-- tell the old process we're ready. Pass the objects to drain on
+-- restarts, sockets or servers with a drain() method, or leave
+-- them out to close all sockets handed over. Sockets served by
+-- lem.http.server are drained by the server.
+function M.enable(...)
+	if not named then inherit() end
+	if select('#', ...) > 0 then
+		drainable = { ... }
+	end
+
+	local ok, err = signal.register('SIGUSR2', onusr2)
+	if not ok then return nil, err end
+
+	if parent then
+		ok, err = signal.kill(parent, 'SIGUSR2')
+		parent = nil
+		if not ok then return nil, err end
+	end
+	return true
+end
+
+return M
+
+-- vim: ts=2 sw=2 noet:
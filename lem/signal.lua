@@ -121,6 +121,15 @@ function M.unregister(signal, func)
 	return true
 end
 
+function M.kill(pid, signal)
+	local signum = signal
+	if type(signal) == 'string' then
+		signum = lookup(signal)
+		if not signum then return nil, 'unknown signal' end
+	end
+	return core.kill(pid, signum)
+end
+
 return M
 
 -- vim: ts=2 sw=2 noet:
@@ -20,7 +20,9 @@
 #include <lem.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <signal.h>
 #include <assert.h>
+#include <errno.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -62,6 +64,9 @@ signal_os_handler(EV_P_ struct ev_signal *w, int revents)
 {
 	lua_State *S;
 
+#if EV_MULTIPLICITY
+	(void)loop;
+#endif
 	(void)revents;
 
 	S = lem_newthread();
@@ -170,6 +175,9 @@ signal_child_handler(EV_P_ struct ev_child *w, int revents)
 	int pid = w->pid;
 	int rpid = w->rpid;
 
+#if EV_MULTIPLICITY
+	(void)loop;
+#endif
 	(void)revents;
 
 	S = lem_newthread();
@@ -354,6 +362,22 @@ signal_unwatch(lua_State *T)
 	return signal_os_unwatch(T, sig);
 }
 
+static int
+signal_kill(lua_State *T)
+{
+	pid_t pid = luaL_checkinteger(T, 1);
+	int sig = luaL_checkinteger(T, 2);
+
+	if (kill(pid, sig)) {
+		lua_pushnil(T);
+		lua_pushstring(T, strerror(errno));
+		return 2;
+	}
+
+	lua_pushboolean(T, 1);
+	return 1;
+}
+
 int
 luaopen_lem_signal_core(lua_State *T)
 {
@@ -384,6 +408,9 @@ luaopen_lem_signal_core(lua_State *T)
 	/* set unwatch function */
 	lua_pushcfunction(T, signal_unwatch);
 	lua_setfield(T, -2, "unwatch");
+	/* set kill function */
+	lua_pushcfunction(T, signal_kill);
+	lua_setfield(T, -2, "kill");
 
 	return 1;
 }
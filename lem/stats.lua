@@ -0,0 +1,144 @@
+--
+-- This file is part of LEM, a Lua Event Machine.
+-- Copyright 2026 agent
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+--
+
+-- Counters of the current loop, collected from lem.utils, lem.io
+-- and the Lua state, and exported in the Prometheus text format.
+
+local setmetatable = setmetatable
+local pairs, ipairs = pairs, ipairs
+local format = string.format
+local concat, sort = table.concat, table.sort
+local collectgarbage = collectgarbage
+
+local utils = require 'lem.utils'
+local io    = require 'lem.io'
+
+local M = {}
+
+-- count finished garbage collection cycles with an object
+-- whose finalizer creates the next one
+local cycles = 0
+do
+	local mt = {}
+	function mt.__gc()
+		cycles = cycles + 1
+		setmetatable({}, mt)
+	end
+	setmetatable({}, mt)
+end
+
+local last_time, last_resumes
+
+-- Returns a table with the counters of lem.utils.stats(), the
+-- i/o counters of lem.io.stats() as io, the Lua heap size in
+-- bytes, the number of finished GC cycles and the resumes per
+-- second since the last call.
+function M.collect()
+	local s = utils.stats()
+	s.io = io.stats()
+	s.heap = collectgarbage('count') * 1024 // 1
+	s.gc_cycles = cycles
+
+	utils.updatenow()
+	local now = utils.now()
+	if last_time and now > last_time then
+		s.resume_rate = (s.resumes - last_resumes) / (now - last_time)
+	else
+		s.resume_rate = 0
+	end
+	last_time, last_resumes = now, s.resumes
+
+	return s
+end
+
+local function header(rope, name, kind, help)
+	rope[#rope+1] = format('# HELP %s %s\n# TYPE %s %s\n', name, help, name, kind)
+end
+
+local function value(rope, name, kind, help, v)
+	header(rope, name, kind, help)
+	rope[#rope+1] = format('%s %s\n', name, v)
+end
+
+-- bucket i counts times below 2^(i-1) microseconds
+local function histogram(rope, name, help, h)
+	header(rope, name, 'histogram', help)
+	local total = 0
+	for i = 1, #h - 1 do
+		total = total + h[i]
+		rope[#rope+1] = format('%s_bucket{le="%g"} %d\n', name, (1 << (i - 1)) / 1e6, total)
+	end
+	total = total + h[#h]
+	rope[#rope+1] = format('%s_bucket{le="+Inf"} %d\n', name, total)
+	rope[#rope+1] = format('%s_sum %.6f\n', name, h.sum / 1e6)
+	rope[#rope+1] = format('%s_count %d\n', name, total)
+end
+
+-- Format stats, or freshly collected ones, as Prometheus text
+function M.prometheus(s)
+	s = s or M.collect()
+	local rope = {}
+
+	value(rope, 'lem_resumes_total', 'counter', 'Lua threads resumed.', s.resumes)
+	value(rope, 'lem_preempted_total', 'counter', 'Lua threads preempted.', s.preempted)
+	value(rope, 'lem_threads', 'gauge', 'Lua threads alive.', s.threads)
+	value(rope, 'lem_runqueue_length', 'gauge', 'Lua threads waiting to run.', s.runqueue)
+	value(rope, 'lem_runqueue_max', 'gauge', 'Most Lua threads waiting to run at once.', s.runqueue_max)
+	value(rope, 'lem_pool_jobs', 'gauge', 'Thread pool jobs of this loop not reaped yet.', s.pool_jobs)
+	value(rope, 'lem_pool_threads', 'gauge', 'Threads in the thread pool.', s.pool_threads)
+	value(rope, 'lem_pool_jobs_total', 'counter', 'Thread pool jobs reaped.', s.pool_done)
+	histogram(rope, 'lem_pool_wait_seconds', 'Time jobs waited for a pool thread.', s.pool_wait)
+	histogram(rope, 'lem_pool_run_seconds', 'Time jobs ran on a pool thread.', s.pool_run)
+	histogram(rope, 'lem_gc_pause_seconds', 'Full collections when the loop is idle.', s.gc_pause)
+	value(rope, 'lem_gc_cycles_total', 'counter', 'Garbage collection cycles finished.', s.gc_cycles)
+	value(rope, 'lem_lua_heap_bytes', 'gauge', 'Memory used by Lua.', s.heap)
+	value(rope, 'lem_accepts_total', 'counter', 'Connections accepted.', s.io.accepts)
+
+	local kinds = {}
+	for kind in pairs(s.io) do
+		if kind ~= 'accepts' then kinds[#kinds+1] = kind end
+	end
+	sort(kinds)
+
+	header(rope, 'lem_io_syscalls_total', 'counter', 'Read and write system calls.')
+	for _, kind in ipairs(kinds) do
+		local c = s.io[kind]
+		rope[#rope+1] = format('lem_io_syscalls_total{kind="%s",op="read"} %d\n', kind, c.reads)
+		rope[#rope+1] = format('lem_io_syscalls_total{kind="%s",op="write"} %d\n', kind, c.writes)
+	end
+	header(rope, 'lem_io_bytes_total', 'counter', 'Bytes read and written.')
+	for _, kind in ipairs(kinds) do
+		local c = s.io[kind]
+		rope[#rope+1] = format('lem_io_bytes_total{kind="%s",op="read"} %d\n', kind, c.rbytes)
+		rope[#rope+1] = format('lem_io_bytes_total{kind="%s",op="write"} %d\n', kind, c.wbytes)
+	end
+
+	return concat(rope)
+end
+
+-- A lem.http.server or Hathaway handler answering with
+-- the stats of the loop serving the request, eg.
+--   GET('/metrics', require('lem.stats').handler)
+function M.handler(req, res)
+	res.headers['Content-Type'] = 'text/plain; version=0.0.4'
+	res:add(M.prometheus())
+end
+
+return M
+
+-- vim: ts=2 sw=2 noet:
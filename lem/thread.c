@@ -0,0 +1,454 @@
+/*
+ * This file is part of LEM, a Lua Event Machine.
+ * Copyright 2026 agent
+ *
+ * LEM is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * LEM is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <lem.h>
+
+/*
+ * A channel carries marshalled messages from one loop to another.
+ * Each channel has exactly one sending and one receiving end.
+ */
+struct message {
+	struct message *next;
+	size_t len;
+	char data[];
+};
+
+struct thread_handle;
+
+struct channel {
+	pthread_mutex_t lock;
+	struct message *head;
+	struct message *tail;
+	struct thread_handle *receiver; /* set while a coroutine waits */
+	int refs;
+	int closed;
+};
+
+/*
+ * A thread handle is the userdata living in each of the two
+ * Lua states. It receives from one channel and sends to the other.
+ */
+struct thread_handle {
+	struct ev_async w;
+#if EV_MULTIPLICITY
+	struct ev_loop *loop;
+#endif
+	struct channel *in;
+	struct channel *out;
+};
+
+static struct channel *
+channel_new(void)
+{
+	struct channel *c = lem_xmalloc(sizeof(struct channel));
+
+	pthread_mutex_init(&c->lock, NULL);
+	c->head = NULL;
+	c->tail = NULL;
+	c->receiver = NULL;
+	c->refs = 2;
+	c->closed = 0;
+	return c;
+}
+
+static void
+channel_wakeup(struct channel *c)
+{
+	struct thread_handle *h = c->receiver;
+
+	if (h == NULL)
+		return;
+#if EV_MULTIPLICITY
+	ev_async_send(h->loop, &h->w);
+#else
+	ev_async_send(&h->w);
+#endif
+}
+
+/* drop a reference to the channel and close it */
+static void
+channel_release(struct channel *c)
+{
+	struct message *m;
+	int refs;
+
+	pthread_mutex_lock(&c->lock);
+	c->closed = 1;
+	refs = --c->refs;
+	if (refs > 0)
+		channel_wakeup(c);
+	pthread_mutex_unlock(&c->lock);
+
+	if (refs > 0)
+		return;
+
+	for (m = c->head; m; ) {
+		struct message *next = m->next;
+		free(m);
+		m = next;
+	}
+	pthread_mutex_destroy(&c->lock);
+	free(c);
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wstrict-aliasing"
+static inline void
+thread_watch_init(struct thread_handle *h, void (*cb)(EV_P_ struct ev_async *w, int revents))
+{
+	ev_async_init(&h->w, cb);
+}
+#pragma GCC diagnostic pop
+
+static void thread_receive_cb(EV_P_ struct ev_async *w, int revents);
+
+static struct thread_handle *
+thread_handle_new(lua_State *T, struct channel *in, struct channel *out, int mt)
+{
+	/* create userdata and set the metatable */
+	struct thread_handle *h = lua_newuserdata(T, sizeof(struct thread_handle));
+	lua_pushvalue(T, mt);
+	lua_setmetatable(T, -2);
+
+	/* initialize userdata */
+	thread_watch_init(h, thread_receive_cb);
+	h->w.data = NULL;
+#if EV_MULTIPLICITY
+	h->loop = LEM;
+#endif
+	h->in = in;
+	h->out = out;
+
+	return h;
+}
+
+static int
+thread_gc(lua_State *T)
+{
+	struct thread_handle *h = lua_touserdata(T, 1);
+
+	if (h->in == NULL)
+		return 0;
+
+	if (h->w.data != NULL) {
+		ev_async_stop(LEM_ &h->w);
+		h->w.data = NULL;
+	}
+
+	pthread_mutex_lock(&h->in->lock);
+	h->in->receiver = NULL;
+	pthread_mutex_unlock(&h->in->lock);
+
+	channel_release(h->in);
+	channel_release(h->out);
+	h->in = NULL;
+	h->out = NULL;
+	return 0;
+}
+
+static int
+thread_closed(lua_State *T)
+{
+	struct thread_handle *h;
+	int closed;
+
+	luaL_checktype(T, 1, LUA_TUSERDATA);
+	h = lua_touserdata(T, 1);
+	if (h->in == NULL) {
+		lua_pushboolean(T, 1);
+		return 1;
+	}
+
+	pthread_mutex_lock(&h->out->lock);
+	closed = h->out->closed;
+	pthread_mutex_unlock(&h->out->lock);
+
+	lua_pushboolean(T, closed);
+	return 1;
+}
+
+/*
+ * thread:send() method
+ */
+static int
+thread_send(lua_State *T)
+{
+	struct thread_handle *h;
+	struct channel *c;
+	struct message *m;
+	char *buf;
+	size_t len;
+
+	luaL_checktype(T, 1, LUA_TUSERDATA);
+	h = lua_touserdata(T, 1);
+	if (h->in == NULL)
+		goto closed;
+
+	buf = lem_marshal(T, 2, lua_gettop(T) - 1, &len);
+	if (buf == NULL)
+		return lua_error(T);
+
+	m = lem_xmalloc(sizeof(struct message) + len);
+	m->next = NULL;
+	m->len = len;
+	memcpy(m->data, buf, len);
+	free(buf);
+
+	c = h->out;
+	pthread_mutex_lock(&c->lock);
+	if (c->closed) {
+		pthread_mutex_unlock(&c->lock);
+		free(m);
+		goto closed;
+	}
+	if (c->tail)
+		c->tail->next = m;
+	else
+		c->head = m;
+	c->tail = m;
+	channel_wakeup(c);
+	pthread_mutex_unlock(&c->lock);
+
+	lua_pushboolean(T, 1);
+	return 1;
+
+closed:
+	lua_pushnil(T);
+	lua_pushliteral(T, "closed");
+	return 2;
+}
+
+/*
+ * thread:receive() method
+ */
+static struct message *
+thread__receive(struct thread_handle *h, int *closed)
+{
+	struct channel *c = h->in;
+	struct message *m;
+
+	pthread_mutex_lock(&c->lock);
+	m = c->head;
+	if (m == NULL) {
+		*closed = c->closed;
+		c->receiver = *closed ? NULL : h;
+	} else {
+		c->head = m->next;
+		if (c->head == NULL)
+			c->tail = NULL;
+		c->receiver = NULL;
+	}
+	pthread_mutex_unlock(&c->lock);
+
+	return m;
+}
+
+static int
+thread__push(lua_State *T, struct message *m)
+{
+	int ret;
+
+	if (m == NULL) {
+		lua_pushnil(T);
+		lua_pushliteral(T, "closed");
+		return 2;
+	}
+
+	ret = lem_unmarshal(T, m->data, m->len);
+	free(m);
+	if (ret < 0) {
+		lua_pushnil(T);
+		lua_pushliteral(T, "corrupt message");
+		return 2;
+	}
+
+	return ret;
+}
+
+static void
+thread_receive_cb(EV_P_ struct ev_async *w, int revents)
+{
+	struct thread_handle *h = (struct thread_handle *)w;
+	lua_State *T = w->data;
+	struct message *m;
+	int closed = 0;
+
+	(void)revents;
+
+	m = thread__receive(h, &closed);
+	if (m == NULL && !closed)
+		return;
+
+	ev_async_stop(EV_A_ &h->w);
+	w->data = NULL;
+
+	lua_settop(T, 0);
+	lem_queue(T, thread__push(T, m));
+}
+
+static int
+thread_receive(lua_State *T)
+{
+	struct thread_handle *h;
+	struct message *m;
+	int closed = 0;
+
+	luaL_checktype(T, 1, LUA_TUSERDATA);
+	h = lua_touserdata(T, 1);
+	if (h->in == NULL) {
+		lua_pushnil(T);
+		lua_pushliteral(T, "closed");
+		return 2;
+	}
+	if (h->w.data != NULL) {
+		lua_pushnil(T);
+		lua_pushliteral(T, "busy");
+		return 2;
+	}
+
+	/* start watching before looking at the channel,
+	 * so no wakeup can get lost in between */
+	ev_async_start(LEM_ &h->w);
+
+	m = thread__receive(h, &closed);
+	if (m != NULL || closed) {
+		ev_async_stop(LEM_ &h->w);
+		lua_settop(T, 0);
+		return thread__push(T, m);
+	}
+
+	h->w.data = T;
+	lua_settop(T, 1);
+	return lua_yield(T, 1);
+}
+
+/*
+ * thread.start()
+ */
+struct start {
+	struct channel *in;
+	struct channel *out;
+	char *args;
+	size_t len;
+};
+
+int luaopen_lem_thread(lua_State *L);
+
+static int
+thread_start_init(lua_State *T, void *arg)
+{
+	struct start *s = arg;
+	int ret;
+
+	if (T == NULL) {
+		channel_release(s->in);
+		channel_release(s->out);
+		free(s->args);
+		free(s);
+		return 0;
+	}
+
+	/* set package.loaded['lem.thread'].parent to our end of the channels */
+	luaL_requiref(T, "lem.thread", luaopen_lem_thread, 0);
+	lua_getfield(T, -1, "Thread");
+	thread_handle_new(T, s->in, s->out, lua_gettop(T));
+	lua_setfield(T, -3, "parent");
+	lua_pop(T, 2);
+
+	ret = lem_unmarshal(T, s->args, s->len);
+	free(s->args);
+	free(s);
+	if (ret < 0)
+		return 0;
+	return ret;
+}
+
+static int
+thread_start(lua_State *T)
+{
+	const char *filename = luaL_checkstring(T, 1);
+	struct start *s;
+	struct channel *in;
+	struct channel *out;
+	int ret;
+
+	s = lem_xmalloc(sizeof(struct start));
+	s->args = lem_marshal(T, 2, lua_gettop(T) - 1, &s->len);
+	if (s->args == NULL) {
+		free(s);
+		return lua_error(T);
+	}
+	s->in = in = channel_new();
+	s->out = out = channel_new();
+
+	/* once the loop is spawned s belongs to the new thread */
+	ret = lem_spawnloop(filename, thread_start_init, s);
+	if (ret) {
+		free(s->args);
+		free(s);
+		pthread_mutex_destroy(&in->lock);
+		free(in);
+		pthread_mutex_destroy(&out->lock);
+		free(out);
+		lua_pushnil(T);
+		lua_pushstring(T, strerror(ret));
+		return 2;
+	}
+
+	/* the parent receives what the thread sends and vice versa */
+	thread_handle_new(T, out, in, lua_upvalueindex(1));
+	return 1;
+}
+
+int
+luaopen_lem_thread(lua_State *L)
+{
+	/* create module table */
+	lua_newtable(L);
+
+	/* create Thread metatable */
+	lua_newtable(L);
+	/* mt.__index = mt */
+	lua_pushvalue(L, -1);
+	lua_setfield(L, -2, "__index");
+	/* mt.__gc = <thread_gc> */
+	lua_pushcfunction(L, thread_gc);
+	lua_setfield(L, -2, "__gc");
+	/* mt.closed = <thread_closed> */
+	lua_pushcfunction(L, thread_closed);
+	lua_setfield(L, -2, "closed");
+	/* mt.send = <thread_send> */
+	lua_pushcfunction(L, thread_send);
+	lua_setfield(L, -2, "send");
+	/* mt.receive = <thread_receive> */
+	lua_pushcfunction(L, thread_receive);
+	lua_setfield(L, -2, "receive");
+
+	/* set start function */
+	lua_pushvalue(L, -1); /* upvalue 1 = Thread */
+	lua_pushcclosure(L, thread_start, 1);
+	lua_setfield(L, -3, "start");
+
+	/* insert table */
+	lua_setfield(L, -2, "Thread");
+
+	return 1;
+}
@@ -17,6 +17,12 @@
  */
 
 #include <sys/time.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <lem.h>
 
 static int
@@ -53,10 +59,14 @@ sleep_handler(EV_P_ struct ev_timer *w, int revents)
 {
 	lua_State *T = w->data;
 
+#if EV_MULTIPLICITY
+	(void)loop;
+#endif
 	(void)revents;
 
-	/* return nil, "timeout" */
-	lem_queue(T, 2);
+	/* return nil, "timeout"
+	 * ..after threads woken by i/o */
+	lem_queueat(T, 2, LEM_PRIO_LOW);
 	w->data = NULL;
 }
 
@@ -156,10 +166,30 @@ utils_thisthread(lua_State *T)
 	return 1;
 }
 
+/*
+ * Upvalue 1 of suspend and resume is a table of values held back
+ * for preempted threads, which are returned by their next suspend.
+ * Threads which end without suspending again don't stay in it.
+ */
 static int
 utils_suspend(lua_State *T)
 {
-	return lua_yield(T, 0);
+	int n;
+	int i;
+
+	lua_pushthread(T);
+	if (lua_rawget(T, lua_upvalueindex(1)) == LUA_TNIL)
+		return lua_yield(T, 0);
+
+	lua_pushthread(T);
+	lua_pushnil(T);
+	lua_rawset(T, lua_upvalueindex(1));
+
+	n = lua_rawlen(T, -1);
+	luaL_checkstack(T, n, NULL);
+	for (i = 1; i <= n; i++)
+		lua_rawgeti(T, -i, i);
+	return n;
 }
 
 static int
@@ -172,6 +202,25 @@ utils_resume(lua_State *T)
 	S = lua_tothread(T, 1);
 
 	args = lua_gettop(T) - 1;
+	if (lem_preempted(S)) {
+		int i;
+
+		/* only the first resume of a suspended thread counts */
+		lua_pushvalue(T, 1);
+		if (lua_rawget(T, lua_upvalueindex(1)) != LUA_TNIL)
+			return 0;
+		lua_pop(T, 1);
+
+		lua_pushvalue(T, 1);
+		lua_createtable(T, args, 0);
+		for (i = 1; i <= args; i++) {
+			lua_pushvalue(T, i + 1);
+			lua_rawseti(T, -2, i);
+		}
+		lua_rawset(T, lua_upvalueindex(1));
+		return 0;
+	}
+
 	lua_xmove(T, S, args);
 	lem_queue(S, args);
 
@@ -193,6 +242,218 @@ utils_updatenow(lua_State *T)
 	return 1;
 }
 
+static int
+utils_fork(lua_State *T)
+{
+	pid_t pid = lem_fork();
+
+	if (pid < 0) {
+		lua_pushnil(T);
+		/* pool jobs are in flight, try again later */
+		if (errno == EBUSY)
+			lua_pushliteral(T, "busy");
+		else
+			lua_pushstring(T, strerror(errno));
+		return 2;
+	}
+
+	lua_pushinteger(T, pid);
+	return 1;
+}
+
+static int
+utils_getpid(lua_State *T)
+{
+	lua_pushinteger(T, getpid());
+	return 1;
+}
+
+/*
+ * utils.setenv(name[, value]) sets a variable
+ * in the environment, or unsets it without a value
+ */
+static int
+utils_setenv(lua_State *T)
+{
+	const char *name = luaL_checkstring(T, 1);
+	int ret;
+
+	if (lua_isnoneornil(T, 2))
+		ret = unsetenv(name);
+	else
+		ret = setenv(name, luaL_checkstring(T, 2), 1);
+	if (ret) {
+		lua_pushnil(T);
+		lua_pushstring(T, strerror(errno));
+		return 2;
+	}
+
+	lua_pushboolean(T, 1);
+	return 1;
+}
+
+/*
+ * utils.exec(path, argv[, env[, fds]]) replaces the process with
+ * the program at path. argv is an array of strings starting with
+ * argv[0]. The variables in env are set in the environment, or unset
+ * if false, and the descriptors in the array fds are passed on as
+ * fd 3, 4, 5 and so on. Only returns on errors, after putting the
+ * environment, descriptors and signal mask back as they were.
+ */
+struct exec_fd {
+	int fd;    /* the descriptor passed on, moved out of the way */
+	int saved; /* a copy of what was at 3 + i, or -1 */
+	int flags; /* the fd flags of what was at 3 + i */
+};
+
+static void
+exec_setenv(lua_State *T, int idx)
+{
+	lua_pushnil(T);
+	while (lua_next(T, idx)) {
+		const char *name = lua_tostring(T, -2);
+
+		if (lua_isboolean(T, -1))
+			unsetenv(name);
+		else
+			setenv(name, lua_tostring(T, -1), 1);
+		lua_pop(T, 1);
+	}
+}
+
+static int
+utils_exec(lua_State *T)
+{
+	const char *path = luaL_checkstring(T, 1);
+	const char **argv;
+	struct exec_fd *fds = NULL;
+	sigset_t none;
+	sigset_t old;
+	int argc;
+	int nfds = 0;
+	int moved = 0;
+	int saved = 0;
+	int placed = 0;
+	int masked = 0;
+	int err;
+	int i;
+
+	luaL_checktype(T, 2, LUA_TTABLE);
+	lua_settop(T, 4);
+	argc = lua_rawlen(T, 2);
+	luaL_argcheck(T, argc > 0, 2, "empty");
+	argv = lua_newuserdata(T, (argc + 1) * sizeof(char *));
+	for (i = 0; i < argc; i++) {
+		if (lua_rawgeti(T, 2, i + 1) != LUA_TSTRING)
+			return luaL_argerror(T, 2, "not an array of strings");
+		argv[i] = lua_tostring(T, -1);
+		/* the string is kept alive by the table */
+		lua_pop(T, 1);
+	}
+	argv[argc] = NULL;
+
+	/* check the variables before setting any of them,
+	 * and save the old values in the table at index 6 */
+	lua_newtable(T);
+	if (!lua_isnil(T, 3)) {
+		luaL_checktype(T, 3, LUA_TTABLE);
+		lua_pushnil(T);
+		while (lua_next(T, 3)) {
+			const char *value;
+			int type = lua_type(T, -1);
+
+			if (lua_type(T, -2) != LUA_TSTRING)
+				return luaL_argerror(T, 3, "invalid name");
+			if (type != LUA_TSTRING && type != LUA_TNUMBER &&
+					!(type == LUA_TBOOLEAN && !lua_toboolean(T, -1)))
+				return luaL_argerror(T, 3, "invalid value");
+			lua_pop(T, 1);
+
+			value = getenv(lua_tostring(T, -1));
+			lua_pushvalue(T, -1);
+			if (value)
+				lua_pushstring(T, value);
+			else
+				lua_pushboolean(T, 0);
+			lua_rawset(T, 6);
+		}
+	}
+
+	if (!lua_isnil(T, 4)) {
+		luaL_checktype(T, 4, LUA_TTABLE);
+		nfds = lua_rawlen(T, 4);
+		fds = lua_newuserdata(T, nfds * sizeof(struct exec_fd) + 1);
+		for (i = 0; i < nfds; i++) {
+			lua_rawgeti(T, 4, i + 1);
+			luaL_argcheck(T, lua_isinteger(T, -1), 4,
+					"not an array of integers");
+			fds[i].fd = lua_tointeger(T, -1);
+			lua_pop(T, 1);
+		}
+	}
+
+	if (!lua_isnil(T, 3))
+		exec_setenv(T, 3);
+
+	/* first move the descriptors out of the way, so
+	 * they can't be overwritten by each other */
+	for (; moved < nfds; moved++) {
+		int fd = fcntl(fds[moved].fd, F_DUPFD_CLOEXEC, 3 + nfds);
+
+		if (fd < 0)
+			goto error;
+		fds[moved].fd = fd;
+	}
+	/* then save what they replace */
+	for (; saved < nfds; saved++) {
+		struct exec_fd *f = &fds[saved];
+
+		f->flags = fcntl(3 + saved, F_GETFD);
+		if (f->flags < 0) {
+			f->saved = -1;
+			continue;
+		}
+		f->saved = fcntl(3 + saved, F_DUPFD_CLOEXEC, 3 + nfds);
+		if (f->saved < 0)
+			goto error;
+	}
+	/* dup2() leaves FD_CLOEXEC unset on the copies */
+	for (; placed < nfds; placed++) {
+		if (dup2(fds[placed].fd, 3 + placed) < 0)
+			goto error;
+	}
+
+	/* don't pass on signals blocked for the loop */
+	sigemptyset(&none);
+	sigprocmask(SIG_SETMASK, &none, &old);
+	masked = 1;
+
+	execv(path, (char *const *)argv);
+error:
+	err = errno;
+	if (masked)
+		sigprocmask(SIG_SETMASK, &old, NULL);
+	for (i = 0; i < placed; i++) {
+		if (fds[i].saved < 0)
+			close(3 + i);
+		else {
+			dup2(fds[i].saved, 3 + i);
+			fcntl(3 + i, F_SETFD, fds[i].flags);
+		}
+	}
+	for (i = 0; i < saved; i++) {
+		if (fds[i].saved >= 0)
+			close(fds[i].saved);
+	}
+	for (i = 0; i < moved; i++)
+		close(fds[i].fd);
+	exec_setenv(T, 6);
+
+	lua_pushnil(T);
+	lua_pushstring(T, strerror(err));
+	return 2;
+}
+
 static int
 utils_poolconfig(lua_State *T)
 {
@@ -218,6 +479,254 @@ utils_poolconfig(lua_State *T)
 	return 0;
 }
 
+static void
+utils_pushhistogram(lua_State *T, struct lem_histogram *h)
+{
+	int i;
+
+	lua_createtable(T, LEM_HISTOGRAM_BUCKETS, 1);
+	for (i = 0; i < LEM_HISTOGRAM_BUCKETS; i++) {
+		lua_pushinteger(T, h->count[i]);
+		lua_rawseti(T, -2, i + 1);
+	}
+	lua_pushinteger(T, h->sum);
+	lua_setfield(T, -2, "sum");
+}
+
+/*
+ * utils.stats() returns the counters of the current loop.
+ * Histograms are arrays where [i] counts times of less than
+ * 2^(i-1) microseconds, and sum is the total in microseconds.
+ */
+static int
+utils_stats(lua_State *T)
+{
+	struct lem_stats st;
+
+	lem_stats(&st);
+
+	lua_createtable(T, 0, 11);
+	lua_pushinteger(T, st.resumes);
+	lua_setfield(T, -2, "resumes");
+	lua_pushinteger(T, st.preempted);
+	lua_setfield(T, -2, "preempted");
+	lua_pushinteger(T, st.threads);
+	lua_setfield(T, -2, "threads");
+	lua_pushinteger(T, st.runqueue);
+	lua_setfield(T, -2, "runqueue");
+	lua_pushinteger(T, st.runqueue_max);
+	lua_setfield(T, -2, "runqueue_max");
+	lua_pushinteger(T, st.pool_jobs);
+	lua_setfield(T, -2, "pool_jobs");
+	lua_pushinteger(T, st.pool_threads);
+	lua_setfield(T, -2, "pool_threads");
+	lua_pushinteger(T, st.pool_done);
+	lua_setfield(T, -2, "pool_done");
+	utils_pushhistogram(T, &st.pool_wait);
+	lua_setfield(T, -2, "pool_wait");
+	utils_pushhistogram(T, &st.pool_run);
+	lua_setfield(T, -2, "pool_run");
+	utils_pushhistogram(T, &st.gc_pause);
+	lua_setfield(T, -2, "gc_pause");
+	return 1;
+}
+
+static const char *const utils_priorities[] = {
+	"high", "normal", "low", NULL
+};
+
+/*
+ * utils.setpriority([thread, ]priority) sets the priority of a
+ * thread, the current one by default, to 'high', 'normal' or 'low'.
+ * Threads spawned later inherit it.
+ */
+static int
+utils_setpriority(lua_State *T)
+{
+	lua_State *S = T;
+	int idx = 1;
+
+	if (lua_type(T, 1) == LUA_TTHREAD) {
+		S = lua_tothread(T, 1);
+		idx = 2;
+	}
+	lem_setpriority(S, luaL_checkoption(T, idx, NULL, utils_priorities));
+	return 0;
+}
+
+static int
+utils_getpriority(lua_State *T)
+{
+	lua_State *S = T;
+
+	if (!lua_isnoneornil(T, 1)) {
+		luaL_checktype(T, 1, LUA_TTHREAD);
+		S = lua_tothread(T, 1);
+	}
+	lua_pushstring(T, utils_priorities[lem_priority(S)]);
+	return 1;
+}
+
+static long
+utils_checkslice(lua_State *T, int idx)
+{
+	lua_Number slice;
+
+	if (lua_isnoneornil(T, idx))
+		return -1;
+	if (lua_isboolean(T, idx) && !lua_toboolean(T, idx))
+		return 0;
+
+	slice = luaL_checknumber(T, idx);
+	luaL_argcheck(T, slice >= 0 && slice < 86400, idx, "out of range");
+	return (long)(slice * 1e6);
+}
+
+/*
+ * utils.preempt([slice]) preempts threads of this loop running for
+ * more than slice seconds without yielding, nil or false turns it
+ * off. Returns the old slice.
+ */
+static int
+utils_preempt(lua_State *T)
+{
+	long us = utils_checkslice(T, 1);
+
+	if (us < 0)
+		us = 0;
+	lua_pushnumber(T, (lua_Number)lem_preempt(us) / 1e6);
+	return 1;
+}
+
+/*
+ * utils.setslice([thread, ]slice) sets the slice of a thread,
+ * the current one by default. false never preempts it and nil
+ * uses the slice set by utils.preempt() again.
+ */
+static int
+utils_setslice(lua_State *T)
+{
+	lua_State *S = T;
+	int idx = 1;
+
+	if (lua_type(T, 1) == LUA_TTHREAD) {
+		S = lua_tothread(T, 1);
+		idx = 2;
+	}
+	lem_setslice(S, utils_checkslice(T, idx));
+	return 0;
+}
+
+static int
+utils_noaccounting(lua_State *T)
+{
+	lua_pushnil(T);
+	if (lem_accounting())
+		lua_pushliteral(T, "not a lem thread");
+	else
+		lua_pushliteral(T, "accounting disabled, set LEM_ACCOUNTING");
+	return 2;
+}
+
+static void
+utils_pushusage(lua_State *T, struct lem_usage *u, int live)
+{
+	lua_createtable(T, 0, 4);
+	lua_pushnumber(T, (lua_Number)u->cpu / 1e9);
+	lua_setfield(T, -2, "cpu");
+	lua_pushinteger(T, u->allocated);
+	lua_setfield(T, -2, "allocated");
+	if (live) {
+		lua_pushinteger(T, u->live);
+		lua_setfield(T, -2, "live");
+	}
+	lua_pushinteger(T, u->resumes);
+	lua_setfield(T, -2, "resumes");
+}
+
+/*
+ * utils.settag(name) sets the accounting tag of the current
+ * thread and the threads it spawns from now on
+ */
+static int
+utils_settag(lua_State *T)
+{
+	const char *name = luaL_checkstring(T, 1);
+
+	if (lem_settag(T, name))
+		return utils_noaccounting(T);
+
+	lua_pushboolean(T, 1);
+	return 1;
+}
+
+static int
+utils_gettag(lua_State *T)
+{
+	lua_State *S = T;
+	const char *name;
+
+	if (!lua_isnoneornil(T, 1)) {
+		luaL_checktype(T, 1, LUA_TTHREAD);
+		S = lua_tothread(T, 1);
+	}
+
+	name = lem_gettag(S, NULL);
+	if (name == NULL)
+		return utils_noaccounting(T);
+
+	lua_pushstring(T, name);
+	return 1;
+}
+
+/*
+ * utils.usage([thread]) returns the CPU time in seconds, bytes
+ * allocated and resumes of a thread, the current one by default
+ */
+static int
+utils_usage(lua_State *T)
+{
+	lua_State *S = T;
+	struct lem_usage u;
+	const char *name;
+
+	if (!lua_isnoneornil(T, 1)) {
+		luaL_checktype(T, 1, LUA_TTHREAD);
+		S = lua_tothread(T, 1);
+	}
+
+	name = lem_gettag(S, &u);
+	if (name == NULL)
+		return utils_noaccounting(T);
+
+	utils_pushusage(T, &u, 0);
+	lua_pushstring(T, name);
+	lua_setfield(T, -2, "tag");
+	return 1;
+}
+
+/*
+ * utils.tagusage() returns a table mapping each tag to its usage,
+ * including the bytes still allocated on behalf of the tag
+ */
+static int
+utils_tagusage(lua_State *T)
+{
+	struct lem_usage u;
+	const char *name;
+	unsigned int i;
+
+	if (!lem_accounting())
+		return utils_noaccounting(T);
+
+	lua_newtable(T);
+	for (i = 0; (name = lem_tagusage(i, &u)) != NULL; i++) {
+		utils_pushusage(T, &u, 1);
+		lua_setfield(T, -2, name);
+	}
+	return 1;
+}
+
 int
 luaopen_lem_utils(lua_State *L)
 {
@@ -255,11 +764,18 @@ luaopen_lem_utils(lua_State *L)
 	/* set thisthread function */
 	lua_pushcfunction(L, utils_thisthread);
 	lua_setfield(L, -2, "thisthread");
+	/* create table of held back resumes, with weak keys */
+	lua_newtable(L);
+	lua_createtable(L, 0, 1);
+	lua_pushliteral(L, "k");
+	lua_setfield(L, -2, "__mode");
+	lua_setmetatable(L, -2);
 	/* set suspend function */
-	lua_pushcfunction(L, utils_suspend);
-	lua_setfield(L, -2, "suspend");
+	lua_pushvalue(L, -1); /* upvalue 1: held back resumes */
+	lua_pushcclosure(L, utils_suspend, 1);
+	lua_setfield(L, -3, "suspend");
 	/* set resume function */
-	lua_pushcfunction(L, utils_resume);
+	lua_pushcclosure(L, utils_resume, 1);
 	lua_setfield(L, -2, "resume");
 
 	/* set now function */
@@ -269,9 +785,49 @@ luaopen_lem_utils(lua_State *L)
 	lua_pushcfunction(L, utils_updatenow);
 	lua_setfield(L, -2, "updatenow");
 
+	/* set fork function */
+	lua_pushcfunction(L, utils_fork);
+	lua_setfield(L, -2, "fork");
+
+	/* set getpid function */
+	lua_pushcfunction(L, utils_getpid);
+	lua_setfield(L, -2, "getpid");
+	/* set setenv function */
+	lua_pushcfunction(L, utils_setenv);
+	lua_setfield(L, -2, "setenv");
+	/* set exec function */
+	lua_pushcfunction(L, utils_exec);
+	lua_setfield(L, -2, "exec");
+
 	/* set poolconfig function */
 	lua_pushcfunction(L, utils_poolconfig);
 	lua_setfield(L, -2, "poolconfig");
 
+	/* set stats function */
+	lua_pushcfunction(L, utils_stats);
+	lua_setfield(L, -2, "stats");
+
+	/* set priority functions */
+	lua_pushcfunction(L, utils_setpriority);
+	lua_setfield(L, -2, "setpriority");
+	lua_pushcfunction(L, utils_getpriority);
+	lua_setfield(L, -2, "getpriority");
+
+	/* set preemption functions */
+	lua_pushcfunction(L, utils_preempt);
+	lua_setfield(L, -2, "preempt");
+	lua_pushcfunction(L, utils_setslice);
+	lua_setfield(L, -2, "setslice");
+
+	/* set accounting functions */
+	lua_pushcfunction(L, utils_settag);
+	lua_setfield(L, -2, "settag");
+	lua_pushcfunction(L, utils_gettag);
+	lua_setfield(L, -2, "gettag");
+	lua_pushcfunction(L, utils_usage);
+	lua_setfield(L, -2, "usage");
+	lua_pushcfunction(L, utils_tagusage);
+	lua_setfield(L, -2, "tagusage");
+
 	return 1;
 }
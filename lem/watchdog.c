@@ -0,0 +1,111 @@
+/*
+ * This file is part of LEM, a Lua Event Machine.
+ * Copyright 2026 agent
+ *
+ * LEM is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * LEM is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <lem.h>
+
+/*
+ * watchdog.start([ms]) starts watching the current loop and logs
+ * every time it stalls for more than ms milliseconds, 100 by default
+ */
+static int
+watchdog_start(lua_State *T)
+{
+	lua_Integer ms = luaL_optinteger(T, 1, 100);
+	int ret;
+
+	luaL_argcheck(T, ms > 0 && ms <= 3600000, 1, "out of range");
+
+	ret = lem_watchdog_start(ms);
+	if (ret) {
+		lua_pushnil(T);
+		if (ret == EBUSY)
+			lua_pushliteral(T, "busy");
+		else
+			lua_pushstring(T, strerror(ret));
+		return 2;
+	}
+
+	lua_pushboolean(T, 1);
+	return 1;
+}
+
+static int
+watchdog_stop(lua_State *T)
+{
+	lem_watchdog_stop();
+	lua_pushboolean(T, 1);
+	return 1;
+}
+
+/*
+ * watchdog.stats() returns the threshold, the number of stalls,
+ * the traceback of the last stall in a Lua thread and the run time
+ * histogram. runs[i] is the number of resumes which took less than
+ * 2^(i-1) microseconds, except the last which counts the rest too,
+ * and runs.sum is the total run time in microseconds.
+ */
+static int
+watchdog_stats(lua_State *T)
+{
+	struct lem_watchdog_stats st;
+	int i;
+
+	lem_watchdog_stats(&st);
+
+	lua_createtable(T, 0, 4);
+	lua_pushinteger(T, st.threshold);
+	lua_setfield(T, -2, "threshold");
+	lua_pushinteger(T, st.stalls);
+	lua_setfield(T, -2, "stalls");
+	if (st.last) {
+		lua_pushstring(T, st.last);
+		lua_setfield(T, -2, "last");
+	}
+	lua_createtable(T, LEM_HISTOGRAM_BUCKETS, 1);
+	for (i = 0; i < LEM_HISTOGRAM_BUCKETS; i++) {
+		lua_pushinteger(T, st.runs.count[i]);
+		lua_rawseti(T, -2, i + 1);
+	}
+	lua_pushinteger(T, st.runs.sum);
+	lua_setfield(T, -2, "sum");
+	lua_setfield(T, -2, "runs");
+	return 1;
+}
+
+int
+luaopen_lem_watchdog(lua_State *L)
+{
+	/* create module table */
+	lua_newtable(L);
+
+	/* set start function */
+	lua_pushcfunction(L, watchdog_start);
+	lua_setfield(L, -2, "start");
+
+	/* set stop function */
+	lua_pushcfunction(L, watchdog_stop);
+	lua_setfield(L, -2, "stop");
+
+	/* set stats function */
+	lua_pushcfunction(L, watchdog_stats);
+	lua_setfield(L, -2, "stats");
+
+	return 1;
+}
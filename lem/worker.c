@@ -0,0 +1,462 @@
+/*
+ * This file is part of LEM, a Lua Event Machine.
+ * Copyright 2026 agent
+ *
+ * LEM is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * LEM is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <lualib.h>
+#include <lem.h>
+
+/*
+ * A worker is a set of plain Lua states, each of which has loaded
+ * the same script. Calls are run on the thread pool by whichever
+ * state is idle, and queued in the loop when all of them are busy.
+ *
+ * The states are only handed out and taken back by the loop, so
+ * the idle list needs no locking. The pool threads only read
+ * the immutable configuration.
+ */
+struct worker_call;
+
+struct worker {
+	struct worker_call *first;
+	struct worker_call *last;
+	char *script;
+	char *path;
+	char *cpath;
+	char *args;
+	size_t args_len;
+	unsigned int max;
+	unsigned int closed;
+	unsigned int states;
+	unsigned int nidle;
+	lua_State *idle[];
+};
+
+struct worker_call {
+	struct lem_async a;
+	struct worker *w;
+	struct worker_call *next;
+	lua_State *T;
+	lua_State *S;
+	char *buf;
+	size_t len;
+	int ok;
+};
+
+static char *
+worker_strdup(const char *str)
+{
+	size_t len = strlen(str) + 1;
+	char *r = lem_xmalloc(len);
+
+	memcpy(r, str, len);
+	return r;
+}
+
+static void
+worker_seterror(struct worker_call *c, lua_State *S)
+{
+	const char *msg = lua_tostring(S, -1);
+
+	if (msg == NULL)
+		msg = "(error object is not a string)";
+	c->buf = worker_strdup(msg);
+	c->len = strlen(msg);
+	c->ok = 0;
+}
+
+static void
+worker_setpath(lua_State *S, const char *field, const char *value)
+{
+	if (value == NULL)
+		return;
+
+	lua_getglobal(S, "package");
+	lua_pushstring(S, value);
+	lua_setfield(S, -2, field);
+	lua_pop(S, 1);
+}
+
+/* create a new state and leave the script's module table at index 1 */
+static lua_State *
+worker_newstate(struct worker_call *c)
+{
+	struct worker *w = c->w;
+	lua_State *S = luaL_newstate();
+	int nargs;
+
+	if (S == NULL) {
+		c->buf = worker_strdup("error initializing Lua state");
+		c->len = strlen(c->buf);
+		c->ok = 0;
+		return NULL;
+	}
+	luaL_openlibs(S);
+	worker_setpath(S, "path", w->path);
+	worker_setpath(S, "cpath", w->cpath);
+
+	if (luaL_loadfile(S, w->script) != LUA_OK)
+		goto error;
+
+	nargs = lem_unmarshal(S, w->args, w->args_len);
+	if (nargs < 0) {
+		lua_pushliteral(S, "corrupt arguments");
+		goto error;
+	}
+
+	if (lua_pcall(S, nargs, 1, 0) != LUA_OK)
+		goto error;
+
+	if (lua_type(S, 1) != LUA_TTABLE) {
+		lua_pushfstring(S, "%s must return a table of functions",
+				w->script);
+		goto error;
+	}
+
+	return S;
+
+error:
+	worker_seterror(c, S);
+	lua_close(S);
+	return NULL;
+}
+
+static void
+worker_call_work(struct lem_async *a)
+{
+	struct worker_call *c = (struct worker_call *)a;
+	lua_State *S = c->S;
+	char *buf = c->buf;
+	int nargs;
+
+	c->buf = NULL;
+	if (S == NULL) {
+		S = c->S = worker_newstate(c);
+		if (S == NULL) {
+			free(buf);
+			return;
+		}
+	}
+
+	/* the function name is the first value in the buffer */
+	nargs = lem_unmarshal(S, buf, c->len);
+	free(buf);
+	if (nargs < 1) {
+		lua_settop(S, 1);
+		lua_pushliteral(S, "corrupt arguments");
+		goto error;
+	}
+
+	lua_pushvalue(S, 2);
+	lua_gettable(S, 1);
+	if (lua_type(S, -1) != LUA_TFUNCTION) {
+		lua_pushfstring(S, "no such function '%s'", lua_tostring(S, 2));
+		goto error;
+	}
+	lua_replace(S, 2);
+
+	if (lua_pcall(S, nargs - 1, LUA_MULTRET, 0) != LUA_OK)
+		goto error;
+
+	buf = lem_marshal(S, 2, lua_gettop(S) - 1, &c->len);
+	if (buf == NULL)
+		goto error;
+
+	c->buf = buf;
+	c->ok = 1;
+	lua_settop(S, 1);
+	return;
+
+error:
+	worker_seterror(c, S);
+	lua_settop(S, 1);
+}
+
+/* the configuration is read by states being created,
+ * so it is only freed when no calls are in flight */
+static void
+worker_free(struct worker *w)
+{
+	free(w->script);
+	free(w->path);
+	free(w->cpath);
+	free(w->args);
+	w->script = NULL;
+}
+
+static void worker_call_reap(struct lem_async *a);
+
+static void
+worker_dispatch(struct worker *w, struct worker_call *c)
+{
+	if (w->nidle > 0)
+		c->S = w->idle[--w->nidle];
+	else {
+		c->S = NULL;
+		w->states++;
+	}
+
+	lem_async_do(&c->a, worker_call_work, worker_call_reap);
+}
+
+static void
+worker_call_reap(struct lem_async *a)
+{
+	struct worker_call *c = (struct worker_call *)a;
+	struct worker *w = c->w;
+	lua_State *T = c->T;
+	int ret;
+
+	/* hand the state back */
+	if (!w->closed && c->S != NULL)
+		w->idle[w->nidle++] = c->S;
+	else {
+		if (c->S != NULL)
+			lua_close(c->S);
+		w->states--;
+		if (w->closed && w->states == 0)
+			worker_free(w);
+	}
+
+	if (c->ok) {
+		ret = lem_unmarshal(T, c->buf, c->len);
+		if (ret < 0) {
+			lua_pushnil(T);
+			lua_pushliteral(T, "corrupt results");
+			ret = 2;
+		}
+	} else {
+		lua_pushnil(T);
+		lua_pushlstring(T, c->buf, c->len);
+		ret = 2;
+	}
+	free(c->buf);
+	free(c);
+	lem_queue(T, ret);
+
+	/* run the next call waiting for a state */
+	c = w->first;
+	if (c != NULL) {
+		w->first = c->next;
+		if (w->first == NULL)
+			w->last = NULL;
+		worker_dispatch(w, c);
+	}
+}
+
+/*
+ * worker:call() method
+ */
+static int
+worker_call(lua_State *T)
+{
+	struct worker *w;
+	struct worker_call *c;
+	char *buf;
+	size_t len;
+
+	luaL_checktype(T, 1, LUA_TUSERDATA);
+	luaL_checkstring(T, 2);
+	w = lua_touserdata(T, 1);
+	if (w->closed) {
+		lua_pushnil(T);
+		lua_pushliteral(T, "closed");
+		return 2;
+	}
+
+	buf = lem_marshal(T, 2, lua_gettop(T) - 1, &len);
+	if (buf == NULL)
+		return lua_error(T);
+
+	c = lem_xmalloc(sizeof(struct worker_call));
+	c->w = w;
+	c->next = NULL;
+	c->T = T;
+	c->buf = buf;
+	c->len = len;
+
+	if (w->nidle > 0 || w->states < w->max)
+		worker_dispatch(w, c);
+	else if (w->last == NULL)
+		w->first = w->last = c;
+	else {
+		w->last->next = c;
+		w->last = c;
+	}
+
+	lua_settop(T, 1);
+	return lua_yield(T, 1);
+}
+
+/*
+ * worker:close() method
+ *
+ * Busy states are closed once their call returns,
+ * but calls still waiting for a state fail right away.
+ */
+static void
+worker__close(struct worker *w)
+{
+	struct worker_call *c;
+
+	w->closed = 1;
+
+	while (w->nidle > 0) {
+		lua_close(w->idle[--w->nidle]);
+		w->states--;
+	}
+	if (w->states == 0)
+		worker_free(w);
+
+	while ((c = w->first) != NULL) {
+		lua_State *T = c->T;
+
+		w->first = c->next;
+		free(c->buf);
+		free(c);
+		lua_pushnil(T);
+		lua_pushliteral(T, "closed");
+		lem_queue(T, 2);
+	}
+	w->last = NULL;
+}
+
+static int
+worker_close(lua_State *T)
+{
+	struct worker *w;
+
+	luaL_checktype(T, 1, LUA_TUSERDATA);
+	w = lua_touserdata(T, 1);
+	if (w->closed) {
+		lua_pushnil(T);
+		lua_pushliteral(T, "already closed");
+		return 2;
+	}
+
+	worker__close(w);
+	lua_pushboolean(T, 1);
+	return 1;
+}
+
+/* calls keep the worker alive through their coroutine,
+ * so when it is collected all states are idle */
+static int
+worker_gc(lua_State *T)
+{
+	struct worker *w = lua_touserdata(T, 1);
+
+	if (!w->closed)
+		worker__close(w);
+	return 0;
+}
+
+static char *
+worker_getpath(lua_State *T, const char *field)
+{
+	const char *str;
+	char *r = NULL;
+
+	lua_getglobal(T, "package");
+	if (lua_type(T, -1) == LUA_TTABLE) {
+		lua_getfield(T, -1, field);
+		str = lua_tostring(T, -1);
+		if (str != NULL)
+			r = worker_strdup(str);
+		lua_pop(T, 1);
+	}
+	lua_pop(T, 1);
+	return r;
+}
+
+/*
+ * worker.new(script [, states [, ...]])
+ */
+static int
+worker_new(lua_State *T)
+{
+	const char *script = luaL_checkstring(T, 1);
+	lua_Integer max = luaL_optinteger(T, 2, 0);
+	struct worker *w;
+	char *args;
+	size_t len;
+
+	if (max <= 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+		max = cpus > 0 ? cpus : 1;
+	}
+	luaL_argcheck(T, max <= 1024, 2, "too many states");
+
+	args = lem_marshal(T, 3, lua_gettop(T) - 2, &len);
+	if (args == NULL)
+		return lua_error(T);
+
+	/* create userdata and set the metatable */
+	w = lua_newuserdata(T, sizeof(struct worker) + max*sizeof(lua_State *));
+	lua_pushvalue(T, lua_upvalueindex(1));
+	lua_setmetatable(T, -2);
+
+	/* initialize userdata */
+	w->first = NULL;
+	w->last = NULL;
+	w->script = worker_strdup(script);
+	w->path = worker_getpath(T, "path");
+	w->cpath = worker_getpath(T, "cpath");
+	w->args = args;
+	w->args_len = len;
+	w->max = max;
+	w->closed = 0;
+	w->states = 0;
+	w->nidle = 0;
+
+	return 1;
+}
+
+int
+luaopen_lem_worker(lua_State *L)
+{
+	/* create module table */
+	lua_newtable(L);
+
+	/* create Worker metatable */
+	lua_newtable(L);
+	/* mt.__index = mt */
+	lua_pushvalue(L, -1);
+	lua_setfield(L, -2, "__index");
+	/* mt.__gc = <worker_gc> */
+	lua_pushcfunction(L, worker_gc);
+	lua_setfield(L, -2, "__gc");
+	/* mt.close = <worker_close> */
+	lua_pushcfunction(L, worker_close);
+	lua_setfield(L, -2, "close");
+	/* mt.call = <worker_call> */
+	lua_pushcfunction(L, worker_call);
+	lua_setfield(L, -2, "call");
+
+	/* set new function */
+	lua_pushvalue(L, -1); /* upvalue 1 = Worker */
+	lua_pushcclosure(L, worker_new, 1);
+	lua_setfield(L, -3, "new");
+
+	/* insert table */
+	lua_setfield(L, -2, "Worker");
+
+	return 1;
+}
@@ -0,0 +1,82 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+-- Copyright 2026 agent
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+
+-- tag threads and see their CPU time and memory, run with
+-- LEM_ACCOUNTING=1 bin/lem test/accounting.lua
+
+package.path = '?.lua'
+package.cpath = '?.so'
+
+local utils = require 'lem.utils'
+
+local format = string.format
+
+local ok, err = utils.settag('main')
+if not ok then
+	print(err)
+	utils.exit(1)
+end
+
+local keep = {}
+
+local function hog(n)
+	local t = {}
+	for i = 1, n do
+		t[i] = format('%d', i)
+		if i % 10000 == 0 then utils.yield() end
+	end
+	keep[#keep+1] = t
+end
+
+local done = 0
+local function worker(tag, n)
+	utils.settag(tag)
+	hog(n)
+	local u = utils.usage()
+	print(format('%-6s cpu %.3fs, %d bytes allocated, %d resumes',
+		u.tag, u.cpu, u.allocated, u.resumes))
+	done = done + 1
+end
+
+utils.spawn(worker, 'small', 10000)
+utils.spawn(worker, 'big', 200000)
+utils.spawn(function()
+	-- inherits the 'main' tag
+	hog(1000)
+	assert(utils.gettag() == 'main')
+	done = done + 1
+end)
+
+while done < 3 do utils.yield() end
+
+local usage = utils.tagusage()
+for _, tag in ipairs{ '', 'main', 'small', 'big' } do
+	local u = usage[tag]
+	print(format('%-6q cpu %.3fs, %d bytes allocated, %d live, %d resumes',
+		tag, u.cpu, u.allocated, u.live, u.resumes))
+end
+assert(usage.big.allocated > usage.small.allocated)
+assert(usage.big.live > usage.small.live)
+
+keep = nil
+collectgarbage()
+usage = utils.tagusage()
+print(format('after collecting %d live bytes are left for big', usage.big.live))
+assert(usage.big.live < 1000)
+
+-- vim: set ts=2 sw=2 noet:
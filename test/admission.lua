@@ -0,0 +1,132 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+-- Copyright 2026 agent
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+--
+
+-- connection and accept rate limits on autospawn
+
+package.path = '?.lua'
+package.cpath = '?.so'
+
+local utils = require 'lem.utils'
+local io    = require 'lem.io'
+
+local format = string.format
+
+local port = tonumber(arg[1]) or 9880
+local clients = 40
+
+local function connect_all(port)
+	local done = 0
+
+	for i = 1, clients do
+		utils.spawn(function()
+			local conn = assert(io.tcp.connect('127.0.0.1', port))
+			assert(conn:write('hello\n'))
+			assert(conn:read('*l') == 'bye')
+			conn:close()
+			done = done + 1
+		end)
+	end
+
+	local sleeper = utils.newsleeper()
+	while done < clients do
+		sleeper:sleep(0.01)
+	end
+end
+
+local function stats(server)
+	local s = server:stats()
+	return format('accepted %d, rejected %d, limited %d, active %d',
+		s.accepted, s.rejected, s.limited, s.active)
+end
+
+-- no more than 4 connections at a time
+do
+	local server = assert(io.tcp.listen('127.0.0.1', port))
+	local sleeper = utils.newsleeper()
+	local active, peak = 0, 0
+
+	assert(server:setlimits(4))
+	utils.spawn(server.autospawn, server, function(client)
+		active = active + 1
+		if active > peak then peak = active end
+		assert(client:read('*l'))
+		utils.newsleeper():sleep(0.02)
+		assert(client:write('bye\n'))
+		client:close()
+		active = active - 1
+	end)
+
+	connect_all(port)
+	sleeper:sleep(0.05)
+	print(format('max 4:    peak %d, %s', peak, stats(server)))
+	assert(peak <= 4)
+	assert(server:stats().accepted == clients)
+	assert(server:stats().limited > 0)
+	assert(server:stats().active == 0)
+	server:close()
+end
+
+-- no more than 100 new connections per second
+do
+	local server = assert(io.tcp.listen('127.0.0.1', port + 1))
+	local sleeper = utils.newsleeper()
+
+	assert(server:setlimits(nil, 100, 1))
+	utils.spawn(server.autospawn, server, function(client)
+		assert(client:read('*l'))
+		assert(client:write('bye\n'))
+		client:close()
+	end)
+
+	-- wait for the bucket to fill
+	sleeper:sleep(1)
+
+	local start = utils.updatenow()
+	connect_all(port + 1)
+	local elapsed = utils.updatenow() - start
+
+	print(format('rate 100: %d connections in %.3fs, %s',
+		clients, elapsed, stats(server)))
+	assert(server:stats().accepted == clients)
+	server:close()
+
+	-- now drain faster than allowed
+	server = assert(io.tcp.listen('127.0.0.1', port + 2))
+	assert(server:setlimits(nil, 20))
+	utils.spawn(server.autospawn, server, function(client)
+		assert(client:read('*l'))
+		assert(client:write('bye\n'))
+		client:close()
+	end)
+
+	start = utils.updatenow()
+	connect_all(port + 2)
+	elapsed = utils.updatenow() - start
+
+	print(format('rate 20:  %d connections in %.3fs, %s',
+		clients, elapsed, stats(server)))
+	-- a burst of 20 and then 20 more at 20 per second
+	assert(elapsed > 0.8)
+	assert(server:stats().limited > 0 and server:stats().rejected == 0)
+	server:close()
+end
+
+print 'OK'
+
+-- vim: set ts=2 sw=2 noet:
@@ -0,0 +1,144 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+-- Copyright 2026 agent
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+--
+
+package.path = '?.lua'
+package.cpath = '?.so'
+
+local utils  = require 'lem.utils'
+local io     = require 'lem.io'
+local buffer = require 'lem.buffer'
+
+local format = string.format
+
+-- basic operations
+do
+	local b = buffer.new('hello')
+	b:append(' ', 'world'):append(buffer.new('!'))
+	assert(#b == 12 and tostring(b) == 'hello world!')
+	assert(b:tostring(7, -2) == 'world')
+	assert(b:find('o') == 5 and b:find('o', 6) == 8)
+	assert(b:find('xyz') == nil)
+
+	local v = b:view(7, 11)
+	assert(#v == 5 and tostring(v) == 'world')
+	v:set(1, 'W')
+	assert(tostring(b) == 'hello World!')
+	assert(tostring(v:view(2, 3)) == 'or')
+	assert(not pcall(v.append, v, 'x'))
+
+	-- growing the base must not break the view
+	b:append(b, string.rep('x', 10000))
+	assert(tostring(v) == 'World')
+
+	b:consume(6)
+	assert(b:tostring(1, 6) == 'World!')
+	b:clear()
+	assert(#b == 0 and #v == 0)
+end
+
+-- integers
+do
+	local b = buffer.new()
+	b:putint(2, 0x1234):putint(4, 0xdeadbeef, true):putint(8, -2)
+	assert(#b == 14)
+	assert(b:tostring(1, 2) == '\x12\x34')
+	assert(b:tostring(3, 6) == '\xef\xbe\xad\xde')
+	assert(b:getu(1, 2) == 0x1234)
+	assert(b:getu(3, 4, true) == 0xdeadbeef)
+	assert(b:geti(3, 4, true) == -559038737)
+	assert(b:geti(7, 8) == -2)
+	b:setint(1, 2, 0xffff)
+	assert(b:geti(1, 2) == -1 and b:getu(1, 2) == 0xffff)
+	assert(not pcall(b.getu, b, 12, 4))
+end
+
+-- read frames into a buffer, patch them and forward them
+local port = tonumber(arg[1]) or 9890
+local frames = 10000
+
+local server = assert(io.tcp.listen('127.0.0.1', port))
+utils.spawn(server.autospawn, server, function(client)
+	local b = buffer.new(4096)
+	while true do
+		b:clear()
+		if not client:read(b, 4) then break end
+		local n = b:getu(1, 4)
+		assert(client:read(b, n))
+		-- turn 'ping' into 'pong' and send it back
+		b:set(6, 'o')
+		assert(client:write(b))
+	end
+	client:close()
+end)
+
+local conn = assert(io.tcp.connect('127.0.0.1', port))
+utils.spawn(function()
+	local b = buffer.new()
+	for i = 1, frames do
+		local body = format('ping %d', i)
+		b:clear():putint(4, #body):append(body)
+		assert(conn:write(b))
+	end
+end)
+
+local b = buffer.new()
+local t1 = os.clock()
+for i = 1, frames do
+	b:clear()
+	assert(conn:read(b, 4))
+	assert(conn:read(b, b:getu(1, 4)))
+	assert(b:tostring(5) == format('pong %d', i))
+end
+local t2 = os.clock()
+conn:close()
+server:close()
+
+-- lines into a buffer
+do
+	local file = assert(io.open('test/buffer.lua'))
+	local b = buffer.new()
+	assert(file:read(b, '*l') == b)
+	assert(file:read(b, '*l') == b)
+	assert(tostring(b) == '#!bin/lem--')
+	file:close()
+end
+
+-- a buffer only the read refers to isn't collected under it
+do
+	local parsers = require 'lem.parsers'
+	local weak = setmetatable({}, { __mode = 'v' })
+	local s = assert(io.popen('sleep 0.1; echo hello'))
+	local kept
+	utils.spawn(function()
+		collectgarbage()
+		kept = weak[1] ~= nil
+	end)
+	assert(s:readp((function()
+		local b = buffer.new()
+		weak[1] = b
+		return b
+	end)(), parsers.lookup['*l']))
+	assert(kept)
+	s:close()
+end
+
+print(format('%d frames in %.3fs of cpu', frames, t2 - t1))
+print 'OK'
+
+-- vim: set ts=2 sw=2 noet:
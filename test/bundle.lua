@@ -0,0 +1,43 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+-- Copyright 2026 agent
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+
+-- startup with every module, compare
+--   time bin/lem test/bundle.lua
+--   make bundle && time bin/lem-bundle test/bundle.lua
+--   make bundle APP=test/bundle.lua && time bin/lem-bundle
+
+package.path = '?.lua'
+package.cpath = '?.so'
+
+local modules = {
+	'lem.utils', 'lem.io', 'lem.io.queue', 'lem.signal', 'lem.lfs',
+	'lem.parsers', 'lem.http', 'lem.http.server', 'lem.http.client',
+	'lem.http.static', 'lem.http.websocket', 'lem.hathaway', 'lem.stats',
+	'lem.profiler', 'lem.redis', 'lem.queue', 'lem.thread', 'lem.channel',
+}
+
+local bundled = 0
+for _, name in ipairs(modules) do
+	if package.preload[name] then bundled = bundled + 1 end
+	require(name)
+end
+
+print(('%d modules loaded, %d of them bundled, %.1fms of cpu'):format(
+	#modules, bundled, os.clock() * 1000))
+
+-- vim: set ts=2 sw=2 noet:
@@ -0,0 +1,91 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+-- Copyright 2026 agent
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+--
+
+package.path = '?.lua'
+package.cpath = '?.so'
+
+local utils   = require 'lem.utils'
+local channel = require 'lem.channel'
+
+local sleeper = utils.newsleeper()
+
+print "Bounded channel, fast producer and slow consumer:\n"
+
+local ch = channel.new(3)
+utils.spawn(function()
+	for i = 1, 10 do
+		assert(ch:put(i))
+		print(string.format('put %2d, count = %d', i, ch:count()))
+	end
+	ch:close()
+end)
+
+while true do
+	local v, err = ch:get()
+	if not v then
+		print('get:', err)
+		break
+	end
+	print(string.format('got %2d', v))
+	sleeper:sleep(0.02)
+end
+
+print "\nTry variants:\n"
+
+ch = channel.new(1)
+print('tryget', ch:tryget())
+print('tryput', ch:tryput('a'))
+print('tryput', ch:tryput('b'))
+print('tryget', ch:tryget())
+
+print "\nSelect:\n"
+
+local a, b, quit = channel.new(), channel.new(), channel.new()
+utils.spawn(function()
+	for i = 1, 3 do
+		sleeper:sleep(0.01)
+		a:put('a' .. i)
+		b:put('b' .. i)
+	end
+	quit:close()
+end)
+
+while true do
+	local c, v, err = channel.select(quit, a, b)
+	if c == quit then
+		print('select:', err)
+		break
+	end
+	print(string.format('select: %s from %s', v, c == a and 'a' or 'b'))
+end
+
+print "\nLots of values:\n"
+
+ch = channel.new()
+local t = os.clock()
+for i = 1, 1000000 do
+	ch:put(i)
+end
+for i = 1, 1000000 do
+	assert(ch:get() == i)
+end
+print(string.format('1000000 values through an unbounded channel in %.3fs',
+	os.clock() - t))
+
+-- vim: set ts=2 sw=2 noet:
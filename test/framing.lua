@@ -0,0 +1,155 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+-- Copyright 2026 agent
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+--
+
+-- length prefixed, varint, netstring and delimited frames
+
+package.path = '?.lua'
+package.cpath = '?.so'
+
+local utils  = require 'lem.utils'
+local io     = require 'lem.io'
+local buffer = require 'lem.buffer'
+
+local format, rep, char = string.format, string.rep, string.char
+local random = math.random
+
+local port = tonumber(arg[1]) or 9900
+
+local function be(n, size)
+	local t = {}
+	for i = size, 1, -1 do
+		t[i] = char(n % 256)
+		n = n // 256
+	end
+	return table.concat(t)
+end
+
+local function le(n, size)
+	return be(n, size):reverse()
+end
+
+local function varint(n)
+	local t = {}
+	repeat
+		local c = n % 128
+		n = n // 128
+		if n > 0 then c = c + 128 end
+		t[#t+1] = char(c)
+	until n == 0
+	return table.concat(t)
+end
+
+-- some payloads, including ones larger than the input buffer
+local payloads = { '', 'a', 'hello', rep('x', 4095), rep('y', 4096),
+	rep('z', 10000), rep('ab\r\n', 3000) .. '\r' }
+for i = 1, 200 do
+	payloads[#payloads+1] = rep(char(97 + i % 26), random(0, 300))
+end
+
+local encoders = {
+	{ '*p', 'u16be', function(s) return be(#s, 2) .. s end, 2 },
+	{ '*p', 'u32le', function(s) return le(#s, 4) .. s end, 4, 'le' },
+	{ '*p', 'u64be', function(s) return be(#s, 8) .. s end, 8 },
+	{ '*v', 'varint', function(s) return varint(#s) .. s end },
+	{ '*n', 'netstring', function(s) return #s .. ':' .. s .. ',' end },
+	{ '*d', 'delimiter', function(s) return s .. '\r\n\r\n' end, '\r\n\r\n' },
+	{ '*d', 'byte', function(s) return s .. '\0' end, '\0' },
+}
+
+-- send everything in randomly sized chunks to split frames anywhere
+local function sender(conn, data)
+	local sleeper = utils.newsleeper()
+	local i = 1
+	while i <= #data do
+		local n = random(1, 6000)
+		assert(conn:write(data:sub(i, i + n - 1)))
+		i = i + n
+		if random(4) == 1 then sleeper:sleep(0.001) end
+	end
+end
+
+local server = assert(io.tcp.listen('127.0.0.1', port))
+local conns = {}
+utils.spawn(server.autospawn, server, function(client)
+	conns[#conns+1] = client
+end)
+
+local sleeper = utils.newsleeper()
+local function pair()
+	local conn = assert(io.tcp.connect('127.0.0.1', port))
+	while #conns == 0 do sleeper:sleep(0.001) end
+	return conn, table.remove(conns)
+end
+
+for _, e in ipairs(encoders) do
+	local fmt, name, encode = e[1], e[2], e[3]
+	local a, b = pair()
+	local t = {}
+	for i = 1, #payloads do
+		t[i] = encode(payloads[i])
+	end
+	utils.spawn(sender, a, table.concat(t))
+
+	local t1 = os.clock()
+	for i = 1, #payloads do
+		local frame = assert(b:read(fmt, e[4], e[5]))
+		assert(frame == payloads[i], format('%s frame %d', name, i))
+	end
+
+	-- and once more into a buffer
+	utils.spawn(sender, a, table.concat(t))
+	local buf = buffer.new()
+	for i = 1, #payloads do
+		buf:clear()
+		assert(b:read(buf, fmt, e[4], e[5]) == buf)
+		assert(tostring(buf) == payloads[i], format('%s buffer %d', name, i))
+	end
+	print(format('%-10s %d frames in %.3fs of cpu', name, 2*#payloads, os.clock() - t1))
+
+	a:close()
+	b:close()
+end
+
+-- limits and malformed input
+do
+	local a, b = pair()
+	assert(a:write(be(100, 4)))
+	local ok, err = b:read('*p', 4, 'be', 10)
+	assert(ok == nil and err == 'frame too large')
+
+	assert(a:write('12x:hello,'))
+	ok, err = b:read('*n')
+	assert(ok == nil and err == 'invalid netstring')
+
+	assert(a:write('5:hello!'))
+	ok, err = b:read('*n')
+	assert(ok == nil and err == 'invalid netstring')
+
+	assert(a:write(rep('\255', 11)))
+	ok, err = b:read('*v')
+	assert(ok == nil and err == 'invalid varint')
+
+	a:close()
+	b:close()
+end
+
+server:close()
+print 'OK'
+
+-- vim: set ts=2 sw=2 noet:
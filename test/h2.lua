@@ -0,0 +1,287 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+-- Copyright 2026 agent
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+--
+
+-- HTTP/2 against lem.http.server with a small client built
+-- from the same frame parser and HPACK coder
+
+package.path = '?.lua'
+package.cpath = '?.so'
+
+local utils  = require 'lem.utils'
+local io     = require 'lem.io'
+local server = require 'lem.http.server'
+local h2     = require 'lem.http.h2'
+
+local format, rep, pack, unpack = string.format, string.rep, string.pack, string.unpack
+
+local port = tonumber(arg[1]) or 9903
+
+-- HPACK examples from RFC 7541 appendix C.4
+do
+	local function hex(s) return (s:gsub('%s', ''):gsub('%x%x', function(c)
+		return string.char(tonumber(c, 16)) end)) end
+	local d = h2.newdecoder()
+	local l = assert(d:decode(hex('8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff')))
+	assert(#l == 8 and l[2] == 'GET' and l[7] == ':authority' and l[8] == 'www.example.com')
+	l = assert(d:decode(hex('8286 84be 5886 a8eb 1064 9cbf')))
+	assert(#l == 10 and l[8] == 'www.example.com' and l[9] == 'cache-control' and l[10] == 'no-cache')
+	assert(d:decode(hex('ff ff ff ff ff ff')) == nil)
+
+	-- round trips through the dynamic tables
+	local e = h2.newencoder()
+	for i = 1, 200 do
+		local list = { ':status', '200', 'x-n', tostring(i % 7),
+			'x-junk', rep(string.char(i % 256), i % 50), 'content-type', 'text/plain' }
+		local block = e:encode(list)
+		local got = assert(d:decode(block))
+		for j = 1, #list do assert(got[j] == list[j]) end
+	end
+	assert(#e:encode({ 'content-type', 'text/plain' }) == 1)
+end
+
+local srv = assert(server.new('127.0.0.1', port, function(req, res)
+	if req.path == '/big' then
+		res:add(rep('0123456789', 100000))
+	elseif req.path == '/post' then
+		local body = assert(req:body())
+		res:add('%d bytes', #body)
+	elseif req.path == '/limited' then
+		local body, err = req:body(20000)
+		if body then
+			res:add('%d bytes', #body)
+		else
+			res.status = 413
+			res:add(err)
+		end
+	elseif req.path == '/slow' then
+		utils.newsleeper():sleep(0.05)
+		res:add('slow')
+	else
+		res.headers['Content-Type'] = 'text/plain'
+		res:add('%s %s %s', req.method, req.path, req.version)
+	end
+end))
+utils.spawn(srv.run, srv)
+
+local Client = {}
+Client.__index = Client
+
+local function connect(upgrade)
+	local c = assert(io.tcp.connect('127.0.0.1', port))
+	local self = setmetatable({ c = c, encoder = h2.newencoder(),
+		decoder = h2.newdecoder(), id = 1, streams = {} }, Client)
+	if upgrade then
+		assert(c:write('GET /upgraded HTTP/1.1\r\nHost: localhost\r\n'
+			.. 'Connection: Upgrade, HTTP2-Settings\r\nUpgrade: h2c\r\n'
+			.. 'HTTP2-Settings: AAMAAABkAAQAAP__\r\n\r\n'))
+		local res = assert(c:read('HTTPResponse'))
+		assert(res.status == 101)
+		self.streams[1] = { data = {} }
+		self.id = 3
+	end
+	assert(c:write(h2.preface .. pack('>I3BBI4', 0, 4, 0, 0)))
+	utils.spawn(self.reader, self)
+	return self
+end
+
+local function frame(t, f, id, payload)
+	return pack('>I3BBI4', #payload, t, f, id) .. payload
+end
+
+function Client:reader()
+	while true do
+		local t, f, id, payload = self.c:read('H2Frame')
+		if not t then break end
+		local s = self.streams[id]
+		if t == 1 then
+			s.headers = assert(self.decoder:decode(payload))
+		elseif t == 0 then
+			s.data[#s.data+1] = payload
+			if #payload > 0 then
+				self.c:write(frame(8, 0, 0, pack('>I4', #payload))
+					.. frame(8, 0, id, pack('>I4', #payload)))
+			end
+		elseif t == 4 and f == 0 then
+			self.c:write(frame(4, 1, 0, ''))
+		elseif t == 3 then
+			s.reset = unpack('>I4', payload)
+			f = 1
+		end
+		if s and f & 1 == 1 and s.thread then
+			local t = s.thread
+			s.thread = nil
+			utils.resume(t)
+		end
+	end
+end
+
+function Client:request(method, path, body)
+	local id = self.id
+	self.id = id + 2
+	local s = { data = {}, thread = utils.thisthread() }
+	self.streams[id] = s
+	local block = self.encoder:encode{ ':method', method, ':scheme', 'http',
+		':path', path, ':authority', 'localhost' }
+	if body then
+		assert(self.c:write(frame(1, 4, id, block) .. frame(0, 1, id, body)))
+	else
+		assert(self.c:write(frame(1, 5, id, block)))
+	end
+	utils.suspend()
+	if s.reset then return nil, s.reset end
+	return s.headers[2], table.concat(s.data)
+end
+
+function Client:wait(id)
+	local s = self.streams[id]
+	if not s.headers or #s.data == 0 then
+		s.thread = utils.thisthread()
+		utils.suspend()
+	end
+	return s.headers[2], table.concat(s.data)
+end
+
+local c = connect()
+local status, body = c:request('GET', '/hello')
+assert(status == '200' and body == 'GET /hello 2.0')
+status, body = c:request('GET', '/big')
+assert(status == '200' and body == rep('0123456789', 100000))
+status, body = c:request('POST', '/post', rep('x', 10000))
+assert(status == '200' and body == '10000 bytes')
+
+-- malformed frames are answered with an error code instead
+-- of taking the server down, GOAWAY (7) for connection errors
+-- and RST_STREAM (3) for stream errors
+do
+	local function answer(want, frames)
+		local c = assert(io.tcp.connect('127.0.0.1', port))
+		assert(c:write(h2.preface .. frame(4, 0, 0, '') .. frames))
+		while true do
+			local t, _, _, payload = c:read('H2Frame')
+			if not t then break end
+			if t == want then
+				c:close()
+				return payload
+			end
+		end
+		c:close()
+	end
+	local function code(want, frames)
+		local payload = answer(want, frames)
+		return payload and unpack('>I4', payload, want == 7 and 5 or 1)
+	end
+	local get = h2.newencoder():encode{ ':method', 'GET', ':scheme', 'http',
+		':path', '/slow', ':authority', 'localhost' }
+
+	-- FRAME_SIZE_ERROR
+	assert(code(7, frame(8, 0, 0, '')) == 6)
+	assert(code(7, frame(3, 0, 1, '\0\0\0')) == 6)
+	assert(code(7, frame(2, 0, 1, '\0\0\0\0')) == 6)
+	assert(code(7, frame(6, 0, 0, '')) == 6)
+	-- PROTOCOL_ERROR
+	assert(code(7, frame(8, 0, 0, pack('>I4', 0))) == 1)
+	assert(code(7, frame(3, 0, 0, pack('>I4', 0))) == 1)
+	assert(code(7, frame(0, 8, 1, '')) == 1)
+	assert(code(7, frame(0, 8, 1, '\5abc')) == 1)
+	assert(code(7, frame(1, 0x8 | 0x4 | 0x1, 1, '')) == 1)
+	assert(code(7, frame(1, 0x20 | 0x4 | 0x1, 1, '\0\0')) == 1)
+	assert(code(3, frame(1, 5, 1, get) .. frame(8, 0, 1, pack('>I4', 0))) == 1)
+	-- FLOW_CONTROL_ERROR
+	assert(code(7, frame(8, 0, 0, pack('>I4', 0x7FFFFFFF))) == 3)
+	assert(code(3, frame(1, 5, 1, get) .. frame(8, 0, 1, pack('>I4', 0x7FFFFFFF))) == 3)
+
+	-- padding which fits is fine
+	local block = answer(1, frame(1, 0x8 | 0x4 | 0x1, 1, '\3' .. get .. 'xxx'))
+	assert(h2.newdecoder():decode(block)[2] == '200')
+end
+
+-- a body over the handler's limit is refused as it arrives,
+-- the handler answers 413 and the rest of the stream is reset
+do
+	local id = c.id
+	c.id = id + 2
+	local s = { data = {}, thread = utils.thisthread() }
+	c.streams[id] = s
+	local chunk = rep('x', 16384)
+	assert(c.c:write(frame(1, 4, id, c.encoder:encode{ ':method', 'POST',
+		':scheme', 'http', ':path', '/limited', ':authority', 'localhost' })
+		.. frame(0, 0, id, chunk) .. frame(0, 0, id, chunk)))
+	utils.suspend()
+	assert(s.headers[2] == '413' and table.concat(s.data) == 'oversized')
+	if not s.reset then
+		s.thread = utils.thisthread()
+		utils.suspend()
+	end
+	assert(s.reset == 0) -- NO_ERROR
+end
+
+-- the stream window is only given back as the body is read,
+-- so a client sending more than it is reset
+do
+	local id = c.id
+	c.id = id + 2
+	local s = { data = {}, thread = utils.thisthread() }
+	c.streams[id] = s
+	local chunk = rep('x', 16384)
+	assert(c.c:write(frame(1, 4, id, c.encoder:encode{ ':method', 'POST',
+		':scheme', 'http', ':path', '/slow', ':authority', 'localhost' })
+		.. rep(frame(0, 0, id, chunk), 5)))
+	utils.suspend()
+	assert(s.reset == 3) -- FLOW_CONTROL_ERROR
+end
+
+-- many requests at once over the one connection,
+-- streams above the concurrency limit are refused
+local done, n, refused = 0, 200, 0
+local t1 = utils.now()
+for i = 1, n do
+	utils.spawn(function()
+		local path = i % 10 == 0 and '/slow' or '/n' .. i
+		local status, body = c:request('GET', path)
+		while status == nil do
+			assert(body == 7) -- REFUSED_STREAM
+			refused = refused + 1
+			utils.newsleeper():sleep(0.01)
+			status, body = c:request('GET', path)
+		end
+		assert(status == '200')
+		assert(body == 'slow' or body == 'GET /n' .. i .. ' 2.0')
+		done = done + 1
+	end)
+end
+local sleeper = utils.newsleeper()
+while done < n do sleeper:sleep(0.001) end
+utils.updatenow()
+print(format('%d multiplexed requests in %.3fs, %d refused and retried',
+	n, utils.now() - t1, refused))
+
+c.c:close()
+
+-- upgrade from HTTP/1.1
+c = connect(true)
+status, body = c:wait(1)
+assert(status == '200' and body == 'GET /upgraded 2.0')
+status, body = c:request('GET', '/again')
+assert(status == '200' and body == 'GET /again 2.0')
+c.c:close()
+
+srv:close()
+print 'OK'
+
+-- vim: set ts=2 sw=2 noet:
@@ -0,0 +1,158 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+-- Copyright 2026 agent
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+
+-- light threads sharing the loop with a heavy one
+
+package.path = '?.lua'
+package.cpath = '?.so'
+
+local utils = require 'lem.utils'
+
+local format = string.format
+local now = utils.updatenow
+
+local function heavy(n)
+	local x = 0
+	for i = 1, n do x = x + i % 7 end
+	return x
+end
+
+-- the worst time a light thread waits for a 1ms sleep
+local function worst(slice)
+	utils.preempt(slice)
+	local done, max = false, 0
+	utils.spawn(function()
+		heavy(3e7)
+		-- a coroutine of our own yields to us, not the loop
+		local co = coroutine.wrap(function()
+			heavy(1e6)
+			coroutine.yield('inner')
+			return 'done'
+		end)
+		assert(co() == 'inner')
+		assert(co() == 'done')
+		done = true
+	end)
+	local sleeper = utils.newsleeper()
+	while not done do
+		local t = now()
+		sleeper:sleep(0.001)
+		local d = now() - t
+		if d > max then max = d end
+	end
+	return max
+end
+
+local before = utils.stats().preempted
+local off = worst(false)
+print(format('without preemption: %.1fms', off * 1000))
+assert(utils.stats().preempted == before)
+
+local on = worst(0.005)
+local preempted = utils.stats().preempted - before
+print(format('with a 5ms slice:   %.1fms, %d preemptions', on * 1000, preempted))
+assert(preempted > 0)
+assert(on < off)
+
+-- a thread may opt out
+local count = 0
+utils.spawn(function()
+	utils.setslice(false)
+	heavy(1e7)
+	count = count + 1
+end)
+utils.spawn(function()
+	utils.setslice(nil)
+	count = count + 1
+end)
+before = utils.stats().preempted
+while count < 2 do utils.yield() end
+assert(utils.stats().preempted == before)
+assert(utils.preempt() == 0.005)
+
+-- a consumer may be preempted after queueing itself as a
+-- waiter but before suspending, and must not lose values
+do
+	local queue = require 'lem.queue'
+	local q = queue.new()
+	local n, got, sum = 20000, 0, 0
+	utils.preempt(1e-6)
+	utils.spawn(function()
+		for v in q:consume() do
+			got = got + 1
+			sum = sum + v
+			if got == n then break end
+		end
+	end)
+	for i = 1, n do
+		q:put(i)
+		if i % 100 == 0 then utils.yield() end
+	end
+	local sleeper = utils.newsleeper()
+	local deadline = utils.now() + 5
+	while got < n and utils.now() < deadline do
+		sleeper:sleep(0.01)
+	end
+	utils.preempt(0.005)
+	print(format('queue under preemption: %d of %d values', got, n))
+	assert(got == n and sum == n * (n + 1) // 2)
+end
+
+-- resuming a thread preempted after making itself known
+-- but before suspending hands it the values on suspend
+do
+	utils.preempt(0.001)
+	local waiter, result
+	before = utils.stats().preempted
+	utils.spawn(function()
+		waiter = utils.thisthread()
+		heavy(3e6)
+		result = utils.suspend()
+	end)
+	while not waiter do utils.yield() end
+	utils.resume(waiter, 'value')
+	while result == nil do utils.yield() end
+	assert(result == 'value')
+	assert(utils.stats().preempted > before)
+	utils.preempt(0.005)
+end
+
+-- values held back for a thread which ends without
+-- suspending again are collected with it
+do
+	utils.preempt(0.001)
+	local waiter, done
+	local weak = setmetatable({}, { __mode = 'v' })
+	utils.spawn(function()
+		waiter = utils.thisthread()
+		heavy(3e6)
+		done = true
+	end)
+	while not waiter do utils.yield() end
+	weak[1] = {}
+	utils.resume(waiter, weak[1])
+	waiter = nil
+	while not done do utils.yield() end
+	collectgarbage()
+	assert(weak[1] == nil)
+	utils.preempt(0.005)
+end
+
+print('OK')
+
+-- vim: set ts=2 sw=2 noet:
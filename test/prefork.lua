@@ -0,0 +1,42 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+-- Copyright 2026 agent
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+--
+
+package.path = '?.lua'
+package.cpath = '?.so'
+
+local io      = require 'lem.io'
+local prefork = require 'lem.prefork'
+
+local port = arg[1] or '8080'
+
+-- every worker binds its own socket and lets the kernel
+-- spread the connections among them
+assert(prefork.run(4, function(id)
+	local server = assert(io.tcp.listen('*', port, nil, true))
+
+	print(string.format('worker %d listening on port %s', id, port))
+	server:autospawn(function(client)
+		client:write(string.format('Hello from worker %d\r\n', id))
+		client:close()
+	end)
+end))
+
+print 'All workers exited'
+
+-- vim: syntax=lua ts=2 sw=2 noet:
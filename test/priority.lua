@@ -0,0 +1,84 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+-- Copyright 2026 agent
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+
+-- threads run by priority, but lower priorities aren't starved
+
+package.path = '?.lua'
+package.cpath = '?.so'
+
+local utils = require 'lem.utils'
+
+local order = {}
+local function mark(name)
+	return function()
+		assert(utils.getpriority() == name)
+		order[#order+1] = name
+	end
+end
+
+-- spawned threads inherit our priority
+utils.setpriority('low')
+utils.spawn(mark('low'))
+utils.setpriority('high')
+utils.spawn(mark('high'))
+utils.setpriority('normal')
+utils.spawn(mark('normal'))
+
+utils.yield()
+print(table.concat(order, ' '))
+assert(order[1] == 'high' and order[2] == 'normal' and #order == 2)
+
+-- keep the normal level busy, the low thread still gets a turn
+local yields = 0
+while #order < 3 do
+	utils.yield()
+	yields = yields + 1
+end
+print(('low ran after %d yields'):format(yields))
+assert(yields < 64)
+
+-- with all three levels busy every level still gets turns
+do
+	local runs = { high = 0, normal = 0, low = 0 }
+	local stop = false
+	local function busy(prio)
+		utils.setpriority(prio)
+		utils.spawn(function()
+			while not stop do
+				runs[prio] = runs[prio] + 1
+				utils.yield()
+			end
+		end)
+	end
+	busy('low')
+	busy('normal')
+	busy('normal')
+	busy('high')
+	busy('high')
+	utils.setpriority('high')
+	for _ = 1, 2000 do utils.yield() end
+	stop = true
+	utils.setpriority('normal')
+	print(('high %d, normal %d, low %d'):format(runs.high, runs.normal, runs.low))
+	assert(runs.low > 2000 / 64 and runs.normal > 2000 / 64)
+	assert(runs.high > runs.normal and runs.high > runs.low)
+end
+
+print('OK')
+
+-- vim: set ts=2 sw=2 noet:
@@ -0,0 +1,110 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+-- Copyright 2026 agent
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+
+-- profile a few busy threads and print the folded stacks
+
+package.path = '?.lua'
+package.cpath = '?.so'
+
+local utils    = require 'lem.utils'
+local io       = require 'lem.io'
+local profiler = require 'lem.profiler'
+
+local format = string.format
+local clock = os.clock
+
+local function fib(n)
+	if n < 2 then return n end
+	return fib(n - 1) + fib(n - 2)
+end
+
+local function hashing(n)
+	local s = 0
+	for i = 1, n do
+		s = s + #format('%d:%x', i, i * 7)
+	end
+	return s
+end
+
+local function busy(f, arg, rounds)
+	local sleeper = utils.newsleeper()
+	for i = 1, rounds do
+		f(arg)
+		sleeper:sleep(0)
+	end
+end
+
+local function run()
+	local done = 0
+	utils.spawn(function() busy(fib, 24, 20) done = done + 1 end)
+	utils.spawn(function() busy(hashing, 100000, 5) done = done + 1 end)
+	utils.spawn(function()
+		for i = 1, 200 do
+			assert(io.open('test/profiler.lua')):close()
+		end
+		done = done + 1
+	end)
+
+	local sleeper = utils.newsleeper()
+	while done < 3 do sleeper:sleep(0.001) end
+end
+
+local t1 = clock()
+run()
+local base = clock() - t1
+
+assert(profiler.start(1000))
+assert(profiler.start() == nil)
+run()
+local path = '/tmp/lem-profile.folded'
+local stacks = assert(profiler.stop(path))
+assert(profiler.stop() == nil)
+
+local function frame(f)
+	local info = debug.getinfo(f, 'S')
+	return format('%s:%d;', info.short_src, info.linedefined)
+end
+
+local total, fibs, hashes = 0, 0, 0
+for stack, n in pairs(stacks) do
+	total = total + n
+	if (stack .. ';'):find(frame(fib), 1, true) then fibs = fibs + n end
+	if (stack .. ';'):find(frame(hashing), 1, true) then hashes = hashes + n end
+end
+print(format('%d samples, %d in fib, %d in hashing', total, fibs, hashes))
+assert(fibs > 0 and hashes > 0)
+
+local file = assert(io.open(path))
+local text = assert(file:read('*a'))
+file:close()
+assert(text == profiler.folded(stacks))
+for line in text:gmatch('[^\n]+') do
+	if #line > 120 then line = '...' .. line:sub(-117) end
+	print(line)
+end
+os.remove(path)
+
+-- overhead at the default rate
+assert(profiler.start())
+t1 = clock()
+run()
+local t = clock() - t1
+profiler.stop()
+print(format('%.3fs without the profiler, %.3fs at 100 Hz', base, t))
+
+-- vim: set ts=2 sw=2 noet:
@@ -0,0 +1,124 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+-- Copyright 2026 agent
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+--
+
+-- reading lines one by one and many at a time
+
+package.path = '?.lua'
+package.cpath = '?.so'
+
+local utils = require 'lem.utils'
+local io    = require 'lem.io'
+
+local format = string.format
+
+local port = tonumber(arg[1]) or 9910
+local lines = 200000
+
+local server = assert(io.tcp.listen('127.0.0.1', port))
+utils.spawn(server.autospawn, server, function(client)
+	local t, n = {}, 0
+	for i = 1, lines do
+		n = n + 1
+		t[n] = format('line %d\n', i)
+		if n == 1000 then
+			assert(client:write(table.concat(t)))
+			t, n = {}, 0
+		end
+	end
+	assert(client:write(table.concat(t, '', 1, n)))
+	client:close()
+end)
+
+local function run(name, reader)
+	local conn = assert(io.tcp.connect('127.0.0.1', port))
+	local t1 = os.clock()
+	local n, calls = reader(conn)
+	local t2 = os.clock()
+	conn:close()
+	assert(n == lines, format('%s: got %d of %d lines', name, n, lines))
+	print(format('%-14s %d lines in %6d calls, %.3fs of cpu',
+		name, n, calls, t2 - t1))
+end
+
+run('read', function(conn)
+	local n = 0
+	while true do
+		local line = conn:read('*l')
+		if not line then break end
+		n = n + 1
+		assert(line == format('line %d', n))
+	end
+	return n, n + 1
+end)
+
+run('readmany', function(conn)
+	local n, calls = 0, 0
+	while true do
+		local batch = conn:readmany('*l')
+		calls = calls + 1
+		if not batch then break end
+		for i = 1, #batch do
+			n = n + 1
+			assert(batch[i] == format('line %d', n))
+		end
+	end
+	return n, calls
+end)
+
+run('readmany 100', function(conn)
+	local n, calls = 0, 0
+	while true do
+		local batch = conn:readmany('*l', 100)
+		calls = calls + 1
+		if not batch then break end
+		assert(#batch <= 100)
+		n = n + #batch
+	end
+	return n, calls
+end)
+
+-- frames that don't fit in one read() and a parser error
+do
+	local s2 = assert(io.tcp.listen('127.0.0.1', port + 1))
+	local c = assert(io.tcp.connect('127.0.0.1', port + 1))
+	local b = assert(s2:accept())
+	s2:close()
+
+	local big = string.rep('x', 10000)
+	assert(c:write('3:foo,', #big .. ':' .. big .. ',', '0:,', 'x'))
+	local batch = assert(b:readmany('*n'))
+	assert(#batch >= 1 and batch[1] == 'foo')
+	while #batch < 3 do
+		local more = assert(b:readmany('*n'))
+		for i = 1, #more do batch[#batch+1] = more[i] end
+	end
+	assert(batch[2] == big and batch[3] == '')
+
+	local ok, err = b:readmany('*n')
+	assert(ok == nil and err == 'invalid netstring')
+
+	assert(not pcall(b.readmanyp, b, 10, require('lem.http').HTTPRequest))
+	c:close()
+	b:close()
+end
+
+server:close()
+print 'OK'
+
+-- vim: set ts=2 sw=2 noet:
@@ -0,0 +1,162 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+-- Copyright 2026 agent
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+--
+
+-- pipelined redis client against a small stand-in server
+
+package.path = '?.lua'
+package.cpath = '?.so'
+
+local utils = require 'lem.utils'
+local io    = require 'lem.io'
+local redis = require 'lem.redis'
+
+local format, rep = string.format, string.rep
+
+local port = tonumber(arg[1]) or 9901
+
+local function bulk(s)
+	return '$' .. #s .. '\r\n' .. s .. '\r\n'
+end
+
+-- a reply using all the RESP3 types, split anywhere
+local types = '*12\r\n+OK\r\n:-42\r\n,3.5\r\n,inf\r\n#t\r\n_\r\n'
+	.. '$-1\r\n' .. bulk(rep('x', 10000))
+	.. '=8\r\ntxt:text\r\n(12345678901234567890\r\n'
+	.. '%2\r\n+a\r\n*2\r\n:1\r\n:2\r\n+b\r\n~0\r\n'
+	.. '|1\r\n+ttl\r\n:10\r\n'
+	.. '*2\r\n-ERR inner\r\n>1\r\n+push\r\n'
+
+local commands = {}
+
+function commands.PING()
+	return '+PONG\r\n'
+end
+
+function commands.SET(db, key, value)
+	db[key] = value
+	return '+OK\r\n'
+end
+
+function commands.GET(db, key)
+	local v = db[key]
+	if v == nil then return '$-1\r\n' end
+	return bulk(v)
+end
+
+function commands.INCR(db, key)
+	local v = (tonumber(db[key]) or 0) + 1
+	db[key] = tostring(v)
+	return ':' .. v .. '\r\n'
+end
+
+function commands.TYPES()
+	return types
+end
+
+local function serve(client)
+	local db = {}
+	while true do
+		local cmd, err = client:read('RESP')
+		if not cmd then break end
+
+		local f = commands[cmd[1]]
+		local reply
+		if f then
+			reply = f(db, table.unpack(cmd, 2))
+		else
+			reply = '-ERR unknown command ' .. cmd[1] .. '\r\n'
+		end
+
+		-- split replies to exercise the parser
+		local i = 1
+		while i <= #reply do
+			local n = math.random(1, 5000)
+			if not client:write(reply:sub(i, i + n - 1)) then break end
+			i = i + n
+		end
+	end
+	client:close()
+end
+
+local server = assert(io.tcp.listen('127.0.0.1', port))
+utils.spawn(server.autospawn, server, serve)
+
+local db = assert(redis.connect('127.0.0.1', port))
+
+assert(db:ping() == 'PONG')
+assert(db:set('foo', 'bar') == 'OK')
+assert(db:get('foo') == 'bar')
+assert(db:get('nothere') == nil)
+local ok, err = db:call('NOPE')
+assert(ok == nil and err == 'ERR unknown command NOPE')
+
+local big = rep('0123456789', 2000)
+assert(db:set('big', big) == 'OK')
+assert(db:get('big') == big)
+
+local t = assert(db:types())
+assert(#t == 12)
+assert(t[1] == 'OK' and t[2] == -42 and t[3] == 3.5 and t[4] == math.huge)
+assert(t[5] == true and t[6] == redis.null and t[7] == redis.null)
+assert(t[8] == rep('x', 10000))
+assert(t[9] == 'text' and t[10] == '12345678901234567890')
+assert(#t[11].a == 2 and t[11].a[2] == 2 and next(t[11].b) == nil)
+assert(t[12][1].err == 'ERR inner' and t[12][2][1] == 'push')
+
+-- many threads incrementing over the same connection
+local threads, n = 50, 200
+local done = 0
+local t1 = utils.now()
+for i = 1, threads do
+	utils.spawn(function()
+		local last = 0
+		for j = 1, n do
+			local v = assert(db:incr('counter'))
+			assert(v > last)
+			last = v
+			v = assert(db:get('k' .. i))
+			assert(v == 'v' .. i)
+		end
+		done = done + 1
+	end)
+	assert(db:set('k' .. i, 'v' .. i) == 'OK')
+end
+
+local sleeper = utils.newsleeper()
+while done < threads do sleeper:sleep(0.01) end
+utils.updatenow()
+assert(db:get('counter') == tostring(threads * n))
+print(format('%d pipelined commands in %.3fs', 2 * threads * n, utils.now() - t1))
+
+-- closing the connection fails all waiters
+local failed = 0
+for i = 1, 10 do
+	utils.spawn(function()
+		local ok, err = db:ping()
+		if ok == nil then failed = failed + 1 end
+	end)
+end
+db:close()
+while failed < 10 do sleeper:sleep(0.01) end
+assert(db:ping() == nil)
+
+server:close()
+print 'OK'
+
+-- vim: set ts=2 sw=2 noet:
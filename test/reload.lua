@@ -0,0 +1,103 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+-- Copyright 2026 agent
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+
+-- restart a server without dropping connections
+
+package.path = '?.lua'
+package.cpath = '?.so'
+
+local utils  = require 'lem.utils'
+local io     = require 'lem.io'
+local signal = require 'lem.signal'
+local server = require 'lem.http.server'
+local reload = require 'lem.reload'
+
+local port = tonumber(arg[1]) or 9907
+local first = os.getenv('LISTEN_FDS') == nil
+
+local function handler(req, res)
+	if req.path == '/slow' then
+		utils.newsleeper():sleep(0.5)
+	end
+	res:add('%d', utils.getpid())
+end
+
+local sock = assert(reload.tcp('127.0.0.1', port))
+local srv = server.new(sock, handler)
+-- a socket for each address family, handed over together
+local any = assert(reload.tcp('*', port + 1))
+assert(getmetatable(any) == io.MultiServer)
+local anysrv = server.new(any, handler)
+assert(reload.enable())
+-- the variables are consumed, so they aren't passed on
+assert(os.getenv('LISTEN_FDS') == nil and os.getenv('LISTEN_PID') == nil)
+utils.spawn(srv.run, srv)
+utils.spawn(anysrv.run, anysrv)
+
+if not first then return end
+
+local function get(conn, path)
+	assert(conn:write(('GET %s HTTP/1.1\r\nHost: localhost\r\n\r\n'):format(path)))
+	local res = assert(conn:read('HTTPResponse'))
+	local body = assert(conn:read(tonumber(res.headers['content-length'])))
+	return tonumber(body), res.headers['connection']
+end
+
+local old = utils.getpid()
+local a = assert(io.tcp.connect('127.0.0.1', port))
+assert(get(a, '/') == old)
+-- the old process exits once this is closed
+local d = assert(io.tcp.connect('127.0.0.1', port))
+assert(get(d, '/') == old)
+
+-- a request in flight while restarting
+local slow
+utils.spawn(function()
+	local b = assert(io.tcp.connect('127.0.0.1', port))
+	slow = get(b, '/slow')
+	b:close()
+end)
+utils.yield()
+
+assert(reload.restart())
+
+local c = assert(io.tcp.connect('127.0.0.1', port))
+local new = get(c, '/')
+c:close()
+print(('old %d, new %d'):format(old, new))
+assert(new ~= old)
+for _, host in ipairs{ '127.0.0.1', '::1' } do
+	c = assert(io.tcp.connect(host, port + 1))
+	assert(get(c, '/') == new)
+	c:close()
+end
+
+-- the old connection gets its answer and is closed
+local pid, connection = get(a, '/')
+assert(pid == old and connection == 'close')
+a:close()
+
+local sleeper = utils.newsleeper()
+while not slow do sleeper:sleep(0.05) end
+assert(slow == old)
+
+signal.kill(new, 'SIGTERM')
+print('OK')
+d:close()
+
+-- vim: set ts=2 sw=2 noet:
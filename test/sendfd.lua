@@ -0,0 +1,95 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+-- Copyright 2026 agent
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+
+-- an acceptor handing connections to a worker process
+
+package.path = '?.lua'
+package.cpath = '?.so'
+
+local utils = require 'lem.utils'
+local io    = require 'lem.io'
+
+local port = tonumber(arg[1]) or 9913
+local path = '/tmp/lem-sendfd-test.sock'
+local file = '/tmp/lem-sendfd-test.txt'
+
+os.remove(path)
+local ctl = assert(io.unix.listen(path))
+local tcp = assert(io.tcp.listen('127.0.0.1', port))
+
+do
+	local f = assert(io.open(file, 'w'))
+	assert(f:write('passed as a file\n'))
+	assert(f:close())
+end
+
+local parent = utils.getpid()
+local pid = assert(utils.fork())
+if pid == 0 then
+	local conn = assert(io.unix.connect(path))
+	while true do
+		local obj, data, spid, uid = conn:recvfd()
+		if obj == nil then break end
+		assert(spid == parent, 'sender pid')
+		assert(uid ~= nil, 'sender uid')
+		if obj == false then
+			assert(conn:write('plain ' .. data .. '\n'))
+		elseif data == 'file' then
+			assert(conn:write(obj:read('*l') .. '\n'))
+			obj:close()
+		else
+			assert(obj:write(('worker %d %s\n'):format(utils.getpid(), data)))
+			obj:close()
+		end
+	end
+	utils.exit(0)
+end
+
+local w = assert(ctl:accept())
+
+-- a file
+local f = assert(io.open(file))
+assert(w:sendfd(f, 'file'))
+f:close()
+assert(w:read('*l') == 'passed as a file')
+
+-- a connection accepted here and answered by the worker
+local client = assert(io.tcp.connect('127.0.0.1', port))
+local c = assert(tcp:accept())
+assert(w:sendfd(c, 'hello'))
+c:close()
+local line = assert(client:read('*l'))
+print(line)
+assert(line == ('worker %d hello'):format(pid))
+client:close()
+
+-- bytes without an fd
+assert(w:write('x'))
+assert(w:read('*l') == 'plain x')
+
+-- closed objects can't be sent
+assert(not pcall(w.sendfd, w, c))
+
+w:close()
+tcp:close()
+ctl:close()
+os.remove(path)
+os.remove(file)
+print('OK')
+
+-- vim: set ts=2 sw=2 noet:
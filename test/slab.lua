@@ -0,0 +1,90 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+-- Copyright 2026 agent
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+
+-- HTTP requests per second and resident memory with the allocator
+-- chosen by the environment. Compare
+--   bin/lem test/slab.lua
+--   LEM_ALLOCATOR=slab bin/lem test/slab.lua
+--   LEM_ALLOCATOR=slab-huge bin/lem test/slab.lua
+
+package.path = '?.lua'
+package.cpath = '?.so'
+
+local utils  = require 'lem.utils'
+local io     = require 'lem.io'
+local server = require 'lem.http.server'
+
+local format = string.format
+
+local port     = tonumber(arg[1]) or 9906
+local clients  = tonumber(arg[2]) or 50
+local duration = tonumber(arg[3]) or 5
+
+local function rss()
+	local f = assert(io.open('/proc/self/statm'))
+	local statm = assert(f:read('*a'))
+	f:close()
+	return tonumber(statm:match('^%d+ (%d+)')) * 4
+end
+
+local srv = assert(server.new('127.0.0.1', port, function(req, res)
+	-- some garbage of the kind a real handler makes
+	local parts = {}
+	for k, v in pairs(req.headers) do
+		parts[#parts+1] = format('%s=%s', k, v)
+	end
+	res.headers['Content-Type'] = 'text/plain'
+	res:add('%s %s\n%s\n', req.method, req.path, table.concat(parts, '&'))
+end))
+utils.spawn(srv.run, srv)
+
+local requests, running = 0, 0
+local stop = false
+
+local function client(n)
+	local conn = assert(io.tcp.connect('127.0.0.1', port))
+	local request = format('GET /client/%d HTTP/1.1\r\nHost: localhost\r\n' ..
+		'User-Agent: lem-bench\r\nAccept: */*\r\n\r\n', n)
+	while not stop do
+		assert(conn:write(request))
+		local res = assert(conn:read('HTTPResponse'))
+		assert(conn:read(tonumber(res.headers['content-length'])))
+		requests = requests + 1
+	end
+	conn:close()
+	running = running - 1
+end
+
+local start = utils.updatenow()
+for i = 1, clients do
+	running = running + 1
+	utils.spawn(client, i)
+end
+
+local sleeper = utils.newsleeper()
+sleeper:sleep(duration)
+stop = true
+while running > 0 do sleeper:sleep(0.01) end
+local elapsed = utils.updatenow() - start
+
+print(format('%s: %d requests in %.2fs, %.0f req/s, %d KiB resident',
+	os.getenv('LEM_ALLOCATOR') or 'default', requests, elapsed,
+	requests / elapsed, rss()))
+srv:close()
+
+-- vim: set ts=2 sw=2 noet:
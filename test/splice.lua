@@ -0,0 +1,76 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+-- Copyright 2026 agent
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+--
+
+-- a tiny TCP proxy moving data with stream:splice()
+--
+-- backend <- proxy (port+1) <- client
+
+package.path = '?.lua'
+package.cpath = '?.so'
+
+local utils = require 'lem.utils'
+local io    = require 'lem.io'
+
+local format = string.format
+
+local port = tonumber(arg[1]) or 9870
+local size = 64 * 1024 * 1024
+
+-- the backend sends size bytes after reading a line
+local backend = assert(io.tcp.listen('127.0.0.1', port))
+utils.spawn(backend.autospawn, backend, function(client)
+	assert(client:read('*l'))
+	local chunk = string.rep('x', 64 * 1024)
+	for _ = 1, size / #chunk do
+		assert(client:write(chunk))
+	end
+	client:close()
+end)
+
+local proxy = assert(io.tcp.listen('127.0.0.1', port + 1))
+utils.spawn(proxy.autospawn, proxy, function(client)
+	local upstream = assert(io.tcp.connect('127.0.0.1', port))
+
+	utils.spawn(function()
+		print('client -> backend:', client:splice(upstream))
+	end)
+	print('backend -> client:', upstream:splice(client))
+	upstream:close()
+	client:close()
+end)
+
+local conn = assert(io.tcp.connect('127.0.0.1', port + 1))
+assert(conn:write('hello\n'))
+
+local t = utils.now()
+local received = 0
+while true do
+	local data = conn:read(64 * 1024)
+	if not data then break end
+	received = received + #data
+end
+utils.updatenow()
+print(format('received %d bytes through the proxy in %.3fs',
+	received, utils.now() - t))
+assert(received == size)
+
+backend:close()
+proxy:close()
+
+-- vim: set ts=2 sw=2 noet:
@@ -0,0 +1,150 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+-- Copyright 2026 agent
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+
+-- static files served from the open file cache with
+-- validators, conditional and range requests
+
+package.path = '?.lua'
+package.cpath = '?.so'
+
+local utils  = require 'lem.utils'
+local io     = require 'lem.io'
+local lfs    = require 'lem.lfs'
+local server = require 'lem.http.server'
+local static = require 'lem.http.static'
+
+local format, rep = string.format, string.rep
+
+local port = tonumber(arg[1]) or 9904
+local dir = '/tmp/lem-static-test'
+
+assert(static.httptime('Sun, 06 Nov 1994 08:49:37 GMT') == 784111777)
+assert(static.mimetype('a/b.HTML') == 'text/html; charset=UTF-8')
+assert(static.mimetype('a.b/c') == static.default_type)
+
+lfs.mkdir(dir)
+local content = {}
+local function create(name, data)
+	local f = assert(io.open(dir .. '/' .. name, 'w'))
+	assert(f:write(data))
+	assert(f:close())
+	content[name] = data
+end
+create('index.html', '<h1>hello</h1>\n')
+create('big.bin', rep('0123456789abcdef', 64*1024))
+create('empty.txt', '')
+
+local srv = assert(server.new('127.0.0.1', port, static.handler(dir, '/files')))
+utils.spawn(srv.run, srv)
+
+local conn = assert(io.tcp.connect('127.0.0.1', port))
+
+local function request(method, path, headers)
+	local rope = { format('%s %s HTTP/1.1\r\nHost: localhost\r\n', method, path) }
+	for k, v in pairs(headers or {}) do
+		rope[#rope+1] = format('%s: %s\r\n', k, v)
+	end
+	rope[#rope+1] = '\r\n'
+	assert(conn:write(table.concat(rope)))
+
+	local res = assert(conn:read('HTTPResponse'))
+	local len = tonumber(res.headers['content-length'] or 0)
+	local body = ''
+	if method ~= 'HEAD' and len > 0 then
+		body = assert(conn:read(len))
+	end
+	return res, body
+end
+
+local res, body = request('GET', '/files/')
+assert(res.status == 200 and body == content['index.html'])
+assert(res.headers['content-type'] == 'text/html; charset=UTF-8')
+local etag, lastmod = res.headers['etag'], res.headers['last-modified']
+assert(etag and lastmod and res.headers['accept-ranges'] == 'bytes')
+
+res, body = request('HEAD', '/files/big.bin')
+assert(res.status == 200 and tonumber(res.headers['content-length']) == #content['big.bin'])
+assert(res.headers['content-type'] == static.default_type)
+
+res, body = request('GET', '/files/index.html', { ['If-None-Match'] = etag })
+assert(res.status == 304 and body == '')
+res = request('GET', '/files/index.html', { ['If-None-Match'] = '"nope", ' .. etag })
+assert(res.status == 304)
+res = request('GET', '/files/index.html', { ['If-Modified-Since'] = lastmod })
+assert(res.status == 304)
+res = request('GET', '/files/index.html',
+	{ ['If-Modified-Since'] = 'Sun, 06 Nov 1994 08:49:37 GMT' })
+assert(res.status == 200)
+
+local big = content['big.bin']
+res, body = request('GET', '/files/big.bin', { Range = 'bytes=100-199' })
+assert(res.status == 206 and body == big:sub(101, 200))
+assert(res.headers['content-range'] == format('bytes 100-199/%d', #big))
+res, body = request('GET', '/files/big.bin', { Range = 'bytes=-10' })
+assert(res.status == 206 and body == big:sub(-10))
+res, body = request('GET', '/files/big.bin', { Range = 'bytes=1000000-' })
+assert(res.status == 206 and body == big:sub(1000001))
+res, body = request('GET', '/files/big.bin', { Range = format('bytes=%d-', #big) })
+assert(res.status == 416 and res.headers['content-range'] == format('bytes */%d', #big))
+res, body = request('GET', '/files/big.bin', { Range = 'bytes=0-1', ['If-Range'] = '"old"' })
+assert(res.status == 200 and body == big)
+
+res, body = request('GET', '/files/empty.txt')
+assert(res.status == 200 and body == '')
+res = request('GET', '/files/nothere')
+assert(res.status == 404)
+request('GET', '/files/../etc/passwd')
+
+-- many concurrent requests for the same file share one open file
+local threads, n, done = 20, 50, 0
+local t1 = utils.now()
+for i = 1, threads do
+	utils.spawn(function()
+		local c = assert(io.tcp.connect('127.0.0.1', port))
+		for j = 1, n do
+			assert(c:write('GET /files/big.bin HTTP/1.1\r\nHost: localhost\r\n\r\n'))
+			local r = assert(c:read('HTTPResponse'))
+			assert(r.status == 200)
+			assert(c:read(tonumber(r.headers['content-length'])) == big)
+		end
+		c:close()
+		done = done + 1
+	end)
+end
+local sleeper = utils.newsleeper()
+while done < threads do sleeper:sleep(0.01) end
+utils.updatenow()
+print(format('%d requests of %d bytes in %.3fs', threads * n, #big, utils.now() - t1))
+
+-- a changed file is picked up after the ttl
+static.ttl = 0
+create('index.html', '<h1>changed</h1>\n')
+res, body = request('GET', '/files/index.html', { ['If-None-Match'] = etag })
+assert(res.status == 200 and body == content['index.html'])
+assert(res.headers['etag'] ~= etag)
+
+conn:close()
+srv:close()
+static.flush()
+for name in pairs(content) do
+	os.remove(dir .. '/' .. name)
+end
+lfs.rmdir(dir)
+print 'OK'
+
+-- vim: set ts=2 sw=2 noet:
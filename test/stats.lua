@@ -0,0 +1,107 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+-- Copyright 2026 agent
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+
+-- collect loop stats and serve them to Prometheus
+
+package.path = '?.lua'
+package.cpath = '?.so'
+
+local utils  = require 'lem.utils'
+local io     = require 'lem.io'
+local server = require 'lem.http.server'
+local stats  = require 'lem.stats'
+
+local format = string.format
+
+local port = tonumber(arg[1]) or 9905
+
+local before = stats.collect()
+
+-- some work for every counter
+local done = 0
+for i = 1, 50 do
+	utils.spawn(function()
+		for j = 1, 20 do utils.yield() end
+		done = done + 1
+	end)
+end
+for i = 1, 20 do
+	local file = assert(io.open('test/stats.lua'))
+	assert(file:read('*a'))
+	file:close()
+end
+local sleeper = utils.newsleeper()
+while done < 50 do sleeper:sleep(0.001) end
+collectgarbage()
+
+local srv = assert(server.new('127.0.0.1', port, stats.handler))
+utils.spawn(srv.run, srv)
+
+local conn = assert(io.tcp.connect('127.0.0.1', port))
+assert(conn:write('GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n'))
+local res = assert(conn:read('HTTPResponse'))
+assert(res.status == 200)
+assert(res.headers['content-type'] == 'text/plain; version=0.0.4')
+local text = assert(conn:read(tonumber(res.headers['content-length'])))
+conn:close()
+
+local metrics = {}
+for name, labels, v in text:gmatch('\n?([%w_]+)(%b{}) ([^\n]+)') do
+	metrics[name .. labels] = tonumber(v)
+end
+for name, v in text:gmatch('\n([%w_]+) ([^\n]+)') do
+	metrics[name] = tonumber(v)
+end
+
+local s = stats.collect()
+assert(s.resumes >= before.resumes + 1000)
+assert(s.runqueue_max >= 50)
+assert(s.pool_done >= before.pool_done + 60)
+assert(s.io.file.reads >= 20 and s.io.file.rbytes > 0)
+assert(s.io.stream.writes > 0 and s.io.stream.rbytes > 0)
+assert(s.io.accepts == 1)
+assert(s.heap > 0 and s.gc_cycles > 0)
+assert(s.resume_rate > 0)
+
+assert(metrics['lem_resumes_total'] >= 1000)
+assert(metrics['lem_accepts_total'] == 1)
+assert(metrics['lem_pool_wait_seconds_count'] >= 60)
+assert(metrics['lem_pool_run_seconds_bucket{le="+Inf"}'] == metrics['lem_pool_run_seconds_count'])
+assert(metrics['lem_io_syscalls_total{kind="file",op="read"}'] >= 20)
+assert(metrics['lem_lua_heap_bytes'] > 0)
+
+local function quantile(h, q)
+	local total = 0
+	for i = 1, #h do total = total + h[i] end
+	local n = 0
+	for i = 1, #h do
+		n = n + h[i]
+		if n >= q * total then return 1 << (i - 1) end
+	end
+end
+
+print(format('%d resumes, %.0f/s, runqueue max %d, %d threads',
+	s.resumes, s.resume_rate, s.runqueue_max, s.threads))
+print(format('%d pool jobs, median wait < %dus, run < %dus',
+	s.pool_done, quantile(s.pool_wait, 0.5), quantile(s.pool_run, 0.5)))
+print(format('heap %d bytes, %d gc cycles', s.heap, s.gc_cycles))
+
+srv:close()
+print 'OK'
+
+-- vim: set ts=2 sw=2 noet:
@@ -0,0 +1,92 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+-- Copyright 2026 agent
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+--
+
+package.path = '?.lua'
+package.cpath = '?.so'
+
+local utils  = require 'lem.utils'
+local thread = require 'lem.thread'
+
+if thread.parent then
+	-- we're running in a thread of our own
+	local id, config = ...
+	local parent = thread.parent
+
+	if id == 'pool' then
+		-- exit while a job of the thread pool is in flight,
+		-- opening a fifo blocks until the parent opens it too
+		utils.spawn(function() require('lem.io').open(config.fifo) end)
+		utils.newsleeper():sleep(0.1)
+		parent:send('exiting')
+		utils.exit(0)
+		return
+	end
+
+	print(string.format('thread %d started, multiplier = %d', id, config.multiplier))
+	while true do
+		local n = parent:receive()
+		if not n then break end
+		parent:send(id, n, n * config.multiplier)
+	end
+	print(string.format('thread %d done', id))
+	return
+end
+
+local threads = {}
+for id = 1, 4 do
+	threads[id] = assert(thread.start(arg[0], id, { multiplier = id * 10 }))
+end
+
+for id, t in ipairs(threads) do
+	utils.spawn(function()
+		for n = 1, 3 do
+			assert(t:send(n))
+			local tid, m, r = t:receive()
+			print(string.format('thread %d: %d * %d = %d', tid, m, tid * 10, r))
+			assert(tid == id and r == m * id * 10)
+		end
+		-- closing our end stops the thread
+		threads[id] = nil
+		t = nil
+	end)
+end
+
+-- make sure the handles get collected
+local sleeper = utils.newsleeper()
+for i = 1, 10 do
+	sleeper:sleep(0.05)
+	collectgarbage()
+end
+
+-- a thread exiting waits for its jobs in the pool
+do
+	local fifo = os.tmpname()
+	os.remove(fifo)
+	assert(os.execute('mkfifo ' .. fifo))
+	local t = assert(thread.start(arg[0], 'pool', { fifo = fifo }))
+	assert(t:receive() == 'exiting')
+	sleeper:sleep(0.1)
+	local f = assert(require('lem.io').open(fifo, 'w'))
+	f:close()
+	sleeper:sleep(0.1)
+	os.remove(fifo)
+	print('pool thread done')
+end
+
+-- vim: set ts=2 sw=2 noet:
@@ -0,0 +1,86 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+-- Copyright 2026 agent
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+--
+
+package.path = '?.lua'
+package.cpath = '?.so'
+
+local utils = require 'lem.utils'
+local io    = require 'lem.io'
+
+local format = string.format
+
+local server = assert(io.udp.bind('127.0.0.1', 0, 'ipv4', true))
+local host, port = server:getsockname()
+print(format('bound to %s:%d, buffers %d/%d', host, port,
+	server:buffers(4*1024*1024, 1024*1024)))
+
+-- echo every datagram back, a batch at a time
+utils.spawn(function()
+	while true do
+		local datas, addrs, ports = server:recvmany()
+		if not datas then
+			print('server:', addrs)
+			break
+		end
+		assert(server:sendmany(datas, addrs, ports))
+	end
+end)
+
+local client = assert(io.udp.connect(host, tostring(port)))
+client:buffers(4*1024*1024, 1024*1024)
+
+-- single datagrams
+assert(client:send('ping'))
+print('client got:', client:recvfrom())
+
+-- lots of datagrams
+local total, batch = 200000, 64
+local received = 0
+local t = os.clock()
+
+utils.spawn(function()
+	while true do
+		local datas = client:recvmany()
+		if not datas then break end
+		received = received + #datas
+	end
+end)
+
+local list = {}
+for i = 1, batch do list[i] = format('datagram %02d', i) end
+
+local sleeper = utils.newsleeper()
+for i = 1, total / batch do
+	assert(client:sendmany(list))
+	-- don't outrun the receive buffers too much
+	if i % 8 == 0 then sleeper:sleep(0) end
+end
+
+-- some datagrams may be dropped, so don't wait for all of them
+local deadline = utils.now() + 5
+while received < total and utils.now() < deadline do
+	sleeper:sleep(0.1)
+end
+print(format('%d of %d datagrams echoed in %.3fs of cpu',
+	received, total, os.clock() - t))
+
+client:close()
+server:close()
+
+-- vim: set ts=2 sw=2 noet:
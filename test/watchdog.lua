@@ -0,0 +1,88 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+-- Copyright 2026 agent
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+
+-- stall the loop from Lua and from a pattern match,
+-- and check the watchdog catches both
+
+package.path = '?.lua'
+package.cpath = '?.so'
+
+local utils    = require 'lem.utils'
+local watchdog = require 'lem.watchdog'
+
+local format = string.format
+local clock = os.clock
+
+local sleeper = utils.newsleeper()
+
+local function spin(seconds)
+	local t = clock() + seconds
+	local n = 0
+	while clock() < t do n = n + 1 end
+	return n
+end
+
+-- quadratic, every position is tried to the end
+local function backtrack()
+	return ((' '):rep(5000) .. 'x'):find('%s*$')
+end
+
+assert(watchdog.start(50))
+assert(watchdog.start() == nil)
+
+-- lots of short runs
+local done = 0
+for i = 1, 100 do
+	utils.spawn(function()
+		for j = 1, 10 do utils.yield() end
+		done = done + 1
+	end)
+end
+while done < 100 do sleeper:sleep(0.001) end
+assert(watchdog.stats().stalls == 0)
+
+utils.spawn(spin, 0.2)
+sleeper:sleep(0.3)
+local stats = watchdog.stats()
+assert(stats.threshold == 50)
+assert(stats.stalls == 1, stats.stalls)
+assert(stats.last:find('in function <test/watchdog.lua:', 1, true))
+
+local t = clock()
+utils.spawn(backtrack)
+sleeper:sleep(0.01)
+print(format('backtracking stalled the loop for %.3fs', clock() - t))
+stats = watchdog.stats()
+assert(stats.stalls == 2)
+assert(stats.last:find("in function 'string.find'", 1, true))
+
+local total = 0
+for i = 1, #stats.runs do
+	local n = stats.runs[i]
+	total = total + n
+	if n > 0 then
+		print(format('< %8dus %6d', 1 << (i - 1), n))
+	end
+end
+assert(total > 1000)
+
+watchdog.stop()
+assert(watchdog.stats().stalls == 0)
+print 'OK'
+
+-- vim: set ts=2 sw=2 noet:
@@ -0,0 +1,164 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+-- Copyright 2026 agent
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+--
+
+-- websocket echo and broadcast server with a minimal client
+
+package.path = '?.lua'
+package.cpath = '?.so'
+
+local utils     = require 'lem.utils'
+local io        = require 'lem.io'
+local server    = require 'lem.http.server'
+local websocket = require 'lem.http.websocket'
+
+local format, rep, char, byte = string.format, string.rep, string.char, string.byte
+local random = math.random
+
+local port = tonumber(arg[1]) or 9902
+
+assert(websocket.accept('dGhlIHNhbXBsZSBub25jZQ==') == 's3pPLMBiTxaQ9kYGzzhZRbK+xOo=')
+
+local sockets = {}
+local srv = assert(server.new('127.0.0.1', port, function(req, res)
+	if req.path ~= '/ws' then
+		res:add('no websocket here\n')
+		return
+	end
+
+	local ws = websocket.upgrade(req, res, { 'echo' })
+	if not ws then return end
+
+	sockets[ws] = true
+	for msg, kind in ws:messages() do
+		if msg == 'broadcast' then
+			websocket.broadcast(sockets, 'hello all')
+		else
+			assert(ws:send(msg, kind == 'binary'))
+		end
+	end
+	sockets[ws] = nil
+end))
+utils.spawn(srv.run, srv)
+
+-- client side frames are masked
+local function mask(payload, key)
+	local t = {}
+	for i = 1, #payload do
+		t[i] = char(byte(payload, i) ~ byte(key, (i - 1) % 4 + 1))
+	end
+	return table.concat(t)
+end
+
+local function frame(opcode, payload, fin)
+	local key = char(random(0, 255), random(0, 255), random(0, 255), random(0, 255))
+	local h = websocket.header(opcode, #payload, fin)
+	return char(byte(h, 1), byte(h, 2) | 0x80) .. h:sub(3) .. key .. mask(payload, key)
+end
+
+local function connect(path)
+	local c = assert(io.tcp.connect('127.0.0.1', port))
+	assert(c:write(format('GET %s HTTP/1.1\r\nHost: localhost\r\n'
+		.. 'Upgrade: websocket\r\nConnection: keep-alive, Upgrade\r\n'
+		.. 'Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n'
+		.. 'Sec-WebSocket-Protocol: chat, echo\r\n'
+		.. 'Sec-WebSocket-Version: 13\r\n\r\n', path)))
+	local res = assert(c:read('HTTPResponse'))
+	return c, res
+end
+
+local c, res = connect('/ws')
+assert(res.status == 101)
+assert(res.headers['sec-websocket-accept'] == 's3pPLMBiTxaQ9kYGzzhZRbK+xOo=')
+assert(res.headers['sec-websocket-protocol'] == 'echo')
+
+-- echo messages of all sizes, written in random pieces
+for _, size in ipairs{ 0, 1, 125, 126, 4095, 4096, 65535, 65536, 200000 } do
+	local msg = rep('x', size - 1) .. (size > 0 and 'y' or '')
+	local data = frame(1, msg)
+	local i = 1
+	while i <= #data do
+		local n = random(1, 10000)
+		assert(c:write(data:sub(i, i + n - 1)))
+		i = i + n
+	end
+	local op, payload, fin = assert(c:read('WSFrame', nil, false))
+	assert(op == 1 and fin == true and payload == msg, size)
+end
+
+-- fragmented binary message with a ping in the middle
+assert(c:write(frame(2, 'abc', false) .. frame(9, 'ping!') .. frame(0, 'def', false) .. frame(0, '\0', true)))
+local op, payload = assert(c:read('WSFrame', nil, false))
+assert(op == 10 and payload == 'ping!')
+op, payload = assert(c:read('WSFrame', nil, false))
+assert(op == 2 and payload == 'abcdef\0')
+
+-- broadcast to every connected socket
+local others = {}
+for i = 1, 5 do others[i] = connect('/ws') end
+assert(c:write(frame(1, 'broadcast')))
+for _, o in ipairs(others) do
+	op, payload = assert(o:read('WSFrame', nil, false))
+	assert(op == 1 and payload == 'hello all')
+end
+op, payload = assert(c:read('WSFrame', nil, false))
+assert(op == 1 and payload == 'hello all')
+
+-- invalid utf-8 closes with 1007
+assert(c:write(frame(1, '\255\254')))
+op, payload = assert(c:read('WSFrame', nil, false))
+assert(op == 8 and payload == '\3\239')
+
+-- the close handshake
+for _, o in ipairs(others) do
+	assert(o:write(frame(8, '\3\232bye')))
+	op, payload = assert(o:read('WSFrame', nil, false))
+	assert(op == 8 and payload == '\3\232')
+	assert(o:read() == nil)
+end
+
+-- unmasked client frames are refused
+c = connect('/ws')
+assert(c:write(websocket.header(1, 2) .. 'hi'))
+op, payload = assert(c:read('WSFrame', nil, false))
+assert(op == 8 and payload == '\3\234')
+
+-- plain requests still work
+c, res = connect('/other')
+assert(res.status == 200)
+
+-- a benchmark of the frame parser
+do
+	local a, b = connect('/ws')
+	local msg = frame(2, rep('z', 1000))
+	local n = 10000
+	utils.spawn(function()
+		for i = 1, n do assert(a:write(msg)) end
+	end)
+	local t1 = os.clock()
+	for i = 1, n do
+		op, payload = assert(a:read('WSFrame', nil, false))
+		assert(#payload == 1000)
+	end
+	print(format('%d echoed frames in %.3fs of cpu', n, os.clock() - t1))
+end
+
+srv:close()
+print 'OK'
+
+-- vim: set ts=2 sw=2 noet:
@@ -0,0 +1,80 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+-- Copyright 2026 agent
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+--
+
+if ... == 'worker' then
+	-- loaded by the worker states, which have no lem modules
+	local _, rounds = ...
+	local M = {}
+
+	function M.checksum(str)
+		local sum = 0
+		for _ = 1, rounds do
+			for i = 1, #str do
+				sum = (sum * 31 + str:byte(i)) % 4294967296
+			end
+		end
+		return sum, #str
+	end
+
+	function M.fail(msg)
+		error(msg, 0)
+	end
+
+	return M
+end
+
+package.path = '?.lua'
+package.cpath = '?.so'
+
+local utils  = require 'lem.utils'
+local worker = require 'lem.worker'
+
+local w = worker.new(arg[0], 2, 'worker', 2000)
+local sleeper = utils.newsleeper()
+
+-- the loop keeps ticking while the workers crunch numbers
+local ticking = true
+utils.spawn(function()
+	local ticks = 0
+	while ticking do
+		sleeper:sleep(0.01)
+		ticks = ticks + 1
+	end
+	print(string.format('loop ticked %d times meanwhile', ticks))
+end)
+
+local left = 4
+for i = 1, left do
+	utils.spawn(function()
+		local str = string.rep(tostring(i), 1000)
+		local t = utils.now()
+		local sum, len = assert(w:call('checksum', str))
+		print(string.format('call %d: sum = %d, len = %d, %.3fs',
+			i, sum, len, utils.now() - t))
+		left = left - 1
+		if left == 0 then
+			print('fail:', w:call('fail', 'oops'))
+			print('missing:', w:call('nonexistent'))
+			ticking = false
+			w:close()
+		end
+	end)
+end
+
+-- vim: set ts=2 sw=2 noet:
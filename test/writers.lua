@@ -0,0 +1,77 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+-- Copyright 2026 agent
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+--
+
+-- many coroutines writing to the same stream at once
+
+package.path = '?.lua'
+package.cpath = '?.so'
+
+local utils = require 'lem.utils'
+local io    = require 'lem.io'
+
+local format = string.format
+
+local writers, lines = 100, 1000
+local port = tonumber(arg[1]) or 9876
+
+local server = assert(io.tcp.listen('127.0.0.1', port))
+
+utils.spawn(function()
+	local client = assert(server:accept())
+	server:close()
+
+	local sleeper = utils.newsleeper()
+	local count, seen = 0, {}
+	while true do
+		local line = client:read('*l')
+		if not line then break end
+
+		local id, n = line:match('^writer (%d+) line (%d+) x+$')
+		assert(id, 'garbled line: ' .. line)
+		id, n = tonumber(id), tonumber(n)
+		assert(n == (seen[id] or 0) + 1, 'lines out of order')
+		seen[id] = n
+		count = count + 1
+
+		-- read slowly now and then so the writers pile up
+		if count % 10000 == 0 then sleeper:sleep(0.01) end
+	end
+	print(format('received %d of %d lines', count, writers * lines))
+	assert(count == writers * lines)
+end)
+
+local conn = assert(io.tcp.connect('127.0.0.1', port))
+local padding = string.rep('x', 100)
+local left = writers
+local t = os.clock()
+
+for id = 1, writers do
+	utils.spawn(function()
+		for n = 1, lines do
+			assert(conn:write('writer ', tostring(id), ' line ', tostring(n), ' ', padding, '\n'))
+		end
+		left = left - 1
+		if left == 0 then
+			print(format('all writers done in %.3fs of cpu', os.clock() - t))
+			conn:close()
+		end
+	end)
+end
+
+-- vim: set ts=2 sw=2 noet: